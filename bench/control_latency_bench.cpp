@@ -0,0 +1,231 @@
+// Measures the latency of control commands (PWD) of one session while other
+//   sessions download a file or list a large directory as fast as they can,
+//   with control connections handled by the server's threads (controlThreads 0)
+//   and by a dedicated control thread (controlThreads 1).
+// usage: control_latency_bench [numDownloads] [seconds] [numThreads] [workload]
+// numDownloads (default 8) sessions transfer from a temporary directory for
+//   seconds (default 5) while PWD is sent, with numThreads (default 2) server
+//   threads. workload is retr (default), the download of a 64 MiB file, or
+//   list, the LIST of a directory of 20000 files (the listing cache is
+//   disabled, so each is read from the filesystem). Each configuration is run
+//   in a child process, since the server cannot be shut down while sessions
+//   are connected.
+#include "md5.h"
+#include "path.h"
+#include "server.h"
+#include "user.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>	// waitpid
+#include <unistd.h>		// fork, _exit
+#include <boost/asio.hpp>
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+
+namespace fs = boost::filesystem;
+using boost::asio::ip::tcp;
+
+
+namespace Bench {
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr char userName[] = "bench";
+constexpr char password[] = "bench";
+constexpr char salt[] = "benchsalt";
+constexpr char fileName[] = "data.bin";
+constexpr std::size_t FILE_SZ = (64 * 1024 * 1024);
+constexpr char listDirName[] = "list";
+constexpr int LIST_DIR_ENTRIES = 20000;
+
+
+static fs::path createDir() {
+	const fs::path dir = fs::temp_directory_path() / fs::unique_path("ctl-bench-%%%%-%%%%");
+	fs::create_directory(dir);
+	fs::ofstream f{dir / fileName, std::ios::binary};
+	const std::string block(1024 * 1024, 'x');
+	for (std::size_t i = 0; i < (FILE_SZ / block.size()); ++i)
+		f << block;
+	fs::create_directory(dir / listDirName);
+	for (int i = 0; i < LIST_DIR_ENTRIES; ++i)
+		fs::ofstream{dir / listDirName / ("file" + std::to_string(i))};
+	return dir;
+}
+
+
+static int getFreePort() {
+	boost::asio::io_service ios;
+	tcp::acceptor acceptor{ios, tcp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+	return acceptor.local_endpoint().port();
+}
+
+
+// A control connection, used synchronously.
+class Client {
+public:
+	Client(boost::asio::io_service&, const int);
+	int command(const std::string&);
+	void transfer(const std::string&);
+private:
+	int readReply(void);
+
+	boost::asio::io_service& ios;
+	tcp::socket sock;
+	boost::asio::streambuf buf;
+	std::string reply;	// last line of last reply
+};
+
+
+Client::Client(boost::asio::io_service& service, const int port) : ios(service), sock{ios} {
+	sock.connect(tcp::endpoint{boost::asio::ip::address_v4::loopback(),
+		static_cast<unsigned short>(port)});
+	sock.set_option(tcp::no_delay{true});
+	readReply();
+	command(std::string{"USER "} + userName);
+	if (command(std::string{"PASS "} + password) != 230)
+		throw std::runtime_error{"login failed"};
+}
+
+
+// returns reply code
+int Client::command(const std::string& cmd) {
+	boost::asio::write(sock, boost::asio::buffer(cmd + "\r\n"));
+	return readReply();
+}
+
+
+int Client::readReply() {
+	std::istream is{&buf};
+	do {
+		boost::asio::read_until(sock, buf, "\r\n");
+		std::getline(is, reply);
+	} while ((reply.size() < 4) || (reply[3] == '-'));
+	return std::stoi(reply.substr(0, 3));
+}
+
+
+// RETR or LIST (cmd), data is discarded
+void Client::transfer(const std::string& cmd) {
+	if (command("PASV") != 227)
+		throw std::runtime_error{"PASV failed"};
+	unsigned h[4], p[2];
+	const std::size_t open = reply.find('(');
+	if ((open == std::string::npos) || (std::sscanf(reply.c_str() + open, "(%u,%u,%u,%u,%u,%u)",
+	&h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6))
+		throw std::runtime_error{"invalid PASV reply"};
+	tcp::socket data{ios};
+	data.connect(tcp::endpoint{boost::asio::ip::address_v4::loopback(),
+		static_cast<unsigned short>((p[0] << 8) | p[1])});
+	if (command(cmd) != 150)
+		throw std::runtime_error{cmd + " failed"};
+	std::vector<char> sink(256 * 1024);
+	boost::system::error_code ec;
+	while (!ec)
+		data.read_some(boost::asio::buffer(sink), ec);
+	readReply();
+}
+
+
+static void run(const fs::path& dir, const int controlThreads, const std::size_t numDownloads,
+const int seconds, const int numThreads, const std::string& transferCmd) {
+	User user;
+	user.name = userName;
+	user.salt = salt;
+	user.pass = MD5::getDigest(std::string{password} + salt);
+	user.home = Path{dir};
+	const int port = getFreePort();
+	Server::instance().reset(new Server{port, numThreads, controlThreads, "bench"});
+	Server::instance()->setUsers(std::vector<User>{user});
+	Server::instance()->run();
+
+	std::atomic<bool> stop{false};
+	std::atomic<std::uint64_t> downloads{0};
+	std::vector<std::thread> loaders;
+	for (std::size_t i = 0; i < numDownloads; ++i) {
+		loaders.emplace_back(
+			[port, &transferCmd, &stop, &downloads]() {
+				boost::asio::io_service ios;
+				Client client{ios, port};
+				while (!stop) {
+					client.transfer(transferCmd);
+					++downloads;
+				}
+			}
+		);
+	}
+	boost::asio::io_service ios;
+	Client client{ios, port};
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));	// let downloads start
+
+	std::vector<double> latencies;	// microseconds
+	const Clock::time_point end = Clock::now() + std::chrono::seconds(seconds);
+	while (Clock::now() < end) {
+		const Clock::time_point begin = Clock::now();
+		client.command("PWD");
+		latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+	}
+	stop = true;
+	for (auto& loader : loaders)
+		loader.join();
+
+	std::sort(latencies.begin(), latencies.end());
+	const auto percentile = [&latencies](const double p) {
+		return latencies[static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1))];
+	};
+	std::cout << "controlThreads " << controlThreads << ": " << latencies.size() << " PWD, latency p50 "
+	          << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, max "
+	          << latencies.back() << " us (" << downloads << " x " << transferCmd << ")" << std::endl;
+}
+
+}	// namespace Bench
+
+
+int main(int argc, char** argv) {
+	const std::size_t numDownloads = ((argc > 1) ? std::stoul(argv[1]) : 8);
+	const int seconds = ((argc > 2) ? std::stoi(argv[2]) : 5);
+	const int numThreads = ((argc > 3) ? std::stoi(argv[3]) : 2);
+	const std::string workload = ((argc > 4) ? argv[4] : "retr");
+	std::string transferCmd;
+	if (workload == "retr") {
+		transferCmd = std::string{"RETR "} + Bench::fileName;
+	}
+	else if (workload == "list") {
+		transferCmd = std::string{"LIST "} + Bench::listDirName;
+	}
+	else {
+		std::cerr << "invalid workload: " << workload << std::endl;
+		return 1;
+	}
+	const fs::path dir = Bench::createDir();
+	int status = 0;
+	for (const int controlThreads : {0, 1}) {
+		const pid_t pid = ::fork();
+		if (pid == 0) {
+			try {
+				Bench::run(dir, controlThreads, numDownloads, seconds, numThreads, transferCmd);
+			}
+			catch (const std::exception& e) {
+				std::cerr << "controlThreads " << controlThreads << ": " << e.what() << std::endl;
+				std::cout.flush();
+				::_exit(1);
+			}
+			std::cout.flush();
+			::_exit(0);		// sessions are still connected
+		}
+		int childStatus = 1;
+		if ((pid < 0) || (::waitpid(pid, &childStatus, 0) < 0) || (childStatus != 0))
+			status = 1;
+	}
+	fs::remove_all(dir);
+	return status;
+}
@@ -0,0 +1,501 @@
+// Measures downloads over FTPS (PROT P):
+// - the throughput of a large file, with record encryption by the kernel
+//   (tlsKernel 1, kTLS) and by OpenSSL (tlsKernel 0), and without TLS (PROT C)
+//   for reference
+// - the latency of RETR of a small file, which is dominated by the handshake
+//   of the data connection, with the client offering no session, and offering
+//   the last session it got (resumed from the server's cache or a ticket)
+// usage: ftps_bench [numDownloads] [seconds] [numThreads]
+// numDownloads (default 4) sessions download a 64 MiB file from a temporary
+//   directory for seconds (default 5), with numThreads (default 2) server
+//   threads. CPU time is of the whole process, clients (which decrypt with
+//   OpenSSL) included. If the kernel has no kTLS (or not for the negotiated
+//   cipher), tlsKernel 1 falls back to OpenSSL, which is reported. Then one
+//   session downloads a 4 KiB file for seconds. Each configuration is run in a
+//   child process, since the server cannot be shut down while sessions are
+//   connected.
+#include "md5.h"
+#include "path.h"
+#include "server.h"
+#include "tls_context.h"
+#include "user.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>	// getrusage
+#include <sys/wait.h>		// waitpid
+#include <unistd.h>			// fork, _exit
+#include <boost/asio.hpp>
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+
+namespace fs = boost::filesystem;
+using boost::asio::ip::tcp;
+
+
+namespace Bench {
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr char userName[] = "bench";
+constexpr char password[] = "bench";
+constexpr char salt[] = "benchsalt";
+constexpr char fileName[] = "data.bin";
+constexpr char smallFileName[] = "small.bin";
+constexpr char certName[] = "cert.pem";
+constexpr char keyName[] = "key.pem";
+constexpr std::size_t FILE_SZ = (64 * 1024 * 1024);
+constexpr std::size_t SMALL_FILE_SZ = (4 * 1024);
+
+enum class Mode {CLEAR, OPENSSL, KERNEL};
+enum class Resumption {NONE, CACHE_AND_TICKETS, CACHE};
+
+
+static const char* getName(const Mode mode) {
+	switch (mode) {
+	case Mode::CLEAR:
+		return "PROT C";
+	case Mode::OPENSSL:
+		return "PROT P, tlsKernel 0";
+	case Mode::KERNEL:
+		return "PROT P, tlsKernel 1";
+	}
+	return "";
+}
+
+
+static const char* getName(const Resumption resumption) {
+	switch (resumption) {
+	case Resumption::NONE:
+		return "no session offered";
+	case Resumption::CACHE_AND_TICKETS:
+		return "session offered, tlsTickets 1";
+	case Resumption::CACHE:
+		return "session offered, tlsTickets 0";
+	}
+	return "";
+}
+
+
+// self-signed P-256 certificate
+static void createCertificate(const fs::path& dir) {
+	EVP_PKEY* key = nullptr;
+	EVP_PKEY_CTX* keyCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	if ((keyCtx == nullptr) || (EVP_PKEY_keygen_init(keyCtx) != 1)
+	|| (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyCtx, NID_X9_62_prime256v1) != 1)
+	|| (EVP_PKEY_keygen(keyCtx, &key) != 1))
+		throw std::runtime_error{"unable to generate key"};
+	EVP_PKEY_CTX_free(keyCtx);
+	X509* cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+	X509_set_pubkey(cert, key);
+	X509_NAME* name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+		reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	if (X509_sign(cert, key, EVP_sha256()) == 0)
+		throw std::runtime_error{"unable to sign certificate"};
+	FILE* f = std::fopen((dir / certName).string().c_str(), "w");
+	PEM_write_X509(f, cert);
+	std::fclose(f);
+	f = std::fopen((dir / keyName).string().c_str(), "w");
+	PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+	std::fclose(f);
+	X509_free(cert);
+	EVP_PKEY_free(key);
+}
+
+
+static fs::path createDir() {
+	const fs::path dir = fs::temp_directory_path() / fs::unique_path("ftps-bench-%%%%-%%%%");
+	fs::create_directory(dir);
+	fs::ofstream f{dir / fileName, std::ios::binary};
+	const std::string block(1024 * 1024, 'x');
+	for (std::size_t i = 0; i < (FILE_SZ / block.size()); ++i)
+		f << block;
+	fs::ofstream{dir / smallFileName, std::ios::binary} << block.substr(0, SMALL_FILE_SZ);
+	createCertificate(dir);
+	return dir;
+}
+
+
+static int getFreePort() {
+	boost::asio::io_service ios;
+	tcp::acceptor acceptor{ios, tcp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+	return acceptor.local_endpoint().port();
+}
+
+
+// A socket, through TLS once secured, used synchronously.
+class Connection {
+public:
+	Connection(boost::asio::io_service&, SSL_CTX*);
+	Connection(const Connection&) = delete;
+	~Connection();
+	Connection& operator=(const Connection&) = delete;
+	void connect(const int);
+	void secure(SSL_SESSION*);
+	SSL_SESSION* getSession(void);
+	void write(const std::string&);
+	std::size_t readSome(char*, const std::size_t);		// 0 at EOF
+	void close(void);
+private:
+	tcp::socket sock;
+	SSL_CTX* ctx;
+	SSL* ssl;
+};
+
+
+Connection::Connection(boost::asio::io_service& ios, SSL_CTX* context)
+: sock{ios}, ctx{context}, ssl{nullptr} {
+}
+
+
+Connection::~Connection() {
+	if (ssl != nullptr)
+		SSL_free(ssl);
+}
+
+
+void Connection::connect(const int port) {
+	sock.connect(tcp::endpoint{boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(port)});
+	sock.set_option(tcp::no_delay{true});
+}
+
+
+// offers session (if not nullptr) to be resumed
+void Connection::secure(SSL_SESSION* session) {
+	ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, static_cast<int>(sock.native_handle()));
+	if (session != nullptr)
+		SSL_set_session(ssl, session);
+	if (SSL_connect(ssl) != 1)
+		throw std::runtime_error{"TLS handshake failed"};
+}
+
+
+// returns the last session received (to be freed), or nullptr
+SSL_SESSION* Connection::getSession() {
+	return ((ssl != nullptr) ? SSL_get1_session(ssl) : nullptr);
+}
+
+
+void Connection::write(const std::string& str) {
+	if (ssl == nullptr) {
+		boost::asio::write(sock, boost::asio::buffer(str));
+		return;
+	}
+	if (SSL_write(ssl, str.data(), static_cast<int>(str.size())) <= 0)
+		throw std::runtime_error{"TLS write failed"};
+}
+
+
+std::size_t Connection::readSome(char* buf, const std::size_t sz) {
+	if (ssl == nullptr) {
+		boost::system::error_code ec;
+		const std::size_t n = sock.read_some(boost::asio::buffer(buf, sz), ec);
+		return (ec ? 0 : n);
+	}
+	const int n = SSL_read(ssl, buf, static_cast<int>(sz));
+	return ((n > 0) ? static_cast<std::size_t>(n) : 0);
+}
+
+
+void Connection::close() {
+	if (ssl != nullptr) {
+		SSL_shutdown(ssl);
+		SSL_free(ssl);
+		ssl = nullptr;
+	}
+	sock.close();
+}
+
+
+// A control connection, secured by AUTH TLS.
+class Client {
+public:
+	Client(boost::asio::io_service&, SSL_CTX*, const int, const Mode, const bool);
+	Client(const Client&) = delete;
+	~Client();
+	Client& operator=(const Client&) = delete;
+	int command(const std::string&);
+	std::uint64_t download(const char*);
+private:
+	int readReply(void);
+
+	boost::asio::io_service& ios;
+	SSL_CTX* ctx;
+	Connection control;
+	std::string input;
+	std::string reply;	// last line of last reply
+	SSL_SESSION* session;	// offered by data connections, nullptr if none
+	bool protect;
+	bool resume;
+};
+
+
+// resumeSession: data connections offer the last session received
+Client::Client(boost::asio::io_service& service, SSL_CTX* context, const int port, const Mode mode,
+const bool resumeSession)
+: ios(service), ctx{context}, control{ios, ctx}, session{nullptr}, protect{mode != Mode::CLEAR},
+resume{resumeSession} {
+	control.connect(port);
+	readReply();
+	if (command("AUTH TLS") != 234)
+		throw std::runtime_error{"AUTH TLS failed"};
+	control.secure(nullptr);
+	command(std::string{"USER "} + userName);
+	if (command(std::string{"PASS "} + password) != 230)
+		throw std::runtime_error{"login failed"};
+	command("PBSZ 0");
+	if (command(protect ? "PROT P" : "PROT C") != 200)
+		throw std::runtime_error{"PROT failed"};
+	command("TYPE I");
+	if (resume)
+		session = control.getSession();		// TLS 1.3 tickets have arrived with the replies
+}
+
+
+Client::~Client() {
+	if (session != nullptr)
+		SSL_SESSION_free(session);
+}
+
+
+// returns reply code
+int Client::command(const std::string& cmd) {
+	control.write(cmd + "\r\n");
+	return readReply();
+}
+
+
+int Client::readReply() {
+	char buf[1024];
+	for (;;) {
+		const std::size_t eol = input.find("\r\n");
+		if (eol == std::string::npos) {
+			const std::size_t n = control.readSome(buf, sizeof(buf));
+			if (n == 0)
+				throw std::runtime_error{"control connection closed"};
+			input.append(buf, n);
+			continue;
+		}
+		reply = input.substr(0, eol);
+		input.erase(0, eol + 2);
+		if ((reply.size() >= 4) && (reply[3] != '-'))
+			return std::stoi(reply.substr(0, 3));
+	}
+}
+
+
+// RETR of the whole file, data is discarded
+// returns bytes received
+std::uint64_t Client::download(const char* name) {
+	if (command("PASV") != 227)
+		throw std::runtime_error{"PASV failed"};
+	unsigned h[4], p[2];
+	const std::size_t open = reply.find('(');
+	if ((open == std::string::npos) || (std::sscanf(reply.c_str() + open, "(%u,%u,%u,%u,%u,%u)",
+	&h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6))
+		throw std::runtime_error{"invalid PASV reply"};
+	Connection data{ios, ctx};
+	data.connect(static_cast<int>((p[0] << 8) | p[1]));
+	if (command(std::string{"RETR "} + name) != 150)
+		throw std::runtime_error{"RETR failed"};
+	if (protect)
+		data.secure(session);
+	std::vector<char> sink(256 * 1024);
+	std::uint64_t total = 0;
+	std::size_t n;
+	while ((n = data.readSome(sink.data(), sink.size())) > 0)
+		total += n;
+	if (resume) {
+		// a session used once (TLS 1.3) is replaced by the one received
+		SSL_SESSION* received = data.getSession();
+		if (received != nullptr) {
+			SSL_SESSION_free(session);
+			session = received;
+		}
+	}
+	data.close();
+	if (readReply() != 226)
+		throw std::runtime_error{"RETR did not complete"};
+	return total;
+}
+
+
+static double getCpuSeconds() {
+	struct rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+	return (static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+		+ (static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6));
+}
+
+
+// returns port
+static int startServer(const fs::path& dir, const int numThreads, const bool kernelTls, const bool tickets) {
+	User user;
+	user.name = userName;
+	user.salt = salt;
+	user.pass = MD5::getDigest(std::string{password} + salt);
+	user.home = Path{dir};
+	const int port = getFreePort();
+	Server::instance().reset(new Server{port, numThreads, 1, "bench"});
+	Server::instance()->setUsers(std::vector<User>{user});
+	Server::instance()->setTls((dir / certName).string(), (dir / keyName).string(), kernelTls, false);
+	Server::instance()->setTlsSessionCache(20480, 7200, tickets);
+	Server::instance()->run();
+	return port;
+}
+
+
+static void runThroughput(const fs::path& dir, const Mode mode, const std::size_t numDownloads,
+const int seconds, const int numThreads) {
+	const int port = startServer(dir, numThreads, (mode == Mode::KERNEL), true);
+
+	SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+	std::atomic<bool> stop{false};
+	std::atomic<std::uint64_t> bytes{0};
+	std::atomic<bool> failed{false};
+	std::vector<std::thread> loaders;
+	const double cpuBegin = getCpuSeconds();
+	const Clock::time_point begin = Clock::now();
+	for (std::size_t i = 0; i < numDownloads; ++i) {
+		loaders.emplace_back(
+			[ctx, port, mode, &stop, &bytes, &failed]() {
+				try {
+					boost::asio::io_service ios;
+					Client client{ios, ctx, port, mode, false};
+					while (!stop)
+						bytes += client.download(fileName);
+				}
+				catch (const std::exception& e) {
+					std::cerr << e.what() << std::endl;
+					failed = true;
+				}
+			}
+		);
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	stop = true;
+	for (auto& loader : loaders)
+		loader.join();
+	const double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+	const double cpu = (getCpuSeconds() - cpuBegin);
+	if (failed)
+		throw std::runtime_error{"download failed"};
+
+	const double gib = (static_cast<double>(bytes) / (1024.0 * 1024.0 * 1024.0));
+	std::cout << getName(mode) << ": " << (static_cast<double>(bytes) / (1024.0 * 1024.0) / elapsed)
+	          << " MiB/s, " << (cpu / gib) << " CPU s/GiB";
+	if (mode == Mode::KERNEL) {
+		const std::uint64_t kernelSend = Server::instance()->getTlsContext()->getKernelSendCount();
+		if (kernelSend == 0)
+			std::cout << " (kTLS unavailable, encrypted by OpenSSL)";
+		else
+			std::cout << " (" << kernelSend << " connections encrypted by kTLS)";
+	}
+	std::cout << std::endl;
+}
+
+
+static void runSmallFiles(const fs::path& dir, const Resumption resumption, const int seconds,
+const int numThreads) {
+	const int port = startServer(dir, numThreads, true, (resumption != Resumption::CACHE));
+	SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+	boost::asio::io_service ios;
+	Client client{ios, ctx, port, Mode::KERNEL, (resumption != Resumption::NONE)};
+	std::vector<double> latencies;	// microseconds
+	const Clock::time_point end = Clock::now() + std::chrono::seconds(seconds);
+	while (Clock::now() < end) {
+		const Clock::time_point begin = Clock::now();
+		client.download(smallFileName);
+		latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	const auto percentile = [&latencies](const double p) {
+		return latencies[static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1))];
+	};
+	const TlsContext::HandshakeStats stats = Server::instance()->getTlsContext()->getStats(
+		TlsContext::Channel::DATA
+	);
+	const double completed = static_cast<double>(std::max<std::uint64_t>(stats.completed, 1));
+	std::cout << getName(resumption) << ": " << latencies.size() << " RETR of "
+	          << (SMALL_FILE_SZ / 1024) << " KiB, latency p50 " << percentile(0.5) << " us, p99 "
+	          << percentile(0.99) << " us; data handshakes resumed "
+	          << (100.0 * static_cast<double>(stats.resumed) / completed) << "%, mean "
+	          << (static_cast<double>(stats.totalNanos) / completed / 1000.0) << " us, max "
+	          << (static_cast<double>(stats.maxNanos) / 1000.0) << " us" << std::endl;
+}
+
+
+// runs f in a child process
+// returns false if it failed
+template<class F>
+static bool runChild(F&& f) {
+	const pid_t pid = ::fork();
+	if (pid == 0) {
+		try {
+			f();
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			std::cout.flush();
+			::_exit(1);
+		}
+		std::cout.flush();
+		::_exit(0);		// sessions are still connected
+	}
+	int childStatus = 1;
+	return ((pid >= 0) && (::waitpid(pid, &childStatus, 0) >= 0) && (childStatus == 0));
+}
+
+}	// namespace Bench
+
+
+int main(int argc, char** argv) {
+	const std::size_t numDownloads = ((argc > 1) ? std::stoul(argv[1]) : 4);
+	const int seconds = ((argc > 2) ? std::stoi(argv[2]) : 5);
+	const int numThreads = ((argc > 3) ? std::stoi(argv[3]) : 2);
+	const fs::path dir = Bench::createDir();
+	int status = 0;
+	for (const Bench::Mode mode : {Bench::Mode::CLEAR, Bench::Mode::OPENSSL, Bench::Mode::KERNEL}) {
+		const bool ok = Bench::runChild(
+			[&dir, mode, numDownloads, seconds, numThreads]() {
+				Bench::runThroughput(dir, mode, numDownloads, seconds, numThreads);
+			}
+		);
+		if (!ok)
+			status = 1;
+	}
+	for (const Bench::Resumption resumption :
+	{Bench::Resumption::NONE, Bench::Resumption::CACHE_AND_TICKETS, Bench::Resumption::CACHE}) {
+		const bool ok = Bench::runChild(
+			[&dir, resumption, seconds, numThreads]() {
+				Bench::runSmallFiles(dir, resumption, seconds, numThreads);
+			}
+		);
+		if (!ok)
+			status = 1;
+	}
+	fs::remove_all(dir);
+	return status;
+}
@@ -0,0 +1,181 @@
+// Compares MLSD entry formatting throughput of ListingFormatter against the
+//   previous stringstream/locale based implementation, and reports the
+//   throughput of the LIST and NLST formats.
+// usage: listing_format_bench [numFiles]
+// A temporary directory containing numFiles (default 100000) empty files is
+//   created, listed with both implementations, and removed.
+#include "listing_format.h"
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <locale>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/date_time/posix_time/posix_time_io.hpp>
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+
+namespace fs = boost::filesystem;
+namespace ps = boost::posix_time;
+
+
+struct EntryData {
+	std::string name;
+	std::uintmax_t size;
+	std::time_t modify;
+};
+
+
+// previous implementation (MLSD writer before ListingFormatter)
+namespace Legacy {
+
+template<class T>
+static void appendFact(std::string& dst, const char* name, const T& value) {
+	dst.append(name);
+	dst.push_back('=');
+	dst.append(value);
+	dst.push_back(';');
+}
+
+
+static std::string genTime(const std::time_t timeT) {
+	ps::ptime posixTime = ps::from_time_t(timeT);
+	ps::time_facet* facet = new ps::time_facet{"%Y%m%d%H%M%S"};
+	std::stringstream ss;
+	ss.imbue(std::locale(ss.getloc(), facet));
+	ss << posixTime;
+	return ss.str();
+}
+
+
+static std::string genEntry(const EntryData& entry) {
+	std::string str;
+	appendFact(str, "type", "file");
+	appendFact(str, "size", std::to_string(entry.size));
+	appendFact(str, "modify", genTime(entry.modify));
+	str.push_back(' ');
+	str.append(entry.name);
+	str.append("\r\n");
+	return str;
+}
+
+}	// namespace Legacy
+
+
+namespace Bench {
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double seconds(const Clock::time_point begin) {
+	return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+
+static void report(const char* name, const std::size_t n, const double sec, const std::size_t bytes) {
+	std::cout << name << ": " << n << " entries in " << sec << " s, "
+	          << static_cast<std::uint64_t>(static_cast<double>(n) / sec) << " entries/s ("
+	          << bytes << " bytes)" << std::endl;
+}
+
+
+static fs::path createDir(const std::size_t numFiles) {
+	const fs::path dir = fs::temp_directory_path() / fs::unique_path("mlsd-bench-%%%%-%%%%");
+	fs::create_directory(dir);
+	for (std::size_t i = 0; i < numFiles; ++i) {
+		fs::ofstream f{dir / ("file_" + std::to_string(i) + ".dat")};
+		f << i;
+	}
+	return dir;
+}
+
+
+// stat every file, as ListingWriter does for MLSD
+static std::vector<EntryData> scan(const fs::path& dir) {
+	std::vector<EntryData> entries;
+	for (fs::directory_iterator it{dir}, end; it != end; ++it) {
+		entries.push_back(EntryData{
+			it->path().filename().string(),
+			fs::file_size(it->path()),
+			fs::last_write_time(it->path())
+		});
+	}
+	return entries;
+}
+
+
+static void formatLegacy(const std::vector<EntryData>& entries) {
+	std::size_t bytes = 0;
+	const Clock::time_point begin = Clock::now();
+	for (const EntryData& entry : entries)
+		bytes += Legacy::genEntry(entry).size();
+	report("legacy format", entries.size(), seconds(begin), bytes);
+}
+
+
+static DirScanner::Entry toEntry(const EntryData& entry) {
+	return DirScanner::Entry{
+		entry.name.data(), entry.name.size(), DirScanner::Type::REGULAR, entry.size, entry.modify
+	};
+}
+
+
+static void formatNew(const std::vector<EntryData>& entries, const ListingFormat format,
+const char* name) {
+	std::vector<char> buf(64 * 1024);
+	ListingFormatter formatter{format};
+	std::size_t bytes = 0;
+	std::size_t used = 0;
+	const Clock::time_point begin = Clock::now();
+	for (const EntryData& entry : entries) {
+		if (used + ListingFormatter::maxEntrySz(entry.name.size()) > buf.size()) {
+			bytes += used;	// batch would be sent here
+			used = 0;
+		}
+		char* const end = formatter.entry(buf.data() + used, toEntry(entry));
+		used = static_cast<std::size_t>(end - buf.data());
+	}
+	bytes += used;
+	report(name, entries.size(), seconds(begin), bytes);
+}
+
+// both implementations must produce identical output
+static bool verify(const std::vector<EntryData>& entries) {
+	std::vector<char> buf(ListingFormatter::maxEntrySz(255));
+	ListingFormatter formatter{ListingFormat::MLSD};
+	for (const EntryData& entry : entries) {
+		if (entry.name.size() > 255)
+			continue;
+		char* const end = formatter.mlsdEntry(buf.data(), toEntry(entry));
+		if (std::string(buf.data(), end) != Legacy::genEntry(entry))
+			return false;
+	}
+	return true;
+}
+
+}	// namespace Bench
+
+
+int main(int argc, char** argv) {
+	const std::size_t numFiles = ((argc > 1) ? std::stoul(argv[1]) : 100000);
+	const fs::path dir = Bench::createDir(numFiles);
+	const Bench::Clock::time_point begin = Bench::Clock::now();
+	const std::vector<EntryData> entries = Bench::scan(dir);
+	Bench::report("scan (stat)", entries.size(), Bench::seconds(begin), 0);
+	if (!Bench::verify(entries)) {
+		std::cerr << "ListingFormatter output differs from legacy output" << std::endl;
+		fs::remove_all(dir);
+		return 1;
+	}
+	Bench::formatLegacy(entries);
+	Bench::formatNew(entries, ListingFormat::MLSD, "ListingFormatter MLSD");
+	Bench::formatNew(entries, ListingFormat::LIST, "ListingFormatter LIST");
+	Bench::formatNew(entries, ListingFormat::NLST, "ListingFormatter NLST");
+	fs::remove_all(dir);
+	return 0;
+}
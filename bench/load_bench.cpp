@@ -0,0 +1,457 @@
+// End-to-end load test: runs the server executable on loopback with a
+//   generated config and home directory, and drives it with concurrent
+//   clients, each doing a random mix of operations:
+// - retr: PASV and RETR of a file
+// - stor: PASV and STOR of a file (over the client's own file)
+// - mlsd: PASV and MLSD of a directory of 200 files
+// - login: a new control connection, greeting, USER and PASS
+// Reports operations and commands per second, transfer throughput, the
+//   latency percentiles of each operation and the CPU time of the server.
+// usage: load_bench server [numClients] [seconds] [numThreads] [mix] [fileKiB]
+// server is the executable (build/release/ftp_server, see make loadtest), which is
+//   copied to a temporary directory along with its config, since it reads
+//   config.yaml from its own directory. numClients (default 16) clients run for
+//   seconds (default 10) against numThreads (default 4) server threads. mix
+//   (default retr:4,stor:2,mlsd:2,login:1) weighs the operations. Files are
+//   fileKiB (default 1024) KiB.
+// The server does not release a session whose client has disconnected, so
+//   each login holds a descriptor (and a debug build aborts): the server runs
+//   with its descriptor limit raised to the hard limit, and should be a
+//   release build.
+// Exits with 1 if an operation failed (the client then reconnects).
+#include "md5.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>			// kill
+#include <sys/resource.h>	// getrusage, setrlimit
+#include <sys/wait.h>		// waitpid
+#include <unistd.h>			// fork, execl, dup2, _exit
+#include <boost/asio.hpp>
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+
+namespace fs = boost::filesystem;
+using boost::asio::ip::tcp;
+
+
+namespace Bench {
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr char userName[] = "bench";
+constexpr char password[] = "bench";
+constexpr char salt[] = "benchsalt";
+constexpr char exeName[] = "ftp_server";
+constexpr char configName[] = "config.yaml";
+constexpr char homeName[] = "home";
+constexpr char filesDir[] = "files";	// read by retr
+constexpr char listDir[] = "list";		// read by mlsd
+constexpr char uploadDir[] = "up";		// written by stor
+constexpr int NUM_FILES = 8;
+constexpr int NUM_LIST_ENTRIES = 200;
+constexpr int STARTUP_SECONDS = 5;
+
+enum class Op {RETR, STOR, MLSD, LOGIN};
+constexpr std::size_t NUM_OPS = 4;
+constexpr std::array<const char*, NUM_OPS> opNames = {{"retr", "stor", "mlsd", "login"}};
+
+// of one client, merged once clients are done
+struct Stats {
+	std::array<std::vector<double>, NUM_OPS> latencies;	// microseconds, by Op
+	std::uint64_t commands = 0;
+	std::uint64_t bytesDown = 0;
+	std::uint64_t bytesUp = 0;
+	std::uint64_t errors = 0;
+};
+
+
+// weights of "op:weight,..."
+// throws invalid_argument
+static std::array<double, NUM_OPS> parseMix(const std::string& mix) {
+	std::array<double, NUM_OPS> weights{};
+	std::size_t begin = 0;
+	while (begin < mix.size()) {
+		std::size_t end = mix.find(',', begin);
+		if (end == std::string::npos)
+			end = mix.size();
+		const std::string item = mix.substr(begin, end - begin);
+		const std::size_t colon = item.find(':');
+		const auto it = std::find(opNames.begin(), opNames.end(), item.substr(0, colon));
+		if ((colon == std::string::npos) || (it == opNames.end()))
+			throw std::invalid_argument{std::string{"invalid mix: "} + item};
+		weights[static_cast<std::size_t>(it - opNames.begin())] = std::stod(item.substr(colon + 1));
+		begin = (end + 1);
+	}
+	if (std::all_of(weights.begin(), weights.end(), [](const double w) { return (w <= 0); }))
+		throw std::invalid_argument{"invalid mix: no operation"};
+	return weights;
+}
+
+
+static int getFreePort() {
+	boost::asio::io_service ios;
+	tcp::acceptor acceptor{ios, tcp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+	return acceptor.local_endpoint().port();
+}
+
+
+// returns directory of the server, its config and home directory
+static fs::path createDir(const fs::path& server, const int port, const std::size_t numClients,
+const int numThreads, const std::size_t fileSz) {
+	const fs::path dir = fs::temp_directory_path() / fs::unique_path("load-bench-%%%%-%%%%");
+	const fs::path home = (dir / homeName);
+	fs::create_directories(home / filesDir);
+	fs::create_directories(home / listDir);
+	fs::create_directories(home / uploadDir);
+	fs::copy_file(server, dir / exeName);
+	const std::string block(fileSz, 'x');
+	for (int i = 0; i < NUM_FILES; ++i)
+		fs::ofstream{home / filesDir / ("f" + std::to_string(i) + ".bin"), std::ios::binary} << block;
+	for (int i = 0; i < NUM_LIST_ENTRIES; ++i)
+		fs::ofstream{home / listDir / ("entry" + std::to_string(i) + ".txt")} << i;
+	fs::ofstream config{dir / configName};
+	config << "port: " << port << "\n"
+	       << "maxUsers: " << (numClients * 2) << "\n"
+	       << "numThreads: " << numThreads << "\n"
+	       << "saltLen: " << (sizeof(salt) - 1) << "\n"
+	       << "welcomeMessage: load_bench\n"
+	       << "users:\n"
+	       << "  - name: " << userName << "\n"
+	       << "    passSalt: " << salt << "\n"
+	       << "    passHash: " << MD5::getDigest(std::string{password} + salt).str() << "\n"
+	       << "    homeDir: " << homeName << "\n";
+	return dir;
+}
+
+
+// returns pid of the server, once it accepts connections
+// throws runtime_error
+static pid_t startServer(const fs::path& dir, const int port) {
+	const fs::path exe = (dir / exeName);
+	const fs::path log = (dir / "server.log");
+	const pid_t pid = ::fork();
+	if (pid < 0)
+		throw std::runtime_error{"fork failed"};
+	if (pid == 0) {
+		struct rlimit limit;
+		if (::getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+			limit.rlim_cur = limit.rlim_max;
+			::setrlimit(RLIMIT_NOFILE, &limit);
+		}
+		if ((std::freopen(log.c_str(), "w", stdout) == nullptr) || (::dup2(STDOUT_FILENO, STDERR_FILENO) < 0))
+			::_exit(127);
+		::execl(exe.c_str(), exe.c_str(), static_cast<char*>(nullptr));
+		::_exit(127);
+	}
+	const Clock::time_point end = Clock::now() + std::chrono::seconds(STARTUP_SECONDS);
+	boost::asio::io_service ios;
+	while (Clock::now() < end) {
+		int status;
+		if (::waitpid(pid, &status, WNOHANG) != 0)
+			throw std::runtime_error{"server exited, see " + log.string()};
+		tcp::socket sock{ios};
+		boost::system::error_code ec;
+		sock.connect(tcp::endpoint{boost::asio::ip::address_v4::loopback(),
+			static_cast<unsigned short>(port)}, ec);
+		if (!ec)
+			return pid;
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	::kill(pid, SIGKILL);
+	::waitpid(pid, nullptr, 0);
+	throw std::runtime_error{"server did not start"};
+}
+
+
+// A logged in control connection, used synchronously.
+// throws runtime_error, boost::system::system_error
+class Client {
+public:
+	Client(boost::asio::io_service&, const int);
+	std::uint64_t getCommandCount(void) const;
+	std::uint64_t retr(const std::string&);
+	std::uint64_t stor(const std::string&, const std::string&);
+	std::uint64_t mlsd(const std::string&);
+private:
+	int command(const std::string&);
+	int readReply(void);
+	tcp::socket openData(void);
+	std::uint64_t readData(tcp::socket&);
+
+	boost::asio::io_service& ios;
+	tcp::socket sock;
+	boost::asio::streambuf buf;
+	std::string reply;	// last line of last reply
+	int port;
+	std::uint64_t commandCount;
+};
+
+
+Client::Client(boost::asio::io_service& service, const int serverPort)
+: ios(service), sock{ios}, port{serverPort}, commandCount{0} {
+	sock.connect(tcp::endpoint{boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(port)});
+	sock.set_option(tcp::no_delay{true});
+	if (readReply() != 220)
+		throw std::runtime_error{"no greeting"};
+	command(std::string{"USER "} + userName);
+	if (command(std::string{"PASS "} + password) != 230)
+		throw std::runtime_error{"login failed"};
+}
+
+
+inline
+std::uint64_t Client::getCommandCount() const {
+	return commandCount;
+}
+
+
+// returns reply code
+int Client::command(const std::string& cmd) {
+	++commandCount;
+	boost::asio::write(sock, boost::asio::buffer(cmd + "\r\n"));
+	return readReply();
+}
+
+
+int Client::readReply() {
+	std::istream is{&buf};
+	do {
+		boost::asio::read_until(sock, buf, "\r\n");
+		std::getline(is, reply);
+	} while ((reply.size() < 4) || (reply[3] == '-'));
+	return std::stoi(reply.substr(0, 3));
+}
+
+
+// PASV and connection to the data port
+tcp::socket Client::openData() {
+	if (command("PASV") != 227)
+		throw std::runtime_error{"PASV failed: " + reply};
+	unsigned h[4], p[2];
+	const std::size_t open = reply.find('(');
+	if ((open == std::string::npos) || (std::sscanf(reply.c_str() + open, "(%u,%u,%u,%u,%u,%u)",
+	&h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6))
+		throw std::runtime_error{"invalid PASV reply: " + reply};
+	tcp::socket data{ios};
+	data.connect(tcp::endpoint{boost::asio::ip::address_v4::loopback(),
+		static_cast<unsigned short>((p[0] << 8) | p[1])});
+	return data;
+}
+
+
+// reads data until EOF, which is discarded, then the reply of the transfer
+// returns bytes received
+std::uint64_t Client::readData(tcp::socket& data) {
+	std::vector<char> sink(256 * 1024);
+	std::uint64_t total = 0;
+	boost::system::error_code ec;
+	while (!ec)
+		total += data.read_some(boost::asio::buffer(sink), ec);
+	if (readReply() != 226)
+		throw std::runtime_error{"transfer did not complete: " + reply};
+	return total;
+}
+
+
+// returns bytes received
+std::uint64_t Client::retr(const std::string& path) {
+	tcp::socket data = openData();
+	if (command("RETR " + path) != 150)
+		throw std::runtime_error{"RETR failed: " + reply};
+	return readData(data);
+}
+
+
+// returns bytes sent
+std::uint64_t Client::stor(const std::string& path, const std::string& contents) {
+	tcp::socket data = openData();
+	if (command("STOR " + path) != 150)
+		throw std::runtime_error{"STOR failed: " + reply};
+	boost::asio::write(data, boost::asio::buffer(contents));
+	data.close();
+	if (readReply() != 226)
+		throw std::runtime_error{"transfer did not complete: " + reply};
+	return contents.size();
+}
+
+
+// returns bytes received
+std::uint64_t Client::mlsd(const std::string& path) {
+	tcp::socket data = openData();
+	if (command("MLSD " + path) != 150)
+		throw std::runtime_error{"MLSD failed: " + reply};
+	return readData(data);
+}
+
+
+// Runs operations chosen by weights until stop.
+static void runClient(const int port, const std::size_t id, const std::array<double, NUM_OPS>& weights,
+const std::size_t fileSz, const std::atomic<bool>& stop, Stats& stats) {
+	std::mt19937 rng{static_cast<std::mt19937::result_type>(id)};
+	std::discrete_distribution<std::size_t> chooseOp{weights.begin(), weights.end()};
+	std::uniform_int_distribution<int> chooseFile{0, NUM_FILES - 1};
+	const std::string upload(fileSz, 'y');
+	const std::string uploadPath = std::string{uploadDir} + "/c" + std::to_string(id) + ".bin";
+	boost::asio::io_service ios;
+	std::unique_ptr<Client> client;
+	while (!stop) {
+		const std::size_t op = chooseOp(rng);
+		const Clock::time_point begin = Clock::now();
+		try {
+			if (!client)
+				client.reset(new Client{ios, port});
+			switch (static_cast<Op>(op)) {
+			case Op::RETR:
+				stats.bytesDown += client->retr(
+					std::string{filesDir} + "/f" + std::to_string(chooseFile(rng)) + ".bin"
+				);
+				break;
+			case Op::STOR:
+				stats.bytesUp += client->stor(uploadPath, upload);
+				break;
+			case Op::MLSD:
+				stats.bytesDown += client->mlsd(listDir);
+				break;
+			case Op::LOGIN:
+				stats.commands += Client{ios, port}.getCommandCount();
+				break;
+			}
+		}
+		catch (const std::exception& e) {
+			if (stats.errors++ == 0)
+				std::cerr << "client " << id << ": " << opNames[op] << ": " << e.what() << std::endl;
+			if (client)
+				stats.commands += client->getCommandCount();
+			client.reset();
+			continue;
+		}
+		stats.latencies[op].push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+	}
+	if (client)
+		stats.commands += client->getCommandCount();
+}
+
+
+static double getChildrenCpuSeconds() {
+	struct rusage usage;
+	::getrusage(RUSAGE_CHILDREN, &usage);
+	return (static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+		+ (static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6));
+}
+
+
+static void printResults(std::vector<Stats>& clientStats, const double elapsed, const double serverCpu) {
+	Stats total;
+	for (Stats& s : clientStats) {
+		for (std::size_t op = 0; op < NUM_OPS; ++op)
+			total.latencies[op].insert(total.latencies[op].end(), s.latencies[op].begin(), s.latencies[op].end());
+		total.commands += s.commands;
+		total.bytesDown += s.bytesDown;
+		total.bytesUp += s.bytesUp;
+		total.errors += s.errors;
+	}
+	std::size_t numOps = 0;
+	std::cout << std::fixed << std::setprecision(0)
+	          << "op        count    ops/s   p50 us   p90 us   p99 us   max us" << std::endl;
+	for (std::size_t op = 0; op < NUM_OPS; ++op) {
+		std::vector<double>& latencies = total.latencies[op];
+		if (latencies.empty())
+			continue;
+		numOps += latencies.size();
+		std::sort(latencies.begin(), latencies.end());
+		const auto percentile = [&latencies](const double p) {
+			return latencies[static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1))];
+		};
+		std::cout << std::left << std::setw(6) << opNames[op] << std::right
+		          << std::setw(9) << latencies.size()
+		          << std::setw(9) << (static_cast<double>(latencies.size()) / elapsed)
+		          << std::setw(9) << percentile(0.5) << std::setw(9) << percentile(0.9)
+		          << std::setw(9) << percentile(0.99) << std::setw(9) << latencies.back() << std::endl;
+	}
+	const double mib = (1024.0 * 1024.0);
+	std::cout << std::setprecision(1)
+	          << (static_cast<double>(numOps) / elapsed) << " ops/s, "
+	          << (static_cast<double>(total.commands) / elapsed) << " commands/s, down "
+	          << (static_cast<double>(total.bytesDown) / mib / elapsed) << " MiB/s, up "
+	          << (static_cast<double>(total.bytesUp) / mib / elapsed) << " MiB/s, server CPU "
+	          << std::setprecision(2) << serverCpu << " s (" << (100.0 * serverCpu / elapsed) << "%), "
+	          << total.errors << " errors" << std::endl;
+}
+
+}	// namespace Bench
+
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cerr << "usage: load_bench server [numClients] [seconds] [numThreads] [mix] [fileKiB]"
+		          << std::endl;
+		return 2;
+	}
+	fs::path dir;
+	pid_t server = -1;
+	int status = 0;
+	try {
+		const fs::path exe = fs::system_complete(argv[1]);
+		const std::size_t numClients = ((argc > 2) ? std::stoul(argv[2]) : 16);
+		const int seconds = ((argc > 3) ? std::stoi(argv[3]) : 10);
+		const int numThreads = ((argc > 4) ? std::stoi(argv[4]) : 4);
+		const std::string mix = ((argc > 5) ? argv[5] : "retr:4,stor:2,mlsd:2,login:1");
+		const std::size_t fileSz = (((argc > 6) ? std::stoul(argv[6]) : 1024) * 1024);
+		const std::array<double, Bench::NUM_OPS> weights = Bench::parseMix(mix);
+		const int port = Bench::getFreePort();
+		dir = Bench::createDir(exe, port, numClients, numThreads, fileSz);
+		server = Bench::startServer(dir, port);
+
+		std::cout << numClients << " clients, " << seconds << " s, " << numThreads << " server threads, mix "
+		          << mix << ", files of " << (fileSz / 1024) << " KiB" << std::endl;
+		std::atomic<bool> stop{false};
+		std::vector<Bench::Stats> stats(numClients);
+		std::vector<std::thread> clients;
+		const Bench::Clock::time_point begin = Bench::Clock::now();
+		for (std::size_t i = 0; i < numClients; ++i) {
+			clients.emplace_back(
+				[port, i, &weights, fileSz, &stop, &stats]() {
+					Bench::runClient(port, i, weights, fileSz, stop, stats[i]);
+				}
+			);
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(seconds));
+		stop = true;
+		for (auto& client : clients)
+			client.join();
+		const double elapsed = std::chrono::duration<double>(Bench::Clock::now() - begin).count();
+		::kill(server, SIGKILL);
+		::waitpid(server, nullptr, 0);
+		server = -1;
+		Bench::printResults(stats, elapsed, Bench::getChildrenCpuSeconds());
+		for (const Bench::Stats& s : stats) {
+			if (s.errors != 0)
+				status = 1;
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		status = 1;
+	}
+	if (server > 0) {
+		::kill(server, SIGKILL);
+		::waitpid(server, nullptr, 0);
+	}
+	if (!dir.empty())
+		fs::remove_all(dir);
+	return status;
+}
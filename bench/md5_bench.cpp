@@ -0,0 +1,458 @@
+// Compares MD5 throughput of MD5Context (incremental, no allocation) against
+//   the previous implementation, which copied and padded the whole message,
+//   and of MD5::updateMulti() hashing several streams at once against hashing
+//   them one after another.
+// usage: md5_bench [MiB]
+// MiB (default 64) is the total amount of data hashed by each throughput test.
+#include "md5.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// previous implementation (MD5::getDigest before MD5Context)
+namespace Legacy {
+
+namespace Constants {
+	constexpr std::array<std::uint32_t, 64> T = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+		0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+		0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+		0xd62f105d, 0x2441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+		0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+		0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x4881d05,
+		0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+		0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+		0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+	constexpr std::array<std::uint32_t, 16> R2_k = {
+		1, 6, 11, 0, 5, 10, 15, 4,
+		9, 14, 3, 8, 13, 2, 7, 12
+	};
+	constexpr std::array<std::uint32_t, 16> R3_k = {
+		5, 8, 11, 14, 1, 4, 7, 10,
+		13, 0, 3, 6, 9, 12, 15, 2
+	};
+	constexpr std::array<std::uint32_t, 16> R4_k = {
+		0, 7, 14, 5, 12, 3, 10, 1,
+		8, 15, 6, 13, 4, 11, 2, 9
+	};
+	constexpr std::array<std::uint32_t, 4> R1_s = {7, 12, 17, 22};
+	constexpr std::array<std::uint32_t, 4> R2_s = {5, 9, 14, 20};
+	constexpr std::array<std::uint32_t, 4> R3_s = {4, 11, 16, 23};
+	constexpr std::array<std::uint32_t, 4> R4_s = {6, 10, 15, 21};
+}
+
+
+template<class T>
+static void copyToByteArray(T& array, const std::size_t i, std::uint32_t value) {
+	const std::uint32_t mask = static_cast<std::uint32_t>(UINT8_MAX);
+	array[i] = static_cast<std::uint8_t>(value & mask);
+	value >>= 8;
+	array[i+1] = static_cast<std::uint8_t>(value & mask);
+	value >>= 8;
+	array[i+2] = static_cast<std::uint8_t>(value & mask);
+	value >>= 8;
+	array[i+3] = static_cast<std::uint8_t>(value);
+}
+
+
+// sz is message size in bits before padding
+static void padMessageSz(std::vector<std::uint8_t>& message, std::uint64_t sz) {
+	const std::uint64_t mask = static_cast<std::uint64_t>(UINT8_MAX);
+	for (int i = 0; i < 7; ++i) {
+		message.push_back(static_cast<std::uint8_t>(sz & mask));
+		sz >>= 8;
+	}
+	message.push_back(static_cast<std::uint8_t>(sz));
+	assert(message.size() % 64 == 0);
+}
+
+
+static void padMessage(std::vector<std::uint8_t>& message) {
+	std::uint64_t messageSz = (static_cast<std::uint64_t>(message.size()) * 8);
+	std::size_t padAmount = ((message.size() % 64) % 56);
+	if (padAmount != 0) {
+		padAmount = (56 - padAmount);
+	}
+	else {
+		padAmount = 56;
+	}
+	message.reserve(message.size() + padAmount + 8);
+	message.push_back(1 << 7);
+	for (std::size_t i = 1; i < padAmount; ++i)
+		message.push_back(0);
+	assert(message.size() % 56 == 0);
+	padMessageSz(message, messageSz);
+}
+
+
+static std::uint32_t getUint32(const std::vector<std::uint8_t>& message, const std::size_t i) {
+	return (
+		static_cast<std::uint32_t>(message[i])
+		| (static_cast<std::uint32_t>(message[i+1]) << 8)
+		| (static_cast<std::uint32_t>(message[i+2]) << 16)
+		| (static_cast<std::uint32_t>(message[i+3]) << 24)
+	);
+}
+
+
+static constexpr std::uint32_t rotateLeft(const std::uint32_t val, const std::uint32_t n) {
+	return ((val << n) | (val >> (32 - n)));
+}
+
+
+static constexpr std::uint32_t F(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+	return ((X & Y) | ((~X) & Z));
+}
+
+
+static constexpr std::uint32_t G(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+	return ((X & Z) | (Y & (~Z)));
+}
+
+
+static constexpr std::uint32_t H(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+	return (X ^ Y ^ Z);
+}
+
+
+static constexpr std::uint32_t I(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+	return (Y ^ (X | (~Z)));
+}
+
+
+template<class Func>
+static void R(Func f, std::uint32_t& A, const std::uint32_t B, const std::uint32_t C, const std::uint32_t D,
+const std::uint32_t X, const std::uint32_t S, const std::uint32_t T) {
+	A = (B + rotateLeft(A + f(B, C, D) + X + T, S));
+}
+
+
+static MD5Digest getDigest(const std::vector<std::uint8_t>& message) {
+	std::array<std::uint32_t, 16> X;
+	std::uint32_t A = 0x67452301;
+	std::uint32_t B = 0xefcdab89;
+	std::uint32_t C = 0x98badcfe;
+	std::uint32_t D = 0x10325476;
+	std::vector<std::uint8_t> input = message;
+	padMessage(input);
+	const std::size_t numBlocks = (input.size() / 64);
+	for (std::size_t i = 0; i < numBlocks; ++i) {
+		const std::uint32_t AA = A;
+		const std::uint32_t BB = B;
+		const std::uint32_t CC = C;
+		const std::uint32_t DD = D;
+		for (std::size_t j = 0; j < 16; ++j) {
+			X[j] = getUint32(input, i*64 + j*4);
+		}
+		// Round 1
+		std::size_t j;
+		for (j = 0; j < 16; ++j) {
+			const std::size_t k = (j % 4);
+			const std::uint32_t X_val = X[j];
+			const std::uint32_t S_val = Constants::R1_s[k];
+			const std::uint32_t T_val = Constants::T[j];
+			switch (k) {
+			case 0:
+				R(F, A, B, C, D, X_val, S_val, T_val);
+				break;
+			case 1:
+				R(F, D, A, B, C, X_val, S_val, T_val);
+				break;
+			case 2:
+				R(F, C, D, A, B, X_val, S_val, T_val);
+				break;
+			case 3:
+				R(F, B, C, D, A, X_val, S_val, T_val);
+				break;
+			default:
+				assert(false);
+				break;
+			}
+		}
+		// Round 2
+		for (; j < 32; ++j) {
+			const std::size_t k = (j % 4);
+			const std::uint32_t X_val = X[Constants::R2_k[j-16]];
+			const std::uint32_t S_val = Constants::R2_s[k];
+			const std::uint32_t T_val = Constants::T[j];
+			switch (k) {
+			case 0:
+				R(G, A, B, C, D, X_val, S_val, T_val);
+				break;
+			case 1:
+				R(G, D, A, B, C, X_val, S_val, T_val);
+				break;
+			case 2:
+				R(G, C, D, A, B, X_val, S_val, T_val);
+				break;
+			case 3:
+				R(G, B, C, D, A, X_val, S_val, T_val);
+				break;
+			default:
+				assert(false);
+				break;
+			}
+		}
+		// Round 3
+		for (; j < 48; ++j) {
+			const std::size_t k = (j % 4);
+			const std::uint32_t X_val = X[Constants::R3_k[j-32]];
+			const std::uint32_t S_val = Constants::R3_s[k];
+			const std::uint32_t T_val = Constants::T[j];
+			switch (k) {
+			case 0:
+				R(H, A, B, C, D, X_val, S_val, T_val);
+				break;
+			case 1:
+				R(H, D, A, B, C, X_val, S_val, T_val);
+				break;
+			case 2:
+				R(H, C, D, A, B, X_val, S_val, T_val);
+				break;
+			case 3:
+				R(H, B, C, D, A, X_val, S_val, T_val);
+				break;
+			default:
+				assert(false);
+				break;
+			}
+		}
+		// Round 4
+		for (; j < 64; ++j) {
+			const std::size_t k = (j % 4);
+			const std::uint32_t X_val = X[Constants::R4_k[j-48]];
+			const std::uint32_t S_val = Constants::R4_s[k];
+			const std::uint32_t T_val = Constants::T[j];
+			switch (k) {
+			case 0:
+				R(I, A, B, C, D, X_val, S_val, T_val);
+				break;
+			case 1:
+				R(I, D, A, B, C, X_val, S_val, T_val);
+				break;
+			case 2:
+				R(I, C, D, A, B, X_val, S_val, T_val);
+				break;
+			case 3:
+				R(I, B, C, D, A, X_val, S_val, T_val);
+				break;
+			default:
+				assert(false);
+				break;
+			}
+		}
+		// Increment registers
+		A += AA;
+		B += BB;
+		C += CC;
+		D += DD;
+	}
+	// Copy digest
+	MD5Digest::ArrayType digest;
+	copyToByteArray(digest, 0, A);
+	copyToByteArray(digest, 4, B);
+	copyToByteArray(digest, 8, C);
+	copyToByteArray(digest, 12, D);
+	return MD5Digest(digest);
+}
+
+}	// namespace Legacy
+
+
+namespace Bench {
+
+typedef std::chrono::steady_clock Clock;
+constexpr std::size_t CHUNK_SZ = (64 * 1024);	// a transfer buffer
+
+
+static double seconds(const Clock::time_point begin) {
+	return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+
+static void reportOps(const char* name, const std::size_t n, const double sec) {
+	std::cout << name << ": " << (sec * 1e9 / static_cast<double>(n)) << " ns/op" << std::endl;
+}
+
+
+static void reportBytes(const char* name, const std::size_t bytes, const double sec) {
+	std::cout << name << ": " << (static_cast<double>(bytes) / (1024 * 1024) / sec) << " MiB/s"
+		<< std::endl;
+}
+
+
+static std::vector<std::uint8_t> randomData(const std::size_t sz) {
+	std::mt19937 gen{12345};
+	std::vector<std::uint8_t> data(sz);
+	for (auto& b : data)
+		b = static_cast<std::uint8_t>(gen());
+	return data;
+}
+
+
+// RFC 1321 test suite, the legacy implementation, arbitrary chunking, and
+//   updateMulti() with unequal sizes must all agree
+// The legacy implementation padded messages of 56 to 63 bytes mod 64
+//   incorrectly, so those sizes are only checked for chunking.
+static bool verify() {
+	const std::array<std::pair<const char*, const char*>, 7> suite = {{
+		{"", "d41d8cd98f00b204e9800998ecf8427e"},
+		{"a", "0cc175b9c0f1b6a831c399e269772661"},
+		{"abc", "900150983cd24fb0d6963f7d28e17f72"},
+		{"message digest", "f96b697d7cb7938d525a2f31aaf161d0"},
+		{"abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"},
+		{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+			"d174ab98d277d9f5a5611c2c9f419d9f"},
+		{"12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+			"57edf4a22be3c955ac49da2e2107b67a"}
+	}};
+	for (const auto& test : suite) {
+		if (MD5::getDigest(std::string{test.first}).str() != test.second)
+			return false;
+	}
+	const std::vector<std::uint8_t> data = randomData(4096);
+	std::mt19937 gen{1};
+	for (std::size_t sz = 0; sz <= 300; ++sz) {
+		const std::vector<std::uint8_t> msg(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(sz));
+		const MD5Digest expected = MD5::getDigest(msg);
+		if (((sz % 64) < 56) && !(Legacy::getDigest(msg) == expected))
+			return false;
+		MD5Context ctx;
+		for (std::size_t i = 0; i < sz; ) {
+			const std::size_t n = std::min(sz - i, static_cast<std::size_t>(gen() % 80));
+			ctx.update(msg.data() + i, n);
+			i += n;
+		}
+		if (!(ctx.final() == expected))
+			return false;
+	}
+	for (std::size_t n = 1; n <= (2 * MD5::MAX_LANES + 1); ++n) {
+		std::vector<MD5Context> ctxs(n);
+		std::vector<MD5Context*> ctxPtrs;
+		std::vector<const void*> ptrs;
+		std::vector<std::size_t> sizes;
+		for (std::size_t i = 0; i < n; ++i) {
+			// some contexts start with a partial block
+			ctxs[i].update(data.data(), i % 3);
+			ctxPtrs.push_back(&ctxs[i]);
+			ptrs.push_back(data.data() + (i % 3));
+			sizes.push_back(1000 + ((i % 2) * 200) + i);
+		}
+		MD5::updateMulti(ctxPtrs.data(), ptrs.data(), sizes.data(), n);
+		for (std::size_t i = 0; i < n; ++i) {
+			const std::vector<std::uint8_t> msg(
+				data.begin(), data.begin() + static_cast<std::ptrdiff_t>((i % 3) + sizes[i])
+			);
+			if (!(ctxs[i].final() == MD5::getDigest(msg)))
+				return false;
+		}
+	}
+	return true;
+}
+
+
+// salted password, as verified on login
+static void shortMessages() {
+	constexpr std::size_t N = 1000000;
+	const std::string pass{"correct horse battery staple"};
+	const std::string salt{"0123456789abcdef"};
+	std::uint8_t sink = 0;
+	Clock::time_point begin = Clock::now();
+	for (std::size_t i = 0; i < N; ++i)
+		sink ^= static_cast<std::uint8_t>(Legacy::getDigest(MD5::strToByteArray(pass + salt)).str()[0]);
+	reportOps("legacy getDigest(pass + salt)", N, seconds(begin));
+	begin = Clock::now();
+	for (std::size_t i = 0; i < N; ++i) {
+		MD5Context ctx;
+		ctx.update(pass.data(), pass.size());
+		ctx.update(salt.data(), salt.size());
+		sink ^= static_cast<std::uint8_t>(ctx.final().str()[0]);
+	}
+	reportOps("MD5Context pass, salt", N, seconds(begin));
+	if (sink == 0xff)
+		std::cout << std::endl;		// keep the results used
+}
+
+
+static void singleStream(const std::vector<std::uint8_t>& data) {
+	Clock::time_point begin = Clock::now();
+	const MD5Digest legacy = Legacy::getDigest(data);
+	reportBytes("legacy getDigest (whole message)", data.size(), seconds(begin));
+	begin = Clock::now();
+	MD5Context ctx;
+	for (std::size_t i = 0; i < data.size(); i += CHUNK_SZ)
+		ctx.update(data.data() + i, std::min(CHUNK_SZ, data.size() - i));
+	const MD5Digest streamed = ctx.final();
+	reportBytes("MD5Context (64 KiB updates)", data.size(), seconds(begin));
+	assert(legacy == streamed);
+	(void)legacy;
+	(void)streamed;
+}
+
+
+// MD5::MAX_LANES streams, each a slice of data, hashed a chunk at a time
+static void multiStream(const std::vector<std::uint8_t>& data) {
+	const std::size_t n = MD5::MAX_LANES;
+	const std::size_t streamSz = (data.size() / n);
+	std::array<MD5Context, MD5::MAX_LANES> sequential;
+	std::array<MD5Context, MD5::MAX_LANES> parallel;
+	Clock::time_point begin = Clock::now();
+	for (std::size_t offset = 0; offset < streamSz; offset += CHUNK_SZ) {
+		for (std::size_t i = 0; i < n; ++i) {
+			sequential[i].update(data.data() + (i * streamSz) + offset,
+				std::min(CHUNK_SZ, streamSz - offset));
+		}
+	}
+	reportBytes("MD5Context x8 streams", streamSz * n, seconds(begin));
+	std::array<MD5Context*, MD5::MAX_LANES> ctxPtrs;
+	std::array<const void*, MD5::MAX_LANES> ptrs;
+	std::array<std::size_t, MD5::MAX_LANES> sizes;
+	for (std::size_t i = 0; i < n; ++i)
+		ctxPtrs[i] = &parallel[i];
+	begin = Clock::now();
+	for (std::size_t offset = 0; offset < streamSz; offset += CHUNK_SZ) {
+		for (std::size_t i = 0; i < n; ++i) {
+			ptrs[i] = (data.data() + (i * streamSz) + offset);
+			sizes[i] = std::min(CHUNK_SZ, streamSz - offset);
+		}
+		MD5::updateMulti(ctxPtrs.data(), ptrs.data(), sizes.data(), n);
+	}
+	const std::string name = ("MD5::updateMulti x8 streams (" + std::to_string(MD5::getLanes())
+		+ " lanes)");
+	reportBytes(name.c_str(), streamSz * n, seconds(begin));
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!(sequential[i].final() == parallel[i].final()))
+			std::cerr << "updateMulti digest differs" << std::endl;
+	}
+}
+
+}	// namespace Bench
+
+
+int main(int argc, char** argv) {
+	const std::size_t mib = ((argc > 1) ? std::stoul(argv[1]) : 64);
+	if (!Bench::verify()) {
+		std::cerr << "MD5 output differs from expected output" << std::endl;
+		return 1;
+	}
+	const std::vector<std::uint8_t> data = Bench::randomData(mib * 1024 * 1024);
+	Bench::shortMessages();
+	Bench::singleStream(data);
+	Bench::multiStream(data);
+	return 0;
+}
@@ -0,0 +1,335 @@
+// Microbenchmarks of the primitives on the path of every command, listing and
+//   transfer, each reporting ns/op and allocations/op (calls of operator new,
+//   counted by this program).
+// usage: micro_bench [filter]
+// Only benchmarks whose name contains filter (default: all) are run.
+// The file buffers read and write a 16 MiB temporary file (in the page cache,
+//   so they measure the copy loops and syscalls, not a disk).
+#include "asio_data.h"
+#include "buffer.h"
+#include "command.h"
+#include "dir_scanner.h"
+#include "input_file_buffer.h"
+#include "listing_format.h"
+#include "md5.h"
+#include "path.h"
+#include "pi.h"
+#include "response.h"
+#include "session.h"
+#include "write_behind.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>		// malloc, free
+#include <cstring>		// memcpy
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>		// open
+#include <unistd.h>		// lseek, dup, close
+#include <boost/asio.hpp>
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+
+namespace fs = boost::filesystem;
+
+
+namespace Bench {
+
+std::uint64_t allocCount = 0;	// single threaded
+
+}	// namespace Bench
+
+
+// The replacements are not inlined, so that the compiler does not mistake the
+//   free() of a pointer from them for a mismatched deallocation.
+__attribute__((noinline)) void* operator new(std::size_t sz) {
+	++Bench::allocCount;
+	void* p = std::malloc(std::max(sz, std::size_t{1}));
+	if (p == nullptr)
+		throw std::bad_alloc{};
+	return p;
+}
+
+
+__attribute__((noinline)) void* operator new[](std::size_t sz) {
+	return operator new(sz);
+}
+
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+	std::free(p);
+}
+
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+
+__attribute__((noinline)) void operator delete[](void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+
+namespace Bench {
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr std::size_t FILE_SZ = (16 * 1024 * 1024);
+constexpr std::size_t RECV_SZ = (16 * 1024);	// an upload's socket read
+
+std::string filter;
+std::size_t sink = 0;	// results are folded into it, so they are not optimized out
+
+
+// Runs f(i) n times, after n / 10 times to warm up, and reports it as name.
+template<class F>
+static void run(const char* name, const std::size_t n, F&& f) {
+	if (std::string{name}.find(filter) == std::string::npos)
+		return;
+	for (std::size_t i = 0; i < (n / 10); ++i)
+		sink += f(i);
+	const std::uint64_t allocBegin = allocCount;
+	const Clock::time_point begin = Clock::now();
+	for (std::size_t i = 0; i < n; ++i)
+		sink += f(i);
+	const double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+	const double allocs = static_cast<double>(allocCount - allocBegin);
+	std::cout << std::left << std::setw(44) << name << std::right << std::fixed
+	          << std::setprecision(1) << std::setw(12) << (ns / static_cast<double>(n)) << " ns/op"
+	          << std::setprecision(2) << std::setw(8) << (allocs / static_cast<double>(n)) << " allocs/op"
+	          << std::endl;
+}
+
+
+static void command() {
+	const std::vector<std::string> lines = {
+		"RETR pub/releases/ftp_server-1.0.tar.gz", "PASV", "TYPE I", "CWD /pub/releases", "XYZZY plugh"
+	};
+	run("Command::Command (mixed)", 1000000,
+		[&lines](const std::size_t i) {
+			return static_cast<std::size_t>(Command{lines[i % lines.size()]}.getName());
+		}
+	);
+	const std::vector<std::string> names = {"RETR", "PASV", "TYPE", "CWD", "XYZZY"};
+	run("Command::parseName (mixed)", 1000000,
+		[&names](const std::size_t i) {
+			return static_cast<std::size_t>(Command::parseName(names[i % names.size()]));
+		}
+	);
+}
+
+
+// Commands are read as the PI reads them: into the input buffer, then taken
+//   out by updateReadInput(), and cmdStr is cleared once the reply is made.
+static void readInput() {
+	const std::string line{"RETR pub/releases/ftp_server-1.0.tar.gz\r\n"};
+	Buffer input;
+	std::string cmdStr;
+	run("PI::updateReadInput (whole command)", 1000000,
+		[&](const std::size_t) {
+			std::copy(line.begin(), line.end(), input.buf.begin() + input.sz);
+			const bool done = PI::updateReadInput(input, cmdStr, line.size());
+			const std::size_t sz = cmdStr.size();
+			cmdStr.clear();
+			return (done ? sz : 0);
+		}
+	);
+	constexpr std::size_t PIECE_SZ = 8;		// a slow client
+	run("PI::updateReadInput (8-byte reads)", 1000000,
+		[&](const std::size_t) {
+			std::size_t sz = 0;
+			for (std::size_t i = 0; i < line.size(); i += PIECE_SZ) {
+				const std::size_t n = std::min(PIECE_SZ, line.size() - i);
+				std::copy(line.begin() + static_cast<std::ptrdiff_t>(i),
+					line.begin() + static_cast<std::ptrdiff_t>(i + n), input.buf.begin() + input.sz);
+				if (PI::updateReadInput(input, cmdStr, n))
+					sz = cmdStr.size();
+			}
+			cmdStr.clear();
+			return sz;
+		}
+	);
+}
+
+
+// Replies are made as the PI makes them: a Response per command, given a code
+//   and text, then formatted by finalize() (which send() calls).
+static void response() {
+	boost::asio::io_service ios;
+	Session session{ios, ios};
+	const std::string cmdStr{"PWD"};
+	const Response::Callback callback = [](const AsioData&, std::shared_ptr<Response>) {};
+	const std::string shortText{"\"/pub/releases\" is the current directory."};
+	const std::string longText(3000, 'x');		// longer than the output buffer
+	const auto reply = [&](const std::string& text, const bool crlf) {
+		std::shared_ptr<Response> resp{new Response{session, cmdStr}};
+		resp->setCallback(callback);
+		resp->setCode(257);
+		resp->append(text);
+		if (crlf)
+			resp->append(Constants::EOL, 2);
+		resp->finalize();
+		return session.getPI().getOutputBuffer().size();
+	};
+	run("Response (short reply)", 1000000,
+		[&](const std::size_t) { return reply(shortText, false); }
+	);
+	run("Response (short reply ending in CRLF)", 1000000,
+		[&](const std::size_t) { return reply(shortText, true); }
+	);
+	run("Response (3000 byte reply)", 200000,
+		[&](const std::size_t) { return reply(longText, false); }
+	);
+}
+
+
+// returns descriptor of a temporary file of FILE_SZ bytes, already removed
+static int createFile(const fs::path& path) {
+	fs::ofstream{path, std::ios::binary} << std::string(FILE_SZ, 'x');
+	const int fd = ::open(path.c_str(), O_RDWR);
+	fs::remove(path);
+	return fd;
+}
+
+
+// Downloads read the file through an InputFileBuffer into the output buffer,
+//   uploads write what each socket read received through a WriteBehind
+//   (without a writer pool, as with writerThreads 0).
+static void fileBuffers(const fs::path& dir) {
+	const int fd = createFile(dir / "micro-bench.bin");
+	if (fd < 0)
+		throw std::runtime_error{"unable to create file"};
+	std::vector<char> out(Constants::FILE_BUF_SZ);
+	std::unique_ptr<InputFileBuffer> fileBuf;
+	run("InputFileBuffer::read (64 KiB)", 20 * (FILE_SZ / Constants::FILE_BUF_SZ),
+		[&](const std::size_t i) {
+			if ((i % (FILE_SZ / Constants::FILE_BUF_SZ)) == 0) {
+				::lseek(fd, 0, SEEK_SET);
+				fileBuf.reset(new InputFileBuffer);
+				fileBuf->setCapacity(Constants::FILE_BUF_SZ);
+				fileBuf->setFile(fd);
+			}
+			return fileBuf->read(out.data(), out.size());
+		}
+	);
+	const std::vector<char> received(RECV_SZ, 'y');
+	boost::asio::io_service ios;
+	std::shared_ptr<WriteBehind> writer;
+	run("WriteBehind::getSpace, commit (16 KiB)", 20 * (FILE_SZ / RECV_SZ),
+		[&](const std::size_t i) {
+			if ((i % (FILE_SZ / RECV_SZ)) == 0) {
+				if (writer)
+					writer->finish([](bool) {});
+				writer = std::make_shared<WriteBehind>(::dup(fd), ios, nullptr, 1,
+					WriteBehind::SyncPolicy::NONE);
+			}
+			std::size_t done = 0;
+			while (done < received.size()) {
+				const std::pair<char*, std::size_t> space = writer->getSpace();
+				const std::size_t n = std::min(space.second, received.size() - done);
+				std::memcpy(space.first, received.data() + done, n);
+				writer->commit(n);
+				done += n;
+			}
+			return done;
+		}
+	);
+	if (writer)		// not if filtered out
+		writer->finish([](bool) {});
+	ios.run();
+	::close(fd);
+}
+
+
+// MLSD entries of files modified in the last year, on different days
+static void listing() {
+	const std::time_t now = std::time(nullptr);
+	const std::string name{"ftp_server-1.0.tar.gz"};
+	DirScanner::Entry entry;
+	entry.name = name.c_str();
+	entry.nameSz = name.size();
+	entry.type = DirScanner::Type::REGULAR;
+	std::vector<char> out(ListingFormatter::maxEntrySz(name.size()));
+	ListingFormatter formatter{ListingFormat::MLSD};
+	run("ListingFormatter::mlsdEntry", 1000000,
+		[&](const std::size_t i) {
+			entry.size = (i * 4099);
+			entry.modify = (now - static_cast<std::time_t>((i % 365) * 86400 + (i % 86400)));
+			return static_cast<std::size_t>(formatter.mlsdEntry(out.data(), entry) - out.data());
+		}
+	);
+	run("ListingFormatter::writeTime", 1000000,
+		[&](const std::size_t i) {
+			const std::time_t t = (now - static_cast<std::time_t>((i % 365) * 86400 + (i % 86400)));
+			return static_cast<std::size_t>(formatter.writeTime(out.data(), t) - out.data());
+		}
+	);
+}
+
+
+// a salted password, as on login
+static void md5() {
+	const std::string salted{"correct horse battery staple0123456789abcdef"};
+	run("MD5::getDigest (44 bytes)", 1000000,
+		[&salted](const std::size_t) {
+			return static_cast<std::size_t>(MD5::getDigest(salted).str()[0]);
+		}
+	);
+}
+
+
+// Path::get resolves with the filesystem (canonical), childOf is lexical.
+static void path(const fs::path& dir) {
+	fs::create_directories(dir / "micro-bench" / "pub" / "releases");
+	const Path home{dir / "micro-bench"};
+	const Path file{dir / "micro-bench" / "pub" / "releases"};
+	run("Path::get (2 components)", 100000,
+		[&home](const std::size_t) {
+			return static_cast<std::size_t>(home.get("pub/releases").second);
+		}
+	);
+	run("Path::childOf", 1000000,
+		[&home, &file](const std::size_t) {
+			return static_cast<std::size_t>(file.childOf(home));
+		}
+	);
+	fs::remove_all(dir / "micro-bench");
+}
+
+}	// namespace Bench
+
+
+int main(int argc, char** argv) {
+	Bench::filter = ((argc > 1) ? argv[1] : "");
+	const fs::path dir = fs::temp_directory_path();
+	try {
+		Bench::command();
+		Bench::readInput();
+		Bench::response();
+		Bench::fileBuffers(dir);
+		Bench::listing();
+		Bench::md5();
+		Bench::path(dir);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	if (Bench::sink == 1)
+		std::cout << std::endl;
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include "checksum.h"
+#include <array>
+#include <cctype>	// toupper
+
+
+namespace ChecksumConstants {
+	constexpr std::uint32_t CRC32_POLY = 0xedb88320;	// IEEE 802.3, reflected
+	constexpr char hexDigits[] = "0123456789abcdef";
+	constexpr std::array<const char*, 2> names = {"MD5", "CRC32"};	// by HashAlgorithm
+}
+
+
+namespace ChecksumUtil {
+
+// Tables for CRC32 "slice-by-8", which processes 8 bytes per step.
+// table[0] is the usual byte-at-a-time table, and table[k][i] is the CRC of
+//   byte i followed by k zero bytes.
+struct CRCTable {
+	std::uint32_t table[8][256];
+};
+
+
+static constexpr CRCTable makeCRCTable() {
+	CRCTable t{};
+	for (std::uint32_t i = 0; i < 256; ++i) {
+		std::uint32_t crc = i;
+		for (int bit = 0; bit < 8; ++bit)
+			crc = ((crc & 1) ? ((crc >> 1) ^ ChecksumConstants::CRC32_POLY) : (crc >> 1));
+		t.table[0][i] = crc;
+	}
+	for (std::uint32_t i = 0; i < 256; ++i) {
+		for (std::size_t k = 1; k < 8; ++k) {
+			const std::uint32_t prev = t.table[k-1][i];
+			t.table[k][i] = ((prev >> 8) ^ t.table[0][prev & 0xff]);
+		}
+	}
+	return t;
+}
+
+
+static constexpr CRCTable crcTable = makeCRCTable();
+
+
+static std::uint32_t getUint32(const std::uint8_t* p) {
+	return (
+		static_cast<std::uint32_t>(p[0])
+		| (static_cast<std::uint32_t>(p[1]) << 8)
+		| (static_cast<std::uint32_t>(p[2]) << 16)
+		| (static_cast<std::uint32_t>(p[3]) << 24)
+	);
+}
+
+
+static std::uint32_t updateCRC(std::uint32_t crc, const std::uint8_t* p, std::size_t sz) {
+	const auto& t = crcTable.table;
+	for (; sz >= 8; sz -= 8, p += 8) {
+		const std::uint32_t one = (crc ^ getUint32(p));
+		const std::uint32_t two = getUint32(p + 4);
+		crc = (
+			t[7][one & 0xff] ^ t[6][(one >> 8) & 0xff] ^ t[5][(one >> 16) & 0xff] ^ t[4][one >> 24]
+			^ t[3][two & 0xff] ^ t[2][(two >> 8) & 0xff] ^ t[1][(two >> 16) & 0xff] ^ t[0][two >> 24]
+		);
+	}
+	for (; sz > 0; --sz, ++p)
+		crc = ((crc >> 8) ^ t[0][(crc ^ *p) & 0xff]);
+	return crc;
+}
+
+}	// namespace ChecksumUtil
+
+
+Checksum::Checksum(const HashAlgorithm a) : crc{0xffffffff}, algorithm{a} {
+}
+
+
+void Checksum::update(const void* data, const std::size_t sz) {
+	switch (algorithm) {
+	case HashAlgorithm::MD5:
+		md5.update(data, sz);
+		break;
+	case HashAlgorithm::CRC32:
+		crc = ChecksumUtil::updateCRC(crc, static_cast<const std::uint8_t*>(data), sz);
+		break;
+	}
+}
+
+
+// returns the checksum in lowercase hex
+// The Checksum must not be updated afterwards.
+std::string Checksum::final() {
+	if (algorithm == HashAlgorithm::MD5)
+		return md5.final().str();
+	const std::uint32_t value = (crc ^ 0xffffffff);
+	std::string str(8, '0');
+	for (std::size_t i = 0; i < 8; ++i)
+		str[i] = ChecksumConstants::hexDigits[(value >> (28 - i*4)) & 0xf];
+	return str;
+}
+
+
+const char* Checksum::getName(const HashAlgorithm a) {
+	return ChecksumConstants::names[static_cast<std::size_t>(a)];
+}
+
+
+// name is case-insensitive
+// returns false if name is not a supported algorithm
+bool Checksum::parseName(const std::string& name, HashAlgorithm& a) {
+	std::string upper{name};
+	for (auto& c : upper)
+		c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	for (std::size_t i = 0; i < ChecksumConstants::names.size(); ++i) {
+		if (upper == ChecksumConstants::names[i]) {
+			a = static_cast<HashAlgorithm>(i);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "md5.h"
+#include <cstddef>	// size_t
+#include <cstdint>
+#include <string>
+
+
+// algorithms of HASH (https://tools.ietf.org/html/draft-bryan-ftp-hash), XMD5,
+//   and XCRC
+enum class HashAlgorithm {MD5, CRC32};
+
+
+// Incremental checksum of a file, so it can be computed as the file is
+//   transferred.
+class Checksum {
+public:
+	Checksum(const HashAlgorithm);
+	Checksum(const Checksum&) = default;
+	~Checksum() = default;
+	void update(const void*, const std::size_t);
+	std::string final(void);
+	HashAlgorithm getAlgorithm(void) const;
+	static const char* getName(const HashAlgorithm);
+	static bool parseName(const std::string&, HashAlgorithm&);
+	Checksum& operator=(const Checksum&) = default;
+private:
+	MD5Context md5;
+	std::uint32_t crc;
+	HashAlgorithm algorithm;
+};
+
+
+inline
+HashAlgorithm Checksum::getAlgorithm() const {
+	return algorithm;
+}
@@ -0,0 +1,125 @@
+#include "checksum_cache.h"
+#include "utility.h"	// Constants
+#include <cerrno>
+#include <memory>
+#include <sstream>
+#ifdef __linux__
+#include <sys/xattr.h>
+#include <unistd.h>		// read
+#else
+#include <io.h>			// read
+#endif
+
+
+namespace ChecksumCacheConstants {
+	constexpr char attrPrefix[] = "user.ftp.";
+	// "<size> <mtime sec> <mtime nsec> <checksum>"
+	constexpr std::size_t MAX_ATTR_SZ = 128;
+}
+
+
+namespace ChecksumCacheUtil {
+
+#ifdef __linux__
+static std::string getAttrName(const HashAlgorithm a) {
+	std::string name{ChecksumCacheConstants::attrPrefix};
+	for (const char* c = Checksum::getName(a); *c != '\0'; ++c)
+		name.push_back(static_cast<char>(*c | 0x20));	// lowercase
+	return name;
+}
+#endif
+
+
+static bool sameStamp(const ChecksumCache::FileStamp& a, const ChecksumCache::FileStamp& b) {
+	return ((a.size == b.size) && (a.mtimeSec == b.mtimeSec) && (a.mtimeNsec == b.mtimeNsec));
+}
+
+}	// namespace ChecksumCacheUtil
+
+
+ChecksumCache::FileStamp ChecksumCache::getStamp(const struct stat& st) {
+	FileStamp stamp;
+	stamp.size = static_cast<std::int64_t>(st.st_size);
+	stamp.mtimeSec = static_cast<std::int64_t>(st.st_mtime);
+#ifdef __linux__
+	stamp.mtimeNsec = static_cast<std::int64_t>(st.st_mtim.tv_nsec);
+#else
+	stamp.mtimeNsec = 0;
+#endif
+	return stamp;
+}
+
+
+// Gets the checksum of the file fd, if it was stored for the file as of stamp.
+// returns false on miss
+bool ChecksumCache::get(const int fd, const HashAlgorithm a, const FileStamp& stamp,
+std::string& checksum) {
+#ifdef __linux__
+	char buf[ChecksumCacheConstants::MAX_ATTR_SZ];
+	const ssize_t sz = ::fgetxattr(fd, ChecksumCacheUtil::getAttrName(a).c_str(), buf, sizeof(buf));
+	if (sz <= 0)
+		return false;
+	std::istringstream iss{std::string{buf, static_cast<std::size_t>(sz)}};
+	FileStamp stored;
+	std::string value;
+	if (!(iss >> stored.size >> stored.mtimeSec >> stored.mtimeNsec >> value))
+		return false;
+	if (!ChecksumCacheUtil::sameStamp(stored, stamp))
+		return false;	// file changed
+	checksum.swap(value);
+	return true;
+#else
+	(void)fd;
+	(void)a;
+	(void)stamp;
+	(void)checksum;
+	return false;
+#endif
+}
+
+
+// Stores checksum of the file fd, computed from its contents as of stamp.
+// Nothing is stored if the file has changed since.
+void ChecksumCache::put(const int fd, const HashAlgorithm a, const FileStamp& stamp,
+const std::string& checksum) {
+#ifdef __linux__
+	struct stat st;
+	if ((::fstat(fd, &st) != 0) || !ChecksumCacheUtil::sameStamp(getStamp(st), stamp))
+		return;
+	std::ostringstream oss;
+	oss << stamp.size << ' ' << stamp.mtimeSec << ' ' << stamp.mtimeNsec << ' ' << checksum;
+	const std::string value = oss.str();
+	// fails without write permission, or on filesystems without user xattrs
+	(void)::fsetxattr(fd, ChecksumCacheUtil::getAttrName(a).c_str(), value.data(), value.size(), 0);
+#else
+	(void)fd;
+	(void)a;
+	(void)stamp;
+	(void)checksum;
+#endif
+}
+
+
+// Reads the whole file fd (from its current offset, which should be 0) to
+//   compute its checksum, and stores it.
+// Blocks for as long as reading the file takes.
+// returns false on read error
+bool ChecksumCache::compute(const int fd, const HashAlgorithm a, const FileStamp& stamp,
+std::string& checksum) {
+	Checksum sum{a};
+	std::unique_ptr<char[]> buf{new char[Constants::FILE_BUF_SZ]};
+	for (;;) {
+		const auto n = ::read(fd, buf.get(), Constants::FILE_BUF_SZ);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		sum.update(buf.get(), static_cast<std::size_t>(n));
+	}
+	checksum = sum.final();
+	put(fd, a, stamp, checksum);
+	return true;
+}
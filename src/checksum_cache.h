@@ -0,0 +1,29 @@
+#pragma once
+
+#include "checksum.h"
+#include <cstdint>
+#include <string>
+#include <sys/stat.h>
+
+
+// Checksums of files, stored with the file in an extended attribute
+//   ("user.ftp.<algorithm>") along with its size and mtime, so a checksum is
+//   only computed again after the file changes, and the cache needs no memory
+//   and survives restarts.
+// Checksums are stored by computing them while a file is transferred (see
+//   FileWriter and FileReader) or by compute().
+// Extended attributes are only used on Linux. Elsewhere, or if the filesystem
+//   does not support them, nothing is cached.
+class ChecksumCache {
+public:
+	struct FileStamp {
+		std::int64_t size;
+		std::int64_t mtimeSec;
+		std::int64_t mtimeNsec;
+	};
+
+	static FileStamp getStamp(const struct stat&);
+	static bool get(const int, const HashAlgorithm, const FileStamp&, std::string&);
+	static void put(const int, const HashAlgorithm, const FileStamp&, const std::string&);
+	static bool compute(const int, const HashAlgorithm, const FileStamp&, std::string&);
+};
@@ -5,7 +5,15 @@ std::unordered_map<std::string, Command::Name> Command::nameMap = {
 	{"USER", Name::USER}, {"PASS", Name::PASS}, {"FEAT", Name::FEAT},
 	{"PWD", Name::PWD}, {"TYPE", Name::TYPE}, {"PASV", Name::PASV},
 	{"MLSD", Name::MLSD}, {"RETR", Name::RETR}, {"SYST", Name::SYST},
-	{"STOR", Name::STOR}
+	{"STOR", Name::STOR}, {"MLST", Name::MLST}, {"LIST", Name::LIST},
+	{"NLST", Name::NLST}, {"CWD", Name::CWD}, {"CDUP", Name::CDUP},
+	{"MKD", Name::MKD}, {"RMD", Name::RMD}, {"DELE", Name::DELE},
+	{"RNFR", Name::RNFR}, {"RNTO", Name::RNTO}, {"SIZE", Name::SIZE},
+	{"MDTM", Name::MDTM}, {"HASH", Name::HASH}, {"XMD5", Name::XMD5},
+	{"XCRC", Name::XCRC}, {"OPTS", Name::OPTS}, {"ALLO", Name::ALLO},
+	{"APPE", Name::APPE}, {"STOU", Name::STOU}, {"REST", Name::REST},
+	{"ABOR", Name::ABOR}, {"AUTH", Name::AUTH}, {"PBSZ", Name::PBSZ},
+	{"PROT", Name::PROT}, {"STAT", Name::STAT}
 };
 
 
@@ -31,3 +39,17 @@ Command::Name Command::parseName(const std::string& str) {
 		return it->second;
 	}
 }
+
+
+// The command as sent, or "_NONE" (no command, e.g. the welcome message) or
+//   "_INVALID".
+// Not meant to be fast.
+std::string Command::getNameStr(const Name n) {
+	if (n == Name::_NONE)
+		return "_NONE";
+	for (const auto& entry : nameMap) {
+		if (entry.second == n)
+			return entry.first;
+	}
+	return "_INVALID";
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>	// size_t
 #include <string>
 #include <unordered_map>
 
@@ -7,8 +8,13 @@
 class Command {
 public:
 	enum class Name {
-		_NONE, _INVALID, USER, PASS, FEAT, PWD, TYPE, PASV, MLSD, RETR, SYST, STOR
+		_NONE, _INVALID, USER, PASS, FEAT, PWD, TYPE, PASV, MLSD, RETR, SYST, STOR,
+		MLST, LIST, NLST, CWD, CDUP, MKD, RMD, DELE, RNFR, RNTO,
+		SIZE, MDTM, HASH, XMD5, XCRC, OPTS, ALLO, APPE, STOU, REST, ABOR,
+		AUTH, PBSZ, PROT, STAT
 	};
+	// number of Names (STAT must be the last)
+	static constexpr std::size_t NUM_NAMES = (static_cast<std::size_t>(Name::STAT) + 1);
 
 	Command();
 	Command(const Command&) = default;
@@ -18,6 +24,7 @@ public:
 	const std::string& getArg(void) const;
 	Command& operator=(const Command&) = default;
 	static Name parseName(const std::string&);
+	static std::string getNameStr(const Name);
 private:
 	static std::unordered_map<std::string, Name> nameMap;
 	Name name;
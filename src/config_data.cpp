@@ -1,5 +1,6 @@
 #include "config_data.h"
 #include "md5.h"
+#include "socket_options.h"
 #include "utility.h"
 #include <fstream>
 #include <sstream>
@@ -20,6 +21,35 @@ namespace ConfigDataDefaults {
 	constexpr char homeDir[] = "public_ftp";
 	constexpr int serverPort = 21;
 	constexpr int saltLength = 16;
+	constexpr int controlThreads = 1;
+	constexpr int authThreads = 0;
+	constexpr int scanThreads = 0;
+	constexpr int checksumThreads = 0;
+	constexpr int writerThreads = 0;
+	constexpr int writeBuffers = 4;
+	constexpr char storSync[] = "none";
+	constexpr int preallocSize = 0;
+	constexpr int atomicUploads = 0;
+	constexpr int transferRate = 0;		// unlimited
+	constexpr int listingCacheSize = (32 * 1024 * 1024);
+	constexpr int transferQuantum = (64 * 1024);
+	constexpr int userWeight = 1;
+	constexpr int controlNoDelay = 1;
+	constexpr int controlQuickAck = 1;
+	constexpr int dataSendBuffer = 0;
+	constexpr int dataRecvBuffer = 0;
+	constexpr int dataNotSentLowat = 0;
+	constexpr int dataCork = 0;
+	constexpr char congestion[] = "";		// system default
+	constexpr char tlsCertificate[] = "";	// FTPS disabled
+	constexpr char tlsPrivateKey[] = "";	// in tlsCertificate
+	constexpr int tlsKernel = 1;
+	constexpr int tlsRequired = 0;
+	constexpr int tlsSessionCacheSize = 20480;
+	constexpr int tlsSessionTimeout = 7200;		// seconds
+	constexpr int tlsTickets = 1;
+	constexpr char metricsFile[] = "";	// not written
+	constexpr int metricsInterval = 10;		// seconds
 }
 
 
@@ -29,11 +59,46 @@ namespace ConfigKeys {
 	constexpr char numThreads[] = "numThreads";
 	constexpr char passSaltLen[] = "saltLen";
 	constexpr char welcomeMessage[] = "welcomeMessage";
+	constexpr char controlThreads[] = "controlThreads";
+	constexpr char authThreads[] = "authThreads";
+	constexpr char scanThreads[] = "scanThreads";
+	constexpr char checksumThreads[] = "checksumThreads";
+	constexpr char writerThreads[] = "writerThreads";
+	constexpr char writeBuffers[] = "writeBuffers";
+	constexpr char storSync[] = "storSync";
+	constexpr char preallocSize[] = "preallocSize";
+	constexpr char atomicUploads[] = "atomicUploads";
+	constexpr char globalRateUp[] = "globalRateUp";
+	constexpr char globalRateDown[] = "globalRateDown";
+	constexpr char userRateUp[] = "userRateUp";
+	constexpr char userRateDown[] = "userRateDown";
+	constexpr char sessionRateUp[] = "sessionRateUp";
+	constexpr char sessionRateDown[] = "sessionRateDown";
+	constexpr char listingCacheSize[] = "listingCacheSize";
+	constexpr char transferQuantum[] = "transferQuantum";
+	constexpr char controlNoDelay[] = "controlNoDelay";
+	constexpr char controlQuickAck[] = "controlQuickAck";
+	constexpr char controlCongestion[] = "controlCongestion";
+	constexpr char dataSendBuffer[] = "dataSendBuffer";
+	constexpr char dataRecvBuffer[] = "dataRecvBuffer";
+	constexpr char dataNotSentLowat[] = "dataNotSentLowat";
+	constexpr char dataCork[] = "dataCork";
+	constexpr char dataCongestion[] = "dataCongestion";
+	constexpr char tlsCertificate[] = "tlsCertificate";
+	constexpr char tlsPrivateKey[] = "tlsPrivateKey";
+	constexpr char tlsKernel[] = "tlsKernel";
+	constexpr char tlsRequired[] = "tlsRequired";
+	constexpr char tlsSessionCacheSize[] = "tlsSessionCacheSize";
+	constexpr char tlsSessionTimeout[] = "tlsSessionTimeout";
+	constexpr char tlsTickets[] = "tlsTickets";
+	constexpr char metricsFile[] = "metricsFile";
+	constexpr char metricsInterval[] = "metricsInterval";
 	constexpr char users[] = "users";
 	constexpr char user_name[] = "name";
 	constexpr char user_passSalt[] = "passSalt";
 	constexpr char user_passHash[] = "passHash";
 	constexpr char user_homeDir[] = "homeDir";
+	constexpr char user_weight[] = "weight";
 }
 
 
@@ -44,7 +109,9 @@ namespace ReadUtil {
 	std::string errorStrKey(const char*);
 	std::string errorStrIntVal(const char*, const std::string&);
 	std::string getValueStr(const YAML::Node&, const char*);
+	std::string getValueStr(const YAML::Node&, const char*, const char*);
 	int getValueInt(const YAML::Node&, const char*);
+	int getValueInt(const YAML::Node&, const char*, const int);
 }
 
 
@@ -102,6 +169,15 @@ std::string getValueStr(const YAML::Node& node, const char* key) {
 }
 
 
+// for optional keys, returns defaultVal if missing key
+std::string getValueStr(const YAML::Node& node, const char* key, const char* defaultVal) {
+	if (!node[key]) {
+		return defaultVal;
+	}
+	return node[key].as<std::string>();
+}
+
+
 // throws runtime_error if missing key or if invalid int
 int getValueInt(const YAML::Node& node, const char* key) {
 	const std::string valStr = getValueStr(node, key);
@@ -114,6 +190,16 @@ int getValueInt(const YAML::Node& node, const char* key) {
 	}
 }
 
+
+// for optional keys, returns defaultVal if missing key
+// throws runtime_error if invalid int
+int getValueInt(const YAML::Node& node, const char* key, const int defaultVal) {
+	if (!node[key]) {
+		return defaultVal;
+	}
+	return getValueInt(node, key);
+}
+
 }	// namespace ReadUtil
 
 
@@ -132,6 +218,7 @@ void writeUser(YAML::Emitter& out, const ConfigData::User& user) {
 	writePair(out, ConfigKeys::user_passSalt, user.passSalt);
 	writePair(out, ConfigKeys::user_passHash, user.passHash);
 	writePair(out, ConfigKeys::user_homeDir, user.homeDir);
+	writePair(out, ConfigKeys::user_weight, user.weight);
 	out << YAML::EndMap;
 }
 
@@ -143,12 +230,47 @@ ConfigData ConfigData::getDefault() {
 	data.port = ConfigDataDefaults::serverPort;
 	data.numThreads = static_cast<int>(std::thread::hardware_concurrency());
 	data.passSaltLen = ConfigDataDefaults::saltLength;
+	data.controlThreads = ConfigDataDefaults::controlThreads;
+	data.authThreads = ConfigDataDefaults::authThreads;
+	data.scanThreads = ConfigDataDefaults::scanThreads;
+	data.checksumThreads = ConfigDataDefaults::checksumThreads;
+	data.writerThreads = ConfigDataDefaults::writerThreads;
+	data.writeBuffers = ConfigDataDefaults::writeBuffers;
+	data.storSync = ConfigDataDefaults::storSync;
+	data.preallocSize = ConfigDataDefaults::preallocSize;
+	data.atomicUploads = ConfigDataDefaults::atomicUploads;
+	data.globalRateUp = ConfigDataDefaults::transferRate;
+	data.globalRateDown = ConfigDataDefaults::transferRate;
+	data.userRateUp = ConfigDataDefaults::transferRate;
+	data.userRateDown = ConfigDataDefaults::transferRate;
+	data.sessionRateUp = ConfigDataDefaults::transferRate;
+	data.sessionRateDown = ConfigDataDefaults::transferRate;
+	data.listingCacheSize = ConfigDataDefaults::listingCacheSize;
+	data.transferQuantum = ConfigDataDefaults::transferQuantum;
+	data.controlNoDelay = ConfigDataDefaults::controlNoDelay;
+	data.controlQuickAck = ConfigDataDefaults::controlQuickAck;
+	data.dataSendBuffer = ConfigDataDefaults::dataSendBuffer;
+	data.dataRecvBuffer = ConfigDataDefaults::dataRecvBuffer;
+	data.dataNotSentLowat = ConfigDataDefaults::dataNotSentLowat;
+	data.dataCork = ConfigDataDefaults::dataCork;
+	data.controlCongestion = ConfigDataDefaults::congestion;
+	data.dataCongestion = ConfigDataDefaults::congestion;
+	data.tlsCertificate = ConfigDataDefaults::tlsCertificate;
+	data.tlsPrivateKey = ConfigDataDefaults::tlsPrivateKey;
+	data.tlsKernel = ConfigDataDefaults::tlsKernel;
+	data.tlsRequired = ConfigDataDefaults::tlsRequired;
+	data.tlsSessionCacheSize = ConfigDataDefaults::tlsSessionCacheSize;
+	data.tlsSessionTimeout = ConfigDataDefaults::tlsSessionTimeout;
+	data.tlsTickets = ConfigDataDefaults::tlsTickets;
+	data.metricsFile = ConfigDataDefaults::metricsFile;
+	data.metricsInterval = ConfigDataDefaults::metricsInterval;
 	data.welcomeMessage = ConfigDataDefaults::welcomeMessage;
 	data.users.emplace_back();
 	data.users.back().name = ConfigDataDefaults::name;
 	data.users.back().passSalt = Utility::getPasswordSalt(data.passSaltLen);
 	data.users.back().passHash = MD5::getDigest(data.users.back().passSalt).str();
 	data.users.back().homeDir = ConfigDataDefaults::homeDir;
+	data.users.back().weight = ConfigDataDefaults::userWeight;
 	return data;
 }
 
@@ -164,6 +286,109 @@ ConfigData ConfigData::read(const std::string& path) {
 	data.numThreads = ReadUtil::getValueInt(node, ConfigKeys::numThreads);
 	data.passSaltLen = ReadUtil::getValueInt(node, ConfigKeys::passSaltLen);
 	data.welcomeMessage = ReadUtil::getValueStr(node, ConfigKeys::welcomeMessage);
+	// optional
+	data.controlThreads = ReadUtil::getValueInt(
+		node, ConfigKeys::controlThreads, ConfigDataDefaults::controlThreads
+	);
+	data.authThreads = ReadUtil::getValueInt(
+		node, ConfigKeys::authThreads, ConfigDataDefaults::authThreads
+	);
+	data.scanThreads = ReadUtil::getValueInt(
+		node, ConfigKeys::scanThreads, ConfigDataDefaults::scanThreads
+	);
+	data.checksumThreads = ReadUtil::getValueInt(
+		node, ConfigKeys::checksumThreads, ConfigDataDefaults::checksumThreads
+	);
+	data.writerThreads = ReadUtil::getValueInt(
+		node, ConfigKeys::writerThreads, ConfigDataDefaults::writerThreads
+	);
+	data.writeBuffers = ReadUtil::getValueInt(
+		node, ConfigKeys::writeBuffers, ConfigDataDefaults::writeBuffers
+	);
+	data.storSync = ReadUtil::getValueStr(
+		node, ConfigKeys::storSync, ConfigDataDefaults::storSync
+	);
+	data.preallocSize = ReadUtil::getValueInt(
+		node, ConfigKeys::preallocSize, ConfigDataDefaults::preallocSize
+	);
+	data.atomicUploads = ReadUtil::getValueInt(
+		node, ConfigKeys::atomicUploads, ConfigDataDefaults::atomicUploads
+	);
+	data.globalRateUp = ReadUtil::getValueInt(
+		node, ConfigKeys::globalRateUp, ConfigDataDefaults::transferRate
+	);
+	data.globalRateDown = ReadUtil::getValueInt(
+		node, ConfigKeys::globalRateDown, ConfigDataDefaults::transferRate
+	);
+	data.userRateUp = ReadUtil::getValueInt(
+		node, ConfigKeys::userRateUp, ConfigDataDefaults::transferRate
+	);
+	data.userRateDown = ReadUtil::getValueInt(
+		node, ConfigKeys::userRateDown, ConfigDataDefaults::transferRate
+	);
+	data.sessionRateUp = ReadUtil::getValueInt(
+		node, ConfigKeys::sessionRateUp, ConfigDataDefaults::transferRate
+	);
+	data.sessionRateDown = ReadUtil::getValueInt(
+		node, ConfigKeys::sessionRateDown, ConfigDataDefaults::transferRate
+	);
+	data.listingCacheSize = ReadUtil::getValueInt(
+		node, ConfigKeys::listingCacheSize, ConfigDataDefaults::listingCacheSize
+	);
+	data.transferQuantum = ReadUtil::getValueInt(
+		node, ConfigKeys::transferQuantum, ConfigDataDefaults::transferQuantum
+	);
+	data.controlNoDelay = ReadUtil::getValueInt(
+		node, ConfigKeys::controlNoDelay, ConfigDataDefaults::controlNoDelay
+	);
+	data.controlQuickAck = ReadUtil::getValueInt(
+		node, ConfigKeys::controlQuickAck, ConfigDataDefaults::controlQuickAck
+	);
+	data.dataSendBuffer = ReadUtil::getValueInt(
+		node, ConfigKeys::dataSendBuffer, ConfigDataDefaults::dataSendBuffer
+	);
+	data.dataRecvBuffer = ReadUtil::getValueInt(
+		node, ConfigKeys::dataRecvBuffer, ConfigDataDefaults::dataRecvBuffer
+	);
+	data.dataNotSentLowat = ReadUtil::getValueInt(
+		node, ConfigKeys::dataNotSentLowat, ConfigDataDefaults::dataNotSentLowat
+	);
+	data.dataCork = ReadUtil::getValueInt(
+		node, ConfigKeys::dataCork, ConfigDataDefaults::dataCork
+	);
+	data.controlCongestion = ReadUtil::getValueStr(
+		node, ConfigKeys::controlCongestion, ConfigDataDefaults::congestion
+	);
+	data.dataCongestion = ReadUtil::getValueStr(
+		node, ConfigKeys::dataCongestion, ConfigDataDefaults::congestion
+	);
+	data.tlsCertificate = ReadUtil::getValueStr(
+		node, ConfigKeys::tlsCertificate, ConfigDataDefaults::tlsCertificate
+	);
+	data.tlsPrivateKey = ReadUtil::getValueStr(
+		node, ConfigKeys::tlsPrivateKey, ConfigDataDefaults::tlsPrivateKey
+	);
+	data.tlsKernel = ReadUtil::getValueInt(
+		node, ConfigKeys::tlsKernel, ConfigDataDefaults::tlsKernel
+	);
+	data.tlsRequired = ReadUtil::getValueInt(
+		node, ConfigKeys::tlsRequired, ConfigDataDefaults::tlsRequired
+	);
+	data.tlsSessionCacheSize = ReadUtil::getValueInt(
+		node, ConfigKeys::tlsSessionCacheSize, ConfigDataDefaults::tlsSessionCacheSize
+	);
+	data.tlsSessionTimeout = ReadUtil::getValueInt(
+		node, ConfigKeys::tlsSessionTimeout, ConfigDataDefaults::tlsSessionTimeout
+	);
+	data.tlsTickets = ReadUtil::getValueInt(
+		node, ConfigKeys::tlsTickets, ConfigDataDefaults::tlsTickets
+	);
+	data.metricsFile = ReadUtil::getValueStr(
+		node, ConfigKeys::metricsFile, ConfigDataDefaults::metricsFile
+	);
+	data.metricsInterval = ReadUtil::getValueInt(
+		node, ConfigKeys::metricsInterval, ConfigDataDefaults::metricsInterval
+	);
 	// read users
 	if (!node[ConfigKeys::users])
 		throw std::runtime_error{ReadUtil::errorStrKey(ConfigKeys::users)};
@@ -178,6 +403,9 @@ ConfigData ConfigData::read(const std::string& path) {
 		tmpUser.passSalt = ReadUtil::getValueStr(*it, ConfigKeys::user_passSalt);
 		tmpUser.passHash = ReadUtil::getValueStr(*it, ConfigKeys::user_passHash);
 		tmpUser.homeDir = ReadUtil::getValueStr(*it, ConfigKeys::user_homeDir);
+		tmpUser.weight = ReadUtil::getValueInt(
+			*it, ConfigKeys::user_weight, ConfigDataDefaults::userWeight
+		);
 		data.users.push_back(tmpUser);
 	}
 	return data;
@@ -210,6 +438,20 @@ void ConfigData::write(const std::string& pathStr) {
 }
 
 
+SocketOptions ConfigData::getSocketOptions() const {
+	SocketOptions options;
+	options.controlNoDelay = (controlNoDelay != 0);
+	options.controlQuickAck = (controlQuickAck != 0);
+	options.controlCongestion = controlCongestion;
+	options.dataSendBuffer = dataSendBuffer;
+	options.dataRecvBuffer = dataRecvBuffer;
+	options.dataNotSentLowat = dataNotSentLowat;
+	options.dataCork = (dataCork != 0);
+	options.dataCongestion = dataCongestion;
+	return options;
+}
+
+
 // throws invalid_argument if user already exists
 void ConfigData::addUser(const std::string& username, const std::string& password,
 const std::string& homeDir) {
@@ -225,6 +467,7 @@ const std::string& homeDir) {
 	const std::string saltedPass = (password + users.back().passSalt);
 	users.back().passHash = MD5::getDigest(saltedPass).str();
 	users.back().homeDir = homeDir;
+	users.back().weight = ConfigDataDefaults::userWeight;
 }
 
 
@@ -240,6 +483,40 @@ void ConfigData::doWrite(std::ostream& os) {
 	WriteUtil::writePair(out, ConfigKeys::numThreads, numThreads);
 	WriteUtil::writePair(out, ConfigKeys::passSaltLen, passSaltLen);
 	WriteUtil::writePair(out, ConfigKeys::welcomeMessage, welcomeMessage);
+	WriteUtil::writePair(out, ConfigKeys::controlThreads, controlThreads);
+	WriteUtil::writePair(out, ConfigKeys::authThreads, authThreads);
+	WriteUtil::writePair(out, ConfigKeys::scanThreads, scanThreads);
+	WriteUtil::writePair(out, ConfigKeys::checksumThreads, checksumThreads);
+	WriteUtil::writePair(out, ConfigKeys::writerThreads, writerThreads);
+	WriteUtil::writePair(out, ConfigKeys::writeBuffers, writeBuffers);
+	WriteUtil::writePair(out, ConfigKeys::storSync, storSync);
+	WriteUtil::writePair(out, ConfigKeys::preallocSize, preallocSize);
+	WriteUtil::writePair(out, ConfigKeys::atomicUploads, atomicUploads);
+	WriteUtil::writePair(out, ConfigKeys::globalRateUp, globalRateUp);
+	WriteUtil::writePair(out, ConfigKeys::globalRateDown, globalRateDown);
+	WriteUtil::writePair(out, ConfigKeys::userRateUp, userRateUp);
+	WriteUtil::writePair(out, ConfigKeys::userRateDown, userRateDown);
+	WriteUtil::writePair(out, ConfigKeys::sessionRateUp, sessionRateUp);
+	WriteUtil::writePair(out, ConfigKeys::sessionRateDown, sessionRateDown);
+	WriteUtil::writePair(out, ConfigKeys::listingCacheSize, listingCacheSize);
+	WriteUtil::writePair(out, ConfigKeys::transferQuantum, transferQuantum);
+	WriteUtil::writePair(out, ConfigKeys::controlNoDelay, controlNoDelay);
+	WriteUtil::writePair(out, ConfigKeys::controlQuickAck, controlQuickAck);
+	WriteUtil::writePair(out, ConfigKeys::controlCongestion, controlCongestion);
+	WriteUtil::writePair(out, ConfigKeys::dataSendBuffer, dataSendBuffer);
+	WriteUtil::writePair(out, ConfigKeys::dataRecvBuffer, dataRecvBuffer);
+	WriteUtil::writePair(out, ConfigKeys::dataNotSentLowat, dataNotSentLowat);
+	WriteUtil::writePair(out, ConfigKeys::dataCork, dataCork);
+	WriteUtil::writePair(out, ConfigKeys::dataCongestion, dataCongestion);
+	WriteUtil::writePair(out, ConfigKeys::tlsCertificate, tlsCertificate);
+	WriteUtil::writePair(out, ConfigKeys::tlsPrivateKey, tlsPrivateKey);
+	WriteUtil::writePair(out, ConfigKeys::tlsKernel, tlsKernel);
+	WriteUtil::writePair(out, ConfigKeys::tlsRequired, tlsRequired);
+	WriteUtil::writePair(out, ConfigKeys::tlsSessionCacheSize, tlsSessionCacheSize);
+	WriteUtil::writePair(out, ConfigKeys::tlsSessionTimeout, tlsSessionTimeout);
+	WriteUtil::writePair(out, ConfigKeys::tlsTickets, tlsTickets);
+	WriteUtil::writePair(out, ConfigKeys::metricsFile, metricsFile);
+	WriteUtil::writePair(out, ConfigKeys::metricsInterval, metricsInterval);
 	// users
 	out << YAML::Key << ConfigKeys::users << YAML::Value << YAML::BeginSeq;
 	for (const User& user : users)
@@ -5,6 +5,9 @@
 #include <vector>
 
 
+struct SocketOptions;
+
+
 // Data from config file
 // If User::homeDir is a relative path, it will be relative to executable
 class ConfigData {
@@ -14,6 +17,7 @@ public:
 		std::string passSalt;
 		std::string passHash;
 		std::string homeDir;
+		int weight;
 	};
 
 	ConfigData(const ConfigData&) = default;
@@ -24,6 +28,33 @@ public:
 	void addUser(const std::string&, const std::string&, const std::string&);
 	int getPort(void) const;
 	int getNumThreads(void) const;
+	int getControlThreads(void) const;
+	int getAuthThreads(void) const;
+	int getScanThreads(void) const;
+	int getChecksumThreads(void) const;
+	int getWriterThreads(void) const;
+	int getWriteBuffers(void) const;
+	const std::string& getStorSync(void) const;
+	int getPreallocSize(void) const;
+	bool getAtomicUploads(void) const;
+	int getGlobalRateUp(void) const;
+	int getGlobalRateDown(void) const;
+	int getUserRateUp(void) const;
+	int getUserRateDown(void) const;
+	int getSessionRateUp(void) const;
+	int getSessionRateDown(void) const;
+	int getListingCacheSize(void) const;
+	int getTransferQuantum(void) const;
+	SocketOptions getSocketOptions(void) const;
+	const std::string& getTlsCertificate(void) const;
+	const std::string& getTlsPrivateKey(void) const;
+	bool getTlsKernel(void) const;
+	bool getTlsRequired(void) const;
+	int getTlsSessionCacheSize(void) const;
+	int getTlsSessionTimeout(void) const;
+	bool getTlsTickets(void) const;
+	const std::string& getMetricsFile(void) const;
+	int getMetricsInterval(void) const;
 	const std::string& getWelcomeMessage(void) const;
 	const std::vector<User>& getUsers(void) const;
 private:
@@ -32,10 +63,49 @@ private:
 
 	std::vector<User> users;
 	std::string welcomeMessage;
+	std::string storSync;
 	int port;
 	int maxNumConcurrentUsers;
 	int numThreads;
+	int controlThreads;
 	int passSaltLen;
+	int authThreads;
+	int scanThreads;
+	int checksumThreads;
+	int writerThreads;
+	int writeBuffers;
+	int preallocSize;
+	int atomicUploads;		// 0 or 1
+	// bytes per second, 0 if unlimited
+	int globalRateUp;
+	int globalRateDown;
+	int userRateUp;
+	int userRateDown;
+	int sessionRateUp;
+	int sessionRateDown;
+	int listingCacheSize;
+	int transferQuantum;
+	// see SocketOptions
+	std::string controlCongestion;
+	std::string dataCongestion;
+	int controlNoDelay;		// 0 or 1
+	int controlQuickAck;	// 0 or 1
+	int dataSendBuffer;
+	int dataRecvBuffer;
+	int dataNotSentLowat;
+	int dataCork;			// 0 or 1
+	// FTPS, see Server::setTls
+	std::string tlsCertificate;	// PEM file, empty to disable FTPS
+	std::string tlsPrivateKey;	// PEM file, empty if in tlsCertificate
+	int tlsKernel;			// 0 or 1
+	int tlsRequired;		// 0 or 1
+	// see TlsContext::setSessionCache
+	int tlsSessionCacheSize;
+	int tlsSessionTimeout;	// seconds
+	int tlsTickets;			// 0 or 1
+	// see Server::setMetricsFile
+	std::string metricsFile;	// empty if not written
+	int metricsInterval;	// seconds
 };
 
 
@@ -51,6 +121,162 @@ int ConfigData::getNumThreads() const {
 }
 
 
+inline
+int ConfigData::getControlThreads() const {
+	return controlThreads;
+}
+
+
+inline
+int ConfigData::getAuthThreads() const {
+	return authThreads;
+}
+
+
+inline
+int ConfigData::getScanThreads() const {
+	return scanThreads;
+}
+
+
+inline
+int ConfigData::getChecksumThreads() const {
+	return checksumThreads;
+}
+
+
+inline
+int ConfigData::getWriterThreads() const {
+	return writerThreads;
+}
+
+
+inline
+int ConfigData::getWriteBuffers() const {
+	return writeBuffers;
+}
+
+
+inline
+const std::string& ConfigData::getStorSync() const {
+	return storSync;
+}
+
+
+inline
+int ConfigData::getPreallocSize() const {
+	return preallocSize;
+}
+
+
+inline
+bool ConfigData::getAtomicUploads() const {
+	return (atomicUploads != 0);
+}
+
+
+inline
+int ConfigData::getGlobalRateUp() const {
+	return globalRateUp;
+}
+
+
+inline
+int ConfigData::getGlobalRateDown() const {
+	return globalRateDown;
+}
+
+
+inline
+int ConfigData::getUserRateUp() const {
+	return userRateUp;
+}
+
+
+inline
+int ConfigData::getUserRateDown() const {
+	return userRateDown;
+}
+
+
+inline
+int ConfigData::getSessionRateUp() const {
+	return sessionRateUp;
+}
+
+
+inline
+int ConfigData::getSessionRateDown() const {
+	return sessionRateDown;
+}
+
+
+inline
+int ConfigData::getListingCacheSize() const {
+	return listingCacheSize;
+}
+
+
+inline
+int ConfigData::getTransferQuantum() const {
+	return transferQuantum;
+}
+
+
+inline
+const std::string& ConfigData::getTlsCertificate() const {
+	return tlsCertificate;
+}
+
+
+inline
+const std::string& ConfigData::getTlsPrivateKey() const {
+	return tlsPrivateKey;
+}
+
+
+inline
+bool ConfigData::getTlsKernel() const {
+	return (tlsKernel != 0);
+}
+
+
+inline
+bool ConfigData::getTlsRequired() const {
+	return (tlsRequired != 0);
+}
+
+
+inline
+int ConfigData::getTlsSessionCacheSize() const {
+	return tlsSessionCacheSize;
+}
+
+
+inline
+int ConfigData::getTlsSessionTimeout() const {
+	return tlsSessionTimeout;
+}
+
+
+inline
+bool ConfigData::getTlsTickets() const {
+	return (tlsTickets != 0);
+}
+
+
+inline
+const std::string& ConfigData::getMetricsFile() const {
+	return metricsFile;
+}
+
+
+inline
+int ConfigData::getMetricsInterval() const {
+	return metricsInterval;
+}
+
+
 inline
 const std::string& ConfigData::getWelcomeMessage() const {
 	return welcomeMessage;
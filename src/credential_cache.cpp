@@ -0,0 +1,50 @@
+#include "credential_cache.h"
+#include <random>
+
+
+CredentialCache::CredentialCache(const std::chrono::seconds t) : ttl{t} {
+	std::random_device rd;
+	std::uniform_int_distribution<int> dist{0, 255};
+	for (auto& c : secret)
+		c = static_cast<char>(dist(rd));
+}
+
+
+// returns true if pass was verified for user within ttl
+bool CredentialCache::check(const std::string& user, const std::string& pass) {
+	const MD5Digest key = getKey(user, pass);
+	std::lock_guard<std::mutex> guard{lock};
+	auto it = entries.find(user);
+	if (it == entries.end())
+		return false;
+	if (Clock::now() >= it->second.expireTime) {
+		entries.erase(it);
+		return false;
+	}
+	return (it->second.passKey == key);
+}
+
+
+// pass must have been verified for user
+void CredentialCache::add(const std::string& user, const std::string& pass) {
+	const Entry entry{getKey(user, pass), Clock::now() + ttl};
+	std::lock_guard<std::mutex> guard{lock};
+	entries[user] = entry;
+}
+
+
+void CredentialCache::clear() {
+	std::lock_guard<std::mutex> guard{lock};
+	entries.clear();
+}
+
+
+MD5Digest CredentialCache::getKey(const std::string& user, const std::string& pass) const {
+	constexpr char separator = '\0';	// user names do not contain NUL
+	MD5Context ctx;
+	ctx.update(secret.data(), secret.size());
+	ctx.update(user.data(), user.size());
+	ctx.update(&separator, 1);
+	ctx.update(pass.data(), pass.size());
+	return ctx.final();
+}
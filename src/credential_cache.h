@@ -0,0 +1,41 @@
+#pragma once
+
+#include "md5.h"
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+// Remembers recently verified logins, so a client that reconnects often (e.g.
+//   automated transfers) is not verified with a possibly slow hash every time.
+// Entries are keyed by user name and hold a keyed digest of the password, not
+//   the password itself. The key is random for each run of the server.
+// Only the last password verified for a user is kept, so the size of the cache
+//   is bounded by the number of users. Entries expire after ttl.
+// Thread safe.
+class CredentialCache {
+public:
+	CredentialCache(const std::chrono::seconds);
+	CredentialCache(const CredentialCache&) = delete;
+	~CredentialCache() = default;
+	bool check(const std::string&, const std::string&);
+	void add(const std::string&, const std::string&);
+	void clear(void);
+	CredentialCache& operator=(const CredentialCache&) = delete;
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Entry {
+		MD5Digest passKey;
+		Clock::time_point expireTime;
+	};
+
+	MD5Digest getKey(const std::string&, const std::string&) const;
+
+	std::unordered_map<std::string, Entry> entries;		// by user name
+	std::mutex lock;
+	std::array<char, 16> secret;
+	const std::chrono::seconds ttl;
+};
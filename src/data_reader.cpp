@@ -2,15 +2,22 @@
 #include "asio_data.h"
 #include "data_response.h"
 #include "dtp.h"
+#include "server.h"
 #include "session.h"
 
 
 DataReader::DataReader(DataResponse& dr)
-: dataResp{dr}, inputBuffer{dr.session.getDTP().getInputBuffer()}, bytesReceived{0} {
+: dataResp{dr}, inputBuffer{dr.session.getDTP().getInputBuffer()}, bytesReceived{0},
+start{Metrics::Clock::now()} {
 }
 
 
 void DataReader::finish(const AsioData& asioData) {
+	// ok as PI::finishCallbackR replies
+	const bool ok = (!dataResp.aborted && ((asioData.ec.value() == 0) || done()) && good());
+	Server::instance()->getMetrics().countTransfer(
+		TrafficShaper::Direction::UP, ok, bytesReceived, Metrics::Clock::now() - start
+	);
 	finishCallback(asioData, dataResp.getPtr());
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "metrics.h"
 #include <functional>
 #include <memory>
 #include <boost/asio.hpp>
@@ -33,6 +34,7 @@ protected:
 	DataResponse& dataResp;
 	Buffer& inputBuffer;
 	std::size_t bytesReceived;
+	Metrics::Clock::time_point start;	// of the transfer, for the Metrics
 };
 
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "transfer_scheduler.h"
+#include <atomic>
 #include <memory>
 
 
@@ -19,6 +21,8 @@ struct DataResponse : public std::enable_shared_from_this<DataResponse> {
 	std::shared_ptr<Response> cmdResp;
 	std::shared_ptr<DataReader> dataReader;
 	std::shared_ptr<DataWriter> dataWriter;
+	TransferScheduler::Flow flow;
+	std::atomic<bool> aborted{false};	// by ABOR
 	Session& session;
 };
 
@@ -2,16 +2,22 @@
 #include "asio_data.h"
 #include "data_response.h"
 #include "dtp.h"
+#include "server.h"
 #include "session.h"
 
 
 DataWriter::DataWriter(DataResponse& dr)
 : dataResp{dr}, outputBuffer{dr.session.getDTP().getOutputBuffer()},
-bytesSent{0} {
+bytesSent{0}, start{Metrics::Clock::now()} {
 }
 
 
 void DataWriter::finish(const AsioData& asioData) {
+	// ok as PI::finishCallbackW replies
+	const bool ok = (!dataResp.aborted && (asioData.ec.value() == 0) && done());
+	Server::instance()->getMetrics().countTransfer(
+		TrafficShaper::Direction::DOWN, ok, bytesSent, Metrics::Clock::now() - start
+	);
 	finishCallback(asioData, dataResp.getPtr());
 }
 
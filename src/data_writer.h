@@ -1,5 +1,6 @@
 #pragma once
 
+#include "metrics.h"
 #include <functional>
 #include <memory>
 #include <boost/asio.hpp>
@@ -53,6 +54,7 @@ protected:
 	DataResponse& dataResp;	// the data response associated with this
 	Buffer& outputBuffer;
 	std::size_t bytesSent;
+	Metrics::Clock::time_point start;	// of the transfer, for the Metrics
 };
 
 
@@ -0,0 +1,281 @@
+#include "dir_scanner.h"
+#include "path.h"
+#include "thread_pool.h"
+#include <algorithm>	// min
+#include <cassert>
+#include <condition_variable>
+#include <cstring>		// strlen, strcmp
+#include <mutex>
+#ifdef __linux__
+#include <dirent.h>		// dirent64, DT_*
+#include <fcntl.h>		// open, AT_*
+#include <sys/stat.h>	// statx
+#include <sys/syscall.h>
+#include <unistd.h>		// close, syscall
+#endif
+
+
+namespace fs = boost::filesystem;
+
+
+namespace DirScannerConstants {
+	constexpr std::size_t DIRENT_BUF_SZ = (64 * 1024);
+	constexpr std::size_t PORTABLE_BATCH_SZ = 1024;
+	// do not bother with the thread pool for batches smaller than this
+	constexpr std::size_t PARALLEL_STAT_MIN = 256;
+}
+
+
+namespace DirScannerUtil {
+
+static bool isDotOrDotDot(const char* name) {
+	return ((name[0] == '.') && ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0'))));
+}
+
+
+// Sets type, size, and modify of entry, or only type to OTHER on error.
+#ifdef __linux__
+static bool statAt(const int dirFd, const char* name, const int flags, DirScanner::Entry& entry) {
+	struct statx stx;
+	const int ret = ::statx(
+		dirFd, name, AT_STATX_SYNC_AS_STAT | flags,
+		STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx
+	);
+	entry.type = DirScanner::Type::OTHER;
+	if (ret != 0)
+		return false;	// most likely removed since it was read
+	if (S_ISREG(stx.stx_mode))
+		entry.type = DirScanner::Type::REGULAR;
+	else if (S_ISDIR(stx.stx_mode))
+		entry.type = DirScanner::Type::DIRECTORY;
+	entry.size = static_cast<std::uintmax_t>(stx.stx_size);
+	entry.modify = static_cast<std::time_t>(stx.stx_mtime.tv_sec);
+	return true;
+}
+#else
+static bool statPortable(const fs::path& p, DirScanner::Entry& entry) {
+	boost::system::error_code ec;
+	const fs::file_status status = fs::status(p, ec);
+	entry.type = DirScanner::Type::OTHER;
+	if (ec)
+		return false;
+	const std::time_t modify = fs::last_write_time(p, ec);
+	if (ec)
+		return false;
+	entry.modify = modify;
+	entry.size = 0;
+	if (status.type() == fs::file_type::directory_file) {
+		entry.type = DirScanner::Type::DIRECTORY;
+	}
+	else if (status.type() == fs::file_type::regular_file) {
+		entry.size = fs::file_size(p, ec);
+		if (ec)
+			return false;
+		entry.type = DirScanner::Type::REGULAR;
+	}
+	return true;
+}
+#endif
+
+}	// namespace DirScannerUtil
+
+
+DirScanner::DirScanner(const Path& p, const Detail d, ThreadPool* threadPool, const int dirHandle)
+: pool{threadPool}, detail{d}, batchIndex{0}, dirFd{-1}, goodFlag{true}, endFlag{false} {
+#ifdef __linux__
+	if (dirHandle >= 0)
+		dirFd = ::openat(dirHandle, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	else
+		dirFd = ::open(p.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirFd < 0) {
+		goodFlag = false;
+		endFlag = true;
+		return;
+	}
+	direntBuf.reset(new char[DirScannerConstants::DIRENT_BUF_SZ]);
+#else
+	(void)dirHandle;
+	boost::system::error_code ec;
+	dirPath = p.getBoostPath();
+	dirIt = fs::directory_iterator{dirPath, ec};
+	if (ec) {
+		goodFlag = false;
+		endFlag = true;
+		return;
+	}
+#endif
+	readBatch();
+}
+
+
+DirScanner::~DirScanner() {
+#ifdef __linux__
+	if (dirFd >= 0)
+		::close(dirFd);
+#endif
+}
+
+
+void DirScanner::advance() {
+	assert(batchIndex < batch.size());
+	++batchIndex;
+	if ((batchIndex == batch.size()) && !endFlag)
+		readBatch();
+}
+
+
+#ifdef __linux__
+
+// Read entries until at least one is found or the end of directory is reached.
+void DirScanner::readBatch() {
+	batch.clear();
+	statIndexes.clear();
+	batchIndex = 0;
+	while (batch.empty() && !endFlag) {
+		const long n = ::syscall(
+			SYS_getdents64, dirFd, direntBuf.get(), DirScannerConstants::DIRENT_BUF_SZ
+		);
+		if (n <= 0) {
+			// 0 is end of directory
+			goodFlag = (n == 0);
+			endFlag = true;
+			break;
+		}
+		std::size_t offset = 0;
+		while (offset < static_cast<std::size_t>(n)) {
+			const dirent64* d = reinterpret_cast<const dirent64*>(direntBuf.get() + offset);
+			offset += d->d_reclen;
+			if (DirScannerUtil::isDotOrDotDot(d->d_name))
+				continue;
+			Entry entry{d->d_name, std::strlen(d->d_name), Type::OTHER, 0, 0};
+			switch (d->d_type) {
+			case DT_DIR:
+				entry.type = Type::DIRECTORY;
+				if (detail == Detail::ALL_METADATA)
+					statIndexes.push_back(batch.size());
+				break;
+			case DT_REG:
+				entry.type = Type::REGULAR;
+				if (detail != Detail::TYPE)
+					statIndexes.push_back(batch.size());
+				break;
+			case DT_LNK:
+			case DT_UNKNOWN:
+				// type is not known yet
+				statIndexes.push_back(batch.size());
+				break;
+			default:
+				continue;	// fifo, socket, device
+			}
+			batch.push_back(entry);
+		}
+	}
+	statBatch();
+}
+
+
+// stat entries statIndexes[begin, end)
+void DirScanner::statRange(const std::size_t begin, const std::size_t end) {
+	for (std::size_t i = begin; i < end; ++i) {
+		Entry& entry = batch[statIndexes[i]];
+		DirScannerUtil::statAt(dirFd, entry.name, 0, entry);
+	}
+}
+
+
+// Sets type, size, and modify of entry (name is left unchanged).
+// Returns false if p cannot be stat'ed.
+bool DirScanner::statPath(const Path& p, Entry& entry) {
+	return DirScannerUtil::statAt(AT_FDCWD, p.string().c_str(), 0, entry);
+}
+
+
+// statPath() of an open file descriptor (including O_PATH)
+bool DirScanner::statHandle(const int fd, Entry& entry) {
+	return DirScannerUtil::statAt(fd, "", AT_EMPTY_PATH, entry);
+}
+
+#else
+
+void DirScanner::readBatch() {
+	const fs::directory_iterator end;
+	boost::system::error_code ec;
+	batch.clear();
+	statIndexes.clear();
+	names.clear();
+	batchIndex = 0;
+	while ((dirIt != end) && (batch.size() < DirScannerConstants::PORTABLE_BATCH_SZ)) {
+		const std::string name = dirIt->path().filename().string();
+		statIndexes.push_back(batch.size());
+		// name is set below, once names will no longer be reallocated
+		batch.push_back(Entry{nullptr, name.size(), Type::OTHER, 0, 0});
+		names.append(name);
+		names.push_back('\0');
+		dirIt.increment(ec);
+		if (ec) {
+			goodFlag = false;
+			dirIt = end;
+		}
+	}
+	if (dirIt == end)
+		endFlag = true;
+	std::size_t offset = 0;
+	for (Entry& entry : batch) {
+		entry.name = (names.data() + offset);
+		offset += (entry.nameSz + 1);
+	}
+	statBatch();
+}
+
+
+// The portable implementation does not know the type of an entry without a
+//   stat, so every entry is stat'ed regardless of detail.
+void DirScanner::statRange(const std::size_t begin, const std::size_t end) {
+	for (std::size_t i = begin; i < end; ++i) {
+		Entry& entry = batch[statIndexes[i]];
+		DirScannerUtil::statPortable(dirPath / entry.name, entry);
+	}
+}
+
+
+// Sets type, size, and modify of entry (name is left unchanged).
+// Returns false if p cannot be stat'ed.
+bool DirScanner::statPath(const Path& p, Entry& entry) {
+	return DirScannerUtil::statPortable(p.getBoostPath(), entry);
+}
+
+#endif
+
+
+// stat entries requiring it, splitting the work over pool if worthwhile
+void DirScanner::statBatch() {
+	const std::size_t n = statIndexes.size();
+	if (!pool || (n < DirScannerConstants::PARALLEL_STAT_MIN)) {
+		statRange(0, n);
+		return;
+	}
+	// this thread does the first chunk
+	const std::size_t numChunks = std::min(
+		pool->size() + 1, n / DirScannerConstants::PARALLEL_STAT_MIN
+	);
+	const std::size_t chunkSz = ((n + numChunks - 1) / numChunks);
+	std::mutex lock;
+	std::condition_variable cv;
+	std::size_t remaining = (numChunks - 1);
+	for (std::size_t i = 1; i < numChunks; ++i) {
+		const std::size_t begin = (i * chunkSz);
+		const std::size_t end = std::min(begin + chunkSz, n);
+		pool->post(
+			[this, begin, end, &lock, &cv, &remaining]() {
+				statRange(begin, end);
+				std::lock_guard<std::mutex> guard{lock};
+				--remaining;
+				// notify while locked, since cv is destroyed once remaining is 0
+				cv.notify_one();
+			}
+		);
+	}
+	statRange(0, std::min(chunkSz, n));
+	std::unique_lock<std::mutex> guard{lock};
+	cv.wait(guard, [&remaining]() { return (remaining == 0); });
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>	// size_t
+#include <cstdint>	// uintmax_t
+#include <ctime>	// time_t
+#include <memory>
+#include <string>
+#include <vector>
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+#include <boost/filesystem.hpp>
+
+
+class Path;
+class ThreadPool;
+
+
+// Reads the entries of a directory in large batches, along with the metadata
+//   needed for listings.
+// On Linux, entries are read with getdents64 and each entry needing metadata
+//   costs a single statx relative to the open directory. Which entries need a
+//   stat depends on the requested Detail, since the type of most entries is
+//   known without one. Symbolic links are followed.
+// If a ThreadPool is provided, the entries of a large batch are stat'ed in
+//   parallel, which helps on filesystems with high stat latency (NFS).
+// If a directory handle (see PathResolver) is provided, the directory is opened
+//   through it instead of by path.
+// Usage:
+//   for (DirScanner scanner{path, detail}; scanner.current() != nullptr; scanner.advance())
+// The pointer returned by current() (and its name) is valid until advance().
+class DirScanner {
+public:
+	enum class Type {OTHER, REGULAR, DIRECTORY};
+	// TYPE: only type is valid
+	// FILE_METADATA: size and modify are also valid for REGULAR
+	// ALL_METADATA: size and modify are valid for REGULAR and DIRECTORY
+	enum class Detail {TYPE, FILE_METADATA, ALL_METADATA};
+
+	struct Entry {
+		const char* name;
+		std::size_t nameSz;
+		Type type;
+		std::uintmax_t size;
+		std::time_t modify;
+	};
+
+	DirScanner(const Path&, const Detail, ThreadPool* = nullptr, const int = -1);
+	DirScanner(const DirScanner&) = delete;
+	~DirScanner();
+	bool good(void) const;
+	const Entry* current(void) const;
+	void advance(void);
+	static bool statPath(const Path&, Entry&);
+#ifdef __linux__
+	static bool statHandle(const int, Entry&);
+#endif
+	DirScanner& operator=(const DirScanner&) = delete;
+private:
+	void readBatch(void);
+	void statBatch(void);
+	void statRange(const std::size_t, const std::size_t);
+
+	std::vector<Entry> batch;
+	std::vector<std::size_t> statIndexes;	// entries of batch requiring stat
+	std::unique_ptr<char[]> direntBuf;
+	// portable implementation
+	boost::filesystem::path dirPath;
+	boost::filesystem::directory_iterator dirIt;
+	std::string names;
+	ThreadPool* pool;
+	Detail detail;
+	std::size_t batchIndex;
+	int dirFd;
+	bool goodFlag;
+	bool endFlag;
+};
+
+
+inline
+bool DirScanner::good() const {
+	return goodFlag;
+}
+
+
+// returns nullptr once all entries have been read (or on error)
+inline
+const DirScanner::Entry* DirScanner::current() const {
+	return ((batchIndex < batch.size()) ? &batch[batchIndex] : nullptr);
+}
@@ -3,14 +3,17 @@
 #include "data_response.h"
 #include "file_reader.h"
 #include "file_writer.h"
-#include "mlsd_writer.h"
+#include "listing_writer.h"
 #include "path.h"
 #include "response.h"
 #include "server.h"
 #include "session.h"
+#include "tls_context.h"
+#include "user.h"
 #include <algorithm>	// swap
 #include <cassert>
 #include <string>
+#include <utility>	// move
 
 
 namespace DTPHelper {
@@ -39,17 +42,29 @@ static std::string getPASVResponse(const T& bytes, unsigned short port) {
 
 
 DTP::DTP(Session& sess)
-: session{sess}, mode{Mode::_NONE}, reprType{RepresentationType::ASCII} {
+: session{sess}, mode{Mode::_NONE}, reprType{RepresentationType::ASCII}, protectData{false} {
 }
 
 
 void DTP::closeConnection() {
 	assert(mode != Mode::_NONE);
+	session.getDTPStream().shutdown();
 	session.getDTPSocket().close();
 	mode = Mode::_NONE;
 }
 
 
+// Makes the pending and any later operations of a transfer fail (or read
+//   EOF), so the transfer finishes. The connection is then closed by
+//   closeConnection() as usual.
+// May be called by a thread other than the transfer's, since the socket itself
+//   is not changed.
+void DTP::abortConnection() {
+	boost::system::error_code ec;
+	session.getDTPSocket().shutdown(socket_type::shutdown_both, ec);
+}
+
+
 void DTP::enablePassiveMode(std::shared_ptr<Response> resp) {
 	// TODO reuse acceptor
 	acceptor.reset(new acceptor_type{Server::instance()->getService()});
@@ -57,6 +72,7 @@ void DTP::enablePassiveMode(std::shared_ptr<Response> resp) {
 	assert(localAddress.is_v4());
 	boost::asio::ip::tcp::endpoint ep{localAddress, 0};
 	acceptor->open(ep.protocol());
+	SocketTuning::tuneDataListener(*acceptor, Server::instance()->getSocketOptions());
 	acceptor->bind(ep);
 	acceptor->listen();
 	const unsigned short localPort = acceptor->local_endpoint().port();
@@ -77,17 +93,55 @@ void DTP::passiveAccept() {
 }
 
 
-void DTP::setMLSDWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p) {
-	// TODO catch exceptions
+// Sends or receives the data of dataResp, once the data connection is secured
+//   if PROT P. If the TLS handshake fails, so does the transfer.
+void DTP::beginTransfer(std::shared_ptr<DataResponse>& dataResp) {
+	TlsContext* context = Server::instance()->getTlsContext();
+	if (!protectData || (context == nullptr)) {
+		startTransfer(dataResp);
+		return;
+	}
+	session.getDTPStream().handshake(
+		*context, TlsContext::Channel::DATA,
+		[this, dataResp](const boost::system::error_code& ec) mutable {
+			if (ec.value() == 0)
+				startTransfer(dataResp);
+			else if (dataResp->dataWriter)
+				dataResp->dataWriter->finish(AsioData{ec, 0});
+			else
+				dataResp->dataReader->finish(AsioData{ec, 0});
+		}
+	);
+}
+
+
+// Also corks the data connection (if enabled) for a writer to send.
+void DTP::startTransfer(std::shared_ptr<DataResponse>& dataResp) {
+	if (dataResp->dataWriter) {
+		if (Server::instance()->getSocketOptions().dataCork)
+			SocketTuning::cork(session.getDTPSocket(), true);
+		dataResp->dataWriter->send();
+	}
+	else {
+		dataResp->dataReader->receive();
+	}
+}
+
+
+// info is the type of p, dirHandle is its directory handle (or -1)
+void DTP::setListingWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p,
+const ListingFormat format, const DirScanner::Entry& info, const int dirHandle) {
 	dataResp->dataWriter = std::shared_ptr<DataWriter>{
-		new MLSDWriter{*dataResp, p}
+		new ListingWriter{*dataResp, p, format, info, dirHandle}
 	};
 	setDefaultWriteCallback(dataResp->dataWriter);
 	// PI will set appropriate finish callback
 }
 
 
-void DTP::setFileWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p) {
+// takes ownership of fd, which is sent from offset
+void DTP::setFileWriter(std::shared_ptr<DataResponse>& dataResp, const int fd,
+const std::uint64_t offset) {
 	switch (mode) {
 	case Mode::_NONE:
 		// PI should have checked if data connection is active
@@ -99,7 +153,7 @@ void DTP::setFileWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p)
 		break;
 	case Mode::PASSIVE:
 		dataResp->dataWriter = std::shared_ptr<DataWriter>{
-			new FileWriter{*dataResp, p}
+			new FileWriter{*dataResp, fd, offset}
 		};
 		setDefaultWriteCallback(dataResp->dataWriter);
 		// PI will set appropriate finish callback
@@ -108,10 +162,10 @@ void DTP::setFileWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p)
 }
 
 
-void DTP::setFileReader(std::shared_ptr<DataResponse>& dataResp, const Path& p,
-const std::string& name) {
+// takes ownership of target.fd
+void DTP::setFileReader(std::shared_ptr<DataResponse>& dataResp, const UploadTarget& target) {
 	dataResp->dataReader = std::shared_ptr<DataReader>{
-		new FileReader{*dataResp, p, name}
+		new FileReader{*dataResp, target}
 	};
 	setDefaultReadCallback(dataResp->dataReader);
 }
@@ -140,9 +194,16 @@ void DTP::writeCallback(const AsioData& asioData, std::shared_ptr<DataResponse>
 		dataResp->dataWriter->finish(asioData);
 	}
 	else if (!dataResp->dataWriter->done()) {
-		dataResp->dataWriter->writeSome();
+		schedule(dataResp, asioData.nBytes,
+			[dataResp]() {
+				dataResp->dataWriter->writeSome();
+			}
+		);
 	}
 	else {
+		// send the last partial segment
+		if (Server::instance()->getSocketOptions().dataCork)
+			SocketTuning::cork(session.getDTPSocket(), false);
 		dataResp->dataWriter->finish(asioData);
 	}
 }
@@ -153,11 +214,26 @@ void DTP::readCallback(const AsioData& asioData, std::shared_ptr<DataResponse> d
 		dataResp->dataReader->finish(asioData);
 	}
 	else {
-		dataResp->dataReader->readSome();
+		schedule(dataResp, asioData.nBytes,
+			[dataResp]() {
+				dataResp->dataReader->readSome();
+			}
+		);
 	}
 }
 
 
+// Runs the next step of a transfer once the server's TransferScheduler allows.
+// nBytes were transferred by the last step.
+void DTP::schedule(std::shared_ptr<DataResponse>& dataResp, const std::size_t nBytes,
+std::function<void(void)>&& step) {
+	const User* user = session.getUser();
+	Server::instance()->getTransferScheduler().submit(
+		dataResp->flow, (user ? user->weight : 1), nBytes, std::move(step)
+	);
+}
+
+
 void DTP::acceptCallback(const boost::system::error_code& ec, std::shared_ptr<socket_type> sock) {
 	if (ec.value() != 0) {
 		// TODO
@@ -171,6 +247,7 @@ void DTP::acceptCallback(const boost::system::error_code& ec, std::shared_ptr<so
 	else {
 		// success
 		std::swap(session.getDTPSocket(), *sock);
+		SocketTuning::tuneData(session.getDTPSocket(), Server::instance()->getSocketOptions());
 		mode = Mode::PASSIVE;
 		session.passiveEnabled();
 	}
@@ -1,12 +1,16 @@
 #pragma once
 
 #include "buffer.h"
+#include "dir_scanner.h"
 #include "representation_type.h"
+#include <cstdint>	// uint64_t
+#include <functional>
 #include <memory>
 #include <string>
 #include <boost/asio.hpp>
 
 
+enum class ListingFormat;
 class AsioData;
 class DataReader;
 class DataResponse;
@@ -14,6 +18,7 @@ class DataWriter;
 class Path;
 class Response;
 class Session;
+struct UploadTarget;
 
 
 // Data-transfer process
@@ -26,19 +31,26 @@ public:
 	DTP(Session&);
 	~DTP() = default;
 	void setRepresentationType(const RepresentationType);
+	void setProtection(const bool);
+	bool getProtection(void) const;
 	void closeConnection(void);
+	void abortConnection(void);
 	void enablePassiveMode(std::shared_ptr<Response>);
 	void passiveAccept(void);
-	void setMLSDWriter(std::shared_ptr<DataResponse>&, const Path&);
-	void setFileWriter(std::shared_ptr<DataResponse>&, const Path&);
-	void setFileReader(std::shared_ptr<DataResponse>&, const Path&, const std::string&);
+	void beginTransfer(std::shared_ptr<DataResponse>&);
+	void setListingWriter(std::shared_ptr<DataResponse>&, const Path&, const ListingFormat,
+		const DirScanner::Entry&, const int);
+	void setFileWriter(std::shared_ptr<DataResponse>&, const int, const std::uint64_t);
+	void setFileReader(std::shared_ptr<DataResponse>&, const UploadTarget&);
 	Buffer& getInputBuffer(void);
 	Buffer& getOutputBuffer(void);
 private:
+	void startTransfer(std::shared_ptr<DataResponse>&);
 	void setDefaultWriteCallback(std::shared_ptr<DataWriter>&);
 	void setDefaultReadCallback(std::shared_ptr<DataReader>&);
 	void writeCallback(const AsioData&, std::shared_ptr<DataResponse>);
 	void readCallback(const AsioData&, std::shared_ptr<DataResponse>);
+	void schedule(std::shared_ptr<DataResponse>&, const std::size_t, std::function<void(void)>&&);
 	void acceptCallback(const boost::system::error_code&, std::shared_ptr<socket_type>);
 
 	std::unique_ptr<acceptor_type> acceptor;
@@ -47,6 +59,7 @@ private:
 	Session& session;
 	Mode mode;
 	RepresentationType reprType;
+	bool protectData;	// PROT P: data connections are secured by TLS
 };
 
 
@@ -56,6 +69,18 @@ void DTP::setRepresentationType(const RepresentationType type) {
 }
 
 
+inline
+void DTP::setProtection(const bool protect) {
+	protectData = protect;
+}
+
+
+inline
+bool DTP::getProtection() const {
+	return protectData;
+}
+
+
 inline
 Buffer& DTP::getInputBuffer() {
 	return inputBuffer;
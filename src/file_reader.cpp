@@ -1,42 +1,69 @@
 #include "file_reader.h"
-#include "buffer.h"
+#include "asio_data.h"
+#include "checksum_cache.h"
 #include "data_response.h"
+#include "server.h"
 #include "session.h"
-#include "utility.h"	// Constants
+#include "write_behind.h"
 #include <cassert>
+#include <sys/stat.h>	// fstat
 
 
-FileReader::FileReader(DataResponse& dr, const Path& dir, const std::string& name)
-: DataReader{dr}, goodFlag{true}, doneFlag{false} {
-	std::pair<Path, bool> reqPath = dir.create(name, file);
-	if (!reqPath.second) {
-		goodFlag = false;
-		return;
-	}
-	path = reqPath.first;
+// takes ownership of t.fd
+FileReader::FileReader(DataResponse& dr, const UploadTarget& t)
+: DataReader{dr}, timer{Server::instance()->getService()}, checksum{HashAlgorithm::MD5},
+target(t), readBuf{nullptr}, granted{0}, goodFlag{t.fd >= 0}, doneFlag{false} {
+	Server* server = Server::instance().get();
+	writer = std::make_shared<WriteBehind>(
+		target.fd, server->getService(), server->getWriterPool(), server->getWriteBuffers(),
+		server->getSyncPolicy()
+	);
+	writer->setPreallocation(target.sizeHint, server->getPreallocSize());
+	writer->setOffset(target.offset);
+	writer->setResumeHandler(
+		[this]() {
+			readSome();
+		}
+	);
 }
 
 
 void FileReader::receive() {
 	assert(goodFlag);
-	inputBuffer.clear();
-	fileBuf.setCapacity(Constants::FILE_BUF_SZ);
-	fileBuf.setFile(&file);
 	readSome();
 }
 
 
 bool FileReader::good() const {
-	return goodFlag;
+	return (goodFlag && writer->good());
 }
 
 
+// Does nothing if all buffers are being written; called again once one is free.
 void FileReader::readSome() {
-	dataResp.session.getDTPSocket().async_read_some(
-		boost::asio::buffer(
-			inputBuffer.data() + inputBuffer.size(),
-			inputBuffer.capacity() - inputBuffer.size()
-		),
+	const std::pair<char*, std::size_t> space = writer->getSpace();
+	if (!space.first)
+		return;
+	granted = space.second;
+	TrafficShaper::Limiter* limiter = dataResp.session.getLimiter();
+	if (limiter) {
+		TokenBucket::Clock::duration wait;
+		granted = limiter->take(TrafficShaper::Direction::UP, granted, wait);
+		if (granted == 0) {
+			std::shared_ptr<DataResponse> dataRespPtr = dataResp.getPtr();
+			timer.expires_after(wait);
+			timer.async_wait(
+				[this, dataRespPtr](const boost::system::error_code& ec) {
+					(void)ec;
+					readSome();
+				}
+			);
+			return;
+		}
+	}
+	readBuf = space.first;
+	dataResp.session.getDTPStream().readSome(
+		boost::asio::buffer(space.first, granted),
 		[this](const boost::system::error_code& ec, std::size_t nBytes) {
 			asioCallback(ec, nBytes);
 		}
@@ -50,40 +77,39 @@ bool FileReader::done() const {
 }
 
 
+// The reply is sent once all data has been written (and synced).
 void FileReader::finish(const AsioData& asioData) {
-	// Ignore asioData since any error that may have occurred will have already been
-	//   known because of asioCallback().
-	if (file.good()) {
-		if (inputBuffer.size() > 0) {
-			fileBuf.write(inputBuffer.data(), inputBuffer.size());
+	// AsioData refers to the error code, which must outlive the writes
+	std::shared_ptr<DataResponse> dataRespPtr = dataResp.getPtr();
+	const boost::system::error_code ec = asioData.ec;
+	const std::size_t nBytes = asioData.nBytes;
+	writer->finish(
+		[this, dataRespPtr, ec, nBytes](const bool ok) {
+			writeFinished(AsioData{ec, nBytes}, ok);
 		}
-		fileBuf.flush();
-	}
-	file.close();
-	DataReader::finish(asioData);
+	);
 }
 
 
 void FileReader::asioCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 	bytesReceived += nBytes;
-	inputBuffer.setSize(inputBuffer.size() + nBytes);
-	if (inputBuffer.full()) {
-		// when inputBuffer is full, write contents to file buffer
-		if (fileBuf.write(inputBuffer.data(), inputBuffer.size())) {
-			// A file write was performed. Check file state.
-			if (file.fail()) {
-				goodFlag = false;
-			}
-		}
-		inputBuffer.clear();
+	TrafficShaper::Limiter* limiter = dataResp.session.getLimiter();
+	if (limiter)
+		limiter->giveBack(TrafficShaper::Direction::UP, granted - nBytes);
+	if (nBytes > 0) {
+		// the file is only hashed if all of it is received
+		if (target.offset == 0)
+			checksum.update(readBuf, nBytes);
+		writer->commit(nBytes);
 	}
 	if (ec.value() != 0) {
 		if (
 			(ec == boost::asio::error::connection_reset)
 			|| (ec == boost::asio::error::eof)
 		) {
-			// Client has closed data connection.
-			doneFlag = true;
+			// Client has closed data connection (unless aborted by ABOR, which
+			//   shuts it down).
+			doneFlag = !dataResp.aborted;
 		}
 		else {
 			// unhandled error
@@ -93,3 +119,38 @@ void FileReader::asioCallback(const boost::system::error_code& ec, std::size_t n
 	}
 	doReadCallback(ec, nBytes);
 }
+
+
+void FileReader::writeFinished(const AsioData& asioData, const bool ok) {
+	const bool complete = (ok && goodFlag && doneFlag);
+	if (!ok)
+		goodFlag = false;
+	if (complete)
+		storeChecksum();
+	if (target.atomic) {
+		PathResolver& resolver = dataResp.session.getResolver();
+		if (!complete) {
+			// an unnamed file is freed once closed
+			if (!target.tmpPath.empty())
+				resolver.removeFile(target.tmpPath);
+		}
+		else if (!resolver.linkTempFile(target.fd, target.tmpPath, target.path, target.replace)) {
+			goodFlag = false;
+		}
+	}
+	DataReader::finish(asioData);
+}
+
+
+void FileReader::storeChecksum() {
+	struct stat st;
+	if (
+		(target.offset == 0)
+		&& (::fstat(writer->getFd(), &st) == 0)
+		&& (static_cast<std::uintmax_t>(st.st_size) == bytesReceived)
+	) {
+		ChecksumCache::put(
+			writer->getFd(), HashAlgorithm::MD5, ChecksumCache::getStamp(st), checksum.final()
+		);
+	}
+}
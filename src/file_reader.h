@@ -1,17 +1,44 @@
 #pragma once
 
+#include "checksum.h"
 #include "data_reader.h"
-#include "output_file_buffer.h"
-#include "path.h"
-#include <fstream>
+#include "traffic_shaper.h"
+#include <cstdint>	// uint64_t
+#include <memory>
 #include <string>
 
 
-// STOR command
+class WriteBehind;
+
+
+// File an upload is written to
+struct UploadTarget {
+	std::string path;		// virtual path of the file
+	std::string tmpPath;	// virtual path of the temporary file, empty if unnamed
+	std::uint64_t sizeHint = 0;	// expected size (from ALLO), 0 if unknown
+	std::uint64_t offset = 0;	// where data is written from (APPE or REST)
+	int fd = -1;		// open for writing
+	bool atomic = false;	// fd is a temporary file, which replaces path once complete
+	bool replace = true;	// may an atomic upload replace an existing file?
+};
+
+
+// STOR, APPE, and STOU commands
 // Reads a file from data connection and writes it to filesystem.
+// Data is received directly into the buffers of a WriteBehind, which writes
+//   them on the server's writer pool (if any). Reading pauses while all
+//   buffers are being written.
+// Disk space is preallocated for the size given by ALLO, or in steps of the
+//   server's preallocation size, and any excess is truncated at the end.
+// The MD5 of the file is computed as it is received, and stored in the
+//   ChecksumCache once the file is complete.
+// An atomic upload is linked into place before the reply, so the file is seen
+//   either as it was or complete. An incomplete one is discarded.
+// Receiving is limited by the session's TrafficShaper::Limiter. While the
+//   limit is reached, the next read waits on a timer.
 class FileReader : public DataReader {
 public:
-	FileReader(DataResponse&, const Path&, const std::string&);
+	FileReader(DataResponse&, const UploadTarget&);
 	void receive(void) override;
 	bool good(void) const override;
 	void readSome(void) override;
@@ -19,10 +46,15 @@ public:
 	void finish(const AsioData&) override;
 private:
 	void asioCallback(const boost::system::error_code&, std::size_t);
+	void writeFinished(const AsioData&, const bool);
+	void storeChecksum(void);
 
-	OutputFileBuffer fileBuf;
-	std::ofstream file;
-	Path path;
+	boost::asio::steady_timer timer;	// waits for limiter
+	Checksum checksum;
+	UploadTarget target;
+	std::shared_ptr<WriteBehind> writer;
+	char* readBuf;		// space of writer being read into
+	std::size_t granted;	// by limiter, for current read
 	bool goodFlag;
 	bool doneFlag;
 };
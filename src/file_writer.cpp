@@ -1,40 +1,71 @@
 #include "file_writer.h"
 #include "buffer.h"
 #include "data_response.h"
-#include "session.h"	// getDTPSocket
+#include "server.h"
+#include "session.h"	// getDTPStream
 #include "utility.h"
-#include <algorithm>	// min
+#include <algorithm>	// min, max
 #include <cassert>
+#include <sys/stat.h>	// fstat
+#ifdef __linux__
+#include <unistd.h>		// close, lseek
+#else
+#include <io.h>			// close, _lseeki64
+#endif
 
 
-// TODO handle case of empty file
-FileWriter::FileWriter(DataResponse& dr, const Path& p)
-: DataWriter{dr}, path{p}, goodFlag{true} {
-	file.open(path.string(), std::ifstream::binary | std::ifstream::ate);
-	if (!file.is_open()) {
-		goodFlag = false;
-		return;
-	}
-	// get file size
-	fileSz = static_cast<std::size_t>(file.tellg());
-	if (fileSz == static_cast<std::size_t>(-1)) {
+namespace FileWriterConstants {
+	constexpr std::size_t SEND_FILE_SZ = (1024 * 1024);	// at most per sendfile()
+}
+
+
+// takes ownership of f
+// offset must not be beyond the end of the file
+FileWriter::FileWriter(DataResponse& dr, const int f, const std::uint64_t offset)
+: DataWriter{dr}, timer{Server::instance()->getService()}, stamp(), fileSz{0}, bytesRead{0},
+bufIndex{0}, granted{0}, fd{f}, goodFlag{true}, sendFileFlag{false} {
+	struct stat st;
+	if (
+		(fd < 0) || (::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)
+		|| (offset > static_cast<std::uint64_t>(st.st_size))
+	) {
 		goodFlag = false;
 		return;
 	}
-	// reset file position to beginning
-	file.seekg(0, file.beg);
-	if (!file.good()) {
-		goodFlag = false;
+	fileSz = static_cast<std::size_t>(static_cast<std::uint64_t>(st.st_size) - offset);
+	if (offset > 0) {
+#ifdef __linux__
+		if (::lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0)
+#else
+		if (::_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0)
+#endif
+			goodFlag = false;
 		return;
 	}
+	stamp = ChecksumCache::getStamp(st);
+	std::string cached;
+	if (!ChecksumCache::get(fd, HashAlgorithm::MD5, stamp, cached))
+		checksum.reset(new Checksum{HashAlgorithm::MD5});
+}
+
+
+FileWriter::~FileWriter() {
+	if (fd >= 0)
+		::close(fd);
 }
 
 
 void FileWriter::send() {
 	assert(goodFlag);
-	// setup file buffer
-	fileBuf.setCapacity(std::min(fileSz, Constants::FILE_BUF_SZ));
-	fileBuf.setFile(&file);
+	// the stream is secured by now (PROT P), so whether the kernel encrypts is known
+	sendFileFlag = (!checksum && dataResp.session.getDTPStream().canSendFile());
+	if (sendFileFlag) {
+		writeSome();
+		return;
+	}
+	// setup file buffer (an empty file still needs a buffer to read EOF into)
+	fileBuf.setCapacity(std::min(std::max(fileSz, std::size_t{1}), Constants::FILE_BUF_SZ));
+	fileBuf.setFile(fd);
 	refillOutputBuffer();
 	writeSome();
 }
@@ -46,18 +77,40 @@ bool FileWriter::good() const {
 
 
 void FileWriter::writeSome() {
-	if (bufIndex == outputBuffer.size()) {
-		refillOutputBuffer();
+	if (sendFileFlag) {
+		granted = std::min(fileSz - bytesSent, FileWriterConstants::SEND_FILE_SZ);
 	}
-	dataResp.session.getDTPSocket().async_write_some(
-		boost::asio::buffer(
-			outputBuffer.data() + bufIndex,
-			outputBuffer.size() - bufIndex
-		),
-		[this](const boost::system::error_code& ec, std::size_t nBytes) {
-			asioCallback(ec, nBytes);
+	else {
+		if (bufIndex == outputBuffer.size()) {
+			refillOutputBuffer();
 		}
-	);
+		granted = outputBuffer.size() - bufIndex;
+	}
+	TrafficShaper::Limiter* limiter = dataResp.session.getLimiter();
+	if (limiter && (granted > 0)) {
+		TokenBucket::Clock::duration wait;
+		granted = limiter->take(TrafficShaper::Direction::DOWN, granted, wait);
+		if (granted == 0) {
+			std::shared_ptr<DataResponse> dataRespPtr = dataResp.getPtr();
+			timer.expires_after(wait);
+			timer.async_wait(
+				[this, dataRespPtr](const boost::system::error_code& ec) {
+					(void)ec;
+					writeSome();
+				}
+			);
+			return;
+		}
+	}
+	const auto callback = [this](const boost::system::error_code& ec, std::size_t nBytes) {
+		asioCallback(ec, nBytes);
+	};
+	if (sendFileFlag)
+		dataResp.session.getDTPStream().sendFile(fd, granted, callback);
+	else
+		dataResp.session.getDTPStream().writeSome(
+			boost::asio::buffer(outputBuffer.data() + bufIndex, granted), callback
+		);
 }
 
 
@@ -69,14 +122,32 @@ bool FileWriter::done() const {
 void FileWriter::refillOutputBuffer() {
 	bufIndex = 0;
 	outputBuffer.setSize(fileBuf.read(outputBuffer.data(), outputBuffer.capacity()));
-	if (file.fail())
+	if ((outputBuffer.size() == 0) && !done()) {
+		// read error, or file was truncated
 		goodFlag = false;
+	}
+	bytesRead += outputBuffer.size();
+	if (checksum) {
+		checksum->update(outputBuffer.data(), outputBuffer.size());
+		if (bytesRead == fileSz) {
+			// put() checks that the file has not changed while it was read
+			ChecksumCache::put(fd, HashAlgorithm::MD5, stamp, checksum->final());
+			checksum.reset(nullptr);
+		}
+	}
 }
 
 
 void FileWriter::asioCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 	bytesSent += nBytes;
 	bufIndex += nBytes;
+	if (sendFileFlag && (ec.value() == 0) && (nBytes == 0) && (granted > 0)) {
+		// file was truncated
+		goodFlag = false;
+	}
+	TrafficShaper::Limiter* limiter = dataResp.session.getLimiter();
+	if (limiter)
+		limiter->giveBack(TrafficShaper::Direction::DOWN, granted - nBytes);
 	// Although all the bytes in current buffer may have been sent by this point, we
 	//   delay refilling the buffer until necessary--in writeSome().
 	doWriteCallback(ec, nBytes);
@@ -1,28 +1,47 @@
 #pragma once
 
+#include "checksum.h"
+#include "checksum_cache.h"
 #include "data_writer.h"
 #include "input_file_buffer.h"
-#include "path.h"
-#include <fstream>
+#include "traffic_shaper.h"
+#include <cstdint>	// uint64_t
+#include <memory>
 
 
 // RETR command
 // Reads a file from filesystem and writes it to data connection.
+// The file is opened by the caller (see PathResolver), and closed by this.
+// The file is sent from an offset (REST).
+// If the MD5 of the file is not in the ChecksumCache, it is computed from the
+//   data as it is sent (unless the offset is not 0).
+// Otherwise, the file is sent with sendfile() if the data connection allows
+//   (see TlsStream::canSendFile()), so it is not copied to user space.
+// Sending is limited by the session's TrafficShaper::Limiter. While the limit
+//   is reached, the next write waits on a timer.
 class FileWriter : public DataWriter {
 public:
-	FileWriter(DataResponse&, const Path&);
+	FileWriter(DataResponse&, const int, const std::uint64_t);
+	FileWriter(const FileWriter&) = delete;
+	~FileWriter();
 	void send(void) override;
 	bool good(void) const override;
 	void writeSome(void) override;
 	bool done(void) const override;
+	FileWriter& operator=(const FileWriter&) = delete;
 private:
 	void refillOutputBuffer(void);
 	void asioCallback(const boost::system::error_code&, std::size_t);
 
+	boost::asio::steady_timer timer;	// waits for limiter
 	InputFileBuffer fileBuf;
-	std::ifstream file;
-	Path path;
-	std::size_t fileSz;
+	std::unique_ptr<Checksum> checksum;		// nullptr if not computing
+	ChecksumCache::FileStamp stamp;
+	std::size_t fileSz;		// bytes to send
+	std::size_t bytesRead;
 	std::size_t bufIndex;	// outputBuffer index
+	std::size_t granted;	// by limiter, for current write
+	int fd;
 	bool goodFlag;
+	bool sendFileFlag;	// sending with TlsStream::sendFile()
 };
@@ -1,15 +1,21 @@
 #include "input_file_buffer.h"
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#ifdef __linux__
+#include <unistd.h>		// read
+#else
+#include <io.h>			// read
+#endif
 
 
-InputFileBuffer::InputFileBuffer() : capacity{0}, file{nullptr} {
+InputFileBuffer::InputFileBuffer() : capacity{0}, size{0}, index{0}, fd{-1} {
 }
 
 
-void InputFileBuffer::setFile(std::ifstream* ptr) {
-	assert(!file);
-	file = ptr;
+void InputFileBuffer::setFile(const int f) {
+	assert(fd < 0);
+	fd = f;
 }
 
 
@@ -40,11 +46,17 @@ std::size_t InputFileBuffer::read(char* dst, const std::size_t dstSz) {
 
 
 // Note: resets index to 0
+// A short read is not an error, only a read of 0 bytes is EOF (or error).
 void InputFileBuffer::fillBuf() {
 	index = 0;
-	file->read(buf.get(), static_cast<std::ifstream::pos_type>(capacity));
-	size = static_cast<std::size_t>(file->gcount());
-	if (size == static_cast<std::size_t>(-1)) {
-		size = 0;		// error has occurred
+	size = 0;
+	for (;;) {
+		const auto n = ::read(fd, buf.get(), capacity);
+		if (n >= 0) {
+			size = static_cast<std::size_t>(n);
+			break;
+		}
+		if (errno != EINTR)
+			break;		// error has occurred
 	}
 }
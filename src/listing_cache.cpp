@@ -0,0 +1,358 @@
+#include "listing_cache.h"
+#include "path.h"
+#include <algorithm>	// find
+#include <cassert>
+#include <utility>	// move
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>		// close
+#endif
+
+
+namespace ListingCacheConstants {
+	constexpr std::chrono::seconds FALLBACK_MAX_AGE{5};
+	// number of directories tracked (each one may hold an inotify watch)
+	constexpr std::size_t MAX_DIRS = 4096;
+	// a single listing (or the file info of a directory) may use at most this
+	//   fraction of the cache
+	constexpr std::size_t MAX_ENTRY_DIV = 4;
+	// estimated memory use of cached file info, in addition to its name
+	constexpr std::size_t FILE_INFO_OVERHEAD = 64;
+#ifdef __linux__
+	constexpr std::uint32_t WATCH_MASK = (
+		IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY
+		| IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR
+	);
+#endif
+}
+
+
+ListingCache::ListingCache(boost::asio::io_service& ios, const std::size_t maxSz)
+: stats(), maxBytes{maxSz}, maxEntrySize{maxSz / ListingCacheConstants::MAX_ENTRY_DIV},
+generationCounter{0},
+#ifdef __linux__
+inotifyDesc{ios},
+#endif
+inotifyFd{-1} {
+#ifdef __linux__
+	inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd >= 0) {
+		inotifyDesc.assign(inotifyFd);
+		readEvents();
+	}
+#else
+	(void)ios;
+#endif
+}
+
+
+ListingCache::~ListingCache() {
+#ifdef __linux__
+	boost::system::error_code ec;
+	// closes inotifyFd
+	inotifyDesc.close(ec);
+#endif
+}
+
+
+// returns nullptr on miss
+ListingCache::DataPtr ListingCache::get(const Path& dir, const ListingFormat format) {
+	const std::size_t index = static_cast<std::size_t>(format);
+	assert(index < NUM_FORMATS);
+	std::lock_guard<std::mutex> guard{lock};
+	auto it = dirs.find(dir.string());
+	if ((it == dirs.end()) || !it->second.listings[index].data) {
+		++stats.misses;
+		return DataPtr{};
+	}
+	DirState& state = it->second;
+	Listing& listing = state.listings[index];
+	if (state.wd < 0) {
+		// not watched, validate by age and mtime
+		if (
+			((Clock::now() - listing.fillTime) > ListingCacheConstants::FALLBACK_MAX_AGE)
+			|| (getMTime(dir) != listing.mtime)
+		) {
+			dropData(listing);
+			++stats.invalidations;
+			++stats.misses;
+			return DataPtr{};
+		}
+	}
+	++stats.hits;
+	lru.splice(lru.begin(), lru, state.lruIt);
+	return listing.data;
+}
+
+
+// Must be called before the directory is read.
+ListingCache::FillToken ListingCache::beginFill(const Path& dir) {
+	const std::string& key = dir.string();
+	std::lock_guard<std::mutex> guard{lock};
+	auto it = dirs.find(key);
+	if (it == dirs.end()) {
+		DirState state;
+		state.filesBytes = 0;
+		lru.push_front(key);
+		state.lruIt = lru.begin();
+		state.generation = ++generationCounter;
+		state.wd = addWatch(key);
+		it = dirs.insert(std::make_pair(key, state)).first;
+		if (it->second.wd >= 0)
+			watches[it->second.wd].push_back(key);
+		evictIfNeeded();
+	}
+	else {
+		lru.splice(lru.begin(), lru, it->second.lruIt);
+	}
+	FillToken token;
+	token.generation = it->second.generation;
+	token.mtime = ((it->second.wd < 0) ? getMTime(dir) : 0);
+	return token;
+}
+
+
+void ListingCache::finishFill(const Path& dir, const ListingFormat format, const FillToken& token,
+std::string&& data) {
+	const std::size_t index = static_cast<std::size_t>(format);
+	assert(index < NUM_FORMATS);
+	if (data.size() > maxEntrySize)
+		return;
+	std::lock_guard<std::mutex> guard{lock};
+	auto it = dirs.find(dir.string());
+	if ((it == dirs.end()) || (it->second.generation != token.generation)) {
+		// directory changed (or was evicted) while being read
+		return;
+	}
+	Listing& listing = it->second.listings[index];
+	dropData(listing);
+	listing.data = std::make_shared<const std::string>(std::move(data));
+	listing.fillTime = Clock::now();
+	listing.mtime = token.mtime;
+	stats.bytes += listing.data->size();
+	++stats.inserts;
+	evictIfNeeded();
+}
+
+
+// returns false on miss
+bool ListingCache::getFileInfo(const Path& dir, const std::string& name, FileInfo& info) {
+	std::lock_guard<std::mutex> guard{lock};
+	auto it = dirs.find(dir.string());
+	if (it != dirs.end()) {
+		auto fileIt = it->second.files.find(name);
+		if (fileIt != it->second.files.end()) {
+			info = fileIt->second;
+			++stats.fileHits;
+			lru.splice(lru.begin(), lru, it->second.lruIt);
+			return true;
+		}
+	}
+	++stats.fileMisses;
+	return false;
+}
+
+
+// Adds info of files in dir, which must have been stat'ed after beginFill().
+void ListingCache::putFileInfo(const Path& dir, const FillToken& token, FileInfoBatch&& batch) {
+	std::lock_guard<std::mutex> guard{lock};
+	auto it = dirs.find(dir.string());
+	if (
+		(it == dirs.end())
+		|| (it->second.generation != token.generation)
+		|| (it->second.wd < 0)
+	) {
+		// directory changed (or was evicted) since beginFill(), or is not watched
+		return;
+	}
+	DirState& state = it->second;
+	for (auto& file : batch) {
+		const std::size_t sz = (file.first.size() + ListingCacheConstants::FILE_INFO_OVERHEAD);
+		if ((state.filesBytes + sz) > maxEntrySize)
+			break;
+		if (state.files.insert(std::make_pair(std::move(file.first), file.second)).second) {
+			state.filesBytes += sz;
+			stats.bytes += sz;
+		}
+	}
+	evictIfNeeded();
+}
+
+
+ListingCache::Stats ListingCache::getStats() const {
+	std::lock_guard<std::mutex> guard{lock};
+	Stats ret = stats;
+	ret.dirs = dirs.size();
+	return ret;
+}
+
+
+// lock must be held
+void ListingCache::dropData(Listing& listing) {
+	if (listing.data) {
+		assert(stats.bytes >= listing.data->size());
+		stats.bytes -= listing.data->size();
+		listing.data.reset();
+	}
+}
+
+
+// Drops the listings of every format, and file info.
+// Returns true if anything was dropped.
+// lock must be held
+bool ListingCache::dropData(DirState& state) {
+	bool dropped = !state.files.empty();
+	for (Listing& listing : state.listings) {
+		if (listing.data)
+			dropped = true;
+		dropData(listing);
+	}
+	assert(stats.bytes >= state.filesBytes);
+	stats.bytes -= state.filesBytes;
+	state.filesBytes = 0;
+	std::unordered_map<std::string, FileInfo>{}.swap(state.files);
+	return dropped;
+}
+
+
+// lock must be held
+void ListingCache::evict(DirMap::iterator it) {
+	DirState& state = it->second;
+	dropData(state);
+#ifdef __linux__
+	if (state.wd >= 0) {
+		// the watch is removed with the last of its keys
+		auto watchIt = watches.find(state.wd);
+		assert(watchIt != watches.end());
+		std::vector<std::string>& keys = watchIt->second;
+		keys.erase(std::find(keys.begin(), keys.end(), it->first));
+		if (keys.empty()) {
+			::inotify_rm_watch(inotifyFd, state.wd);
+			watches.erase(watchIt);
+		}
+	}
+#endif
+	lru.erase(state.lruIt);
+	dirs.erase(it);
+	++stats.evictions;
+}
+
+
+// lock must be held
+void ListingCache::evictIfNeeded() {
+	while (
+		!lru.empty()
+		&& ((stats.bytes > maxBytes) || (dirs.size() > ListingCacheConstants::MAX_DIRS))
+	) {
+		auto it = dirs.find(lru.back());
+		assert(it != dirs.end());
+		evict(it);
+	}
+}
+
+
+// returns -1 if unable to watch
+// lock must be held
+int ListingCache::addWatch(const std::string& key) {
+#ifdef __linux__
+	if (inotifyFd < 0)
+		return -1;
+	return ::inotify_add_watch(inotifyFd, key.c_str(), ListingCacheConstants::WATCH_MASK);
+#else
+	(void)key;
+	return -1;
+#endif
+}
+
+
+void ListingCache::readEvents() {
+#ifdef __linux__
+	inotifyDesc.async_read_some(
+		boost::asio::buffer(eventBuf),
+		[this](const boost::system::error_code& ec, std::size_t nBytes) {
+			eventsCallback(ec, nBytes);
+		}
+	);
+#endif
+}
+
+
+void ListingCache::eventsCallback(const boost::system::error_code& ec, std::size_t nBytes) {
+#ifdef __linux__
+	if (ec.value() != 0) {
+		if (ec == boost::asio::error::operation_aborted)
+			return;		// being destroyed
+		// Events can no longer be received, so nothing cached can be trusted.
+		std::lock_guard<std::mutex> guard{lock};
+		while (!lru.empty())
+			evict(dirs.find(lru.back()));
+		return;
+	}
+	std::size_t offset = 0;
+	while ((offset + sizeof(inotify_event)) <= nBytes) {
+		const inotify_event* event = reinterpret_cast<const inotify_event*>(eventBuf.data() + offset);
+		invalidate(event->wd, event->mask);
+		offset += (sizeof(inotify_event) + event->len);
+	}
+	readEvents();
+#else
+	(void)ec;
+	(void)nBytes;
+#endif
+}
+
+
+void ListingCache::invalidate(const int wd, const std::uint32_t mask) {
+#ifdef __linux__
+	std::lock_guard<std::mutex> guard{lock};
+	if (mask & IN_Q_OVERFLOW) {
+		// events were lost, invalidate everything
+		for (auto& dir : dirs) {
+			dir.second.generation = ++generationCounter;
+			if (dropData(dir.second))
+				++stats.invalidations;
+		}
+		return;
+	}
+	auto watchIt = watches.find(wd);
+	if (watchIt == watches.end())
+		return;		// watch was already removed
+	for (const std::string& key : watchIt->second) {
+		auto it = dirs.find(key);
+		assert(it != dirs.end());
+		DirState& state = it->second;
+		state.generation = ++generationCounter;
+		if (dropData(state))
+			++stats.invalidations;
+		if (mask & IN_IGNORED) {
+			// directory was removed (or unmounted), so the watch no longer exists
+			lru.erase(state.lruIt);
+			dirs.erase(it);
+		}
+	}
+	if (mask & IN_IGNORED)
+		watches.erase(watchIt);
+#else
+	(void)wd;
+	(void)mask;
+#endif
+}
+
+
+// modification time of dir in nanoseconds, 0 on error
+std::int64_t ListingCache::getMTime(const Path& dir) {
+#ifdef __linux__
+	struct stat st;
+	if (::stat(dir.string().c_str(), &st) != 0)
+		return 0;
+	return (
+		static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000
+		+ static_cast<std::int64_t>(st.st_mtim.tv_nsec)
+	);
+#else
+	boost::system::error_code ec;
+	const std::time_t mtime = boost::filesystem::last_write_time(dir.getBoostPath(), ec);
+	return (ec ? 0 : (static_cast<std::int64_t>(mtime) * 1000000000));
+#endif
+}
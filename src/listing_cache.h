@@ -0,0 +1,132 @@
+#pragma once
+
+#include "listing_format.h"
+#include <array>
+#include <chrono>
+#include <cstddef>	// size_t
+#include <cstdint>	// uint64_t, int64_t, uintmax_t
+#include <ctime>	// time_t
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>	// pair
+#include <vector>
+#include <boost/asio.hpp>
+
+
+class Path;
+
+
+// Server-wide cache of rendered directory listings, keyed by canonical
+//   directory path and format, so it is shared by every session listing the
+//   same directory.
+// The size and modification time of files (for SIZE and MDTM) are cached by
+//   directory as well, filled by stat'ing a single file or as a side effect of
+//   listing the directory. They are only cached for watched directories, since
+//   changing a file does not change its directory's mtime.
+// On Linux, each cached directory is watched with inotify, and any change to the
+//   directory or its entries invalidates the listing. If a directory cannot be
+//   watched, a listing is only used while the directory's mtime is unchanged,
+//   and for at most FALLBACK_MAX_AGE (changes to the contents of existing files
+//   do not update the directory's mtime).
+// A listing is filled by:
+//   FillToken token = cache.beginFill(dir);	// before reading the directory
+//   ... render listing ...
+//   cache.finishFill(dir, format, token, listing);
+// finishFill() discards the listing if the directory changed after beginFill().
+// Thread safe.
+class ListingCache {
+public:
+	typedef std::shared_ptr<const std::string> DataPtr;
+
+	struct FillToken {
+		std::uint64_t generation;
+		std::int64_t mtime;		// fallback validation
+	};
+
+	struct FileInfo {
+		std::uintmax_t size;
+		std::time_t modify;
+	};
+
+	typedef std::vector<std::pair<std::string, FileInfo>> FileInfoBatch;	// names in a directory
+
+	struct Stats {
+		std::uint64_t hits;
+		std::uint64_t misses;
+		std::uint64_t fileHits;
+		std::uint64_t fileMisses;
+		std::uint64_t inserts;
+		std::uint64_t invalidations;
+		std::uint64_t evictions;
+		std::size_t bytes;
+		std::size_t dirs;
+	};
+
+	ListingCache(boost::asio::io_service&, const std::size_t);
+	ListingCache(const ListingCache&) = delete;
+	~ListingCache();
+	DataPtr get(const Path&, const ListingFormat);
+	FillToken beginFill(const Path&);
+	void finishFill(const Path&, const ListingFormat, const FillToken&, std::string&&);
+	bool getFileInfo(const Path&, const std::string&, FileInfo&);
+	void putFileInfo(const Path&, const FillToken&, FileInfoBatch&&);
+	std::size_t getMaxEntrySize(void) const;
+	Stats getStats(void) const;
+	ListingCache& operator=(const ListingCache&) = delete;
+private:
+	typedef std::chrono::steady_clock Clock;
+	static constexpr std::size_t NUM_FORMATS = 3;
+	typedef std::list<std::string> LRUList;
+
+	struct Listing {
+		DataPtr data;
+		Clock::time_point fillTime;
+		std::int64_t mtime;
+	};
+
+	struct DirState {
+		std::array<Listing, NUM_FORMATS> listings;	// indexed by ListingFormat
+		std::unordered_map<std::string, FileInfo> files;	// by name
+		std::size_t filesBytes;		// estimated memory use of files
+		LRUList::iterator lruIt;
+		std::uint64_t generation;
+		int wd;		// inotify watch descriptor, -1 if not watched
+	};
+
+	typedef std::unordered_map<std::string, DirState> DirMap;
+
+	void dropData(Listing&);
+	bool dropData(DirState&);
+	void evict(DirMap::iterator);
+	void evictIfNeeded(void);
+	int addWatch(const std::string&);
+	void readEvents(void);
+	void eventsCallback(const boost::system::error_code&, std::size_t);
+	void invalidate(const int, const std::uint32_t);
+	static std::int64_t getMTime(const Path&);
+
+	DirMap dirs;
+	// wd to keys of dirs: a directory has a single wd, but may have several
+	//   canonical paths (bind mounts)
+	std::unordered_map<int, std::vector<std::string>> watches;
+	LRUList lru;	// keys of dirs, most recently used first
+	mutable std::mutex lock;
+	Stats stats;
+	const std::size_t maxBytes;
+	const std::size_t maxEntrySize;
+	std::uint64_t generationCounter;
+#ifdef __linux__
+	boost::asio::posix::stream_descriptor inotifyDesc;
+	alignas(int) std::array<char, 4096> eventBuf;
+#endif
+	int inotifyFd;	// -1 if inotify is unavailable
+};
+
+
+inline
+std::size_t ListingCache::getMaxEntrySize() const {
+	return maxEntrySize;
+}
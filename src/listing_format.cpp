@@ -0,0 +1,313 @@
+#include "listing_format.h"
+#include <algorithm>	// copy, min, max
+#include <cassert>
+#include <cstring>		// memcpy
+
+
+/* MLSD format (https://tools.ietf.org/html/rfc3659)
+data-response    = *( entry CRLF )
+entry            = [ facts ] SP pathname
+facts            = 1*( fact ";" )
+fact             = factname "=" value
+factname         = "Size" / "Modify" / "Create" /
+                   "Type" / "Unique" / "Perm" /
+                   "Lang" / "Media-Type" / "CharSet" /
+                   os-depend-fact / local-fact
+os-depend-fact   = <IANA assigned OS name> "." token
+local-fact       = "X." token
+token            = 1*RCHAR
+value            = *SCHAR
+SCHAR          = RCHAR / "=" ;
+RCHAR          = ALPHA / DIGIT / "," / "." / ":" / "!" /
+                 "@" / "#" / "$" / "%" / "^" /
+                 "&" / "(" / ")" / "-" / "_" /
+                 "+" / "?" / "/" / "\" / "'" /
+                 DQUOTE   ; <"> -- double quote character (%x22)
+ALPHA          =  %x41-5A / %x61-7A   ; A-Z / a-z
+DIGIT          =  %x30-39   ; 0-9
+
+Fact names are case-insensitive.
+
+Five values are possible for the type fact:
+
+      file         -- a file entry
+      cdir         -- the listed directory
+      pdir         -- a parent directory
+      dir          -- a directory or sub-directory
+      OS.name=type -- an OS or file system dependent file type
+
+The perm fact is used to indicate access rights the current FTP user
+   has over the object listed.  Its value is always an unordered
+   sequence of alphabetic characters.
+
+      perm-fact    = "Perm" "=" *pvals
+      pvals        = "a" / "c" / "d" / "e" / "f" /
+                     "l" / "m" / "p" / "r" / "w"
+
+The syntax of a time value is:
+      time-val       = 14DIGIT [ "." 1*DIGIT ]
+
+The leading, mandatory, fourteen digits are to be interpreted as, in
+   order from the leftmost, four digits giving the year, with a range of
+   1000--9999, two digits giving the month of the year, with a range of
+   01--12, two digits giving the day of the month, with a range of
+   01--31, two digits giving the hour of the day, with a range of
+   00--23, two digits giving minutes past the hour, with a range of
+   00--59, and finally, two digits giving seconds past the minute, with
+   a range of 00--60 (with 60 being used only at a leap second).
+*/
+
+
+/* LIST format
+There is no standard, clients expect the output of "ls -l":
+-rw-r--r--    1 ftp      ftp          1234 Mar 14 09:26 name
+drwxr-xr-x    1 ftp      ftp          4096 Mar 14  2015 name
+Permissions, link count, and owner are not provided (yet).
+The date shows the time of day if the entry was modified within the last six
+   months, otherwise the year.
+*/
+
+
+namespace ListingConstants {
+	constexpr char factTypeFile[] = "type=file;";
+	constexpr char factTypeDir[] = "type=dir;";
+	constexpr char factSize[] = "size=";
+	constexpr char factModify[] = "modify=";
+	constexpr char listPrefixFile[] = "-rw-r--r--    1 ftp      ftp      ";
+	constexpr char listPrefixDir[] = "drwxr-xr-x    1 ftp      ftp      ";
+	constexpr std::size_t listSizeWidth = 8;
+	constexpr char monthNames[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	constexpr std::time_t recentAge = (31556952 / 2);	// six months, as ls
+	constexpr std::time_t recentFuture = 3600;	// tolerated clock skew
+	constexpr std::int64_t secondsPerDay = 86400;
+	// time-val years are limited to 1000--9999
+	constexpr std::time_t minTime = -30610224000;	// 1000-01-01 00:00:00
+	constexpr std::time_t maxTime = 253402300799;	// 9999-12-31 23:59:59
+	constexpr char digitPairs[] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+}
+
+
+namespace ListingFormatUtil {
+
+template<std::size_t N>
+static char* append(char* dst, const char (&str)[N]) {
+	std::memcpy(dst, str, N-1);
+	return (dst + N - 1);
+}
+
+
+// write exactly two digits of val (val < 100)
+static char* write2(char* dst, const unsigned int val) {
+	assert(val < 100);
+	std::memcpy(dst, ListingConstants::digitPairs + (val * 2), 2);
+	return (dst + 2);
+}
+
+
+static char* writeName(char* dst, const char* name, const std::size_t nameSz) {
+	*dst++ = ' ';
+	std::memcpy(dst, name, nameSz);
+	dst += nameSz;
+	*dst++ = '\r';
+	*dst++ = '\n';
+	return dst;
+}
+
+
+// floor division for possibly negative times
+static std::int64_t floorDiv(const std::int64_t a, const std::int64_t b) {
+	return ((a >= 0) ? (a / b) : ((a - b + 1) / b));
+}
+
+}	// namespace ListingFormatUtil
+
+
+ListingFormatter::ListingFormatter(const ListingFormat f)
+: cachedDay{0}, cachedTime{0}, format{f} {
+	const std::time_t now = std::time(nullptr);
+	recentBegin = (now - ListingConstants::recentAge);
+	recentEnd = (now + ListingConstants::recentFuture);
+	updateDay(0);
+}
+
+
+// metadata the scanner must provide for format f
+DirScanner::Detail ListingFormatter::getDetail(const ListingFormat f) {
+	switch (f) {
+	case ListingFormat::MLSD:
+		return DirScanner::Detail::FILE_METADATA;
+	case ListingFormat::LIST:
+		return DirScanner::Detail::ALL_METADATA;
+	case ListingFormat::NLST:
+		break;
+	}
+	return DirScanner::Detail::TYPE;
+}
+
+
+// Formats entry according to format.
+// Returns dst if entry is not a regular file or directory, since those are not listed.
+char* ListingFormatter::entry(char* dst, const DirScanner::Entry& e) {
+	if (e.type == DirScanner::Type::OTHER)
+		return dst;
+	switch (format) {
+	case ListingFormat::MLSD:
+		return mlsdEntry(dst, e);
+	case ListingFormat::LIST:
+		return listEntry(dst, e);
+	case ListingFormat::NLST:
+		break;
+	}
+	return nlstEntry(dst, e);
+}
+
+
+// TODO add permissions
+char* ListingFormatter::mlsdEntry(char* dst, const DirScanner::Entry& e) {
+	if (e.type == DirScanner::Type::DIRECTORY) {
+		dst = ListingFormatUtil::append(dst, ListingConstants::factTypeDir);
+	}
+	else {
+		dst = ListingFormatUtil::append(dst, ListingConstants::factTypeFile);
+		dst = ListingFormatUtil::append(dst, ListingConstants::factSize);
+		dst = writeUInt(dst, e.size);
+		*dst++ = ';';
+		dst = ListingFormatUtil::append(dst, ListingConstants::factModify);
+		dst = writeTime(dst, e.modify);
+		*dst++ = ';';
+	}
+	return ListingFormatUtil::writeName(dst, e.name, e.nameSz);
+}
+
+
+char* ListingFormatter::listEntry(char* dst, const DirScanner::Entry& e) {
+	if (e.type == DirScanner::Type::DIRECTORY)
+		dst = ListingFormatUtil::append(dst, ListingConstants::listPrefixDir);
+	else
+		dst = ListingFormatUtil::append(dst, ListingConstants::listPrefixFile);
+	// size, right aligned
+	char sizeStr[UINT_MAX_SZ];
+	const std::size_t sizeSz = static_cast<std::size_t>(writeUInt(sizeStr, e.size) - sizeStr);
+	for (std::size_t i = sizeSz; i < ListingConstants::listSizeWidth; ++i)
+		*dst++ = ' ';
+	std::memcpy(dst, sizeStr, sizeSz);
+	dst += sizeSz;
+	*dst++ = ' ';
+	// date, from the digits of the MLSD time
+	char t[TIME_SZ];
+	writeTime(t, e.modify);
+	const unsigned int month = static_cast<unsigned int>((t[4] - '0') * 10 + (t[5] - '0'));
+	assert((month >= 1) && (month <= 12));
+	std::memcpy(dst, ListingConstants::monthNames + ((month - 1) * 3), 3);
+	dst += 3;
+	*dst++ = ' ';
+	*dst++ = ((t[6] == '0') ? ' ' : t[6]);
+	*dst++ = t[7];
+	*dst++ = ' ';
+	if ((e.modify >= recentBegin) && (e.modify < recentEnd)) {
+		*dst++ = t[8];
+		*dst++ = t[9];
+		*dst++ = ':';
+		*dst++ = t[10];
+		*dst++ = t[11];
+	}
+	else {
+		*dst++ = ' ';
+		std::memcpy(dst, t, 4);
+		dst += 4;
+	}
+	return ListingFormatUtil::writeName(dst, e.name, e.nameSz);
+}
+
+
+char* ListingFormatter::nlstEntry(char* dst, const DirScanner::Entry& e) {
+	std::memcpy(dst, e.name, e.nameSz);
+	dst += e.nameSz;
+	*dst++ = '\r';
+	*dst++ = '\n';
+	return dst;
+}
+
+
+// writes TIME_SZ digits, the UTC time-val of t
+// The last formatted time is cached, as is the date, since entries in a
+//   directory tend to have close modification times.
+char* ListingFormatter::writeTime(char* dst, std::time_t t) {
+	t = std::min(std::max(t, ListingConstants::minTime), ListingConstants::maxTime);
+	if (t != cachedTime) {
+		const std::int64_t t64 = static_cast<std::int64_t>(t);
+		const std::int64_t day = ListingFormatUtil::floorDiv(t64, ListingConstants::secondsPerDay);
+		if (day != cachedDay)
+			updateDay(day);
+		const unsigned int secOfDay = static_cast<unsigned int>(
+			t64 - (day * ListingConstants::secondsPerDay)
+		);
+		char* p = (timeStr.data() + 8);
+		p = ListingFormatUtil::write2(p, secOfDay / 3600);
+		p = ListingFormatUtil::write2(p, (secOfDay / 60) % 60);
+		ListingFormatUtil::write2(p, secOfDay % 60);
+		cachedTime = t;
+	}
+	std::memcpy(dst, timeStr.data(), TIME_SZ);
+	return (dst + TIME_SZ);
+}
+
+
+// writes val in decimal
+char* ListingFormatter::writeUInt(char* dst, std::uintmax_t val) {
+	char tmp[UINT_MAX_SZ];
+	char* p = (tmp + UINT_MAX_SZ);
+	// two digits at a time, from least significant
+	while (val >= 100) {
+		const unsigned int i = static_cast<unsigned int>(val % 100);
+		val /= 100;
+		p -= 2;
+		std::memcpy(p, ListingConstants::digitPairs + (i * 2), 2);
+	}
+	if (val >= 10) {
+		p -= 2;
+		std::memcpy(p, ListingConstants::digitPairs + (val * 2), 2);
+	}
+	else {
+		*--p = static_cast<char>('0' + val);
+	}
+	const std::size_t n = static_cast<std::size_t>((tmp + UINT_MAX_SZ) - p);
+	std::memcpy(dst, p, n);
+	return (dst + n);
+}
+
+
+// Sets the YYYYMMDD part of timeStr to the civil date of day (days since epoch).
+// http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+void ListingFormatter::updateDay(const std::int64_t day) {
+	const std::int64_t z = (day + 719468);
+	const std::int64_t era = ListingFormatUtil::floorDiv(z, 146097);
+	const unsigned int doe = static_cast<unsigned int>(z - era * 146097);	// [0, 146096]
+	const unsigned int yoe = ((doe - doe/1460 + doe/36524 - doe/146096) / 365);	// [0, 399]
+	const unsigned int doy = (doe - (365*yoe + yoe/4 - yoe/100));	// [0, 365]
+	const unsigned int mp = ((5*doy + 2) / 153);	// [0, 11]
+	const unsigned int d = (doy - (153*mp + 2)/5 + 1);	// [1, 31]
+	const unsigned int m = ((mp < 10) ? (mp + 3) : (mp - 9));	// [1, 12]
+	const unsigned int y = static_cast<unsigned int>(
+		static_cast<std::int64_t>(yoe) + era * 400 + ((m <= 2) ? 1 : 0)
+	);
+	assert((y >= 1000) && (y <= 9999));
+	char* p = timeStr.data();
+	p = ListingFormatUtil::write2(p, y / 100);
+	p = ListingFormatUtil::write2(p, y % 100);
+	p = ListingFormatUtil::write2(p, m);
+	ListingFormatUtil::write2(p, d);
+	cachedDay = day;
+	// invalidate cached time
+	cachedTime = ListingConstants::minTime - 1;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "dir_scanner.h"
+#include <array>
+#include <cstddef>	// size_t
+#include <cstdint>	// int64_t, uintmax_t
+#include <ctime>	// time_t
+
+
+// MLSD and MLST (https://tools.ietf.org/html/rfc3659), LIST ("ls -l" style)
+//   and NLST (names only)
+enum class ListingFormat {MLSD, LIST, NLST};
+
+
+// Formats listing entries directly into a caller-provided buffer, without
+//   allocating or using streams/locales.
+// The caller must make sure at least maxEntrySz(nameSz) bytes are available.
+// Every write method returns a pointer one past the last character written.
+// Not thread safe (times are cached), so each writer should own an instance.
+class ListingFormatter {
+public:
+	static constexpr std::size_t TIME_SZ = 14;	// YYYYMMDDHHMMSS
+	static constexpr std::size_t UINT_MAX_SZ = 20;	// digits of max uint64
+	// longest text before the name of any format
+	// MLSD: "type=file;size=<uint>;modify=<time>;"
+	// LIST: "-rw-r--r--    1 ftp      ftp      <uint> Mmm DD HH:MM"
+	static constexpr std::size_t MAX_PREFIX_SZ = (34 + UINT_MAX_SZ + 13);
+
+	ListingFormatter(const ListingFormat);
+	~ListingFormatter() = default;
+	static constexpr std::size_t maxEntrySz(const std::size_t);
+	static DirScanner::Detail getDetail(const ListingFormat);
+	char* entry(char*, const DirScanner::Entry&);
+	char* mlsdEntry(char*, const DirScanner::Entry&);
+	char* listEntry(char*, const DirScanner::Entry&);
+	static char* nlstEntry(char*, const DirScanner::Entry&);
+	char* writeTime(char*, std::time_t);
+	static char* writeUInt(char*, std::uintmax_t);
+private:
+	void updateDay(const std::int64_t);
+
+	std::array<char, TIME_SZ> timeStr;	// formatted cachedTime
+	std::int64_t cachedDay;		// days since epoch of timeStr's date
+	std::time_t cachedTime;
+	// LIST shows the time of day only for entries modified in [recentBegin, recentEnd)
+	std::time_t recentBegin;
+	std::time_t recentEnd;
+	ListingFormat format;
+};
+
+
+// entry = prefix SP pathname CRLF
+inline
+constexpr std::size_t ListingFormatter::maxEntrySz(const std::size_t nameSz) {
+	return (MAX_PREFIX_SZ + 1 + nameSz + 2);
+}
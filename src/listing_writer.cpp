@@ -0,0 +1,197 @@
+#include "listing_writer.h"
+#include "data_response.h"
+#include "path.h"
+#include "server.h"
+#include "session.h"
+#include "utility.h"
+#include <cassert>
+#include <utility>	// move
+#include <fcntl.h>	// fcntl
+#include <unistd.h>	// close
+
+
+// pathInfo is the type of p (name is not used)
+// dirHandle is a handle of p if it is a directory (see PathResolver), or -1.
+// The directory is not read here, since the constructor is run by the control
+//   thread, but by send(). dirHandle is only valid until the next call to the
+//   PathResolver, so a duplicate is kept until then.
+ListingWriter::ListingWriter(DataResponse& dr, const Path& p, const ListingFormat f,
+const DirScanner::Entry& pathInfo, const int dirHandle)
+: DataWriter{dr}, path{p}, info(pathInfo), fillToken(), formatter{f}, format{f}, sendBuf{nullptr},
+batchSz{0}, bufIndex{0}, cache{nullptr}, dirFd{-1}, goodFlag{true}, doneFlag{false} {
+	if (info.type != DirScanner::Type::DIRECTORY) {
+		assert(format != ListingFormat::MLSD);
+		// single entry, formatted by send()
+		name = path.fileName();
+		info.name = name.c_str();
+		info.nameSz = name.size();
+		return;
+	}
+	ListingCache* listingCache = Server::instance()->getListingCache();
+	if (listingCache) {
+		cached = listingCache->get(path, format);
+		if (cached)
+			return;
+		// miss, fill cache while listing
+		fillToken = listingCache->beginFill(path);
+		cache = listingCache;
+	}
+	if (dirHandle >= 0)
+		dirFd = ::fcntl(dirHandle, F_DUPFD_CLOEXEC, 0);	// or opened by path if -1
+}
+
+
+ListingWriter::~ListingWriter() {
+	if (dirFd >= 0)
+		::close(dirFd);
+}
+
+
+void ListingWriter::send() {
+	assert(goodFlag);
+	if (cached) {
+		sendBuf = cached->data();
+		batchSz = cached->size();
+		doneFlag = (batchSz == 0);
+	}
+	else if (info.type != DirScanner::Type::DIRECTORY) {
+		fillSingle();
+	}
+	else {
+		scanner.reset(new DirScanner{
+			path, ListingFormatter::getDetail(format), Server::instance()->getScanPool(), dirFd
+		});
+		if (dirFd >= 0) {
+			::close(dirFd);
+			dirFd = -1;
+		}
+		goodFlag = scanner->good();
+		if (goodFlag) {
+			batchBuf.reset(new char[Constants::LIST_BUF_SZ]);
+			sendBuf = batchBuf.get();
+			fillBatch();
+		}
+	}
+	if (batchSz == 0) {
+		// Empty directory (or error on first entry, or file of unsupported type,
+		//   or unable to open directory), so there is nothing to write.
+		// Still required to initiate a call to writeCallback.
+		std::shared_ptr<DataResponse> dataRespPtr = dataResp.getPtr();
+		Server::instance()->getService().post(
+			[this, dataRespPtr]() {
+				doWriteCallback(boost::system::error_code{}, 0);
+			}
+		);
+		return;
+	}
+	writeSome();
+}
+
+
+bool ListingWriter::good() const {
+	return goodFlag;
+}
+
+
+void ListingWriter::writeSome() {
+	dataResp.session.getDTPStream().writeSome(
+		boost::asio::buffer(
+			sendBuf + bufIndex,
+			batchSz - bufIndex
+		),
+		[this](const boost::system::error_code& ec, std::size_t nBytes) {
+			asioCallback(ec, nBytes);
+		}
+	);
+}
+
+
+bool ListingWriter::done() const {
+	return doneFlag;
+}
+
+
+void ListingWriter::finish(const AsioData& asioData) {
+	// After listing is successfully sent over data connection, we close data connection
+	//   and send 226 response over command connection.
+	// This is done in PI, so we do nothing in this method.
+	DataWriter::finish(asioData);
+}
+
+
+// listing of a file, sent as a single batch
+void ListingWriter::fillSingle() {
+	batchBuf.reset(new char[ListingFormatter::maxEntrySz(info.nameSz)]);
+	sendBuf = batchBuf.get();
+	bufIndex = 0;
+	batchSz = static_cast<std::size_t>(formatter.entry(batchBuf.get(), info) - batchBuf.get());
+	doneFlag = true;
+}
+
+
+// Format as many entries as will fit into batchBuf.
+// batchSz will be 0 if there are no more entries, in which case scanFinished()
+//   has been called.
+void ListingWriter::fillBatch() {
+	char* const bufBegin = batchBuf.get();
+	char* bufEnd = bufBegin;
+	bufIndex = 0;
+	for (const DirScanner::Entry* entry; (entry = scanner->current()) != nullptr; scanner->advance()) {
+		const std::size_t maxSz = ListingFormatter::maxEntrySz(entry->nameSz);
+		if (static_cast<std::size_t>(bufEnd - bufBegin) + maxSz > Constants::LIST_BUF_SZ)
+			break;	// send current batch first
+		bufEnd = formatter.entry(bufEnd, *entry);
+		if (cache && (format != ListingFormat::NLST) && (entry->type == DirScanner::Type::REGULAR)) {
+			fileInfos.emplace_back(
+				std::string{entry->name, entry->nameSz},
+				ListingCache::FileInfo{entry->size, entry->modify}
+			);
+		}
+	}
+	if (!scanner->good()) {
+		// unable to continue listing
+		goodFlag = false;
+	}
+	batchSz = static_cast<std::size_t>(bufEnd - bufBegin);
+	if (cache) {
+		if (!fileInfos.empty()) {
+			// for SIZE and MDTM
+			cache->putFileInfo(path, fillToken, std::move(fileInfos));
+			fileInfos.clear();
+		}
+		if ((fillData.size() + batchSz) > cache->getMaxEntrySize()) {
+			// too large to cache
+			cache = nullptr;
+			std::string{}.swap(fillData);
+		}
+		else {
+			fillData.append(bufBegin, batchSz);
+		}
+	}
+	if (batchSz == 0)
+		scanFinished();
+}
+
+
+void ListingWriter::scanFinished() {
+	doneFlag = goodFlag;
+	if (cache && goodFlag)
+		cache->finishFill(path, format, fillToken, std::move(fillData));
+	cache = nullptr;
+}
+
+
+void ListingWriter::asioCallback(const boost::system::error_code& ec, std::size_t nBytes) {
+	bytesSent += nBytes;
+	bufIndex += nBytes;
+	if ((ec.value() == 0) && (bufIndex == batchSz)) {
+		if (cached || !scanner) {
+			doneFlag = true;
+		}
+		else {
+			// current batch sent, generate the next one
+			fillBatch();
+		}
+	}
+	doWriteCallback(ec, nBytes);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "data_writer.h"
+#include "dir_scanner.h"
+#include "listing_cache.h"
+#include "listing_format.h"
+#include "path.h"
+#include <memory>
+#include <string>
+
+
+// MLSD, LIST, and NLST commands
+// If the listed path is not a directory (LIST and NLST only), the listing is
+//   the single entry of that file.
+// The directory is opened and iterated lazily by send() (on a data thread). Entries are formatted in batches into a
+//   listing buffer, and each batch is sent before the next one is generated,
+//   so memory use does not depend on the size of the directory.
+// If the server has a ListingCache, a cached listing is sent as is, and on a
+//   miss the rendered batches are collected and added to the cache once done,
+//   and the metadata of listed files is added as it is read.
+class ListingWriter : public DataWriter {
+public:
+	ListingWriter(DataResponse&, const Path&, const ListingFormat, const DirScanner::Entry&,
+		const int = -1);
+	~ListingWriter();
+	void send(void) override;
+	bool good(void) const override;
+	void writeSome(void) override;
+	bool done(void) const override;
+	void finish(const AsioData&) override;
+private:
+	void fillSingle(void);
+	void fillBatch(void);
+	void scanFinished(void);
+	void asioCallback(const boost::system::error_code&, std::size_t);
+
+	Path path;
+	DirScanner::Entry info;		// of path
+	std::string name;	// of path, for single entry listing
+	ListingCache::DataPtr cached;	// set on cache hit
+	ListingCache::FillToken fillToken;
+	std::string fillData;	// listing collected for cache
+	ListingCache::FileInfoBatch fileInfos;	// of the current batch
+	std::unique_ptr<DirScanner> scanner;
+	ListingFormatter formatter;
+	ListingFormat format;
+	std::unique_ptr<char[]> batchBuf;
+	const char* sendBuf;	// batchBuf or cached listing
+	std::size_t batchSz;	// number of valid bytes in sendBuf
+	std::size_t bufIndex;	// index into sendBuf
+	ListingCache* cache;	// nullptr if not filling cache
+	int dirFd;	// duplicate of directory handle until send(), or -1
+	bool goodFlag;
+	bool doneFlag;
+};
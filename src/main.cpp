@@ -6,6 +6,7 @@
 #include <exception>
 #include <iostream>
 #include <limits>
+#include <stdexcept>
 #include <string>
 #include <boost/program_options.hpp>
 
@@ -57,6 +58,32 @@ static bool procArgs(const int argc, char** argv) {
 }
 
 
+// throws invalid_argument
+static void setTransferRates(const ConfigData& config) {
+	typedef TrafficShaper::Level Level;
+	typedef TrafficShaper::Direction Direction;
+	Server& server = *Server::instance();
+	server.setTransferRate(Level::GLOBAL, Direction::UP, config.getGlobalRateUp());
+	server.setTransferRate(Level::GLOBAL, Direction::DOWN, config.getGlobalRateDown());
+	server.setTransferRate(Level::USER, Direction::UP, config.getUserRateUp());
+	server.setTransferRate(Level::USER, Direction::DOWN, config.getUserRateDown());
+	server.setTransferRate(Level::SESSION, Direction::UP, config.getSessionRateUp());
+	server.setTransferRate(Level::SESSION, Direction::DOWN, config.getSessionRateDown());
+}
+
+
+// Rereads the settings that may be changed while running (on SIGHUP).
+static void reloadConfig() {
+	try {
+		setTransferRates(ConfigData::read(Constants::configName));
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Unable to reload config." << std::endl
+		          << "Reason: " << e.what() << std::endl;
+	}
+}
+
+
 static void initServer() {
 	ConfigData config = ConfigData::read(Constants::configName);
 	std::vector<User> users;
@@ -67,14 +94,35 @@ static void initServer() {
 		tmpUser.name = user.name;
 		tmpUser.salt = user.passSalt;
 		tmpUser.home = Path{user.homeDir};
+		if (user.weight < 1)
+			throw std::invalid_argument{std::string{"invalid weight of user: "} + user.name};
+		tmpUser.weight = static_cast<unsigned>(user.weight);
 		users.push_back(tmpUser);
 	}
 	Server::instance().reset(new Server{
 		config.getPort(),
 		config.getNumThreads(),
+		config.getControlThreads(),
 		config.getWelcomeMessage()
 	});
 	Server::instance()->setUsers(users);
+	Server::instance()->setAuthThreads(config.getAuthThreads());
+	Server::instance()->setScanThreads(config.getScanThreads());
+	Server::instance()->setChecksumThreads(config.getChecksumThreads());
+	Server::instance()->setWriterThreads(config.getWriterThreads());
+	Server::instance()->setWriteBehind(config.getWriteBuffers(), config.getStorSync());
+	Server::instance()->setPreallocSize(config.getPreallocSize());
+	Server::instance()->setAtomicUploads(config.getAtomicUploads());
+	Server::instance()->setListingCacheSize(config.getListingCacheSize());
+	Server::instance()->setTransferQuantum(config.getTransferQuantum());
+	Server::instance()->setSocketOptions(config.getSocketOptions());
+	Server::instance()->setTls(config.getTlsCertificate(), config.getTlsPrivateKey(), config.getTlsKernel(),
+		config.getTlsRequired());
+	Server::instance()->setTlsSessionCache(config.getTlsSessionCacheSize(), config.getTlsSessionTimeout(),
+		config.getTlsTickets());
+	Server::instance()->setMetricsFile(config.getMetricsFile(), config.getMetricsInterval());
+	setTransferRates(config);
+	Server::instance()->setReloadHandler(reloadConfig);
 }
 
 
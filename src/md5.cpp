@@ -1,11 +1,28 @@
-// Assumes little-endian (for now)
 #include "md5.h"
-#include <algorithm>	// find
+#include <algorithm>	// find, min
 #include <cassert>
 #include <cmath>
+#include <cstring>	// memcpy
 #include <stdexcept>	// invalid_argument
 
 
+// The rounds are written once for any Word type, and instantiated with GCC
+//   vector extensions (one message per lane) for MD5::updateMulti().
+#ifdef __GNUC__
+#define MD5_INLINE static inline __attribute__((always_inline))
+#define MD5_UNROLL _Pragma("GCC unroll 16")
+#define MD5_VECTOR
+#if defined(__x86_64__) || defined(__i386__)
+#define MD5_AVX2
+// the vector round functions are always inlined, so their ABI does not matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+#else
+#define MD5_INLINE static inline
+#define MD5_UNROLL
+#endif
+
+
 namespace MD5Constants {
 	constexpr std::array<std::uint32_t, 64> T = {
 		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
@@ -125,206 +142,320 @@ void copyToByteArray(T& array, const std::size_t i, std::uint32_t value) {
 }
 
 
-// sz is message size in bits before padding
-static void padMessageSz(std::vector<std::uint8_t>& message, std::uint64_t sz) {
-	const std::uint64_t mask = static_cast<std::uint64_t>(UINT8_MAX);
-	for (int i = 0; i < 7; ++i) {
-		message.push_back(static_cast<std::uint8_t>(sz & mask));
-		sz >>= 8;
-	}
-	message.push_back(static_cast<std::uint8_t>(sz));
-	assert(message.size() % 64 == 0);
-}
-
+namespace MD5Util {
 
-static void padMessage(std::vector<std::uint8_t>& message) {
-	std::uint64_t messageSz = (static_cast<std::uint64_t>(message.size()) * 8);
-	std::size_t padAmount = ((message.size() % 64) % 56);
-	if (padAmount != 0) {
-		padAmount = (56 - padAmount);
-	}
-	else {
-		padAmount = 56;
-	}
-	message.reserve(message.size() + padAmount + 8);
-	message.push_back(1 << 7);
-	for (std::size_t i = 1; i < padAmount; ++i)
-		message.push_back(0);
-	assert(message.size() % 56 == 0);
-	padMessageSz(message, messageSz);
-}
+typedef std::array<std::uint32_t, 4> State;	// A, B, C, D
 
 
-static std::uint32_t getUint32(const std::vector<std::uint8_t>& message, const std::size_t i) {
+static std::uint32_t getUint32(const std::uint8_t* p) {
 	return (
-		static_cast<std::uint32_t>(message[i])
-		| (static_cast<std::uint32_t>(message[i+1]) << 8)
-		| (static_cast<std::uint32_t>(message[i+2]) << 16)
-		| (static_cast<std::uint32_t>(message[i+3]) << 24)
+		static_cast<std::uint32_t>(p[0])
+		| (static_cast<std::uint32_t>(p[1]) << 8)
+		| (static_cast<std::uint32_t>(p[2]) << 16)
+		| (static_cast<std::uint32_t>(p[3]) << 24)
 	);
 }
 
 
-static constexpr std::uint32_t rotateLeft(const std::uint32_t val, const std::uint32_t n) {
-	return ((val << n) | (val >> (32 - n)));
-}
-
-
-static constexpr std::uint32_t F(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+// The round functions are templates so the same code runs on a single
+//   uint32_t or on a SIMD vector of them (one message per lane).
+// They must be inlined into the (possibly AVX2) function using them.
+template<class Word>
+MD5_INLINE Word F(const Word& X, const Word& Y, const Word& Z) {
 	return ((X & Y) | ((~X) & Z));
 }
 
 
-static constexpr std::uint32_t G(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+template<class Word>
+MD5_INLINE Word G(const Word& X, const Word& Y, const Word& Z) {
 	return ((X & Z) | (Y & (~Z)));
 }
 
 
-static constexpr std::uint32_t H(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+template<class Word>
+MD5_INLINE Word H(const Word& X, const Word& Y, const Word& Z) {
 	return (X ^ Y ^ Z);
 }
 
 
-static constexpr std::uint32_t I(const std::uint32_t X, const std::uint32_t Y, const std::uint32_t Z) {
+template<class Word>
+MD5_INLINE Word I(const Word& X, const Word& Y, const Word& Z) {
 	return (Y ^ (X | (~Z)));
 }
 
 
-template<class Func>
-static void R(Func f, std::uint32_t& A, const std::uint32_t B, const std::uint32_t C, const std::uint32_t D,
-const std::uint32_t X, const std::uint32_t S, const std::uint32_t T) {
-	A = (B + rotateLeft(A + f(B, C, D) + X + T, S));
+// a = b + ((a + f + x + t) <<< s)
+template<class Word>
+MD5_INLINE Word step(const Word& a, const Word& b, const Word& f, const Word& x,
+const std::uint32_t t, const std::uint32_t s) {
+	const Word sum = (a + f + x + t);
+	return (b + ((sum << s) | (sum >> (32 - s))));
+}
+
+
+// Processes one block of each lane.
+// Each step computes a new A, and the registers are rotated (A, B, C, D) to
+//   (D, A', B, C) instead of permuting the arguments as in RFC 1321.
+template<class Word>
+MD5_INLINE void transform(std::array<Word, 4>& state, const std::array<Word, 16>& X) {
+	Word A = state[0];
+	Word B = state[1];
+	Word C = state[2];
+	Word D = state[3];
+	Word f;
+	Word tmp;
+	MD5_UNROLL
+	for (std::size_t j = 0; j < 16; ++j) {
+		f = F(B, C, D);
+		tmp = D;
+		D = C;
+		C = B;
+		B = step(A, B, f, X[j], MD5Constants::T[j], MD5Constants::R1_s[j % 4]);
+		A = tmp;
+	}
+	MD5_UNROLL
+	for (std::size_t j = 0; j < 16; ++j) {
+		f = G(B, C, D);
+		tmp = D;
+		D = C;
+		C = B;
+		B = step(A, B, f, X[MD5Constants::R2_k[j]], MD5Constants::T[16 + j],
+			MD5Constants::R2_s[j % 4]);
+		A = tmp;
+	}
+	MD5_UNROLL
+	for (std::size_t j = 0; j < 16; ++j) {
+		f = H(B, C, D);
+		tmp = D;
+		D = C;
+		C = B;
+		B = step(A, B, f, X[MD5Constants::R3_k[j]], MD5Constants::T[32 + j],
+			MD5Constants::R3_s[j % 4]);
+		A = tmp;
+	}
+	MD5_UNROLL
+	for (std::size_t j = 0; j < 16; ++j) {
+		f = I(B, C, D);
+		tmp = D;
+		D = C;
+		C = B;
+		B = step(A, B, f, X[MD5Constants::R4_k[j]], MD5Constants::T[48 + j],
+			MD5Constants::R4_s[j % 4]);
+		A = tmp;
+	}
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
 }
 
 
-MD5Digest MD5::getDigest(const std::vector<std::uint8_t>& message) {
-	assert(testTArray(MD5Constants::T));
+static void transformBlocks(State& state, const std::uint8_t* data,
+const std::size_t numBlocks) {
 	std::array<std::uint32_t, 16> X;
-	std::uint32_t A = 0x67452301;
-	std::uint32_t B = 0xefcdab89;
-	std::uint32_t C = 0x98badcfe;
-	std::uint32_t D = 0x10325476;
-	std::vector<std::uint8_t> input = message;
-	padMessage(input);
-	const std::size_t numBlocks = (input.size() / 64);
-	for (std::size_t i = 0; i < numBlocks; ++i) {
-		const std::uint32_t AA = A;
-		const std::uint32_t BB = B;
-		const std::uint32_t CC = C;
-		const std::uint32_t DD = D;
+	for (std::size_t i = 0; i < numBlocks; ++i, data += 64) {
+		for (std::size_t j = 0; j < 16; ++j)
+			X[j] = getUint32(data + j*4);
+		transform(state, X);
+	}
+}
+
+
+#ifdef MD5_VECTOR
+typedef std::uint32_t Vec4 __attribute__((vector_size(16)));
+typedef std::uint32_t Vec8 __attribute__((vector_size(32)));
+
+
+// Processes numBlocks blocks of each of Lanes messages.
+template<class Vec, std::size_t Lanes>
+MD5_INLINE void transformLanes(State* const* states, const std::uint8_t* const* data,
+const std::size_t numBlocks) {
+	std::array<Vec, 4> state;
+	std::array<Vec, 16> X;
+	for (std::size_t i = 0; i < 4; ++i) {
+		for (std::size_t lane = 0; lane < Lanes; ++lane)
+			state[i][lane] = (*states[lane])[i];
+	}
+	for (std::size_t b = 0; b < numBlocks; ++b) {
 		for (std::size_t j = 0; j < 16; ++j) {
-			X[j] = getUint32(input, i*64 + j*4);
-		}
-		// Round 1
-		std::size_t j;
-		for (j = 0; j < 16; ++j) {
-			const std::size_t k = (j % 4);
-			const std::uint32_t X_val = X[j];
-			const std::uint32_t S_val = MD5Constants::R1_s[k];
-			const std::uint32_t T_val = MD5Constants::T[j];
-			switch (k) {
-			case 0:
-				R(F, A, B, C, D, X_val, S_val, T_val);
-				break;
-			case 1:
-				R(F, D, A, B, C, X_val, S_val, T_val);
-				break;
-			case 2:
-				R(F, C, D, A, B, X_val, S_val, T_val);
-				break;
-			case 3:
-				R(F, B, C, D, A, X_val, S_val, T_val);
-				break;
-			default:
-				assert(false);
-				break;
-			}
+			for (std::size_t lane = 0; lane < Lanes; ++lane)
+				X[j][lane] = getUint32(data[lane] + b*64 + j*4);
 		}
-		// Round 2
-		for (; j < 32; ++j) {
-			const std::size_t k = (j % 4);
-			const std::uint32_t X_val = X[MD5Constants::R2_k[j-16]];
-			const std::uint32_t S_val = MD5Constants::R2_s[k];
-			const std::uint32_t T_val = MD5Constants::T[j];
-			switch (k) {
-			case 0:
-				R(G, A, B, C, D, X_val, S_val, T_val);
-				break;
-			case 1:
-				R(G, D, A, B, C, X_val, S_val, T_val);
-				break;
-			case 2:
-				R(G, C, D, A, B, X_val, S_val, T_val);
-				break;
-			case 3:
-				R(G, B, C, D, A, X_val, S_val, T_val);
-				break;
-			default:
-				assert(false);
-				break;
+		transform(state, X);
+	}
+	for (std::size_t i = 0; i < 4; ++i) {
+		for (std::size_t lane = 0; lane < Lanes; ++lane)
+			(*states[lane])[i] = state[i][lane];
+	}
+}
+
+
+static void transform4(State* const* states, const std::uint8_t* const* data,
+const std::size_t numBlocks) {
+	transformLanes<Vec4, 4>(states, data, numBlocks);
+}
+
+
+#ifdef MD5_AVX2
+__attribute__((target("avx2")))
+static void transform8(State* const* states, const std::uint8_t* const* data,
+const std::size_t numBlocks) {
+	transformLanes<Vec8, 8>(states, data, numBlocks);
+}
+#endif
+#endif	// MD5_VECTOR
+
+
+#ifndef NDEBUG
+// checked once, since init() is called for every message
+static bool validT() {
+	static const bool valid = testTArray(MD5Constants::T);
+	return valid;
+}
+#endif
+
+
+static std::size_t detectLanes() {
+#ifdef MD5_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return 8;
+#endif
+#ifdef MD5_VECTOR
+	return 4;
+#else
+	return 1;
+#endif
+}
+
+}	// namespace MD5Util
+
+
+void MD5Context::init() {
+	assert(MD5Util::validT());
+	state = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	messageSz = 0;
+}
+
+
+void MD5Context::update(const void* data, std::size_t sz) {
+	const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+	std::size_t used = static_cast<std::size_t>(messageSz % 64);
+	messageSz += sz;
+	if (used != 0) {
+		// complete the buffered block
+		const std::size_t n = std::min(sz, 64 - used);
+		std::memcpy(buffer.data() + used, p, n);
+		p += n;
+		sz -= n;
+		used += n;
+		if (used < 64)
+			return;
+		MD5Util::transformBlocks(state, buffer.data(), 1);
+	}
+	const std::size_t numBlocks = (sz / 64);
+	MD5Util::transformBlocks(state, p, numBlocks);
+	p += (numBlocks * 64);
+	sz -= (numBlocks * 64);
+	std::memcpy(buffer.data(), p, sz);
+}
+
+
+MD5Digest MD5Context::final() {
+	// pad with a 1 bit, then 0 bits to 56 mod 64 bytes, then the size in bits
+	constexpr std::array<std::uint8_t, 64> padding = {0x80};
+	const std::uint64_t sizeBits = (messageSz * 8);
+	const std::size_t used = static_cast<std::size_t>(messageSz % 64);
+	update(padding.data(), ((used < 56) ? (56 - used) : (120 - used)));
+	std::array<std::uint8_t, 8> sizeBytes;
+	for (std::size_t i = 0; i < 8; ++i)
+		sizeBytes[i] = static_cast<std::uint8_t>(sizeBits >> (i * 8));
+	update(sizeBytes.data(), sizeBytes.size());
+	assert(messageSz % 64 == 0);
+	MD5Digest::ArrayType digest;
+	copyToByteArray(digest, 0, state[0]);
+	copyToByteArray(digest, 4, state[1]);
+	copyToByteArray(digest, 8, state[2]);
+	copyToByteArray(digest, 12, state[3]);
+	return MD5Digest(digest);
+}
+
+
+MD5Digest MD5::getDigest(const void* data, const std::size_t sz) {
+	MD5Context ctx;
+	ctx.update(data, sz);
+	return ctx.final();
+}
+
+
+// number of messages updateMulti() hashes at once
+std::size_t MD5::getLanes() {
+	static const std::size_t lanes = MD5Util::detectLanes();
+	return lanes;
+}
+
+
+// Same as ctxs[i]->update(data[i], sizes[i]) for i in [0, n).
+// The whole blocks common to a group of getLanes() messages are hashed in
+//   parallel, so this is fastest when sizes are equal (e.g. a buffer of each of
+//   several transfers) and each context has hashed a multiple of 64 bytes.
+void MD5::updateMulti(MD5Context* const* ctxs, const void* const* data, const std::size_t* sizes,
+const std::size_t n) {
+	const std::size_t lanes = getLanes();
+	std::array<const std::uint8_t*, MAX_LANES> ptrs;
+	std::array<std::size_t, MAX_LANES> remaining;
+	for (std::size_t first = 0; first < n; first += lanes) {
+		const std::size_t count = std::min(lanes, n - first);
+		std::size_t numBlocks = SIZE_MAX;
+		for (std::size_t lane = 0; lane < count; ++lane) {
+			MD5Context& ctx = *ctxs[first + lane];
+			ptrs[lane] = static_cast<const std::uint8_t*>(data[first + lane]);
+			remaining[lane] = sizes[first + lane];
+			const std::size_t used = static_cast<std::size_t>(ctx.messageSz % 64);
+			if (used != 0) {
+				// complete the buffered block first
+				const std::size_t sz = std::min(remaining[lane], 64 - used);
+				ctx.update(ptrs[lane], sz);
+				ptrs[lane] += sz;
+				remaining[lane] -= sz;
 			}
+			if ((ctx.messageSz % 64) != 0)
+				numBlocks = 0;	// all remaining data was buffered
+			else
+				numBlocks = std::min(numBlocks, (remaining[lane] / 64));
 		}
-		// Round 3
-		for (; j < 48; ++j) {
-			const std::size_t k = (j % 4);
-			const std::uint32_t X_val = X[MD5Constants::R3_k[j-32]];
-			const std::uint32_t S_val = MD5Constants::R3_s[k];
-			const std::uint32_t T_val = MD5Constants::T[j];
-			switch (k) {
-			case 0:
-				R(H, A, B, C, D, X_val, S_val, T_val);
-				break;
-			case 1:
-				R(H, D, A, B, C, X_val, S_val, T_val);
-				break;
-			case 2:
-				R(H, C, D, A, B, X_val, S_val, T_val);
-				break;
-			case 3:
-				R(H, B, C, D, A, X_val, S_val, T_val);
-				break;
-			default:
-				assert(false);
-				break;
+#ifdef MD5_VECTOR
+		if ((count > 1) && (numBlocks > 0)) {
+			// unused lanes repeat the first message, and their result is discarded
+			std::array<MD5Util::State*, MAX_LANES> states;
+			std::array<MD5Util::State, MAX_LANES> unused;
+			for (std::size_t lane = 0; lane < lanes; ++lane) {
+				if (lane < count) {
+					states[lane] = &ctxs[first + lane]->state;
+				}
+				else {
+					unused[lane] = ctxs[first]->state;
+					states[lane] = &unused[lane];
+					ptrs[lane] = ptrs[0];
+				}
 			}
-		}
-		// Round 4
-		for (; j < 64; ++j) {
-			const std::size_t k = (j % 4);
-			const std::uint32_t X_val = X[MD5Constants::R4_k[j-48]];
-			const std::uint32_t S_val = MD5Constants::R4_s[k];
-			const std::uint32_t T_val = MD5Constants::T[j];
-			switch (k) {
-			case 0:
-				R(I, A, B, C, D, X_val, S_val, T_val);
-				break;
-			case 1:
-				R(I, D, A, B, C, X_val, S_val, T_val);
-				break;
-			case 2:
-				R(I, C, D, A, B, X_val, S_val, T_val);
-				break;
-			case 3:
-				R(I, B, C, D, A, X_val, S_val, T_val);
-				break;
-			default:
-				assert(false);
-				break;
+#ifdef MD5_AVX2
+			if (lanes == 8)
+				MD5Util::transform8(states.data(), ptrs.data(), numBlocks);
+			else
+				MD5Util::transform4(states.data(), ptrs.data(), numBlocks);
+#else
+			MD5Util::transform4(states.data(), ptrs.data(), numBlocks);
+#endif
+			for (std::size_t lane = 0; lane < count; ++lane) {
+				ctxs[first + lane]->messageSz += (numBlocks * 64);
+				ptrs[lane] += (numBlocks * 64);
+				remaining[lane] -= (numBlocks * 64);
 			}
 		}
-		// Increment registers
-		A += AA;
-		B += BB;
-		C += CC;
-		D += DD;
+#endif
+		for (std::size_t lane = 0; lane < count; ++lane)
+			ctxs[first + lane]->update(ptrs[lane], remaining[lane]);
 	}
-	// Copy digest
-	MD5Digest::ArrayType digest;
-	copyToByteArray(digest, 0, A);
-	copyToByteArray(digest, 4, B);
-	copyToByteArray(digest, 8, C);
-	copyToByteArray(digest, 12, D);
-	return MD5Digest(digest);
 }
 
 
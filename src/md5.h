@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cstddef>	// size_t
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -23,11 +24,45 @@ private:
 };
 
 
+// Incremental MD5, for hashing a message as it is read or written.
+// Usage:
+//   MD5Context ctx;
+//   ctx.update(data, sz);	// any number of times
+//   MD5Digest digest = ctx.final();
+// Nothing is allocated. A context must be init()'ed again after final().
+class MD5Context {
+public:
+	MD5Context();
+	MD5Context(const MD5Context&) = default;
+	~MD5Context() = default;
+	void init(void);
+	void update(const void*, std::size_t);
+	MD5Digest final(void);
+	std::uint64_t size(void) const;
+	MD5Context& operator=(const MD5Context&) = default;
+private:
+	friend class MD5;
+
+	std::array<std::uint32_t, 4> state;		// A, B, C, D
+	std::array<std::uint8_t, 64> buffer;	// partial block
+	std::uint64_t messageSz;	// bytes
+};
+
+
 // https://tools.ietf.org/html/rfc1321
+// updateMulti() hashes independent messages in parallel, one per SIMD lane
+//   (8 lanes with AVX2, 4 with SSE2/NEON), since the MD5 rounds of a single
+//   message are strictly sequential.
 class MD5 {
 public:
+	static constexpr std::size_t MAX_LANES = 8;
+
+	static MD5Digest getDigest(const void*, const std::size_t);
 	static MD5Digest getDigest(const std::string&);
 	static MD5Digest getDigest(const std::vector<std::uint8_t>&);
+	static std::size_t getLanes(void);
+	static void updateMulti(MD5Context* const*, const void* const*, const std::size_t*,
+		const std::size_t);
 	static std::vector<std::uint8_t> strToByteArray(const std::string&);
 };
 
@@ -43,13 +78,37 @@ MD5Digest::MD5Digest(const ArrayType& d) : digest(d) {
 }
 
 
+// Takes the same time wherever the digests differ, since a digest may be a
+//   password hash.
 inline
 bool MD5Digest::operator==(const MD5Digest& o) const {
-	return (digest == o.digest);
+	std::uint8_t diff = 0;
+	for (std::size_t i = 0; i < digest.size(); ++i)
+		diff |= static_cast<std::uint8_t>(digest[i] ^ o.digest[i]);
+	return (diff == 0);
+}
+
+
+inline
+MD5Context::MD5Context() {
+	init();
+}
+
+
+// number of bytes hashed so far
+inline
+std::uint64_t MD5Context::size() const {
+	return messageSz;
 }
 
 
 inline
 MD5Digest MD5::getDigest(const std::string& str) {
-	return getDigest(strToByteArray(str));
+	return getDigest(str.data(), str.size());
+}
+
+
+inline
+MD5Digest MD5::getDigest(const std::vector<std::uint8_t>& message) {
+	return getDigest(message.data(), message.size());
 }
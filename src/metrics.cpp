@@ -0,0 +1,394 @@
+#include "metrics.h"
+#include "listing_cache.h"
+#include "tls_context.h"
+#include "utility.h"
+#include <algorithm>	// find_if, max
+#include <cmath>		// ceil
+#include <cstdio>		// rename
+#include <fstream>
+#include <stdexcept>
+
+
+namespace MetricsConstants {
+	constexpr std::uint64_t MAX_MICROS = ((std::uint64_t{1} << Metrics::MAX_MICROS_BITS) - 1);
+	// le of Prometheus buckets: 2^k us
+	constexpr std::size_t MIN_EXPORT_BITS = 4;
+	constexpr double MICROS_PER_SECOND = 1e6;
+	constexpr char counterNames[Metrics::NUM_COUNTERS][16] = {
+		"sessions", "accept errors", "logins", "login failures"
+	};
+	constexpr char directionNames[2][16] = {"upload", "download"};		// by TrafficShaper::Direction
+	constexpr char channelNames[2][16] = {"control", "data"};		// by TlsContext::Channel
+}
+
+
+namespace MetricsUtil {
+
+static std::atomic<std::uint64_t> nextId{1};
+
+
+static std::string seconds(const std::uint64_t micros) {
+	return std::to_string(static_cast<double>(micros) / MetricsConstants::MICROS_PER_SECOND);
+}
+
+
+// "count, errors, us p50 a, p99 b, max c"
+static std::string summary(const Metrics::Histogram& h) {
+	return (
+		std::to_string(h.count) + ", us p50 " + std::to_string(h.percentile(0.5))
+		+ ", p99 " + std::to_string(h.percentile(0.99)) + ", max " + std::to_string(h.max())
+	);
+}
+
+
+static void appendType(std::string& out, const char* name, const char* type, const char* help) {
+	out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+
+// labels: "name=\"value\"", may be empty
+static void appendSample(std::string& out, const char* name, const std::string& labels,
+const std::string& value) {
+	out.append(name);
+	if (!labels.empty())
+		out.append("{").append(labels).append("}");
+	out.append(" ").append(value).append("\n");
+}
+
+
+static void appendHistogram(std::string& out, const char* name, const std::string& labels,
+const Metrics::Histogram& h) {
+	const std::string bucket = (std::string{name} + "_bucket");
+	const std::string prefix = (labels + (labels.empty() ? "" : ",") + "le=\"");
+	for (std::size_t bits = MetricsConstants::MIN_EXPORT_BITS; bits <= Metrics::MAX_MICROS_BITS; ++bits) {
+		const std::uint64_t bound = (std::uint64_t{1} << bits);
+		appendSample(out, bucket.c_str(), prefix + seconds(bound) + "\"", std::to_string(h.countBelow(bound)));
+	}
+	appendSample(out, bucket.c_str(), prefix + "+Inf\"", std::to_string(h.count));
+	appendSample(out, (std::string{name} + "_sum").c_str(), labels, seconds(h.sumMicros));
+	appendSample(out, (std::string{name} + "_count").c_str(), labels, std::to_string(h.count));
+}
+
+}	// namespace MetricsUtil
+
+
+// Highest value of the bucket of the percentile p (in [0, 1]) of the values,
+//   0 if none.
+std::uint64_t Metrics::Histogram::percentile(const double p) const {
+	if (count == 0)
+		return 0;
+	const std::uint64_t rank = std::max<std::uint64_t>(
+		static_cast<std::uint64_t>(std::ceil(p * static_cast<double>(count))), 1
+	);
+	std::uint64_t seen = 0;
+	for (std::size_t i = 0; i < NUM_BUCKETS; ++i) {
+		seen += buckets[i];
+		if (seen >= rank)
+			return ((i + 1 < NUM_BUCKETS) ? (getLowerBound(i + 1) - 1) : MetricsConstants::MAX_MICROS);
+	}
+	return MetricsConstants::MAX_MICROS;
+}
+
+
+// Number of values less than bound, which must be the lower bound of a
+//   bucket (as any power of 2 is), or greater than all.
+std::uint64_t Metrics::Histogram::countBelow(const std::uint64_t bound) const {
+	if (bound > MetricsConstants::MAX_MICROS)
+		return count;
+	std::uint64_t n = 0;
+	const std::size_t end = getBucket(bound);
+	for (std::size_t i = 0; i < end; ++i)
+		n += buckets[i];
+	return n;
+}
+
+
+// Highest value of the highest bucket with a value, 0 if none.
+std::uint64_t Metrics::Histogram::max() const {
+	for (std::size_t i = NUM_BUCKETS; i > 0; --i) {
+		if (buckets[i - 1] != 0)
+			return ((i < NUM_BUCKETS) ? (getLowerBound(i) - 1) : MetricsConstants::MAX_MICROS);
+	}
+	return 0;
+}
+
+
+// Values below 2 * SUB_BUCKETS have a bucket each. Above, each power of 2 is
+//   split into SUB_BUCKETS buckets by the bits following the highest.
+// Values above MAX_MICROS are in the last bucket.
+std::size_t Metrics::Histogram::getBucket(const std::uint64_t value) {
+	const std::uint64_t v = std::min(value, MetricsConstants::MAX_MICROS);
+	if (v < (2 * SUB_BUCKETS))
+		return static_cast<std::size_t>(v);
+	std::size_t bits = (SUB_BUCKET_BITS + 1);	// of the highest bit
+	while ((v >> (bits + 1)) != 0)
+		++bits;
+	return (
+		((bits - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+		+ static_cast<std::size_t>((v >> (bits - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1))
+	);
+}
+
+
+std::uint64_t Metrics::Histogram::getLowerBound(const std::size_t bucket) {
+	if (bucket < (2 * SUB_BUCKETS))
+		return bucket;
+	const std::size_t bits = ((bucket / SUB_BUCKETS) + SUB_BUCKET_BITS - 1);
+	return (static_cast<std::uint64_t>(SUB_BUCKETS + (bucket % SUB_BUCKETS)) << (bits - SUB_BUCKET_BITS));
+}
+
+
+Metrics::Metrics() : id{MetricsUtil::nextId.fetch_add(1, std::memory_order_relaxed)} {
+}
+
+
+// code: of the reply, time: from the command being read to its reply sent
+void Metrics::countCommand(const Command::Name name, const int code, const Clock::duration time) {
+	Shard& shard = getShard();
+	const std::size_t i = static_cast<std::size_t>(name);
+	add(shard.commandLatency[i], time);
+	if (code >= 400)
+		add(shard.commandErrors[i], 1);
+}
+
+
+// ok: the transfer completed, bytes: transferred, time: from the command to
+//   the end of the transfer
+void Metrics::countTransfer(const TrafficShaper::Direction dir, const bool ok, const std::uint64_t bytes,
+const Clock::duration time) {
+	Shard& shard = getShard();
+	const std::size_t i = static_cast<std::size_t>(dir);
+	add(shard.transferDuration[i], time);
+	add(shard.transferBytes[i], bytes);
+	if (!ok)
+		add(shard.transferFailed[i], 1);
+}
+
+
+Metrics::Snapshot Metrics::read() const {
+	Snapshot snapshot;
+	std::lock_guard<std::mutex> guard{shardsLock};
+	for (const auto& shard : shards) {
+		for (std::size_t i = 0; i < NUM_COUNTERS; ++i)
+			snapshot.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+		for (std::size_t i = 0; i < Command::NUM_NAMES; ++i) {
+			read(shard->commandLatency[i], snapshot.commands[i].latency);
+			snapshot.commands[i].errors += shard->commandErrors[i].load(std::memory_order_relaxed);
+		}
+		for (std::size_t i = 0; i < snapshot.transfers.size(); ++i) {
+			read(shard->transferDuration[i], snapshot.transfers[i].duration);
+			snapshot.transfers[i].failed += shard->transferFailed[i].load(std::memory_order_relaxed);
+			snapshot.transfers[i].bytes += shard->transferBytes[i].load(std::memory_order_relaxed);
+		}
+	}
+	return snapshot;
+}
+
+
+// Lines of STAT, tls: nullptr if FTPS is disabled, listingCache: nullptr if
+//   disabled.
+std::string Metrics::getStatus(const Snapshot& snapshot, const TlsContext* tls,
+const ListingCache* listingCache) {
+	std::string str;
+	for (std::size_t i = 0; i < NUM_COUNTERS; ++i) {
+		str.append((i == 0) ? " " : ", ");
+		str.append(MetricsConstants::counterNames[i]).append(" ").append(std::to_string(snapshot.counters[i]));
+	}
+	str.append(Constants::EOL);
+	for (std::size_t i = 0; i < Command::NUM_NAMES; ++i) {
+		const CommandStats& stats = snapshot.commands[i];
+		if (stats.latency.count == 0)
+			continue;
+		str.append(" ").append(Command::getNameStr(static_cast<Command::Name>(i))).append(" ")
+			.append(MetricsUtil::summary(stats.latency)).append(", errors ")
+			.append(std::to_string(stats.errors)).append(Constants::EOL);
+	}
+	for (std::size_t i = 0; i < snapshot.transfers.size(); ++i) {
+		const TransferStats& stats = snapshot.transfers[i];
+		str.append(" ").append(MetricsConstants::directionNames[i]).append(" ")
+			.append(MetricsUtil::summary(stats.duration)).append(", failed ")
+			.append(std::to_string(stats.failed)).append(", bytes ").append(std::to_string(stats.bytes))
+			.append(Constants::EOL);
+	}
+	if (listingCache != nullptr) {
+		const ListingCache::Stats stats = listingCache->getStats();
+		str.append(" listing cache hits ").append(std::to_string(stats.hits))
+			.append(", misses ").append(std::to_string(stats.misses))
+			.append(", file hits ").append(std::to_string(stats.fileHits))
+			.append(", file misses ").append(std::to_string(stats.fileMisses))
+			.append(", inserts ").append(std::to_string(stats.inserts))
+			.append(", invalidations ").append(std::to_string(stats.invalidations))
+			.append(", evictions ").append(std::to_string(stats.evictions))
+			.append(", dirs ").append(std::to_string(stats.dirs))
+			.append(", bytes ").append(std::to_string(stats.bytes)).append(Constants::EOL);
+	}
+	if (tls == nullptr)
+		return str;
+	for (const TlsContext::Channel channel : {TlsContext::Channel::CONTROL, TlsContext::Channel::DATA}) {
+		const TlsContext::HandshakeStats stats = tls->getStats(channel);
+		str.append(" TLS ").append(MetricsConstants::channelNames[static_cast<std::size_t>(channel)])
+			.append(" handshakes ").append(std::to_string(stats.completed))
+			.append(", resumed ").append(std::to_string(stats.resumed))
+			.append(", failed ").append(std::to_string(stats.failed))
+			.append(", us mean ").append(std::to_string(stats.totalNanos / std::max<std::uint64_t>(stats.completed, 1) / 1000))
+			.append(", max ").append(std::to_string(stats.maxNanos / 1000)).append(Constants::EOL);
+	}
+	return str;
+}
+
+
+// Prometheus text format, tls: nullptr if FTPS is disabled, listingCache:
+//   nullptr if disabled.
+std::string Metrics::getPrometheus(const Snapshot& snapshot, const TlsContext* tls,
+const ListingCache* listingCache) {
+	using MetricsUtil::appendType;
+	using MetricsUtil::appendSample;
+	using MetricsUtil::appendHistogram;
+	typedef Metrics::Counter C;
+	const auto counter = [&snapshot](const C c) {
+		return std::to_string(snapshot.counters[static_cast<std::size_t>(c)]);
+	};
+	std::string out;
+	appendType(out, "ftp_sessions_total", "counter", "Control connections accepted.");
+	appendSample(out, "ftp_sessions_total", "", counter(C::SESSIONS));
+	appendType(out, "ftp_accept_errors_total", "counter", "Control connections failed to be accepted.");
+	appendSample(out, "ftp_accept_errors_total", "", counter(C::ACCEPT_ERRORS));
+	appendType(out, "ftp_logins_total", "counter", "Replies to PASS.");
+	appendSample(out, "ftp_logins_total", "result=\"success\"", counter(C::LOGINS));
+	appendSample(out, "ftp_logins_total", "result=\"failure\"", counter(C::LOGIN_FAILURES));
+
+	appendType(out, "ftp_command_errors_total", "counter", "Replies 4xx and 5xx, by command.");
+	for (std::size_t i = 0; i < Command::NUM_NAMES; ++i) {
+		if (snapshot.commands[i].latency.count != 0) {
+			appendSample(out, "ftp_command_errors_total",
+				"command=\"" + Command::getNameStr(static_cast<Command::Name>(i)) + "\"",
+				std::to_string(snapshot.commands[i].errors));
+		}
+	}
+	appendType(out, "ftp_command_reply_seconds", "histogram",
+		"Time from a command being read to its (first) reply sent.");
+	for (std::size_t i = 0; i < Command::NUM_NAMES; ++i) {
+		if (snapshot.commands[i].latency.count != 0) {
+			appendHistogram(out, "ftp_command_reply_seconds",
+				"command=\"" + Command::getNameStr(static_cast<Command::Name>(i)) + "\"",
+				snapshot.commands[i].latency);
+		}
+	}
+
+	appendType(out, "ftp_transfer_bytes_total", "counter", "Bytes of data connections, listings included.");
+	appendType(out, "ftp_transfer_failures_total", "counter", "Transfers failed or aborted.");
+	appendType(out, "ftp_transfer_seconds", "histogram", "Time from a transfer's command to its end.");
+	for (std::size_t i = 0; i < snapshot.transfers.size(); ++i) {
+		const std::string labels = (std::string{"direction=\""} + MetricsConstants::directionNames[i] + "\"");
+		appendSample(out, "ftp_transfer_bytes_total", labels, std::to_string(snapshot.transfers[i].bytes));
+		appendSample(out, "ftp_transfer_failures_total", labels, std::to_string(snapshot.transfers[i].failed));
+		appendHistogram(out, "ftp_transfer_seconds", labels, snapshot.transfers[i].duration);
+	}
+
+	if (listingCache != nullptr) {
+		const ListingCache::Stats stats = listingCache->getStats();
+		appendType(out, "ftp_listing_cache_lookups_total", "counter",
+			"Lookups of listings (LIST, NLST, MLSD) and of file metadata (SIZE, MDTM).");
+		appendSample(out, "ftp_listing_cache_lookups_total", "type=\"listing\",result=\"hit\"",
+			std::to_string(stats.hits));
+		appendSample(out, "ftp_listing_cache_lookups_total", "type=\"listing\",result=\"miss\"",
+			std::to_string(stats.misses));
+		appendSample(out, "ftp_listing_cache_lookups_total", "type=\"file\",result=\"hit\"",
+			std::to_string(stats.fileHits));
+		appendSample(out, "ftp_listing_cache_lookups_total", "type=\"file\",result=\"miss\"",
+			std::to_string(stats.fileMisses));
+		appendType(out, "ftp_listing_cache_inserts_total", "counter", "Listings added.");
+		appendSample(out, "ftp_listing_cache_inserts_total", "", std::to_string(stats.inserts));
+		appendType(out, "ftp_listing_cache_invalidations_total", "counter",
+			"Directories dropped since they changed.");
+		appendSample(out, "ftp_listing_cache_invalidations_total", "", std::to_string(stats.invalidations));
+		appendType(out, "ftp_listing_cache_evictions_total", "counter",
+			"Directories dropped for space, or once changes could no longer be watched.");
+		appendSample(out, "ftp_listing_cache_evictions_total", "", std::to_string(stats.evictions));
+		appendType(out, "ftp_listing_cache_directories", "gauge", "Directories cached.");
+		appendSample(out, "ftp_listing_cache_directories", "", std::to_string(stats.dirs));
+		appendType(out, "ftp_listing_cache_bytes", "gauge", "Bytes of listings and file metadata cached.");
+		appendSample(out, "ftp_listing_cache_bytes", "", std::to_string(stats.bytes));
+	}
+
+	if (tls == nullptr)
+		return out;
+	appendType(out, "ftp_tls_handshakes_total", "counter", "TLS handshakes, by channel.");
+	appendType(out, "ftp_tls_handshakes_resumed_total", "counter", "TLS handshakes which resumed a session.");
+	appendType(out, "ftp_tls_handshake_seconds_total", "counter", "Time of completed TLS handshakes.");
+	appendType(out, "ftp_tls_handshake_seconds_max", "gauge", "Longest completed TLS handshake.");
+	for (const TlsContext::Channel channel : {TlsContext::Channel::CONTROL, TlsContext::Channel::DATA}) {
+		const TlsContext::HandshakeStats stats = tls->getStats(channel);
+		const std::string labels = (
+			std::string{"channel=\""} + MetricsConstants::channelNames[static_cast<std::size_t>(channel)] + "\""
+		);
+		appendSample(out, "ftp_tls_handshakes_total", labels + ",result=\"success\"",
+			std::to_string(stats.completed));
+		appendSample(out, "ftp_tls_handshakes_total", labels + ",result=\"failure\"",
+			std::to_string(stats.failed));
+		appendSample(out, "ftp_tls_handshakes_resumed_total", labels, std::to_string(stats.resumed));
+		appendSample(out, "ftp_tls_handshake_seconds_total", labels, MetricsUtil::seconds(stats.totalNanos / 1000));
+		appendSample(out, "ftp_tls_handshake_seconds_max", labels, MetricsUtil::seconds(stats.maxNanos / 1000));
+	}
+	return out;
+}
+
+
+// Replaces the file at path (atomically, by renaming a temporary file).
+// throws runtime_error
+void Metrics::writePrometheus(const std::string& path, const Snapshot& snapshot, const TlsContext* tls,
+const ListingCache* listingCache) {
+	const std::string tmpPath = (path + ".tmp");
+	{
+		std::ofstream f{tmpPath, std::ios::binary | std::ios::trunc};
+		f << getPrometheus(snapshot, tls, listingCache);
+		if (!f.flush())
+			throw std::runtime_error{"unable to write " + tmpPath};
+	}
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+		throw std::runtime_error{"unable to replace " + path};
+}
+
+
+// Registers a shard for this thread on its first count, which is then found
+//   without the lock.
+Metrics::Shard& Metrics::getShard() {
+	thread_local std::uint64_t cachedId = 0;
+	thread_local Shard* cached = nullptr;
+	if (cachedId == id)
+		return *cached;
+	std::lock_guard<std::mutex> guard{shardsLock};
+	const std::thread::id self = std::this_thread::get_id();
+	auto it = std::find_if(shards.begin(), shards.end(),
+		[&self](const std::unique_ptr<Shard>& shard) {
+			return (shard->thread == self);
+		}
+	);
+	if (it == shards.end()) {
+		shards.emplace_back(new Shard());
+		shards.back()->thread = self;
+		it = (shards.end() - 1);
+	}
+	cachedId = id;
+	cached = it->get();
+	return *cached;
+}
+
+
+void Metrics::add(AtomicHistogram& h, const Clock::duration time) {
+	const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+	const std::uint64_t value = ((micros > 0) ? static_cast<std::uint64_t>(micros) : 0);
+	add(h.buckets[Histogram::getBucket(value)], 1);
+	add(h.sumMicros, value);
+}
+
+
+void Metrics::read(const AtomicHistogram& from, Histogram& to) {
+	for (std::size_t i = 0; i < NUM_BUCKETS; ++i) {
+		const std::uint64_t n = from.buckets[i].load(std::memory_order_relaxed);
+		to.buckets[i] += n;
+		to.count += n;
+	}
+	to.sumMicros += from.sumMicros.load(std::memory_order_relaxed);
+}
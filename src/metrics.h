@@ -0,0 +1,123 @@
+#pragma once
+
+#include "command.h"
+#include "traffic_shaper.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>	// size_t
+#include <cstdint>	// uint64_t
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+class ListingCache;
+class TlsContext;
+
+
+// Counters of the server: sessions, logins, commands (by Command::Name, with
+//   a histogram of the time to reply), and transfers (by direction, with bytes
+//   and a histogram of their duration).
+// Counting is lock free: each thread counts into its own shard (registered,
+//   under a lock, on its first count), which only it writes, and read()
+//   adds up all shards. So counts of different threads are not read at the
+//   same instant.
+// Histograms are log-linear (HDR-style): microseconds, with 8 buckets per
+//   power of 2 (at most 12.5% apart), up to 2^32 us (about 71 minutes).
+// Thread safe.
+class Metrics {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum class Counter {SESSIONS, ACCEPT_ERRORS, LOGINS, LOGIN_FAILURES};
+	static constexpr std::size_t NUM_COUNTERS = 4;
+	static constexpr std::size_t SUB_BUCKET_BITS = 3;
+	static constexpr std::size_t SUB_BUCKETS = (1 << SUB_BUCKET_BITS);
+	static constexpr std::size_t MAX_MICROS_BITS = 32;
+	static constexpr std::size_t NUM_BUCKETS = ((MAX_MICROS_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS);
+
+	struct Histogram {
+		std::array<std::uint64_t, NUM_BUCKETS> buckets{};
+		std::uint64_t count = 0;
+		std::uint64_t sumMicros = 0;
+
+		std::uint64_t percentile(const double) const;
+		std::uint64_t countBelow(const std::uint64_t) const;
+		std::uint64_t max(void) const;
+		static std::size_t getBucket(const std::uint64_t);
+		static std::uint64_t getLowerBound(const std::size_t);
+	};
+
+	struct CommandStats {
+		Histogram latency;		// from the command being read to its (first) reply sent
+		std::uint64_t errors = 0;	// replies 4xx and 5xx
+	};
+
+	struct TransferStats {
+		Histogram duration;		// from the command to the end of the transfer
+		std::uint64_t failed = 0;
+		std::uint64_t bytes = 0;
+	};
+
+	// all counts, added up from all threads
+	struct Snapshot {
+		std::array<std::uint64_t, NUM_COUNTERS> counters{};
+		std::array<CommandStats, Command::NUM_NAMES> commands;
+		std::array<TransferStats, 2> transfers;		// by TrafficShaper::Direction
+	};
+
+	Metrics();
+	Metrics(const Metrics&) = delete;
+	~Metrics() = default;
+	void count(const Counter);
+	void countCommand(const Command::Name, const int, const Clock::duration);
+	void countTransfer(const TrafficShaper::Direction, const bool, const std::uint64_t,
+		const Clock::duration);
+	Snapshot read(void) const;
+	static std::string getStatus(const Snapshot&, const TlsContext*, const ListingCache*);
+	static std::string getPrometheus(const Snapshot&, const TlsContext*, const ListingCache*);
+	static void writePrometheus(const std::string&, const Snapshot&, const TlsContext*,
+		const ListingCache*);
+	Metrics& operator=(const Metrics&) = delete;
+private:
+	// std::atomic to be read while written, written by its thread only
+	struct AtomicHistogram {
+		std::array<std::atomic<std::uint64_t>, NUM_BUCKETS> buckets{};
+		std::atomic<std::uint64_t> sumMicros{0};
+	};
+
+	struct Shard {
+		std::thread::id thread;
+		std::array<std::atomic<std::uint64_t>, NUM_COUNTERS> counters{};
+		std::array<AtomicHistogram, Command::NUM_NAMES> commandLatency;
+		std::array<std::atomic<std::uint64_t>, Command::NUM_NAMES> commandErrors{};
+		std::array<AtomicHistogram, 2> transferDuration;
+		std::array<std::atomic<std::uint64_t>, 2> transferFailed{};
+		std::array<std::atomic<std::uint64_t>, 2> transferBytes{};
+	};
+
+	Shard& getShard(void);
+	static void add(std::atomic<std::uint64_t>&, const std::uint64_t);
+	static void add(AtomicHistogram&, const Clock::duration);
+	static void read(const AtomicHistogram&, Histogram&);
+
+	mutable std::mutex shardsLock;	// guards shards (not their counts)
+	std::vector<std::unique_ptr<Shard>> shards;
+	std::uint64_t id;	// tells this from other (past) instances in threads' cached shards
+};
+
+
+inline
+void Metrics::count(const Counter counter) {
+	add(getShard().counters[static_cast<std::size_t>(counter)], 1);
+}
+
+
+// Only the thread of the shard adds to a, so it need not be atomic.
+inline
+void Metrics::add(std::atomic<std::uint64_t>& a, const std::uint64_t n) {
+	a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
@@ -0,0 +1,11 @@
+#include "password_verifier.h"
+#include "md5.h"
+#include "user.h"
+
+
+bool SaltedMD5Verifier::verify(const User& user, const std::string& pass) const {
+	MD5Context ctx;
+	ctx.update(pass.data(), pass.size());
+	ctx.update(user.salt.data(), user.salt.size());
+	return (ctx.final() == user.pass);
+}
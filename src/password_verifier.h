@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+
+struct User;
+
+
+// Checks a password against the credentials stored for a user.
+// Passwords may be verified on Server's authentication threads, so
+//   implementations must be thread safe. Digests should be compared in
+//   constant time.
+class PasswordVerifier {
+public:
+	virtual ~PasswordVerifier() = default;
+	virtual bool verify(const User&, const std::string&) const = 0;
+};
+
+
+// User::pass = md5(password + User::salt), as written by ConfigData
+class SaltedMD5Verifier : public PasswordVerifier {
+public:
+	bool verify(const User&, const std::string&) const override;
+};
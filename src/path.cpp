@@ -6,39 +6,11 @@
 namespace fs = boost::filesystem;
 
 
-static std::string formatFTPStr(const std::string& str) {
-	std::string ret;
-	for (const auto c : str) {
-		if (c == '"') {
-			ret.append(2, '"');
-		}
-		else {
-			ret.push_back(c);
-		}
-	}
-	return ret;
-}
-
-
 // throws boost::filesystem::filesystem_error if path does not exist
 Path::Path(const fs::path& home) : path(fs::canonical(home)) {
 }
 
 
-// this is interpreted as the current working directory of a user, and
-//   provided Path p is the user's home directory.
-// Returns string of ftp response, excluding delimiting '"'
-std::string Path::pwd(const Path& p) const {
-	// TODO temporary implementation
-	fs::path relPath = fs::relative(path, p.path);
-	std::string str = relPath.string();
-	if (relPath == fs::path{"."}) {
-		str = "/";
-	}
-	return formatFTPStr(str);
-}
-
-
 // returns a new Path relative to this, where p is a relative path
 // ret.first is the new Path if ret.second is true
 // returns a new Path where this is interpreted as the root path and p is
@@ -70,41 +42,13 @@ std::pair<Path, bool> Path::get(const std::string& p) const {
 }
 
 
-// Attempts to create a file with this as the base path and name being the desired
-//   filename. this is assumed to be a directory.
-// The provided ofstream should be only default constructed and not modified.
-// create() will attempt to open the file in binary mode.
-// If file successfully opened, the returned ret.second will be true, and
-//   ret.first will be the Path to the created file.
-std::pair<Path, bool> Path::create(const std::string& name, std::ofstream& file) const {
-	assert(isDirectory());
-	std::pair<Path, bool> ret = std::make_pair(Path{}, false);
-	// make sure that name is a valid filename (that is, not an absolute path,
-	//   does not begin with invalid sequence, has no parent path).
-	const fs::path namePath{name};
-	if (name.empty() || !namePath.is_relative() || !namePath.parent_path().string().empty())
-		return ret;
-	if (
-		(name == ".")
-		|| (name == "..")
-		|| (name.substr(0, 2) == "./")
-		|| (name.substr(0, 3) == "../")
-	) {
-		return ret;
-	}
-	// attempt to open file
-	fs::path reqPath = (path / namePath);
-	file.open(reqPath.string(), std::ofstream::binary | std::ofstream::trunc);
-	if (file.is_open()) {
-		try {
-			ret.first = Path{reqPath};
-			ret.second = true;
-			assert(ret.first.childOf(*this));
-		}
-		catch (const std::exception&) {
-			// unable to get Path...
-		}
-	}
+// Returns this / rel without resolving rel, which must be relative and contain
+//   no "." or ".." components, so that the result stays canonical (unless rel
+//   contains symbolic links).
+Path Path::join(const std::string& rel) const {
+	assert(!rel.empty() && (rel.front() != '/'));
+	Path ret;
+	ret.path = (path / rel);
 	return ret;
 }
 
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <fstream>
 #include <string>
 #include <utility>
 #define BOOST_FILESYSTEM_NO_DEPRECATED
@@ -16,9 +15,8 @@ public:
 	~Path() = default;
 	std::string string(void) const;
 	std::string fileName(void) const;
-	std::string pwd(const Path&) const;
 	std::pair<Path, bool> get(const std::string&) const;
-	std::pair<Path, bool> create(const std::string&, std::ofstream&) const;
+	Path join(const std::string&) const;
 	bool childOf(const Path&) const;
 	bool isFile(void) const;
 	bool isDirectory(void) const;
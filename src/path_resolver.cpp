@@ -0,0 +1,713 @@
+#include "path_resolver.h"
+#include "user.h"
+#include <algorithm>	// mismatch
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>		// renameat2
+#include <cstring>		// memset
+#include <exception>
+#include <sstream>
+#include <fcntl.h>		// open, O_*
+#include <sys/stat.h>
+#ifdef __linux__
+#include <climits>		// PATH_MAX
+#include <linux/openat2.h>	// open_how, RESOLVE_*
+#include <sys/syscall.h>
+#include <unistd.h>		// close, syscall, readlink
+#else
+#include <io.h>			// close
+#endif
+
+
+namespace fs = boost::filesystem;
+
+
+namespace PathResolverConstants {
+	constexpr std::size_t DIR_CACHE_SZ = 8;
+	constexpr std::chrono::seconds DIR_CACHE_TTL{1};
+	constexpr int FILE_MODE = 0644;		// of created files
+	constexpr int DIR_MODE = 0755;		// of created directories
+	// names of temporary files are tried until one does not exist
+	constexpr int TEMP_NAME_TRIES = 8;
+	// of the destination name in a temporary file name, which must fit in NAME_MAX
+	constexpr std::size_t TEMP_NAME_PREFIX_MAX = 200;
+#ifdef __linux__
+	constexpr int CLOEXEC = O_CLOEXEC;
+	// openat2 fails with EAGAIN if a rename raced with resolving ".."
+	constexpr int OPENAT2_TRIES = 3;
+	constexpr char PROC_FD[] = "/proc/self/fd/";
+	// symbolic links followed in the last component without openat2
+	constexpr int FALLBACK_LINK_TRIES = 8;
+#else
+	constexpr int CLOEXEC = 0;
+#endif
+}
+
+
+namespace PathResolverUtil {
+
+// virtual path to path relative to home
+static std::string relative(const std::string& vpath) {
+	assert(!vpath.empty() && (vpath.front() == '/'));
+	return ((vpath.size() == 1) ? std::string{"."} : vpath.substr(1));
+}
+
+
+// is p dir, or in dir (both virtual paths)?
+static bool inDir(const std::string& dir, const std::string& p) {
+	return (
+		(p.compare(0, dir.size(), dir) == 0)
+		&& ((p.size() == dir.size()) || (p[dir.size()] == '/') || (dir.size() == 1))
+	);
+}
+
+
+// is p home, or in home (both canonical)?
+static bool inHome(const fs::path& home, const fs::path& p) {
+	return (std::mismatch(home.begin(), home.end(), p.begin(), p.end()).first == home.end());
+}
+
+
+// virtual path of p, which must be in home (both canonical)
+static std::string virtualPath(const fs::path& home, const fs::path& p) {
+	std::string rel;
+	for (
+		auto it = std::mismatch(home.begin(), home.end(), p.begin(), p.end()).second;
+		it != p.end(); ++it
+	) {
+		rel.push_back('/');
+		rel.append(it->string());
+	}
+	return PathResolver::normalize("/", rel);
+}
+
+
+#ifdef __linux__
+// canonical path of a file descriptor, empty on error
+static fs::path handlePath(const int fd) {
+	const std::string procPath = (PathResolverConstants::PROC_FD + std::to_string(fd));
+	char buf[PATH_MAX];
+	const ssize_t n = ::readlink(procPath.c_str(), buf, sizeof(buf));
+	if ((n <= 0) || (static_cast<std::size_t>(n) >= sizeof(buf)))
+		return fs::path{};
+	return fs::path{std::string(buf, static_cast<std::size_t>(n))};
+}
+#endif
+
+
+// Returns a suffix that is different on every call, also across restarts
+//   of the server: "<start time in microseconds>-<counter>" in hex
+static std::string uniqueSuffix() {
+	static const long long startTime = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()
+	).count();
+	static std::atomic<unsigned long long> counter{0};
+	std::ostringstream ss;
+	ss << std::hex << startTime << '-' << counter++;
+	return ss.str();
+}
+
+
+// Returns the virtual path of a hidden file in the directory of vpath:
+//   ".<name>.<unique suffix>"
+static std::string tempPath(const std::string& vpath) {
+	const std::size_t slash = vpath.rfind('/');
+	return (
+		vpath.substr(0, slash + 1) + '.'
+		+ vpath.substr(slash + 1, PathResolverConstants::TEMP_NAME_PREFIX_MAX) + '.'
+		+ uniqueSuffix()
+	);
+}
+
+}	// namespace PathResolverUtil
+
+
+PathResolver::PathResolver() : cwd{"/"}, homeFd{-1}, cwdFd{-1} {
+}
+
+
+PathResolver::~PathResolver() {
+	for (const DirHandle& dir : dirs)
+		::close(dir.fd);
+	if (cwdFd >= 0)
+		::close(cwdFd);
+}
+
+
+// cwd is set to home
+void PathResolver::setUser(const User& user) {
+	for (const DirHandle& dir : dirs)
+		::close(dir.fd);
+	dirs.clear();
+	home = user.home;
+	homeFd = user.homeFd;
+	changeDir("/");
+}
+
+
+// Returns the virtual path of arg, which is relative to cwd (a virtual path)
+//   unless it begins with '/'.
+std::string PathResolver::normalize(const std::string& cwd, const std::string& arg) {
+	assert(!cwd.empty() && (cwd.front() == '/'));
+	// without trailing '/', so root is empty until the end
+	std::string ret;
+	if (arg.empty() || (arg.front() != '/'))
+		ret = ((cwd.size() == 1) ? std::string{} : cwd);
+	std::size_t begin = 0;
+	while (begin < arg.size()) {
+		std::size_t end = arg.find('/', begin);
+		if (end == std::string::npos)
+			end = arg.size();
+		const std::size_t len = (end - begin);
+		if ((len == 0) || ((len == 1) && (arg[begin] == '.'))) {
+			// empty or current directory
+		}
+		else if ((len == 2) && (arg[begin] == '.') && (arg[begin + 1] == '.')) {
+			// parent directory
+			if (!ret.empty())
+				ret.resize(ret.rfind('/'));
+		}
+		else {
+			ret.push_back('/');
+			ret.append(arg, begin, len);
+		}
+		begin = (end + 1);
+	}
+	if (ret.empty())
+		ret.push_back('/');
+	return ret;
+}
+
+
+// Returns vpath with a suffix, which no other call returns (STOU).
+// A file could only exist at the returned path if created by someone else
+//   with the same naming scheme, so it need not be retried.
+std::string PathResolver::uniquePath(const std::string& vpath) {
+	return (vpath + '.' + PathResolverUtil::uniqueSuffix());
+}
+
+
+// Returns the local path of vpath, without resolving it.
+// Suitable for display and cache keys, but not for access checks.
+Path PathResolver::getPath(const std::string& vpath) const {
+	if (vpath.size() == 1)
+		return home;
+	return home.join(PathResolverUtil::relative(vpath));
+}
+
+
+// Sets p to the canonical local path of directory vpath, which is the same
+//   whichever symbolic links vpath was reached through (for cache keys).
+// Returns false if vpath cannot be resolved.
+bool PathResolver::getDirPath(const std::string& vpath, Path& p) {
+#ifdef __linux__
+	const int fd = getDir(vpath);
+	if (fd >= 0) {
+		// the kernel's path of the handle, rather than resolving vpath again
+		const fs::path canonical = PathResolverUtil::handlePath(fd);
+		if (canonical.empty())
+			return false;
+		try {
+			p = Path{canonical};
+			return true;
+		}
+		catch (const std::exception&) {
+			// removed since opened (the kernel's path ends with " (deleted)")
+			return false;
+		}
+	}
+#endif
+	boost::system::error_code ec;
+	const fs::path canonical = fs::canonical(home.getBoostPath() / PathResolverUtil::relative(vpath), ec);
+	if (ec || !PathResolverUtil::inHome(home.getBoostPath(), canonical))
+		return false;
+	p = Path{canonical};
+	return true;
+}
+
+
+// Sets type, size, and modify of entry (name is left unchanged).
+// Returns false if vpath does not exist or is not in home.
+bool PathResolver::stat(const std::string& vpath, DirScanner::Entry& entry) {
+#ifdef __linux__
+	int fd = findDir(vpath);
+	if (fd >= 0)
+		return DirScanner::statHandle(fd, entry);
+	fd = openBeneath(vpath, O_PATH);
+	if (fd < 0)
+		return false;
+	const bool ret = DirScanner::statHandle(fd, entry);
+	if (ret && (entry.type == DirScanner::Type::DIRECTORY))
+		addDir(vpath, fd);	// most likely about to be listed
+	else
+		::close(fd);
+	return ret;
+#else
+	boost::system::error_code ec;
+	const fs::path p = fs::canonical(home.getBoostPath() / PathResolverUtil::relative(vpath), ec);
+	if (ec || !PathResolverUtil::inHome(home.getBoostPath(), p))
+		return false;
+	try {
+		return DirScanner::statPath(Path{p}, entry);
+	}
+	catch (const std::exception&) {
+		// removed since canonical()
+		return false;
+	}
+#endif
+}
+
+
+// Returns a handle (O_PATH) of directory vpath, or -1 if it cannot be resolved
+//   or handles are unavailable.
+// The handle is owned by this, and is valid until the next call of any method.
+int PathResolver::getDir(const std::string& vpath) {
+#ifdef __linux__
+	if ((cwdFd >= 0) && (vpath == cwd))
+		return cwdFd;
+	int fd = findDir(vpath);
+	if (fd >= 0)
+		return fd;
+	fd = openBeneath(vpath, O_PATH | O_DIRECTORY);
+	if (fd >= 0)
+		addDir(vpath, fd);
+	return fd;
+#else
+	(void)vpath;
+	return -1;
+#endif
+}
+
+
+// Opens regular file vpath with flags (as open), returning a file descriptor
+//   owned by the caller, or -1 (errno is set, EINVAL if not a regular file).
+// It is opened non-blocking until its type is checked, since opening a FIFO
+//   blocks until its other end is opened.
+int PathResolver::openFile(const std::string& vpath, const int flags) {
+#ifdef __linux__
+	const int fd = openBeneath(vpath, flags | O_NONBLOCK);
+	if (fd < 0)
+		return -1;
+	int error = 0;
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		error = errno;
+	else if (!S_ISREG(st.st_mode))
+		error = EINVAL;
+	else if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK) != 0)
+		error = errno;
+	if (error != 0) {
+		::close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+#else
+	return openBeneath(vpath, flags);
+#endif
+}
+
+
+// Changes cwd to vpath, which must be a directory.
+bool PathResolver::changeDir(const std::string& vpath) {
+#ifdef __linux__
+	const int fd = openBeneath(vpath, O_PATH | O_DIRECTORY);
+	if (fd < 0)
+		return false;
+	if (cwdFd >= 0)
+		::close(cwdFd);
+	cwdFd = fd;
+#else
+	DirScanner::Entry entry;
+	if (!stat(vpath, entry) || (entry.type != DirScanner::Type::DIRECTORY))
+		return false;
+#endif
+	cwd = vpath;
+	return true;
+}
+
+
+bool PathResolver::makeDir(const std::string& vpath) {
+#ifdef __linux__
+	std::string name;
+	const int dirFd = getParent(vpath, name);
+	return ((dirFd >= 0) && (::mkdirat(dirFd, name.c_str(), PathResolverConstants::DIR_MODE) == 0));
+#else
+	boost::system::error_code ec;
+	fs::path p;
+	return (getFallbackPath(vpath, p) && fs::create_directory(p, ec) && !ec);
+#endif
+}
+
+
+// vpath must be an empty directory
+bool PathResolver::removeDir(const std::string& vpath) {
+	invalidate(vpath);
+#ifdef __linux__
+	std::string name;
+	const int dirFd = getParent(vpath, name);
+	if ((dirFd < 0) || (::unlinkat(dirFd, name.c_str(), AT_REMOVEDIR) != 0))
+		return false;
+#else
+	boost::system::error_code ec;
+	fs::path p;
+	if (!getFallbackPath(vpath, p) || !fs::is_directory(p, ec) || !fs::remove(p, ec) || ec)
+		return false;
+#endif
+	if (PathResolverUtil::inDir(vpath, cwd))
+		resetCWD(cwd);
+	return true;
+}
+
+
+// vpath must not be a directory (a symbolic link itself is removed)
+bool PathResolver::removeFile(const std::string& vpath) {
+#ifdef __linux__
+	std::string name;
+	const int dirFd = getParent(vpath, name);
+	return ((dirFd >= 0) && (::unlinkat(dirFd, name.c_str(), 0) == 0));
+#else
+	boost::system::error_code ec;
+	fs::path p;
+	return (
+		getFallbackPath(vpath, p) && !fs::is_directory(p, ec) && fs::remove(p, ec) && !ec
+	);
+#endif
+}
+
+
+// Atomically renames from to to. If replace is true, an existing to is
+//   replaced, otherwise the rename fails if to exists.
+bool PathResolver::rename(const std::string& from, const std::string& to, const bool replace) {
+	invalidate(from);
+	invalidate(to);
+#ifdef __linux__
+	std::string fromName;
+	std::string toName;
+	const int fromDirFd = getParent(from, fromName);
+	if (fromDirFd < 0)
+		return false;
+	int toDirFd;
+	const std::size_t slash = to.rfind('/');
+	if (
+		(slash == from.rfind('/')) && (slash != (to.size() - 1))
+		&& (to.compare(0, slash, from, 0, slash) == 0)
+	) {
+		// same parent, resolved once (looking it up again may expire its handle)
+		toDirFd = fromDirFd;
+		toName = to.substr(slash + 1);
+	}
+	else {
+		// fromDirFd is now the most recently used handle, so it is not evicted by
+		//   resolving the second parent (nor expired, since its path is different)
+		toDirFd = getParent(to, toName);
+	}
+	if (toDirFd < 0)
+		return false;
+	const unsigned int flags = (replace ? 0 : RENAME_NOREPLACE);
+	if (::renameat2(fromDirFd, fromName.c_str(), toDirFd, toName.c_str(), flags) != 0) {
+		if (!replace || ((errno != ENOSYS) && (errno != EINVAL)))
+			return false;
+		if (::renameat(fromDirFd, fromName.c_str(), toDirFd, toName.c_str()) != 0)
+			return false;
+	}
+#else
+	boost::system::error_code ec;
+	fs::path fromPath;
+	fs::path toPath;
+	if (!getFallbackPath(from, fromPath) || !getFallbackPath(to, toPath))
+		return false;
+	if (!replace && fs::exists(toPath, ec))
+		return false;
+	fs::rename(fromPath, toPath, ec);
+	if (ec)
+		return false;
+#endif
+	if (PathResolverUtil::inDir(from, cwd))
+		resetCWD(to + cwd.substr(from.size()));
+	else if (PathResolverUtil::inDir(to, cwd))
+		resetCWD(cwd);	// replaced by from
+	return true;
+}
+
+
+// Creates a file to upload vpath to, which has no name (O_TMPFILE) if
+//   supported, or is a hidden file in the same directory. tmpPath is set to the
+//   virtual path of the hidden file, or empty.
+// Returns the file descriptor (open for writing), or -1.
+int PathResolver::openTempFile(const std::string& vpath, std::string& tmpPath) {
+	tmpPath.clear();
+#ifdef __linux__
+	std::string name;
+	const int dirFd = getParent(vpath, name);
+	if (dirFd < 0)
+		return -1;
+	int fd = ::openat(
+		dirFd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, PathResolverConstants::FILE_MODE
+	);
+	if (fd >= 0)
+		return fd;
+	if ((errno != EOPNOTSUPP) && (errno != EISDIR) && (errno != EINVAL))
+		return -1;
+	// not supported by the kernel or file system
+#else
+	int fd;
+#endif
+	for (int i = 0; i < PathResolverConstants::TEMP_NAME_TRIES; ++i) {
+		tmpPath = PathResolverUtil::tempPath(vpath);
+		fd = openFile(tmpPath, O_WRONLY | O_CREAT | O_EXCL);
+		if ((fd >= 0) || (errno != EEXIST))
+			break;
+	}
+	if (fd < 0)
+		tmpPath.clear();
+	return fd;
+}
+
+
+// Replaces vpath with the file from openTempFile(). If replace is false, fails
+//   if vpath exists.
+// On failure, the temporary file is removed (or is freed once fd is closed).
+bool PathResolver::linkTempFile(const int fd, const std::string& tmpPath, const std::string& vpath,
+const bool replace) {
+	if (!tmpPath.empty()) {
+		if (rename(tmpPath, vpath, replace))
+			return true;
+		removeFile(tmpPath);
+		return false;
+	}
+#ifdef __linux__
+	// An unnamed file cannot replace a file, so it is linked to a hidden name
+	//   first, and that is renamed. linkat() itself does not replace.
+	std::string linkPath;
+	for (int i = 0; i < PathResolverConstants::TEMP_NAME_TRIES; ++i) {
+		linkPath = (replace ? PathResolverUtil::tempPath(vpath) : vpath);
+		std::string name;
+		const int dirFd = getParent(linkPath, name);
+		if (dirFd < 0)
+			return false;
+		// AT_EMPTY_PATH requires CAP_DAC_READ_SEARCH, unlike linking the
+		//   descriptor through /proc
+		int ret = ::linkat(fd, "", dirFd, name.c_str(), AT_EMPTY_PATH);
+		if ((ret != 0) && (errno != EEXIST)) {
+			const std::string procPath = (PathResolverConstants::PROC_FD + std::to_string(fd));
+			ret = ::linkat(AT_FDCWD, procPath.c_str(), dirFd, name.c_str(), AT_SYMLINK_FOLLOW);
+		}
+		if (ret == 0) {
+			if (!replace || rename(linkPath, vpath))
+				return true;
+			removeFile(linkPath);
+			return false;
+		}
+		if (!replace || (errno != EEXIST))
+			return false;
+	}
+	return false;
+#else
+	(void)fd;
+	(void)replace;
+	assert(false);	// O_TMPFILE is not used
+	return false;
+#endif
+}
+
+
+// Opens the home directory of a user, which is kept open while the server runs.
+// Returns -1 if unavailable, in which case paths are resolved without it.
+int PathResolver::openHome(const Path& p) {
+#ifdef __linux__
+	return ::open(p.string().c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+	(void)p;
+	return -1;
+#endif
+}
+
+
+void PathResolver::closeHome(const int fd) {
+	if (fd >= 0)
+		::close(fd);
+}
+
+
+// Returns the handle of the parent directory of vpath (see getDir()), and sets
+//   name to the last component of vpath.
+// Returns -1 for "/", which has no parent.
+int PathResolver::getParent(const std::string& vpath, std::string& name) {
+	assert(!vpath.empty() && (vpath.front() == '/'));
+	const std::size_t slash = vpath.rfind('/');
+	if (slash == (vpath.size() - 1))
+		return -1;
+	name = vpath.substr(slash + 1);
+	return getDir((slash == 0) ? std::string{"/"} : vpath.substr(0, slash));
+}
+
+
+// Returns the cached handle of vpath, or -1.
+int PathResolver::findDir(const std::string& vpath) {
+	for (auto it = dirs.begin(); it != dirs.end(); ++it) {
+		if (it->path != vpath)
+			continue;
+		if ((Clock::now() - it->openTime) > PathResolverConstants::DIR_CACHE_TTL) {
+			::close(it->fd);
+			dirs.erase(it);
+			return -1;
+		}
+		dirs.splice(dirs.begin(), dirs, it);
+		return dirs.front().fd;
+	}
+	return -1;
+}
+
+
+// takes ownership of fd
+void PathResolver::addDir(const std::string& vpath, const int fd) {
+	dirs.push_front(DirHandle{vpath, Clock::now(), fd});
+	if (dirs.size() > PathResolverConstants::DIR_CACHE_SZ) {
+		::close(dirs.back().fd);
+		dirs.pop_back();
+	}
+}
+
+
+int PathResolver::openBeneath(const std::string& vpath, const int flags) {
+#ifdef __linux__
+	if (homeFd >= 0) {
+		const std::string rel = PathResolverUtil::relative(vpath);
+		open_how how;
+		std::memset(&how, 0, sizeof(how));
+		how.flags = static_cast<unsigned int>(flags | O_CLOEXEC);
+		how.mode = ((flags & O_CREAT) ? PathResolverConstants::FILE_MODE : 0);
+		how.resolve = (RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS);
+		for (int i = 0; i < PathResolverConstants::OPENAT2_TRIES; ++i) {
+			const long fd = ::syscall(SYS_openat2, homeFd, rel.c_str(), &how, sizeof(how));
+			if (fd >= 0)
+				return static_cast<int>(fd);
+			if (errno != EAGAIN)
+				break;
+		}
+		if (errno != ENOSYS)
+			return -1;
+		// kernel older than 5.6
+	}
+#endif
+	return openFallback(vpath, flags);
+}
+
+
+// Changes cwd to vpath, or else to its nearest ancestor that exists, after
+//   the working directory has been renamed or removed.
+void PathResolver::resetCWD(const std::string& vpath) {
+	std::string p = vpath;
+	while (!changeDir(p)) {
+		if (p.size() == 1) {
+			// home is unavailable
+			if (cwdFd >= 0)
+				::close(cwdFd);
+			cwdFd = -1;
+			cwd = p;
+			return;
+		}
+		const std::size_t slash = p.rfind('/');
+		p.erase((slash == 0) ? 1 : slash);
+	}
+}
+
+
+// Drops the cached handles of vpath and of any path in it, since it is being
+//   removed or renamed.
+void PathResolver::invalidate(const std::string& vpath) {
+	for (auto it = dirs.begin(); it != dirs.end();) {
+		if (PathResolverUtil::inDir(vpath, it->path)) {
+			::close(it->fd);
+			it = dirs.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+
+// Resolves vpath in user space. Its last component may not exist (if creating).
+// On Linux, the last component is opened relative to a handle of its parent
+//   directory (checked to be in home through the handle), without following a
+//   symbolic link, so a link cannot lead out of home between the check and the
+//   open, nor have O_CREAT create its target. A link in the last component is
+//   followed by resolving it, and opening its target the same way.
+int PathResolver::openFallback(const std::string& vpath, const int flags) const {
+#ifdef __linux__
+	std::string target = vpath;
+	for (int i = 0; i < PathResolverConstants::FALLBACK_LINK_TRIES; ++i) {
+		if (target.size() == 1)
+			return ::open(home.string().c_str(), flags | O_CLOEXEC);	// home itself
+		fs::path p;
+		if (!getFallbackPath(target, p)) {
+			errno = EACCES;
+			return -1;
+		}
+		const int dirFd = ::open(p.parent_path().c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (dirFd < 0)
+			return -1;
+		int fd = -1;
+		// the parent may have been replaced by a link since getFallbackPath()
+		if (PathResolverUtil::inHome(home.getBoostPath(), PathResolverUtil::handlePath(dirFd))) {
+			fd = ::openat(
+				dirFd, p.filename().c_str(), flags | O_NOFOLLOW | O_CLOEXEC, PathResolverConstants::FILE_MODE
+			);
+		}
+		else {
+			errno = EACCES;
+		}
+		const int openErrno = errno;
+		::close(dirFd);
+		errno = openErrno;
+		if ((fd >= 0) || (errno != ELOOP) || (flags & O_NOFOLLOW))
+			return fd;
+		// a symbolic link, which is followed if its target is in home
+		boost::system::error_code ec;
+		const fs::path linkTarget = fs::canonical(p, ec);
+		if (ec || !PathResolverUtil::inHome(home.getBoostPath(), linkTarget)) {
+			errno = EACCES;
+			return -1;
+		}
+		target = PathResolverUtil::virtualPath(home.getBoostPath(), linkTarget);
+	}
+	errno = ELOOP;
+	return -1;
+#else
+	boost::system::error_code ec;
+	const fs::path p = fs::weakly_canonical(
+		home.getBoostPath() / PathResolverUtil::relative(vpath), ec
+	);
+	if (ec)
+		return -1;
+	if (!PathResolverUtil::inHome(home.getBoostPath(), p)) {
+		errno = EACCES;
+		return -1;
+	}
+	return ::open(
+		p.string().c_str(), flags | PathResolverConstants::CLOEXEC, PathResolverConstants::FILE_MODE
+	);
+#endif
+}
+
+
+// Sets p to the local path of vpath, with its parent directory resolved in user
+//   space (as the *at system calls do).
+// Returns false if the parent directory is not in home, or vpath is "/".
+bool PathResolver::getFallbackPath(const std::string& vpath, fs::path& p) const {
+	const std::size_t slash = vpath.rfind('/');
+	if (slash == (vpath.size() - 1))
+		return false;
+	const std::string parentPath = ((slash == 0) ? std::string{"/"} : vpath.substr(0, slash));
+	boost::system::error_code ec;
+	const fs::path parent = fs::canonical(
+		home.getBoostPath() / PathResolverUtil::relative(parentPath), ec
+	);
+	if (ec || !PathResolverUtil::inHome(home.getBoostPath(), parent))
+		return false;
+	p = (parent / vpath.substr(slash + 1));
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "dir_scanner.h"
+#include "path.h"
+#include <chrono>
+#include <list>
+#include <string>
+
+
+struct User;
+
+
+// Resolves FTP pathnames beneath a user's home directory.
+// A pathname is first made a "virtual" path, which is absolute with "/" being
+//   the home directory, by lexically resolving "." and ".." against the working
+//   directory (".." of "/" is "/").
+// On Linux, a virtual path is then opened relative to the user's home
+//   directory fd with openat2(RESOLVE_BENEATH), so the kernel walks the path
+//   once and rejects any ".." or symbolic link leading out of home, instead of
+//   canonicalizing (an lstat per component) and comparing strings.
+// Handles of recently resolved directories are kept for a short time, so a
+//   burst of commands on the same directory resolves it once. A directory
+//   renamed by another session may be seen at its old path until then.
+// The working directory is held open, so commands on names in it (the usual
+//   case) do not resolve any path. File system changes are made with the *at
+//   system calls relative to the handle of the parent directory, which do not
+//   follow a symbolic link in the last component. If the working directory (or
+//   a directory it is in) is renamed or removed through this, cwd follows it,
+//   or moves up to the nearest directory that still exists.
+// Elsewhere (or if openat2 is unavailable), paths are canonicalized and
+//   checked to be in home.
+// A file may be uploaded atomically by writing it to a temporary file in the
+//   same directory (unnamed with O_TMPFILE, if supported), which replaces the
+//   destination once complete (see openTempFile()).
+// Not thread safe, so each session owns one.
+class PathResolver {
+public:
+	PathResolver();
+	PathResolver(const PathResolver&) = delete;
+	~PathResolver();
+	void setUser(const User&);
+	const std::string& getCWD(void) const;
+	static std::string normalize(const std::string&, const std::string&);
+	static std::string uniquePath(const std::string&);
+	Path getPath(const std::string&) const;
+	bool getDirPath(const std::string&, Path&);
+	bool stat(const std::string&, DirScanner::Entry&);
+	int getDir(const std::string&);
+	int openFile(const std::string&, const int);
+	bool changeDir(const std::string&);
+	bool makeDir(const std::string&);
+	bool removeDir(const std::string&);
+	bool removeFile(const std::string&);
+	bool rename(const std::string&, const std::string&, const bool = true);
+	int openTempFile(const std::string&, std::string&);
+	bool linkTempFile(const int, const std::string&, const std::string&, const bool = true);
+	static int openHome(const Path&);
+	static void closeHome(const int);
+	PathResolver& operator=(const PathResolver&) = delete;
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct DirHandle {
+		std::string path;	// virtual
+		Clock::time_point openTime;
+		int fd;		// O_PATH
+	};
+
+	typedef std::list<DirHandle> DirCache;
+
+	int getParent(const std::string&, std::string&);
+	int findDir(const std::string&);
+	void addDir(const std::string&, const int);
+	int openBeneath(const std::string&, const int);
+	int openFallback(const std::string&, const int) const;
+	bool getFallbackPath(const std::string&, boost::filesystem::path&) const;
+	void resetCWD(const std::string&);
+	void invalidate(const std::string&);
+
+	DirCache dirs;	// most recently used first
+	Path home;
+	std::string cwd;	// virtual path of working directory
+	int homeFd;		// owned by User, -1 if unavailable
+	int cwdFd;		// O_PATH handle of cwd, -1 if unavailable
+};
+
+
+inline
+const std::string& PathResolver::getCWD() const {
+	return cwd;
+}
@@ -1,21 +1,45 @@
 #include "pi.h"
 #include "asio_data.h"
+#include "checksum.h"
+#include "checksum_cache.h"
 #include "data_reader.h"
 #include "data_response.h"
 #include "data_writer.h"
+#include "dir_scanner.h"
+#include "file_reader.h"
+#include "listing_cache.h"
+#include "listing_format.h"
 #include "path.h"
+#include "path_resolver.h"
 #include "representation_type.h"
 #include "response.h"
 #include "server.h"
 #include "session.h"
+#include "thread_pool.h"
+#include "tls_context.h"
 #include "user.h"
 #include "utility.h"
-#include <algorithm>	// copy
+#include <algorithm>	// copy, max
 #include <cassert>
+#include <cstring>	// strlen
+#include <limits>
 #include <stdexcept>
+#include <cctype>		// toupper, isdigit
+#include <fcntl.h>		// O_RDONLY
+#include <sys/stat.h>	// fstat
+#ifdef __linux__
+#include <unistd.h>		// close
+#else
+#include <io.h>			// close
+#endif
 #include <utility>	// pair
 
 
+namespace PIConstants {
+	constexpr char STOU_NAME[] = "stou";	// unique names are based on it if STOU has no argument
+}
+
+
 namespace PIHelper {
 
 static std::pair<RepresentationType, bool> parseReprType(const std::string& type) {
@@ -38,10 +62,105 @@ static std::pair<RepresentationType, bool> parseReprType(const std::string& type
 	return ret;
 }
 
+
+// LIST arguments are often "ls" options (e.g. "-la"), which are not supported
+//   and are removed.
+static std::string stripListOptions(const std::string& arg) {
+	std::size_t i = 0;
+	while ((i < arg.size()) && (arg[i] == '-')) {
+		const std::size_t spIndex = arg.find(' ', i);
+		if (spIndex == std::string::npos)
+			return std::string{};
+		i = (spIndex + 1);
+	}
+	return arg.substr(i);
+}
+
+
+// RFC 959: a '"' in a quoted pathname is doubled
+static std::string escapePathname(const std::string& str) {
+	std::string ret;
+	for (const auto c : str) {
+		if (c == '"') {
+			ret.append(2, '"');
+		}
+		else {
+			ret.push_back(c);
+		}
+	}
+	return ret;
+}
+
+// Parses the decimal integer at the beginning of str. pos is set to the index
+//   after it.
+static std::pair<std::uint64_t, bool> parseUInt(const std::string& str, std::size_t& pos) {
+	const std::pair<std::uint64_t, bool> fail = std::make_pair(0, false);
+	std::uint64_t n = 0;
+	for (pos = 0; (pos < str.size()) && std::isdigit(static_cast<unsigned char>(str[pos])); ++pos) {
+		const std::uint64_t digit = static_cast<std::uint64_t>(str[pos] - '0');
+		if (n > ((std::numeric_limits<std::uint64_t>::max() - digit) / 10))
+			return fail;
+		n = (n * 10 + digit);
+	}
+	return ((pos == 0) ? fail : std::make_pair(n, true));
+}
+
+
+// ALLO argument: <decimal-integer> [R <decimal-integer>]
+// The record size is ignored, since files have no record structure.
+static std::pair<std::uint64_t, bool> parseAlloSize(const std::string& arg) {
+	std::size_t pos;
+	const std::pair<std::uint64_t, bool> sz = parseUInt(arg, pos);
+	if (sz.second && (pos < arg.size())) {
+		const std::string rest = arg.substr(pos);
+		if (
+			(rest.size() < 4) || (rest.compare(0, 3, " R ") != 0)
+			|| (rest.find_first_not_of("0123456789", 3) != std::string::npos)
+		) {
+			return std::make_pair(0, false);
+		}
+	}
+	return sz;
+}
+
+
+// REST argument (STREAM mode): <decimal-integer>
+static std::pair<std::uint64_t, bool> parseRestOffset(const std::string& arg) {
+	std::size_t pos;
+	const std::pair<std::uint64_t, bool> offset = parseUInt(arg, pos);
+	return ((pos == arg.size()) ? offset : std::make_pair(std::uint64_t{0}, false));
+}
+
+
+// Removes Telnet commands from a command line, such as the IP (interrupt
+//   process) and the DM of the Synch sent before ABOR. IAC IAC is an escaped
+//   0xFF.
+static void stripTelnet(std::string& str) {
+	constexpr unsigned char IAC = 255;
+	constexpr unsigned char WILL = 251;		// WILL, WONT, DO, and DONT have an option
+	if (str.find(static_cast<char>(IAC)) == std::string::npos)
+		return;
+	std::string ret;
+	for (std::size_t i = 0; i < str.size(); ++i) {
+		if (static_cast<unsigned char>(str[i]) != IAC) {
+			ret.push_back(str[i]);
+		}
+		else if (i + 1 < str.size()) {
+			const unsigned char cmd = static_cast<unsigned char>(str[i+1]);
+			if (cmd == IAC)
+				ret.push_back(str[i]);
+			i += ((cmd >= WILL) && (cmd != IAC)) ? 2 : 1;
+		}
+	}
+	str.swap(ret);
+}
+
 }	// namespace PIHelper
 
 
-PI::PI(Session& s) : session{s} {
+PI::PI(Session& s)
+: session{s}, alloSize{0}, restOffset{0}, hashAlgorithm{HashAlgorithm::MD5}, authPending{false},
+pbszSet{false}, finishing{false}, reading{false}, cmdHeld{false} {
 }
 
 
@@ -102,12 +221,45 @@ void PI::readCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 		assert(false);
 		return;
 	}
-	if (!updateReadInput(nBytes)) {
+	if (Server::instance()->getSocketOptions().controlQuickAck)
+		SocketTuning::quickAck(session.getPISocket());
+	if (!updateReadInput(inputBuffer, cmdStr, nBytes)) {
 		readSome();
 		return;
 	}
+	if (!holdDuringTransfer())
+		execute();
+}
+
+
+// Handles a command received while a transfer is in progress.
+// Returns false if there is no transfer, and the command should be executed.
+bool PI::holdDuringTransfer() {
+	std::lock_guard<std::mutex> guard{transferLock};
+	reading = false;
+	if (!transfer)
+		return false;
+	if (!finishing && !abortResp && (Command{cmdStr}.getName() == Command::Name::ABOR)) {
+		// The transfer finishes with an error once its data connection is shut
+		//   down. Its reply (426) is followed by the reply to ABOR (226).
+		abortResp = makeResponse();
+		transfer->aborted = true;
+		session.abortDataConnection();
+	}
+	else {
+		cmdHeld = true;
+	}
+	return true;
+}
+
+
+// Executes the command in cmdStr.
+void PI::execute() {
 	std::shared_ptr<Response> resp = makeResponse();
 	setDefaultCallback(resp);
+	// RNTO must immediately follow RNFR
+	std::string renameFrom;
+	renameFrom.swap(rnfrPath);
 	switch (resp->getCmd().getName()) {
 	case Command::Name::_INVALID:
 		resp->setCode(ReturnCode::syntaxError);
@@ -126,7 +278,7 @@ void PI::readCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 	case Command::Name::FEAT:
 		if (resp->getCmd().getArg().empty()) {
 			resp->setCode(ReturnCode::systemStatus);
-			resp->set(getFeaturesResp());
+			resp->set(getFeaturesResp(hashAlgorithm, (Server::instance()->getTlsContext() != nullptr)));
 		}
 		else {
 			resp->setCode(ReturnCode::argumentSyntaxError);
@@ -136,7 +288,7 @@ void PI::readCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 	case Command::Name::PWD:
 		if (resp->getCmd().getArg().empty()) {
 			resp->setCode(ReturnCode::pathnameCreated);
-			resp->append(Utility::quote(session.getCWD().pwd(session.getUser()->home)));
+			resp->append(Utility::quote(PIHelper::escapePathname(session.getCWD())));
 		}
 		else {
 			resp->setCode(ReturnCode::argumentSyntaxError);
@@ -169,51 +321,32 @@ void PI::readCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 		}
 		break;
 	case Command::Name::PASV:
-		if (resp->getCmd().getArg().empty()) {
-			resp->setCode(ReturnCode::enterPassiveMode);
-			session.passiveBegin(resp);
-			// response message will be set by above call
-		}
-		else {
+		if (!resp->getCmd().getArg().empty()) {
 			resp->setCode(ReturnCode::argumentSyntaxError);
 			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
 		}
-		break;
-	case Command::Name::MLSD:
-		// listing is sent through data connection
-		if (!session.getDTPSocket().is_open()) {
-			resp->setCode(ReturnCode::noDataConnection);
-			resp->append(ResponseString::reqDataConnection, sizeof(ResponseString::reqDataConnection)-1);
-		}
-		else if (resp->getCmd().getArg().empty()) {
-			// print cwd listing
-			std::shared_ptr<DataResponse> dataResp{new DataResponse{session}};
-			dataResp->cmdResp = resp;
-			session.setMLSDWriter(dataResp, session.getCWD());
-			if (!dataResp->dataWriter || !dataResp->dataWriter->good()) {
-				// unable to get directory listing
-				// TODO not implemented
-				assert(false);
-			}
-			// DTP should have set the writeCallback of dataResp
-			// PI should set the finish callback
-			setDefaultFinishCallback(dataResp->dataWriter);
-			resp->setCallback(
-				[this, dataResp](const AsioData& asioData, std::shared_ptr<Response> resp2) {
-					(void)resp2;	// dataResp already contains associated Response
-					writeCallback(asioData, dataResp);
-				}
-			);
-			resp->setCode(ReturnCode::fileOkayDataConn);
-			resp->append(ResponseString::incomingDirList, sizeof(ResponseString::incomingDirList)-1);
+		else if (Server::instance()->getTlsRequired() && !session.getDTP().getProtection()) {
+			resp->setCode(ReturnCode::dataProtectionDenied);
+			resp->append(ResponseString::protRequired, sizeof(ResponseString::protRequired)-1);
 		}
 		else {
-			// argument should be directory path
-			// TODO not implemented
-			resp->setCode(ReturnCode::syntaxError);
-			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+			resp->setCode(ReturnCode::enterPassiveMode);
+			session.passiveBegin(resp);
+			// response message will be set by above call
 		}
 		break;
+	case Command::Name::MLSD:
+		listing(resp, ListingFormat::MLSD);
+		break;
+	case Command::Name::LIST:
+		listing(resp, ListingFormat::LIST);
+		break;
+	case Command::Name::NLST:
+		listing(resp, ListingFormat::NLST);
+		break;
+	case Command::Name::MLST:
+		mlst(resp);
+		break;
 	case Command::Name::RETR:
 		if (resp->getCmd().getArg().empty()) {
 			resp->setCode(ReturnCode::argumentSyntaxError);
@@ -224,22 +357,31 @@ void PI::readCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 			resp->append(ResponseString::reqDataConnection, sizeof(ResponseString::reqDataConnection)-1);
 		}
 		else {
-			std::pair<Path, bool> reqPath = session.getUser()->home.get(resp->getCmd().getArg());
-			if (
-				!reqPath.second
-				|| !reqPath.first.isFile()
-				|| !reqPath.first.childOf(session.getUser()->home)
-			) {
+			const std::string reqPath = PathResolver::normalize(
+				session.getCWD(), resp->getCmd().getArg()
+			);
+			const std::uint64_t offset = restOffset;	// of REST, used once
+			restOffset = 0;
+			// resolved and opened at once, as a regular file
+			const int fd = session.getResolver().openFile(reqPath, O_RDONLY);
+			if (fd < 0) {
 				resp->setCode(ReturnCode::fileUnavailable);
 				resp->append(ResponseString::cannotOpenFile, sizeof(ResponseString::cannotOpenFile)-1);
 				break;
 			}
-			// valid file requested
+			struct stat st;
+			if ((offset > 0) && (::fstat(fd, &st) == 0) && S_ISREG(st.st_mode)
+			&& (offset > static_cast<std::uint64_t>(st.st_size))) {
+				::close(fd);
+				resp->setCode(ReturnCode::invalidRestParam);
+				resp->append(ResponseString::restFail, sizeof(ResponseString::restFail)-1);
+				break;
+			}
 			std::shared_ptr<DataResponse> dataResp{new DataResponse{session}};
 			dataResp->cmdResp = resp;
-			session.setFileWriter(dataResp, reqPath.first);
+			session.setFileWriter(dataResp, fd, offset);
 			if (!dataResp->dataWriter || !dataResp->dataWriter->good()) {
-				// error occurred when instantiating dataWriter
+				// not a regular file, or error occurred when instantiating dataWriter
 				resp->setCode(ReturnCode::fileUnavailable);
 				resp->append(ResponseString::cannotOpenFile, sizeof(ResponseString::cannotOpenFile)-1);
 				break;
@@ -253,42 +395,196 @@ void PI::readCallback(const boost::system::error_code& ec, std::size_t nBytes) {
 			);
 			resp->setCode(ReturnCode::fileOkayDataConn);
 			resp->append("Opening data connection for ");
-			resp->append(reqPath.first.fileName());
+			resp->append(reqPath.substr(reqPath.rfind('/') + 1));
 		}
 		break;
 	case Command::Name::STOR:
+	case Command::Name::APPE:
+	case Command::Name::STOU:
+		upload(resp);
+		break;
+	case Command::Name::CWD:
 		if (resp->getCmd().getArg().empty()) {
 			resp->setCode(ReturnCode::argumentSyntaxError);
 			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
 		}
-		else if (!session.getDTPSocket().is_open()) {
-			resp->setCode(ReturnCode::noDataConnection);
-			resp->append(ResponseString::reqDataConnection, sizeof(ResponseString::reqDataConnection)-1);
+		else if (session.getResolver().changeDir(
+			PathResolver::normalize(session.getCWD(), resp->getCmd().getArg())
+		)) {
+			resp->setCode(ReturnCode::fileActionOkay);
+			resp->append(ResponseString::cwdSuccess, sizeof(ResponseString::cwdSuccess)-1);
 		}
 		else {
-			std::shared_ptr<DataResponse> dataResp{new DataResponse{session}};
-			dataResp->cmdResp = resp;
-			session.setFileReader(dataResp, resp->getCmd().getArg());
-			// DTP should have set the readCallback of dataResp
-			// PI should set the finish callback
-			if (!dataResp->dataReader || !dataResp->dataReader->good()) {
-				session.closeDataConnection();
+			resp->setCode(ReturnCode::fileUnavailable);
+			resp->append(ResponseString::cwdFail, sizeof(ResponseString::cwdFail)-1);
+		}
+		break;
+	case Command::Name::CDUP:
+		if (!resp->getCmd().getArg().empty()) {
+			resp->setCode(ReturnCode::argumentSyntaxError);
+			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		}
+		else if (session.getResolver().changeDir(PathResolver::normalize(session.getCWD(), ".."))) {
+			resp->setCode(ReturnCode::fileActionOkay);
+			resp->append(ResponseString::cwdSuccess, sizeof(ResponseString::cwdSuccess)-1);
+		}
+		else {
+			resp->setCode(ReturnCode::fileUnavailable);
+			resp->append(ResponseString::cwdFail, sizeof(ResponseString::cwdFail)-1);
+		}
+		break;
+	case Command::Name::MKD:
+		if (resp->getCmd().getArg().empty()) {
+			resp->setCode(ReturnCode::argumentSyntaxError);
+			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		}
+		else {
+			const std::string reqPath = PathResolver::normalize(
+				session.getCWD(), resp->getCmd().getArg()
+			);
+			if (session.getResolver().makeDir(reqPath)) {
+				resp->setCode(ReturnCode::pathnameCreated);
+				resp->append(Utility::quote(PIHelper::escapePathname(reqPath)));
+				resp->append(Constants::SP);
+				resp->append(ResponseString::mkdSuccess, sizeof(ResponseString::mkdSuccess)-1);
+			}
+			else {
 				resp->setCode(ReturnCode::fileUnavailable);
-				resp->append(ResponseString::cannotOpenFile, sizeof(ResponseString::cannotOpenFile)-1);
-				break;
+				resp->append(ResponseString::mkdFail, sizeof(ResponseString::mkdFail)-1);
 			}
-			setDefaultFinishCallback(dataResp->dataReader);
-			resp->setCallback(
-				[this, dataResp](const AsioData& asioData, std::shared_ptr<Response> resp2) {
-					(void)resp2;	// dataResp already contains associated Response
-					writeCallback(asioData, dataResp);
-				}
+		}
+		break;
+	case Command::Name::RMD:
+		if (resp->getCmd().getArg().empty()) {
+			resp->setCode(ReturnCode::argumentSyntaxError);
+			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		}
+		else if (session.getResolver().removeDir(
+			PathResolver::normalize(session.getCWD(), resp->getCmd().getArg())
+		)) {
+			resp->setCode(ReturnCode::fileActionOkay);
+			resp->append(ResponseString::rmdSuccess, sizeof(ResponseString::rmdSuccess)-1);
+		}
+		else {
+			resp->setCode(ReturnCode::fileUnavailable);
+			resp->append(ResponseString::rmdFail, sizeof(ResponseString::rmdFail)-1);
+		}
+		break;
+	case Command::Name::DELE:
+		if (resp->getCmd().getArg().empty()) {
+			resp->setCode(ReturnCode::argumentSyntaxError);
+			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		}
+		else if (session.getResolver().removeFile(
+			PathResolver::normalize(session.getCWD(), resp->getCmd().getArg())
+		)) {
+			resp->setCode(ReturnCode::fileActionOkay);
+			resp->append(ResponseString::deleSuccess, sizeof(ResponseString::deleSuccess)-1);
+		}
+		else {
+			resp->setCode(ReturnCode::fileUnavailable);
+			resp->append(ResponseString::deleFail, sizeof(ResponseString::deleFail)-1);
+		}
+		break;
+	case Command::Name::RNFR:
+		if (resp->getCmd().getArg().empty()) {
+			resp->setCode(ReturnCode::argumentSyntaxError);
+			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		}
+		else {
+			const std::string reqPath = PathResolver::normalize(
+				session.getCWD(), resp->getCmd().getArg()
 			);
-			resp->setCode(ReturnCode::fileOkayDataConn);
-			resp->append("Opening data connection for ");
-			resp->append(resp->getCmd().getArg());	// TODO escape
+			DirScanner::Entry info{nullptr, 0, DirScanner::Type::OTHER, 0, 0};
+			if ((reqPath.size() > 1) && session.getResolver().stat(reqPath, info)) {
+				rnfrPath = reqPath;
+				resp->setCode(ReturnCode::fileActionPending);
+				resp->append(ResponseString::rnfrSuccess, sizeof(ResponseString::rnfrSuccess)-1);
+			}
+			else {
+				resp->setCode(ReturnCode::fileUnavailable);
+				resp->append(ResponseString::rnfrFail, sizeof(ResponseString::rnfrFail)-1);
+			}
 		}
 		break;
+	case Command::Name::RNTO:
+		if (resp->getCmd().getArg().empty()) {
+			resp->setCode(ReturnCode::argumentSyntaxError);
+			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		}
+		else if (renameFrom.empty()) {
+			resp->setCode(ReturnCode::badSequence);
+			resp->append(ResponseString::rntoNeedRnfr, sizeof(ResponseString::rntoNeedRnfr)-1);
+		}
+		else if (session.getResolver().rename(
+			renameFrom, PathResolver::normalize(session.getCWD(), resp->getCmd().getArg())
+		)) {
+			resp->setCode(ReturnCode::fileActionOkay);
+			resp->append(ResponseString::rntoSuccess, sizeof(ResponseString::rntoSuccess)-1);
+		}
+		else {
+			resp->setCode(ReturnCode::fileUnavailable);
+			resp->append(ResponseString::rntoFail, sizeof(ResponseString::rntoFail)-1);
+		}
+		break;
+	case Command::Name::SIZE:
+	case Command::Name::MDTM:
+		fileStatus(resp);
+		break;
+	case Command::Name::HASH:
+	case Command::Name::XMD5:
+	case Command::Name::XCRC:
+		// responds once the checksum is known
+		fileChecksum(resp);
+		return;
+	case Command::Name::OPTS:
+		options(resp);
+		break;
+	case Command::Name::REST:
+		{
+			const std::pair<std::uint64_t, bool> offset = PIHelper::parseRestOffset(
+				resp->getCmd().getArg()
+			);
+			if (!offset.second) {
+				resp->setCode(ReturnCode::argumentSyntaxError);
+				resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+				break;
+			}
+			restOffset = offset.first;
+			resp->setCode(ReturnCode::fileActionPending);
+			resp->append("Restart position accepted (");
+			resp->append(std::to_string(restOffset));
+			resp->append(").");
+		}
+		break;
+	case Command::Name::ALLO:
+		{
+			const std::pair<std::uint64_t, bool> sz = PIHelper::parseAlloSize(resp->getCmd().getArg());
+			if (!sz.second) {
+				resp->setCode(ReturnCode::argumentSyntaxError);
+				resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+				break;
+			}
+			alloSize = sz.first;
+			resp->setCode(ReturnCode::commandOkay);
+			resp->append(ResponseString::alloSuccess, sizeof(ResponseString::alloSuccess)-1);
+		}
+		break;
+	case Command::Name::ABOR:
+		// no transfer in progress (see holdDuringTransfer)
+		resp->setCode(ReturnCode::closeDataConn);
+		resp->append(ResponseString::aborNoTransfer, sizeof(ResponseString::aborNoTransfer)-1);
+		break;
+	case Command::Name::AUTH:
+		auth(resp);
+		break;
+	case Command::Name::PBSZ:
+	case Command::Name::PROT:
+		dataProtection(resp);
+		break;
+	case Command::Name::STAT:
+		status(resp);
+		break;
 	case Command::Name::SYST:
 		if (resp->getCmd().getArg().empty()) {
 			resp->setCode(ReturnCode::systemType);
@@ -318,12 +614,25 @@ void PI::writeCallback(const AsioData& asioData, std::shared_ptr<Response> resp)
 	}
 	switch (resp->getCmd().getName()) {
 	case Command::Name::PASV:
-		// DTP has set up acceptor and is already listening.
+		// DTP has set up acceptor and is already listening (unless refused).
 		// Accept the expected incoming connection.
-		session.passiveAccept();
+		if (resp->getCode() == ReturnCode::enterPassiveMode) {
+			session.passiveAccept();
+			break;
+		}
+		readSome();
 		break;
 	default:
-		readSome();
+		if (authPending) {
+			secureControl(
+				[this]() {
+					readSome();
+				}
+			);
+		}
+		else {
+			readSome();
+		}
 		break;
 	}
 }
@@ -336,7 +645,7 @@ std::size_t nBytes, std::shared_ptr<LoginData> data) {
 		assert(false);
 		return;
 	}
-	if (!updateReadInput(nBytes)) {
+	if (!updateReadInput(inputBuffer, cmdStr, nBytes)) {
 		readSome(data);
 		return;
 	}
@@ -349,14 +658,27 @@ std::size_t nBytes, std::shared_ptr<LoginData> data) {
 	switch (data->state) {
 	case LoginData::State::READ_USER:
 		// check if input buffer contains a finished command
-		if (resp->getCmd().getName() == Command::Name::USER) {
+		if (resp->getCmd().getName() == Command::Name::AUTH) {
+			auth(resp);
+		}
+		else if ((resp->getCmd().getName() == Command::Name::FEAT) && resp->getCmd().getArg().empty()) {
+			// clients look for AUTH TLS before logging in
+			resp->setCode(ReturnCode::systemStatus);
+			resp->set(getFeaturesResp(hashAlgorithm, (Server::instance()->getTlsContext() != nullptr)));
+		}
+		else if ((resp->getCmd().getName() == Command::Name::USER) && Server::instance()->getTlsRequired()
+		&& !session.getPIStream().secure()) {
+			resp->setCode(ReturnCode::notLoggedIn);
+			resp->append(ResponseString::authRequired, sizeof(ResponseString::authRequired)-1);
+		}
+		else if (resp->getCmd().getName() == Command::Name::USER) {
 			data->username = resp->getCmd().getArg();
 			data->state = LoginData::State::RESP_USER;
 			resp->setCode(ReturnCode::userOkNeedPass);
 			resp->append(ResponseString::loginReqPass, sizeof(ResponseString::loginReqPass)-1);
 		}
 		else {
-			// until logged in, ignore all commands except USER and PASS
+			// until logged in, ignore all commands except AUTH, FEAT, USER, and PASS
 			resp->setCode(ReturnCode::notLoggedIn);
 			resp->append(ResponseString::loginRequest, sizeof(ResponseString::loginRequest)-1);
 		}
@@ -366,20 +688,14 @@ std::size_t nBytes, std::shared_ptr<LoginData> data) {
 		if (resp->getCmd().getName() == Command::Name::PASS) {
 			data->password = resp->getCmd().getArg();
 			data->state = LoginData::State::RESP_PASS;
-			// validate login
-			data->user = Server::instance()->getUser(data->username, data->password);
-			if (data->user != nullptr) {
-				// valid login provided, set Session state
-				session.setUser(data->user);
-				resp->setCode(ReturnCode::loggedIn);
-				resp->append(ResponseString::loginSuccess, sizeof(ResponseString::loginSuccess)-1);
-			}
-			else {
-				// incorrect login, reset state
-				data->state = LoginData::State::READ_USER;
-				resp->setCode(ReturnCode::notLoggedIn);
-				resp->append(ResponseString::loginIncorrect, sizeof(ResponseString::loginIncorrect)-1);
-			}
+			// validate login, possibly on another thread
+			// Nothing is read until the response is sent.
+			Server::instance()->verifyUser(data->username, data->password,
+				[this, resp, data](User* user) mutable {
+					loginResult(resp, data, user);
+				}
+			);
+			return;
 		}
 		else {
 			// Reset state to beginning since PASS must be provided
@@ -399,6 +715,28 @@ std::size_t nBytes, std::shared_ptr<LoginData> data) {
 }
 
 
+// Responds to PASS.
+void PI::loginResult(std::shared_ptr<Response>& resp, std::shared_ptr<LoginData> data, User* user) {
+	data->password.clear();
+	data->user = user;
+	if (data->user != nullptr) {
+		// valid login provided, set Session state
+		session.setUser(data->user);
+		Server::instance()->getMetrics().count(Metrics::Counter::LOGINS);
+		resp->setCode(ReturnCode::loggedIn);
+		resp->append(ResponseString::loginSuccess, sizeof(ResponseString::loginSuccess)-1);
+	}
+	else {
+		// incorrect login, reset state
+		data->state = LoginData::State::READ_USER;
+		Server::instance()->getMetrics().count(Metrics::Counter::LOGIN_FAILURES);
+		resp->setCode(ReturnCode::notLoggedIn);
+		resp->append(ResponseString::loginIncorrect, sizeof(ResponseString::loginIncorrect)-1);
+	}
+	resp->send();
+}
+
+
 void PI::writeCallback(const AsioData& asioData, std::shared_ptr<Response> resp,
 std::shared_ptr<LoginData> data) {
 	if (asioData.ec.value() != 0) {
@@ -412,9 +750,18 @@ std::shared_ptr<LoginData> data) {
 	}
 	switch (data->state) {
 	case LoginData::State::READ_USER:
-		// A response was sent (welcome message, invalid login, invalid command),
-		//   so keep trying to read USER command.
-		readSome(data);
+		// A response was sent (welcome message, invalid login, invalid command,
+		//   AUTH), so keep trying to read USER command.
+		if (authPending) {
+			secureControl(
+				[this, data]() {
+					readSome(data);
+				}
+			);
+		}
+		else {
+			readSome(data);
+		}
 		break;
 	case LoginData::State::RESP_USER:
 		// response to USER command was sent, now read PASS
@@ -447,18 +794,31 @@ void PI::writeCallback(const AsioData& asioData, std::shared_ptr<DataResponse> d
 		dataResp->cmdResp->writeSome();
 		return;
 	}
+	{
+		// read commands (ABOR) during transfer
+		std::lock_guard<std::mutex> guard{transferLock};
+		transfer = dataResp;
+		reading = true;
+	}
+	readSome();
 	switch (dataResp->cmdResp->getCmd().getName()) {
+	// Transfers are started by the data threads (see Server::getControlService).
 	case Command::Name::MLSD:
-		// Initial response to MLSD has been sent. Now send listing.
-		dataResp->dataWriter->send();
-		break;
+	case Command::Name::LIST:
+	case Command::Name::NLST:
+		// Initial response to listing command has been sent. Now send listing.
 	case Command::Name::RETR:
 		// Initial response to RETR has been sent. Now send file.
-		dataResp->dataWriter->send();
-		break;
 	case Command::Name::STOR:
+	case Command::Name::APPE:
+	case Command::Name::STOU:
 		// Initial response to STOR has been sent. Now receive file.
-		dataResp->dataReader->receive();
+		// The data connection is secured first if PROT P.
+		Server::instance()->getService().post(
+			[this, dataResp]() {
+				session.beginTransfer(dataResp);
+			}
+		);
 		break;
 	default:
 		assert(false);
@@ -468,79 +828,585 @@ void PI::writeCallback(const AsioData& asioData, std::shared_ptr<DataResponse> d
 
 
 void PI::finishCallbackW(const AsioData& asioData, std::shared_ptr<DataResponse> dataResp) {
-	if ((asioData.ec.value() != 0) || !dataResp->dataWriter->done()) {
-		// TODO
-		assert(false);
-		return;
+	// Since finished writing over data connection, close data connection.
+	session.closeDataConnection();
+	std::shared_ptr<Response> resp = dataResp->cmdResp;
+	resp->clear();
+	if (dataResp->aborted || (asioData.ec.value() != 0)) {
+		// ABOR, or data connection failed
+		resp->setCode(ReturnCode::transferAborted);
+		resp->append(ResponseString::transAborted, sizeof(ResponseString::transAborted)-1);
 	}
-	switch (dataResp->cmdResp->getCmd().getName()) {
-	case Command::Name::MLSD:
-		// MLSD data response has been successfully sent.
-		// Send success response over command connection.
-		// Since finished writing over data connection, close data connection.
-		session.closeDataConnection();
-		{
-			std::shared_ptr<Response> resp = dataResp->cmdResp;
-			resp->clear();
-			setDefaultCallback(resp);
+	else if (!dataResp->dataWriter->done()) {
+		// file could not be read
+		resp->setCode(ReturnCode::localError);
+		resp->append(ResponseString::readFail, sizeof(ResponseString::readFail)-1);
+	}
+	else {
+		switch (resp->getCmd().getName()) {
+		case Command::Name::MLSD:
+		case Command::Name::LIST:
+		case Command::Name::NLST:
+			// Listing data response has been successfully sent.
 			resp->setCode(ReturnCode::closeDataConn);
 			resp->append(ResponseString::dirListSuccess, sizeof(ResponseString::dirListSuccess)-1);
-			resp->send();
-		}
-		break;
-	case Command::Name::RETR:
-		session.closeDataConnection();
-		{
-			std::shared_ptr<Response> resp = dataResp->cmdResp;
-			resp->clear();
-			setDefaultCallback(resp);
+			break;
+		case Command::Name::RETR:
 			resp->setCode(ReturnCode::closeDataConn);
 			resp->append(ResponseString::transComplete, sizeof(ResponseString::transComplete)-1);
-			resp->send();
+			break;
+		default:
+			assert(false);
+			break;
 		}
-		break;
-	default:
-		assert(false);
-		break;
 	}
+	sendTransferReply(resp);
 }
 
 
 void PI::finishCallbackR(const AsioData& asioData, std::shared_ptr<DataResponse> dataResp) {
-	if (asioData.ec.value() != 0) {
-		if (dataResp->dataReader->done()) {
+	session.closeDataConnection();
+	std::shared_ptr<Response> resp = dataResp->cmdResp;
+	resp->clear();
+	if (dataResp->aborted || ((asioData.ec.value() != 0) && !dataResp->dataReader->done())) {
+		// ABOR, or data connection failed (an incomplete file is kept, unless
+		//   the upload is atomic)
+		resp->setCode(ReturnCode::transferAborted);
+		resp->append(ResponseString::transAborted, sizeof(ResponseString::transAborted)-1);
+	}
+	else if (dataResp->dataReader->good()) {
+		resp->setCode(ReturnCode::closeDataConn);
+		resp->append(ResponseString::transComplete, sizeof(ResponseString::transComplete)-1);
+	}
+	else {
+		// file could not be written (or synced)
+		resp->setCode(ReturnCode::localError);
+		resp->append(ResponseString::writeFail, sizeof(ResponseString::writeFail)-1);
+	}
+	sendTransferReply(resp);
+}
 
+
+// Sends the last reply of the transfer in progress.
+// Called by a data thread.
+void PI::sendTransferReply(std::shared_ptr<Response>& resp) {
+	{
+		std::lock_guard<std::mutex> guard{transferLock};
+		finishing = true;
+	}
+	resp->setCallback(
+		[this](const AsioData& asioData, std::shared_ptr<Response> resp2) {
+			transferReplyCallback(asioData, resp2);
 		}
-		else {
-			// TODO
-			assert(false);
-			return;
+	);
+	resp->send();
+}
+
+
+// The last reply of a transfer (or the reply to its ABOR) has been sent.
+void PI::transferReplyCallback(const AsioData& asioData, std::shared_ptr<Response> resp) {
+	if (asioData.ec.value() != 0) {
+		// TODO
+		assert(false);
+		return;
+	}
+	if (!resp->done()) {
+		resp->writeSome();
+		return;
+	}
+	std::unique_lock<std::mutex> guard{transferLock};
+	std::shared_ptr<Response> aborResp;
+	aborResp.swap(abortResp);
+	if (aborResp) {
+		guard.unlock();
+		aborResp->setCode(ReturnCode::closeDataConn);
+		aborResp->append(ResponseString::aborSuccess, sizeof(ResponseString::aborSuccess)-1);
+		aborResp->setCallback(
+			[this](const AsioData& asioData2, std::shared_ptr<Response> resp2) {
+				transferReplyCallback(asioData2, resp2);
+			}
+		);
+		aborResp->send();
+		return;
+	}
+	transfer.reset();
+	finishing = false;
+	const bool held = cmdHeld;
+	const bool stillReading = reading;
+	cmdHeld = false;
+	guard.unlock();
+	if (held)
+		execute();
+	else if (!stillReading)
+		readSome();
+}
+
+
+// STOR, APPE, and STOU
+// STOR replaces the file, unless after REST, from which it writes over the
+//   file. APPE writes from the end of the file (or the REST offset).
+// STOU stores a new file, with the unique name replied in the 150 reply
+//   (RFC 1123), based on the argument if given.
+// With atomic uploads, STOR (without REST) and STOU write to a temporary file,
+//   which is linked into place once complete.
+void PI::upload(std::shared_ptr<Response>& resp) {
+	const Command::Name cmd = resp->getCmd().getName();
+	const std::string& arg = resp->getCmd().getArg();
+	// of ALLO and REST, used once
+	const std::uint64_t sizeHint = alloSize;
+	const std::uint64_t offset = restOffset;
+	alloSize = 0;
+	restOffset = 0;
+	if (arg.empty() && (cmd != Command::Name::STOU)) {
+		resp->setCode(ReturnCode::argumentSyntaxError);
+		resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		return;
+	}
+	if (!session.getDTPSocket().is_open()) {
+		resp->setCode(ReturnCode::noDataConnection);
+		resp->append(ResponseString::reqDataConnection, sizeof(ResponseString::reqDataConnection)-1);
+		return;
+	}
+	PathResolver& resolver = session.getResolver();
+	UploadTarget target;
+	target.sizeHint = sizeHint;
+	if (cmd == Command::Name::STOU) {
+		target.path = PathResolver::uniquePath(PathResolver::normalize(
+			session.getCWD(), (arg.empty() ? std::string{PIConstants::STOU_NAME} : arg)
+		));
+		target.replace = false;
+	}
+	else {
+		target.path = PathResolver::normalize(session.getCWD(), arg);
+	}
+	const bool resume = ((cmd == Command::Name::APPE) || (offset > 0));
+	if (!resume && Server::instance()->getAtomicUploads()) {
+		target.atomic = true;
+		target.fd = resolver.openTempFile(target.path, target.tmpPath);
+	}
+	else if (cmd == Command::Name::STOU) {
+		// the name is unique, so it is not retried
+		target.fd = resolver.openFile(target.path, O_WRONLY | O_CREAT | O_EXCL);
+	}
+	else if (!resume) {
+		target.fd = resolver.openFile(target.path, O_WRONLY | O_CREAT | O_TRUNC);
+	}
+	else {
+		// APPE may create the file, STOR after REST resumes an existing one
+		const int flags = ((cmd == Command::Name::APPE) ? (O_WRONLY | O_CREAT) : O_WRONLY);
+		target.fd = resolver.openFile(target.path, flags);
+		struct stat st;
+		if ((target.fd >= 0) && (::fstat(target.fd, &st) == 0)) {
+			const std::uint64_t fileSz = static_cast<std::uint64_t>(st.st_size);
+			// Data is written at explicit offsets rather than with O_APPEND,
+			//   since the writer pool may write buffers concurrently.
+			target.offset = (((cmd == Command::Name::APPE) && (offset == 0)) ? fileSz : offset);
+			if (offset > fileSz) {
+				::close(target.fd);
+				session.closeDataConnection();
+				resp->setCode(ReturnCode::invalidRestParam);
+				resp->append(ResponseString::restFail, sizeof(ResponseString::restFail)-1);
+				return;
+			}
 		}
 	}
-	switch (dataResp->cmdResp->getCmd().getName()) {
-	case Command::Name::STOR:
+	if (target.fd < 0) {
 		session.closeDataConnection();
-		{
-			std::shared_ptr<Response> resp = dataResp->cmdResp;
-			resp->clear();
-			setDefaultCallback(resp);
-			resp->setCode(ReturnCode::closeDataConn);
-			resp->append(ResponseString::transComplete, sizeof(ResponseString::transComplete)-1);
-			resp->send();
+		resp->setCode(ReturnCode::fileUnavailable);
+		resp->append(ResponseString::cannotOpenFile, sizeof(ResponseString::cannotOpenFile)-1);
+		return;
+	}
+	std::shared_ptr<DataResponse> dataResp{new DataResponse{session}};
+	dataResp->cmdResp = resp;
+	session.setFileReader(dataResp, target);
+	// DTP should have set the readCallback of dataResp
+	// PI should set the finish callback
+	setDefaultFinishCallback(dataResp->dataReader);
+	resp->setCallback(
+		[this, dataResp](const AsioData& asioData, std::shared_ptr<Response> resp2) {
+			(void)resp2;	// dataResp already contains associated Response
+			writeCallback(asioData, dataResp);
 		}
-		break;
-	default:
-		assert(false);
-		break;
+	);
+	resp->setCode(ReturnCode::fileOkayDataConn);
+	if (cmd == Command::Name::STOU) {
+		resp->append("FILE: ");
+		resp->append(target.path.substr(target.path.rfind('/') + 1));	// TODO escape
+	}
+	else {
+		resp->append("Opening data connection for ");
+		resp->append(arg);	// TODO escape
+	}
+}
+
+
+// MLSD, LIST, and NLST
+// The argument (optional) is the directory to list. LIST and NLST also accept
+//   a file, which is listed as a single entry.
+void PI::listing(std::shared_ptr<Response>& resp, const ListingFormat format) {
+	// listing is sent through data connection
+	if (!session.getDTPSocket().is_open()) {
+		resp->setCode(ReturnCode::noDataConnection);
+		resp->append(ResponseString::reqDataConnection, sizeof(ResponseString::reqDataConnection)-1);
+		return;
+	}
+	const std::string arg = ((format == ListingFormat::LIST)
+		? PIHelper::stripListOptions(resp->getCmd().getArg())
+		: resp->getCmd().getArg());
+	PathResolver& resolver = session.getResolver();
+	const std::string reqPath = PathResolver::normalize(session.getCWD(), arg);
+	DirScanner::Entry info{nullptr, 0, DirScanner::Type::OTHER, 0, 0};
+	if (!resolver.stat(reqPath, info) || (info.type == DirScanner::Type::OTHER)) {
+		resp->setCode(ReturnCode::fileUnavailable);
+		resp->append(ResponseString::cannotOpenDir, sizeof(ResponseString::cannotOpenDir)-1);
+		return;
+	}
+	if ((format == ListingFormat::MLSD) && (info.type != DirScanner::Type::DIRECTORY)) {
+		// RFC 3659: MLSD of a file is an error, MLST lists it
+		resp->setCode(ReturnCode::argumentSyntaxError);
+		resp->append(ResponseString::notDirectory, sizeof(ResponseString::notDirectory)-1);
+		return;
+	}
+	// A directory is listed (and cached) by its canonical path, a file by the
+	//   name it was given.
+	Path path = resolver.getPath(reqPath);
+	if ((info.type == DirScanner::Type::DIRECTORY) && !resolver.getDirPath(reqPath, path)) {
+		resp->setCode(ReturnCode::fileUnavailable);
+		resp->append(ResponseString::cannotOpenDir, sizeof(ResponseString::cannotOpenDir)-1);
+		return;
+	}
+	std::shared_ptr<DataResponse> dataResp{new DataResponse{session}};
+	dataResp->cmdResp = resp;
+	// stat() has cached the handle of a directory, so this does not resolve it again
+	const int dirHandle = ((info.type == DirScanner::Type::DIRECTORY) ? resolver.getDir(reqPath) : -1);
+	session.setListingWriter(dataResp, path, format, info, dirHandle);
+	if (!dataResp->dataWriter || !dataResp->dataWriter->good()) {
+		// unable to get directory listing
+		resp->setCode(ReturnCode::fileUnavailable);
+		resp->append(ResponseString::cannotOpenDir, sizeof(ResponseString::cannotOpenDir)-1);
+		return;
+	}
+	// DTP should have set the writeCallback of dataResp
+	// PI should set the finish callback
+	setDefaultFinishCallback(dataResp->dataWriter);
+	resp->setCallback(
+		[this, dataResp](const AsioData& asioData, std::shared_ptr<Response> resp2) {
+			(void)resp2;	// dataResp already contains associated Response
+			writeCallback(asioData, dataResp);
+		}
+	);
+	resp->setCode(ReturnCode::fileOkayDataConn);
+	resp->append(ResponseString::incomingDirList, sizeof(ResponseString::incomingDirList)-1);
+}
+
+
+// MLST
+// The facts of a single file or directory are sent over the control connection,
+//   so only that entry is stat'ed.
+void PI::mlst(std::shared_ptr<Response>& resp) {
+	const std::string& arg = resp->getCmd().getArg();
+	const std::string reqPath = PathResolver::normalize(session.getCWD(), arg);
+	DirScanner::Entry info{nullptr, 0, DirScanner::Type::OTHER, 0, 0};
+	if (!session.getResolver().stat(reqPath, info) || (info.type == DirScanner::Type::OTHER)) {
+		resp->setCode(ReturnCode::fileUnavailable);
+		resp->append(ResponseString::cannotOpenFile, sizeof(ResponseString::cannotOpenFile)-1);
+		return;
+	}
+	// pathname as given, or the cwd
+	const std::string& name = (arg.empty() ? session.getCWD() : arg);
+	info.name = name.c_str();
+	info.nameSz = name.size();
+	std::unique_ptr<char[]> entryBuf{new char[ListingFormatter::maxEntrySz(name.size())]};
+	ListingFormatter formatter{ListingFormat::MLSD};
+	const char* const entryBegin = entryBuf.get();
+	const char* const entryEnd = formatter.mlsdEntry(entryBuf.get(), info);
+	/*
+	250-Listing <pathname>
+	 <facts> <pathname>
+	250 End
+	*/
+	std::string str{std::to_string(ReturnCode::fileActionOkay)};
+	str.append("-Listing ");
+	str.append(name);
+	str.append(Constants::EOL);
+	str.append(Constants::SP);
+	str.append(entryBegin, entryEnd);
+	str.append(std::to_string(ReturnCode::fileActionOkay));
+	str.append(Constants::SP);
+	str.append(ResponseString::listingEnd, sizeof(ResponseString::listingEnd)-1);
+	str.append(Constants::EOL);
+	resp->setCode(ReturnCode::fileActionOkay);
+	resp->set(str);
+}
+
+
+// SIZE and MDTM (https://tools.ietf.org/html/rfc3659)
+// Only regular files have a size or modification time.
+void PI::fileStatus(std::shared_ptr<Response>& resp) {
+	const bool isSize = (resp->getCmd().getName() == Command::Name::SIZE);
+	const std::string& arg = resp->getCmd().getArg();
+	DirScanner::Entry info{nullptr, 0, DirScanner::Type::OTHER, 0, 0};
+	if (arg.empty()) {
+		resp->setCode(ReturnCode::argumentSyntaxError);
+		resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+	}
+	else if (
+		!statFile(PathResolver::normalize(session.getCWD(), arg), info)
+		|| (info.type != DirScanner::Type::REGULAR)
+	) {
+		resp->setCode(ReturnCode::fileUnavailable);
+		if (isSize)
+			resp->append(ResponseString::sizeFail, sizeof(ResponseString::sizeFail)-1);
+		else
+			resp->append(ResponseString::mdtmFail, sizeof(ResponseString::mdtmFail)-1);
+	}
+	else {
+		// 213 <size> or 213 YYYYMMDDHHMMSS
+		char buf[std::max(ListingFormatter::UINT_MAX_SZ, ListingFormatter::TIME_SZ)];
+		const char* const end = (isSize
+			? ListingFormatter::writeUInt(buf, info.size)
+			: ListingFormatter{ListingFormat::MLSD}.writeTime(buf, info.modify));
+		resp->setCode(ReturnCode::fileStatus);
+		resp->append(buf, static_cast<std::size_t>(end - buf));
+	}
+}
+
+
+// Stats the file at virtual path vpath, through the server's ListingCache if
+//   any, so clients probing the size or time of many files (e.g. to resume or
+//   synchronize) do not stat each one every time.
+// The parent directory is still resolved (usually from the resolver's handle
+//   cache), since the cache is keyed by canonical local path and shared by all
+//   users.
+// Only the size and modify of a REGULAR info are set on a cache hit.
+bool PI::statFile(const std::string& vpath, DirScanner::Entry& info) {
+	PathResolver& resolver = session.getResolver();
+	ListingCache* cache = Server::instance()->getListingCache();
+	const std::size_t slashIndex = vpath.rfind('/');
+	if (!cache || (slashIndex == std::string::npos) || ((slashIndex + 1) == vpath.size()))
+		return resolver.stat(vpath, info);	// root
+	const std::string dirPath = ((slashIndex == 0) ? std::string{"/"} : vpath.substr(0, slashIndex));
+	const std::string name = vpath.substr(slashIndex + 1);
+	Path dir;
+	if (!resolver.getDirPath(dirPath, dir))
+		return false;
+	ListingCache::FileInfo fileInfo;
+	if (cache->getFileInfo(dir, name, fileInfo)) {
+		info.type = DirScanner::Type::REGULAR;
+		info.size = fileInfo.size;
+		info.modify = fileInfo.modify;
+		return true;
 	}
+	const ListingCache::FillToken token = cache->beginFill(dir);
+	if (!resolver.stat(vpath, info))
+		return false;
+	if (info.type == DirScanner::Type::REGULAR) {
+		ListingCache::FileInfoBatch batch;
+		batch.emplace_back(name, ListingCache::FileInfo{info.size, info.modify});
+		cache->putFileInfo(dir, token, std::move(batch));
+	}
+	return true;
 }
 
 
-// Updates members inputBuffer and cmdStr.
+// HASH (https://tools.ietf.org/html/draft-bryan-ftp-hash), XMD5, and XCRC
+// Checksums are cached (see ChecksumCache). A checksum that is not cached is
+//   computed on the checksum pool (if any, or else by a data thread), since
+//   the whole file is read, and the response is sent once it is done.
+void PI::fileChecksum(std::shared_ptr<Response> resp) {
+	HashAlgorithm algorithm = hashAlgorithm;
+	if (resp->getCmd().getName() == Command::Name::XMD5)
+		algorithm = HashAlgorithm::MD5;
+	else if (resp->getCmd().getName() == Command::Name::XCRC)
+		algorithm = HashAlgorithm::CRC32;
+	const std::string& arg = resp->getCmd().getArg();
+	if (arg.empty()) {
+		resp->setCode(ReturnCode::argumentSyntaxError);
+		resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+		resp->send();
+		return;
+	}
+	const int fd = session.getResolver().openFile(
+		PathResolver::normalize(session.getCWD(), arg), O_RDONLY
+	);
+	struct stat st;
+	if ((fd < 0) || (::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+		if (fd >= 0)
+			::close(fd);
+		checksumResult(resp, algorithm, 0, std::string{});
+		return;
+	}
+	const ChecksumCache::FileStamp stamp = ChecksumCache::getStamp(st);
+	std::string value;
+	if (ChecksumCache::get(fd, algorithm, stamp, value)) {
+		::close(fd);
+		checksumResult(resp, algorithm, stamp.size, value);
+		return;
+	}
+	const auto compute = [this, resp, fd, algorithm, stamp]() {
+		std::string computed;
+		if (!ChecksumCache::compute(fd, algorithm, stamp, computed))
+			computed.clear();
+		::close(fd);
+		Server::instance()->getControlService().post(
+			[this, resp, algorithm, stamp, computed]() mutable {
+				checksumResult(resp, algorithm, stamp.size, computed);
+			}
+		);
+	};
+	// never on the control thread, which every session's commands wait for
+	ThreadPool* pool = Server::instance()->getChecksumPool();
+	if (pool)
+		pool->post(compute);
+	else
+		Server::instance()->getService().post(compute);
+}
+
+
+// Sends the response of HASH, XMD5, or XCRC.
+// value is empty if the checksum could not be computed.
+void PI::checksumResult(std::shared_ptr<Response>& resp, const HashAlgorithm algorithm,
+const std::int64_t fileSz, const std::string& value) {
+	if (value.empty()) {
+		resp->setCode(ReturnCode::fileUnavailable);
+		resp->append(ResponseString::checksumFail, sizeof(ResponseString::checksumFail)-1);
+	}
+	else if (resp->getCmd().getName() == Command::Name::HASH) {
+		// 213 <algorithm> <start>-<end> <checksum> <pathname>
+		resp->setCode(ReturnCode::fileStatus);
+		resp->append(std::string{Checksum::getName(algorithm)} + " 0-" + std::to_string(fileSz)
+			+ Constants::SP + value + Constants::SP + resp->getCmd().getArg());
+	}
+	else {
+		// clients of XMD5 and XCRC expect uppercase
+		std::string upper{value};
+		for (auto& c : upper)
+			c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+		resp->setCode(ReturnCode::fileActionOkay);
+		resp->append(upper);
+	}
+	resp->send();
+}
+
+
+// OPTS HASH [<algorithm>] selects the algorithm of HASH, or shows the
+//   selected one.
+void PI::options(std::shared_ptr<Response>& resp) {
+	const std::string& arg = resp->getCmd().getArg();
+	const std::size_t spIndex = arg.find(' ');
+	std::string option = arg.substr(0, spIndex);
+	for (auto& c : option)
+		c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	if (option != "HASH") {
+		resp->setCode(ReturnCode::argumentSyntaxError);
+		resp->append(ResponseString::unknownOption, sizeof(ResponseString::unknownOption)-1);
+		return;
+	}
+	if ((spIndex != std::string::npos) && !Checksum::parseName(arg.substr(spIndex + 1), hashAlgorithm)) {
+		resp->setCode(ReturnCode::paramNotImplemented);
+		resp->append(ResponseString::unknownAlgorithm, sizeof(ResponseString::unknownAlgorithm)-1);
+		return;
+	}
+	resp->setCode(ReturnCode::commandOkay);
+	resp->append(Checksum::getName(hashAlgorithm), std::strlen(Checksum::getName(hashAlgorithm)));
+}
+
+
+// AUTH TLS (RFC 4217), of which TLS-C and SSL are synonyms. Once the reply is
+//   sent, the control connection is secured by secureControl().
+void PI::auth(std::shared_ptr<Response>& resp) {
+	std::string mechanism = resp->getCmd().getArg();
+	for (auto& c : mechanism)
+		c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	if (Server::instance()->getTlsContext() == nullptr) {
+		resp->setCode(ReturnCode::notImplemented);
+		resp->append(ResponseString::authUnavailable, sizeof(ResponseString::authUnavailable)-1);
+	}
+	else if (session.getPIStream().secure()) {
+		resp->setCode(ReturnCode::badSequence);
+		resp->append(ResponseString::authDone, sizeof(ResponseString::authDone)-1);
+	}
+	else if ((mechanism != "TLS") && (mechanism != "TLS-C") && (mechanism != "SSL")) {
+		resp->setCode(ReturnCode::paramNotImplemented);
+		resp->append(ResponseString::authUnknown, sizeof(ResponseString::authUnknown)-1);
+	}
+	else {
+		authPending = true;
+		resp->setCode(ReturnCode::authOkay);
+		resp->append(ResponseString::authSuccess, sizeof(ResponseString::authSuccess)-1);
+	}
+}
+
+
+// TLS handshake of the control connection, after the reply to AUTH TLS. Then
+//   next is called, or the connection is closed if the handshake failed.
+void PI::secureControl(std::function<void(void)>&& next) {
+	authPending = false;
+	session.getPIStream().handshake(
+		*Server::instance()->getTlsContext(), TlsContext::Channel::CONTROL,
+		[this, next](const boost::system::error_code& ec) {
+			if (ec.value() != 0) {
+				boost::system::error_code closeEc;
+				session.getPISocket().close(closeEc);
+				return;
+			}
+			next();
+		}
+	);
+}
+
+
+// PBSZ and PROT (RFC 4217), once the control connection is secured.
+// PBSZ must be 0 (TLS needs no buffer), and precedes PROT P (some clients
+//   send PROT C alone). PROT C (clear) or P (private) applies to the following
+//   data connections.
+void PI::dataProtection(std::shared_ptr<Response>& resp) {
+	std::string arg = resp->getCmd().getArg();
+	for (auto& c : arg)
+		c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	if (!session.getPIStream().secure()) {
+		resp->setCode(ReturnCode::badSequence);
+		resp->append(ResponseString::pbszNeedAuth, sizeof(ResponseString::pbszNeedAuth)-1);
+	}
+	else if (resp->getCmd().getName() == Command::Name::PBSZ) {
+		if (arg.empty() || (arg.find_first_not_of("0123456789") != std::string::npos)) {
+			resp->setCode(ReturnCode::argumentSyntaxError);
+			resp->append(ResponseString::invalidCmd, sizeof(ResponseString::invalidCmd)-1);
+			return;
+		}
+		pbszSet = true;
+		resp->setCode(ReturnCode::commandOkay);
+		resp->append(ResponseString::pbszSuccess, sizeof(ResponseString::pbszSuccess)-1);
+	}
+	else if ((arg == "P") && !pbszSet) {
+		resp->setCode(ReturnCode::badSequence);
+		resp->append(ResponseString::protNeedPbsz, sizeof(ResponseString::protNeedPbsz)-1);
+	}
+	else if ((arg == "C") && Server::instance()->getTlsRequired()) {
+		resp->setCode(ReturnCode::policyDenied);
+		resp->append(ResponseString::protRequired, sizeof(ResponseString::protRequired)-1);
+	}
+	else if ((arg == "C") || (arg == "P")) {
+		session.setDataProtection(arg == "P");
+		resp->setCode(ReturnCode::commandOkay);
+		resp->append(ResponseString::protSuccess, sizeof(ResponseString::protSuccess)-1);
+	}
+	else if ((arg == "S") || (arg == "E")) {
+		resp->setCode(ReturnCode::protNotSupported);
+		resp->append(ResponseString::protUnsupported, sizeof(ResponseString::protUnsupported)-1);
+	}
+	else {
+		resp->setCode(ReturnCode::paramNotImplemented);
+		resp->append(ResponseString::protUnsupported, sizeof(ResponseString::protUnsupported)-1);
+	}
+}
+
+
+// Updates inputBuffer, of which nBytes were just read, and cmdStr.
 // Returns true if there is a command read. When this happens,
 //   cmdStr will contain the complete command and inputBuffer's
 //   contents will be cleared of the command read.
-bool PI::updateReadInput(std::size_t nBytes) {
+bool PI::updateReadInput(Buffer& inputBuffer, std::string& cmdStr, const std::size_t nBytes) {
 	bool retVal = false;	// EOL flag
 	// check if input buffer contains a finished command
 	const std::size_t newBufSz = (inputBuffer.sz + nBytes);
@@ -571,6 +1437,7 @@ bool PI::updateReadInput(std::size_t nBytes) {
 		if (i > 1) {
 			cmdStr.append(inputBuffer.buf.data(), i-1);
 		}
+		PIHelper::stripTelnet(cmdStr);
 		// shift if needed
 		if (newBufSz > i+1) {
 			std::copy(
@@ -595,7 +1462,7 @@ bool PI::updateReadInput(std::size_t nBytes) {
 
 
 void PI::readSome() {
-	session.getPISocket().async_read_some(
+	session.getPIStream().readSome(
 		boost::asio::buffer(
 			inputBuffer.buf.data() + inputBuffer.size(),
 			inputBuffer.capacity() - inputBuffer.size()
@@ -608,7 +1475,7 @@ void PI::readSome() {
 
 
 void PI::readSome(std::shared_ptr<LoginData> data) {
-	session.getPISocket().async_read_some(
+	session.getPIStream().readSome(
 		boost::asio::buffer(
 			inputBuffer.buf.data() + inputBuffer.size(),
 			inputBuffer.capacity() - inputBuffer.size()
@@ -620,8 +1487,38 @@ void PI::readSome(std::shared_ptr<LoginData> data) {
 }
 
 
+// STAT without an argument: the server's metrics (see Metrics::getStatus),
+//   for connections from the loopback address only.
+void PI::status(std::shared_ptr<Response>& resp) {
+	boost::system::error_code ec;
+	const boost::asio::ip::tcp::endpoint peer = session.getPISocket().remote_endpoint(ec);
+	if (!resp->getCmd().getArg().empty()) {
+		resp->setCode(ReturnCode::paramNotImplemented);
+		resp->append(ResponseString::statPathname, sizeof(ResponseString::statPathname)-1);
+	}
+	else if ((ec.value() != 0) || !peer.address().is_loopback()) {
+		resp->setCode(ReturnCode::policyDenied);
+		resp->append(ResponseString::statLocalOnly, sizeof(ResponseString::statLocalOnly)-1);
+	}
+	else {
+		Server& server = *Server::instance();
+		std::string str{"211-Server status"};
+		str.append(Constants::EOL);
+		str.append(Metrics::getStatus(
+			server.getMetrics().read(), server.getTlsContext(), server.getListingCache()
+		));
+		str.append("211 End");
+		str.append(Constants::EOL);
+		resp->setCode(ReturnCode::systemStatus);
+		resp->set(str);
+	}
+}
+
+
 // https://tools.ietf.org/html/rfc2389
-std::string PI::getFeaturesResp() {
+// HASH lists its algorithms, with the selected one marked by '*'.
+// AUTH TLS, PBSZ, and PROT are listed if tls (RFC 4217).
+std::string PI::getFeaturesResp(const HashAlgorithm selected, const bool tls) {
 	std::string str{"211-Features"};
 	str.append(Constants::EOL);
 	for (const auto feat : Constants::features) {
@@ -629,6 +1526,22 @@ std::string PI::getFeaturesResp() {
 		str.append(feat);
 		str.append(Constants::EOL);
 	}
+	if (tls) {
+		for (const char* feat : {"AUTH TLS", "PBSZ", "PROT"}) {
+			str.append(Constants::SP);
+			str.append(feat);
+			str.append(Constants::EOL);
+		}
+	}
+	str.append(" HASH ");
+	for (const HashAlgorithm a : {HashAlgorithm::MD5, HashAlgorithm::CRC32}) {
+		if (a != HashAlgorithm::MD5)
+			str.push_back(';');
+		str.append(Checksum::getName(a));
+		if (a == selected)
+			str.push_back('*');
+	}
+	str.append(Constants::EOL);
 	str.append("211 End");
 	str.append(Constants::EOL);
 	return str;
@@ -1,12 +1,18 @@
 #pragma once
 
 #include "buffer.h"
+#include "dir_scanner.h"
 #include <array>
+#include <cstdint>	// int64_t
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <boost/asio.hpp>
 
 
+enum class HashAlgorithm;
+enum class ListingFormat;
 class AsioData;
 class DataReader;
 class DataResponse;
@@ -17,6 +23,9 @@ class User;
 
 
 // Protocol interpreter
+// While a transfer is in progress, commands are still read, so that ABOR can
+//   abort it. Any other command is held until the transfer's last reply has
+//   been sent.
 class PI {
 	struct LoginData {
 		enum class State {READ_USER, RESP_USER, READ_PASS, RESP_PASS};
@@ -32,27 +41,57 @@ public:
 	void begin(void);
 	void resume(void);
 	Buffer& getOutputBuffer(void);
+	static bool updateReadInput(Buffer&, std::string&, const std::size_t);
 private:
 	std::shared_ptr<Response> makeResponse(void);
 	void setDefaultCallback(std::shared_ptr<Response>&);
 	void setDefaultFinishCallback(std::shared_ptr<DataWriter>&);
 	void setDefaultFinishCallback(std::shared_ptr<DataReader>&);
 	void readCallback(const boost::system::error_code&, std::size_t);
+	bool holdDuringTransfer(void);
+	void execute(void);
 	void writeCallback(const AsioData&, std::shared_ptr<Response>);
 	void readCallback(const boost::system::error_code&, std::size_t, std::shared_ptr<LoginData>);
+	void loginResult(std::shared_ptr<Response>&, std::shared_ptr<LoginData>, User*);
 	void writeCallback(const AsioData&, std::shared_ptr<Response>, std::shared_ptr<LoginData>);
 	void writeCallback(const AsioData&, std::shared_ptr<DataResponse>);
 	void finishCallbackW(const AsioData&, std::shared_ptr<DataResponse>);
 	void finishCallbackR(const AsioData&, std::shared_ptr<DataResponse>);
-	bool updateReadInput(std::size_t);
+	void sendTransferReply(std::shared_ptr<Response>&);
+	void transferReplyCallback(const AsioData&, std::shared_ptr<Response>);
+	void upload(std::shared_ptr<Response>&);
+	void listing(std::shared_ptr<Response>&, const ListingFormat);
+	void mlst(std::shared_ptr<Response>&);
+	void fileStatus(std::shared_ptr<Response>&);
+	bool statFile(const std::string&, DirScanner::Entry&);
+	void fileChecksum(std::shared_ptr<Response>);
+	void checksumResult(std::shared_ptr<Response>&, const HashAlgorithm, const std::int64_t,
+		const std::string&);
+	void options(std::shared_ptr<Response>&);
+	void auth(std::shared_ptr<Response>&);
+	void secureControl(std::function<void(void)>&&);
+	void dataProtection(std::shared_ptr<Response>&);
+	void status(std::shared_ptr<Response>&);
 	void readSome(void);
 	void readSome(std::shared_ptr<LoginData>);
-	static std::string getFeaturesResp(void);
+	static std::string getFeaturesResp(const HashAlgorithm, const bool);
 
 	Session& session;
 	Buffer inputBuffer;
 	Buffer outputBuffer;
 	std::string cmdStr;
+	std::string rnfrPath;	// virtual path of RNFR, valid for the next command only
+	std::uint64_t alloSize;	// size given by ALLO, used by the next upload
+	std::uint64_t restOffset;	// offset given by REST, used by the next transfer
+	HashAlgorithm hashAlgorithm;	// of HASH, set by OPTS HASH
+	bool authPending;	// AUTH TLS was accepted, the handshake follows its reply
+	bool pbszSet;		// PBSZ was sent after AUTH TLS, so PROT may be
+	std::mutex transferLock;	// guards the members below, used by data threads too
+	std::shared_ptr<DataResponse> transfer;	// from its 1xx reply until its last reply is sent
+	std::shared_ptr<Response> abortResp;	// ABOR of transfer, replied to after transfer
+	bool finishing;		// last reply of transfer is being sent
+	bool reading;		// command is being read during transfer
+	bool cmdHeld;		// cmdStr is a command received during transfer
 };
 
 
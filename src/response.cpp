@@ -2,6 +2,7 @@
 #include "asio_data.h"
 #include "buffer.h"
 #include "pi.h"
+#include "server.h"
 #include "session.h"
 #include <algorithm>	// min
 #include <utility>		// swap
@@ -46,8 +47,8 @@ static void updateEOLSplitApp(T& buf1, V& buf2) {
 
 
 Response::Response(Session& sess)
-: session{sess}, outputBuffer{sess.getPI().getOutputBuffer()}, bufIndex{0},
-bytesSent{0}, outputSz{0}, code{0}, doneFlag{false}, format{true} {
+: session{sess}, outputBuffer{sess.getPI().getOutputBuffer()}, created{Metrics::Clock::now()},
+counted{false}, bufIndex{0}, bytesSent{0}, outputSz{0}, code{0}, doneFlag{false}, format{true} {
 }
 
 
@@ -73,7 +74,7 @@ void Response::send() {
 
 void Response::writeSome() {
 	auto thisShared = getPtr();
-	session.getPISocket().async_write_some(
+	session.getPIStream().writeSome(
 		boost::asio::buffer(
 			outputBuffer.data() + bufIndex,
 			outputBuffer.size() - bufIndex
@@ -117,6 +118,8 @@ void Response::append2(const char* str, const std::size_t sz) {
 }
 
 
+// Formats the reply (code, text, EOL) into the output buffer, as send() does
+//   before writing it.
 void Response::finalize() {
 	assert(Utility::validReturnCode(code));
 	assert(callback);
@@ -184,6 +187,10 @@ void Response::asioCallback(const boost::system::error_code& ec, std::size_t nBy
 	if (bytesSent >= outputSz) {
 		assert(bytesSent == outputSz);
 		doneFlag = true;
+		if (!counted && (command.getName() != Command::Name::_NONE)) {
+			counted = true;
+			Server::instance()->getMetrics().countCommand(command.getName(), code, Metrics::Clock::now() - created);
+		}
 	}
 	else if (bufIndex == outputBuffer.capacity()) {
 		// reset outputBuffer
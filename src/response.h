@@ -1,6 +1,7 @@
 #pragma once
 
 #include "command.h"
+#include "metrics.h"
 #include "utility.h"
 #include <cassert>
 #include <functional>
@@ -23,11 +24,13 @@ public:
 	Response(Session&, const std::string&);
 	~Response() = default;
 	void setCode(const int);
+	int getCode(void) const;
 	void setCallback(const Callback&);
 	const Command& getCmd(void) const;
 	void append(const char*, const std::size_t);
 	void append(const std::string&);
 	void set(const std::string&);
+	void finalize(void);
 	void send(void);
 	void writeSome(void);
 	bool done(void) const;
@@ -35,7 +38,6 @@ public:
 private:
 	std::shared_ptr<Response> getPtr(void);
 	void append2(const char*, const std::size_t);
-	void finalize(void);
 	void updateEOL(void);
 	void asioCallback(const boost::system::error_code&, std::size_t);
 
@@ -44,6 +46,8 @@ private:
 	std::string respTmp;
 	Session& session;
 	Buffer& outputBuffer;
+	Metrics::Clock::time_point created;		// the command was read
+	bool counted;	// in the Metrics, once the first reply is sent (kept by clear())
 	std::size_t bufIndex;
 	std::size_t bytesSent;
 	std::size_t outputSz;
@@ -60,6 +64,12 @@ void Response::setCode(const int c) {
 }
 
 
+inline
+int Response::getCode() const {
+	return code;
+}
+
+
 inline
 void Response::setCallback(const Callback& c) {
 	callback = c;
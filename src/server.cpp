@@ -1,6 +1,13 @@
 #include "server.h"
+#include "listing_cache.h"
+#include "password_verifier.h"
+#include "path_resolver.h"
 #include "session.h"
+#include "thread_pool.h"
+#include "tls_context.h"
+#include <algorithm>	// max
 #include <cassert>
+#include <csignal>	// SIGHUP
 #include <limits>
 #include <stdexcept>
 #include <utility>	// make_pair
@@ -9,6 +16,11 @@
 std::shared_ptr<Server> Server::serverInstance;
 
 
+namespace ServerConstants {
+	constexpr std::chrono::seconds CREDENTIAL_TTL{300};
+}
+
+
 static constexpr bool validPort(const int port) {
 	return ((port > 0) && (port <= static_cast<int>(std::numeric_limits<unsigned short>::max())));
 }
@@ -19,16 +31,29 @@ static constexpr bool validNumThreads(const int numThreads) {
 }
 
 
+// numControlThreads may be 0, for control connections to be handled by the
+//   numThreads threads too.
 // throws boost::system::system_error, std::invalid_argument
-Server::Server(const int port, const int numThreads, const std::string& welcomeMsg)
-: acceptor{ios}, ios_work{new boost::asio::io_service::work{ios}},
-welcomeMessage{welcomeMsg} {
+Server::Server(const int port, const int numThreads, const int numControlThreads,
+const std::string& welcomeMsg)
+: controlIos{(numControlThreads > 0) ? new boost::asio::io_service : nullptr},
+acceptor{getControlService()}, ios_work{new boost::asio::io_service::work{ios}},
+controlWork{controlIos ? new boost::asio::io_service::work{*controlIos} : nullptr},
+signals{getControlService()},
+verifier{new SaltedMD5Verifier}, credentialCache{ServerConstants::CREDENTIAL_TTL},
+transferScheduler{ios, static_cast<std::size_t>(std::max(numThreads, 1))},
+metricsTimer{getControlService()}, welcomeMessage{welcomeMsg} {
 	assert(validPort(port));
 	assert(validNumThreads(numThreads));
 	if (!validPort(port))
 		throw std::invalid_argument{std::string{"invalid port: "} + std::to_string(port)};
 	if (!validNumThreads(numThreads))
 		throw std::invalid_argument{std::string{"invalid numThreads: "} + std::to_string(numThreads)};
+	if (numControlThreads < 0) {
+		throw std::invalid_argument{
+			std::string{"invalid controlThreads: "} + std::to_string(numControlThreads)
+		};
+	}
 	boost::asio::ip::tcp::endpoint ep{
 		boost::asio::ip::address_v4::any(),
 		static_cast<unsigned short>(port)
@@ -43,13 +68,31 @@ welcomeMessage{welcomeMsg} {
 			}
 		);
 	}
+	controlThreads.reserve(static_cast<std::size_t>(numControlThreads));
+	for (int i = 0; i < numControlThreads; ++i) {
+		controlThreads.emplace_back(
+			[this]() {
+				controlIos->run();
+			}
+		);
+	}
+}
+
+
+// ThreadPool, ListingCache, TlsContext, and PasswordVerifier are incomplete in server.h
+Server::~Server() {
+	for (const auto& user : users)
+		PathResolver::closeHome(user.second.homeFd);
 }
 
 
 void Server::run() {
 	running = true;
+	SocketTuning::tuneControlListener(acceptor, socketOptions);
 	acceptor.listen();
 	beginAccept();
+	if (!metricsFile.empty())
+		waitForMetrics();
 }
 
 
@@ -57,10 +100,19 @@ void Server::stop() {
 	boost::system::error_code ec;
 	running = false;
 	ios_work.reset(nullptr);
+	controlWork.reset(nullptr);
 	acceptor.close(ec);
+	signals.cancel(ec);
+	metricsTimer.cancel(ec);
 	ios.stop();
+	if (controlIos)
+		controlIos->stop();
 	for (auto& thread : threads)
 		thread.join();
+	for (auto& thread : controlThreads)
+		thread.join();
+	if (!metricsFile.empty())
+		writeMetrics();
 }
 
 
@@ -70,7 +122,204 @@ void Server::setUsers(const std::vector<User>& usersVec) {
 		auto insert = users.insert(std::make_pair(user.name, user));
 		if (!insert.second)
 			throw std::invalid_argument{"duplicate user"};
+		insert.first->second.homeFd = PathResolver::openHome(user.home);
 	}
+	credentialCache.clear();
+}
+
+
+// Number of threads used to verify passwords, for password hashes too slow
+//   to compute on the server's threads.
+// 0 disables the pool.
+// throws invalid_argument
+void Server::setAuthThreads(const int numThreads) {
+	if (numThreads < 0)
+		throw std::invalid_argument{std::string{"invalid authThreads: "} + std::to_string(numThreads)};
+	if (numThreads == 0)
+		authPool.reset(nullptr);
+	else
+		authPool.reset(new ThreadPool{numThreads});
+}
+
+
+// Number of threads used to stat entries of large directories in parallel.
+// 0 disables the pool.
+// throws invalid_argument
+void Server::setScanThreads(const int numThreads) {
+	if (numThreads < 0)
+		throw std::invalid_argument{std::string{"invalid scanThreads: "} + std::to_string(numThreads)};
+	if (numThreads == 0)
+		scanPool.reset(nullptr);
+	else
+		scanPool.reset(new ThreadPool{numThreads});
+}
+
+
+// Number of threads used to compute checksums (HASH, XMD5, XCRC) that are not
+//   cached. Each reads a whole file, so they are kept off the scan pool, whose
+//   batches a listing waits for.
+// 0 disables the pool.
+// throws invalid_argument
+void Server::setChecksumThreads(const int numThreads) {
+	if (numThreads < 0)
+		throw std::invalid_argument{std::string{"invalid checksumThreads: "} + std::to_string(numThreads)};
+	if (numThreads == 0)
+		checksumPool.reset(nullptr);
+	else
+		checksumPool.reset(new ThreadPool{numThreads});
+}
+
+
+// Number of threads used to write uploaded files, so that a slow disk does not
+//   block the server's threads.
+// 0 disables the pool.
+// throws invalid_argument
+void Server::setWriterThreads(const int numThreads) {
+	if (numThreads < 0)
+		throw std::invalid_argument{std::string{"invalid writerThreads: "} + std::to_string(numThreads)};
+	if (numThreads == 0)
+		writerPool.reset(nullptr);
+	else
+		writerPool.reset(new ThreadPool{numThreads});
+}
+
+
+// numBuffers: buffers of an upload that may be waiting to be written before
+//   reading from the data connection pauses (only with a writer pool)
+// sync: "none", "end" (fdatasync before the reply), or "periodic" (also while
+//   writing)
+// throws invalid_argument
+void Server::setWriteBehind(const int numBuffers, const std::string& sync) {
+	if (numBuffers <= 0)
+		throw std::invalid_argument{std::string{"invalid writeBuffers: "} + std::to_string(numBuffers)};
+	if (sync == "none")
+		syncPolicy = WriteBehind::SyncPolicy::NONE;
+	else if (sync == "end")
+		syncPolicy = WriteBehind::SyncPolicy::END;
+	else if (sync == "periodic")
+		syncPolicy = WriteBehind::SyncPolicy::PERIODIC;
+	else
+		throw std::invalid_argument{std::string{"invalid storSync: "} + sync};
+	writeBuffers = static_cast<std::size_t>(numBuffers);
+}
+
+
+// Uploads larger than sz bytes are preallocated sz bytes at a time (uploads
+//   announced by ALLO are preallocated at once regardless).
+// 0 disables it.
+// throws invalid_argument
+void Server::setPreallocSize(const int sz) {
+	if (sz < 0)
+		throw std::invalid_argument{std::string{"invalid preallocSize: "} + std::to_string(sz)};
+	preallocSize = static_cast<std::uint64_t>(sz);
+}
+
+
+// rate is in bytes per second, 0 if unlimited
+// May be called while running.
+// throws invalid_argument
+void Server::setTransferRate(const TrafficShaper::Level level, const TrafficShaper::Direction dir,
+const int rate) {
+	if (rate < 0)
+		throw std::invalid_argument{std::string{"invalid transfer rate: "} + std::to_string(rate)};
+	trafficShaper.setRate(level, dir, static_cast<std::uint64_t>(rate));
+}
+
+
+// Bytes a data transfer may send or receive in each round of the
+//   TransferScheduler, times its user's weight.
+// 0 disables scheduling.
+// throws invalid_argument
+void Server::setTransferQuantum(const int quantum) {
+	if (quantum < 0)
+		throw std::invalid_argument{std::string{"invalid transferQuantum: "} + std::to_string(quantum)};
+	transferScheduler.setQuantum(static_cast<std::size_t>(quantum));
+}
+
+
+// Must be called before run().
+// throws invalid_argument
+void Server::setSocketOptions(const SocketOptions& options) {
+	options.validate();
+	socketOptions = options;
+}
+
+
+// FTPS (AUTH TLS) with the PEM certificate chain in certFile, and its private
+//   key in keyFile (or certFile if empty). An empty certFile disables it.
+// kernelTls: encrypt with kTLS where available (see TlsContext).
+// required: USER is refused before AUTH TLS, and PASV before PROT P.
+// Must be called before run().
+// throws invalid_argument, runtime_error
+void Server::setTls(const std::string& certFile, const std::string& keyFile, const bool kernelTls,
+const bool required) {
+	if (certFile.empty()) {
+		if (required)
+			throw std::invalid_argument{"tlsRequired without tlsCertificate"};
+		tlsContext.reset(nullptr);
+	}
+	else {
+		tlsContext.reset(new TlsContext{certFile, keyFile, kernelTls});
+	}
+	tlsRequired = required;
+}
+
+
+// See TlsContext::setSessionCache. Ignored if FTPS is disabled.
+// Must be called after setTls(), before run().
+// throws invalid_argument
+void Server::setTlsSessionCache(const int cacheSize, const int timeout, const bool tickets) {
+	if (tlsContext)
+		tlsContext->setSessionCache(cacheSize, timeout, tickets);
+}
+
+
+// handler is called by a server thread on SIGHUP, to reload settings that may
+//   be changed while running.
+void Server::setReloadHandler(const std::function<void(void)>& handler) {
+	reloadHandler = handler;
+#ifdef SIGHUP
+	boost::system::error_code ec;
+	signals.add(SIGHUP, ec);
+	if (!ec)
+		waitForSignal();
+#endif
+}
+
+
+// Maximum number of bytes of directory listings to cache.
+// 0 disables the cache.
+// throws invalid_argument
+void Server::setListingCacheSize(const int sz) {
+	if (sz < 0)
+		throw std::invalid_argument{std::string{"invalid listingCacheSize: "} + std::to_string(sz)};
+	if (sz == 0)
+		listingCache.reset(nullptr);
+	else
+		listingCache.reset(new ListingCache{ios, static_cast<std::size_t>(sz)});
+}
+
+
+// The metrics are written to path (in the Prometheus text format) every
+//   intervalSeconds, and on stop(). An empty path disables it.
+// Must be called before run().
+// throws invalid_argument
+void Server::setMetricsFile(const std::string& path, const int intervalSeconds) {
+	if (intervalSeconds <= 0) {
+		throw std::invalid_argument{
+			std::string{"invalid metricsInterval: "} + std::to_string(intervalSeconds)
+		};
+	}
+	if (!path.empty()) {
+		try {
+			Metrics::writePrometheus(path, metrics.read(), tlsContext.get(), listingCache.get());
+		}
+		catch (const std::runtime_error& e) {
+			throw std::invalid_argument{std::string{"invalid metricsFile: "} + e.what()};
+		}
+	}
+	metricsFile = path;
+	metricsInterval = std::chrono::seconds{intervalSeconds};
 }
 
 
@@ -78,7 +327,7 @@ void Server::setUsers(const std::vector<User>& usersVec) {
 void Server::beginAccept() {
 	if (!running)
 		return;
-	std::shared_ptr<Session> session{new Session{ios}};
+	std::shared_ptr<Session> session{new Session{getControlService(), ios}};
 	// A worker thread will run acceptCallback(), which should call beginAccept()
 	acceptor.async_accept(
 		session->getPISocket(),
@@ -114,31 +363,103 @@ void Server::removeSession(std::shared_ptr<Session>& s) {
 }
 
 
-// returns nullptr if invalid username or password
+// Returns nullptr if the login is incorrect.
+// Thread safe.
 User* Server::getUser(const std::string& user, const std::string& pass) {
 	auto it = users.find(user);
 	if (it == users.end()) {
+		// verify anyway, so an unknown user takes as long as a wrong password
+		(void)verifier->verify(unknownUser, pass);
 		return nullptr;
 	}
-	const std::string saltedPass = (pass + it->second.salt);
-	MD5Digest digest = MD5::getDigest(saltedPass);
-	if (digest == it->second.pass) {
+	if (credentialCache.check(user, pass))
 		return &it->second;
-	}
-	else {
+	if (!verifier->verify(it->second, pass))
 		return nullptr;
+	credentialCache.add(user, pass);
+	return &it->second;
+}
+
+
+// Calls handler with the result of getUser().
+// If there is an authentication pool, a password that is not cached is
+//   verified on the pool and handler is posted to the control threads.
+//   Otherwise handler is called before returning.
+void Server::verifyUser(const std::string& user, const std::string& pass,
+std::function<void(User*)> handler) {
+	if (!authPool) {
+		handler(getUser(user, pass));
+		return;
+	}
+	auto it = users.find(user);
+	if ((it != users.end()) && credentialCache.check(user, pass)) {
+		handler(&it->second);
+		return;
 	}
+	authPool->post(
+		[this, user, pass, handler]() {
+			User* verifiedUser = getUser(user, pass);
+			getControlService().post(
+				[handler, verifiedUser]() {
+					handler(verifiedUser);
+				}
+			);
+		}
+	);
 }
 
 
 void Server::acceptCallback(const boost::system::error_code& ec, std::shared_ptr<Session> s) {
 	if (ec.value() != 0) {
-		// TODO
-		assert(false);
+		// e.g. out of descriptors: the session is dropped, and accepting goes on
+		if (running)
+			metrics.count(Metrics::Counter::ACCEPT_ERRORS);
 	}
 	else {
+		metrics.count(Metrics::Counter::SESSIONS);
+		// Telnet Synch (sent with ABOR) is urgent data, which is read in line.
+		boost::system::error_code optEc;
+		s->getPISocket().set_option(boost::asio::socket_base::out_of_band_inline{true}, optEc);
+		SocketTuning::tuneControl(s->getPISocket(), socketOptions);
 		addSession(s);
 	}
 	// always call beginAccept() to initialize another new connection
 	beginAccept();
 }
+
+
+void Server::waitForSignal() {
+	signals.async_wait(
+		[this](const boost::system::error_code& ec, int signal) {
+			(void)signal;
+			if (ec.value() != 0)
+				return;		// stopped
+			reloadHandler();
+			waitForSignal();
+		}
+	);
+}
+
+
+// Rewrites the metrics file every metricsInterval.
+void Server::waitForMetrics() {
+	metricsTimer.expires_from_now(metricsInterval);
+	metricsTimer.async_wait(
+		[this](const boost::system::error_code& ec) {
+			if (ec.value() != 0)
+				return;		// stopped
+			writeMetrics();
+			waitForMetrics();
+		}
+	);
+}
+
+
+void Server::writeMetrics() {
+	try {
+		Metrics::writePrometheus(metricsFile, metrics.read(), tlsContext.get(), listingCache.get());
+	}
+	catch (const std::runtime_error&) {
+		// the previous file is kept until the next interval (e.g. the disk is full)
+	}
+}
@@ -1,6 +1,14 @@
 #pragma once
 
+#include "credential_cache.h"
+#include "metrics.h"
+#include "socket_options.h"
+#include "traffic_shaper.h"
+#include "transfer_scheduler.h"
 #include "user.h"
+#include "write_behind.h"
+#include <cstdint>	// uint64_t
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -11,35 +19,100 @@
 #include <boost/asio.hpp>
 
 
+class ListingCache;
+class PasswordVerifier;
 class Session;
+class ThreadPool;
+class TlsContext;
 
 
 class Server {
 public:
 	static std::shared_ptr<Server>& instance(void);
-	Server(const int, const int, const std::string&);
-	~Server() = default;
+	Server(const int, const int, const int, const std::string&);
+	~Server();
 	void run(void);
 	void stop(void);
 	void setUsers(const std::vector<User>&);
+	void setAuthThreads(const int);
+	void setScanThreads(const int);
+	void setChecksumThreads(const int);
+	void setWriterThreads(const int);
+	void setWriteBehind(const int, const std::string&);
+	void setPreallocSize(const int);
+	void setAtomicUploads(const bool);
+	void setTransferRate(const TrafficShaper::Level, const TrafficShaper::Direction, const int);
+	void setTransferQuantum(const int);
+	void setSocketOptions(const SocketOptions&);
+	void setTls(const std::string&, const std::string&, const bool, const bool);
+	void setTlsSessionCache(const int, const int, const bool);
+	void setReloadHandler(const std::function<void(void)>&);
+	void setListingCacheSize(const int);
+	void setMetricsFile(const std::string&, const int);
 	const std::string& getWelcomeMessage(void) const;
 	void beginAccept(void);
 	void addSession(std::shared_ptr<Session>&);
 	void removeSession(std::shared_ptr<Session>&);
 	User* getUser(const std::string&, const std::string&);
+	void verifyUser(const std::string&, const std::string&, std::function<void(User*)>);
 	boost::asio::io_service& getService(void);
+	boost::asio::io_service& getControlService(void);
+	ThreadPool* getScanPool(void);
+	ThreadPool* getChecksumPool(void);
+	ThreadPool* getWriterPool(void);
+	std::size_t getWriteBuffers(void) const;
+	WriteBehind::SyncPolicy getSyncPolicy(void) const;
+	std::uint64_t getPreallocSize(void) const;
+	bool getAtomicUploads(void) const;
+	ListingCache* getListingCache(void);
+	TrafficShaper& getTrafficShaper(void);
+	TransferScheduler& getTransferScheduler(void);
+	const SocketOptions& getSocketOptions(void) const;
+	TlsContext* getTlsContext(void);
+	bool getTlsRequired(void) const;
+	Metrics& getMetrics(void);
 private:
 	void acceptCallback(const boost::system::error_code&, std::shared_ptr<Session>);
+	void waitForSignal(void);
+	void waitForMetrics(void);
+	void writeMetrics(void);
 
 	static std::shared_ptr<Server> serverInstance;
 	boost::asio::io_service ios;
+	// nullptr if control connections are handled by the server's threads
+	std::unique_ptr<boost::asio::io_service> controlIos;
 	boost::asio::ip::tcp::acceptor acceptor;
 	std::unique_ptr<boost::asio::io_service::work> ios_work;
+	std::unique_ptr<boost::asio::io_service::work> controlWork;
+	boost::asio::signal_set signals;
+	std::function<void(void)> reloadHandler;
 	std::vector<std::thread> threads;
+	std::vector<std::thread> controlThreads;
+	std::unique_ptr<PasswordVerifier> verifier;
+	std::unique_ptr<ThreadPool> authPool;	// nullptr if passwords are verified by the server's threads
+	std::unique_ptr<ThreadPool> scanPool;	// nullptr if directories are scanned serially
+	std::unique_ptr<ThreadPool> checksumPool;	// nullptr if checksums are computed by the server's threads
+	std::unique_ptr<ThreadPool> writerPool;	// nullptr if uploads are written by the server's threads
+	std::unique_ptr<ListingCache> listingCache;	// nullptr if disabled
+	std::unique_ptr<TlsContext> tlsContext;	// nullptr if FTPS is disabled
 	std::unordered_set<std::shared_ptr<Session>> sessions;
 	std::unordered_map<std::string, User> users;
+	CredentialCache credentialCache;
+	TrafficShaper trafficShaper;
+	TransferScheduler transferScheduler;
+	SocketOptions socketOptions;
+	Metrics metrics;
+	boost::asio::steady_timer metricsTimer;
+	std::string metricsFile;	// empty if not written
+	std::chrono::seconds metricsInterval{10};
+	User unknownUser;	// verified against for unknown user names
 	std::string welcomeMessage;
 	std::mutex sessionsLock;
+	std::size_t writeBuffers = 4;
+	std::uint64_t preallocSize = 0;
+	bool atomicUploads = false;
+	bool tlsRequired = false;
+	WriteBehind::SyncPolicy syncPolicy = WriteBehind::SyncPolicy::NONE;
 	bool running = false;
 };
 
@@ -56,7 +129,111 @@ const std::string& Server::getWelcomeMessage() const {
 }
 
 
+// Data connections, and blocking work handed back from pools, are handled here.
 inline
 boost::asio::io_service& Server::getService() {
 	return ios;
 }
+
+
+// Control connections (PI) are handled here, by their own threads if any, so
+//   commands are not queued behind data transfers.
+inline
+boost::asio::io_service& Server::getControlService() {
+	return (controlIos ? *controlIos : ios);
+}
+
+
+inline
+ThreadPool* Server::getScanPool() {
+	return scanPool.get();
+}
+
+
+inline
+ThreadPool* Server::getChecksumPool() {
+	return checksumPool.get();
+}
+
+
+inline
+ThreadPool* Server::getWriterPool() {
+	return writerPool.get();
+}
+
+
+// maximum number of buffers of an upload being written at once
+inline
+std::size_t Server::getWriteBuffers() const {
+	return writeBuffers;
+}
+
+
+inline
+WriteBehind::SyncPolicy Server::getSyncPolicy() const {
+	return syncPolicy;
+}
+
+
+// bytes preallocated at a time for uploads of unknown size, 0 if disabled
+inline
+std::uint64_t Server::getPreallocSize() const {
+	return preallocSize;
+}
+
+
+// Are uploads written to a temporary file, which replaces the destination
+//   once complete?
+inline
+bool Server::getAtomicUploads() const {
+	return atomicUploads;
+}
+
+
+inline
+void Server::setAtomicUploads(const bool atomic) {
+	atomicUploads = atomic;
+}
+
+
+inline
+ListingCache* Server::getListingCache() {
+	return listingCache.get();
+}
+
+
+inline
+TrafficShaper& Server::getTrafficShaper() {
+	return trafficShaper;
+}
+
+
+inline
+TransferScheduler& Server::getTransferScheduler() {
+	return transferScheduler;
+}
+
+
+inline
+const SocketOptions& Server::getSocketOptions() const {
+	return socketOptions;
+}
+
+
+inline
+TlsContext* Server::getTlsContext() {
+	return tlsContext.get();
+}
+
+
+// Must control and data connections be secured by TLS?
+inline
+bool Server::getTlsRequired() const {
+	return tlsRequired;
+}
+
+
+inline
+Metrics& Server::getMetrics() {
+	return metrics;
+}
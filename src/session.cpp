@@ -1,14 +1,16 @@
 #include "session.h"
 #include "representation_type.h"
 #include "response.h"
+#include "server.h"
 #include "user.h"
 
 
 namespace fs = boost::filesystem;
 
 
-Session::Session(boost::asio::io_service& ios)
-: socketPI{ios}, socketDTP{ios}, pi{*this}, dtp{*this}, user{nullptr} {
+// control connection is handled by controlIos, data connection by dataIos
+Session::Session(boost::asio::io_service& controlIos, boost::asio::io_service& dataIos)
+: socketPI{controlIos}, socketDTP{dataIos}, streamPI{socketPI}, streamDTP{socketDTP}, pi{*this}, dtp{*this}, user{nullptr} {
 }
 
 
@@ -20,7 +22,8 @@ Session::~Session() {
 void Session::setUser(User* usr) {
 	assert(usr != nullptr);
 	user = usr;
-	cwd = user->home;
+	resolver.setUser(*user);
+	limiter = Server::instance()->getTrafficShaper().makeLimiter(user->name);
 }
 
 
@@ -29,11 +32,22 @@ void Session::setRepresentationType(const RepresentationType reprType) {
 }
 
 
+// Are data connections protected by TLS (PROT P)?
+void Session::setDataProtection(const bool protect) {
+	dtp.setProtection(protect);
+}
+
+
 void Session::closeDataConnection() {
 	dtp.closeConnection();
 }
 
 
+void Session::abortDataConnection() {
+	dtp.abortConnection();
+}
+
+
 // start the process of enabling passive mode
 void Session::passiveBegin(std::shared_ptr<Response> resp) {
 	dtp.enablePassiveMode(resp);
@@ -52,22 +66,26 @@ void Session::passiveEnabled() {
 }
 
 
-void Session::setMLSDWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p) {
-	dtp.setMLSDWriter(dataResp, p);
+// sends or receives the data of dataResp
+void Session::beginTransfer(std::shared_ptr<DataResponse> dataResp) {
+	dtp.beginTransfer(dataResp);
 }
 
 
-void Session::setFileWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p) {
-	dtp.setFileWriter(dataResp, p);
+void Session::setListingWriter(std::shared_ptr<DataResponse>& dataResp, const Path& p,
+const ListingFormat format, const DirScanner::Entry& info, const int dirHandle) {
+	dtp.setListingWriter(dataResp, p, format, info, dirHandle);
 }
 
 
-// TODO better path handling
-void Session::setFileReader(std::shared_ptr<DataResponse>& dataResp, const std::string& name) {
-	std::string newName = name;
-	if (!newName.empty() && (newName.front() == '/')) {
-		newName = newName.substr(1);
-	}
-	dtp.setFileReader(dataResp, cwd, newName);
+// takes ownership of fd, which is sent from offset
+void Session::setFileWriter(std::shared_ptr<DataResponse>& dataResp, const int fd,
+const std::uint64_t offset) {
+	dtp.setFileWriter(dataResp, fd, offset);
+}
+
 
+// takes ownership of target.fd
+void Session::setFileReader(std::shared_ptr<DataResponse>& dataResp, const UploadTarget& target) {
+	dtp.setFileReader(dataResp, target);
 }
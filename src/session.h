@@ -1,44 +1,61 @@
 #pragma once
 
 #include "path.h"
+#include "path_resolver.h"
 #include "dtp.h"
 #include "pi.h"
+#include "tls_stream.h"
+#include "traffic_shaper.h"
+#include <cstdint>	// uint64_t
 #include <memory>
 #include <string>
 #include <boost/asio.hpp>
 
 
+enum class ListingFormat;
 enum class RepresentationType;
 class Response;
 class User;
+struct UploadTarget;
 
 
 class Session {
 public:
-	Session(boost::asio::io_service&);
+	Session(boost::asio::io_service&, boost::asio::io_service&);
 	~Session();
 	PI& getPI(void);
 	DTP& getDTP(void);
 	boost::asio::ip::tcp::socket& getPISocket(void);
 	boost::asio::ip::tcp::socket& getDTPSocket(void);
+	TlsStream& getPIStream(void);
+	TlsStream& getDTPStream(void);
 	void run(void);
 	void setUser(User*);
 	User* getUser(void);
-	const Path& getCWD(void) const;
+	TrafficShaper::Limiter* getLimiter(void);
+	const std::string& getCWD(void) const;
+	PathResolver& getResolver(void);
 	void setRepresentationType(const RepresentationType);
+	void setDataProtection(const bool);
 	void closeDataConnection(void);
+	void abortDataConnection(void);
 	void passiveBegin(std::shared_ptr<Response>);
 	void passiveAccept(void);
 	void passiveEnabled(void);
-	void setMLSDWriter(std::shared_ptr<DataResponse>&, const Path&);
-	void setFileWriter(std::shared_ptr<DataResponse>&, const Path&);
-	void setFileReader(std::shared_ptr<DataResponse>&, const std::string&);
+	void beginTransfer(std::shared_ptr<DataResponse>);
+	void setListingWriter(std::shared_ptr<DataResponse>&, const Path&, const ListingFormat,
+		const DirScanner::Entry&, const int);
+	void setFileWriter(std::shared_ptr<DataResponse>&, const int, const std::uint64_t);
+	void setFileReader(std::shared_ptr<DataResponse>&, const UploadTarget&);
 private:
 	boost::asio::ip::tcp::socket socketPI;
 	boost::asio::ip::tcp::socket socketDTP;
+	TlsStream streamPI;		// I/O of socketPI
+	TlsStream streamDTP;	// I/O of socketDTP
 	PI pi;
 	DTP dtp;
-	Path cwd;	// absolute path of local directory
+	PathResolver resolver;	// holds cwd
+	std::unique_ptr<TrafficShaper::Limiter> limiter;	// nullptr until logged in
 	User* user;
 };
 
@@ -67,6 +84,18 @@ boost::asio::ip::tcp::socket& Session::getDTPSocket() {
 }
 
 
+inline
+TlsStream& Session::getPIStream() {
+	return streamPI;
+}
+
+
+inline
+TlsStream& Session::getDTPStream() {
+	return streamDTP;
+}
+
+
 inline
 void Session::run() {
 	pi.begin();
@@ -80,6 +109,19 @@ User* Session::getUser() {
 
 
 inline
-const Path& Session::getCWD() const {
-	return cwd;
+TrafficShaper::Limiter* Session::getLimiter() {
+	return limiter.get();
+}
+
+
+// virtual path (see PathResolver) of working directory
+inline
+const std::string& Session::getCWD() const {
+	return resolver.getCWD();
+}
+
+
+inline
+PathResolver& Session::getResolver() {
+	return resolver;
 }
@@ -0,0 +1,123 @@
+#include "socket_options.h"
+#include <stdexcept>
+#ifdef __linux__
+#include <netinet/in.h>		// IPPROTO_TCP
+#include <netinet/tcp.h>	// TCP_QUICKACK, TCP_CORK, TCP_NOTSENT_LOWAT, TCP_CONGESTION
+#include <sys/socket.h>		// setsockopt
+#endif
+
+
+namespace SocketOptionsUtil {
+
+// returns false on error
+static bool setTcpOption(const int fd, const int name, const int value) {
+#ifdef __linux__
+	return (::setsockopt(fd, IPPROTO_TCP, name, &value, sizeof(value)) == 0);
+#else
+	(void)fd;
+	(void)name;
+	(void)value;
+	return true;
+#endif
+}
+
+
+// returns false if algorithm is not available
+static bool setCongestion(const int fd, const std::string& algorithm) {
+	if (algorithm.empty())
+		return true;
+#if defined(__linux__) && defined(TCP_CONGESTION)
+	return (::setsockopt(
+		fd, IPPROTO_TCP, TCP_CONGESTION, algorithm.data(), static_cast<socklen_t>(algorithm.size())
+	) == 0);
+#else
+	(void)fd;
+	return true;
+#endif
+}
+
+}	// namespace SocketOptionsUtil
+
+
+// Checks the congestion control algorithms by setting them on a socket.
+// throws invalid_argument
+void SocketOptions::validate() const {
+	if ((dataSendBuffer < 0) || (dataRecvBuffer < 0) || (dataNotSentLowat < 0))
+		throw std::invalid_argument{"invalid data socket buffer size"};
+	if (controlCongestion.empty() && dataCongestion.empty())
+		return;
+	boost::asio::io_service ios;
+	boost::asio::ip::tcp::socket sock{ios, boost::asio::ip::tcp::v4()};
+	for (const std::string* algorithm : {&controlCongestion, &dataCongestion}) {
+		if (!SocketOptionsUtil::setCongestion(sock.native_handle(), *algorithm))
+			throw std::invalid_argument{std::string{"invalid congestion control: "} + *algorithm};
+	}
+}
+
+
+namespace SocketTuning {
+
+// before listen(), so that accepted sockets inherit the options
+void tuneControlListener(acceptor_type& acceptor, const SocketOptions& options) {
+	SocketOptionsUtil::setCongestion(acceptor.native_handle(), options.controlCongestion);
+}
+
+
+void tuneControl(socket_type& sock, const SocketOptions& options) {
+	boost::system::error_code ec;
+	if (options.controlNoDelay)
+		sock.set_option(boost::asio::ip::tcp::no_delay{true}, ec);
+	if (options.controlQuickAck)
+		quickAck(sock);
+}
+
+
+// before listen(), so that accepted sockets inherit the options (a receive
+//   buffer larger than 64 KiB must be set before the connection is made for
+//   the window to be scaled)
+void tuneDataListener(acceptor_type& acceptor, const SocketOptions& options) {
+	boost::system::error_code ec;
+	if (options.dataSendBuffer > 0)
+		acceptor.set_option(boost::asio::socket_base::send_buffer_size{options.dataSendBuffer}, ec);
+	if (options.dataRecvBuffer > 0) {
+		acceptor.set_option(
+			boost::asio::socket_base::receive_buffer_size{options.dataRecvBuffer}, ec
+		);
+	}
+	SocketOptionsUtil::setCongestion(acceptor.native_handle(), options.dataCongestion);
+}
+
+
+void tuneData(socket_type& sock, const SocketOptions& options) {
+#ifdef TCP_NOTSENT_LOWAT
+	if (options.dataNotSentLowat > 0)
+		SocketOptionsUtil::setTcpOption(sock.native_handle(), TCP_NOTSENT_LOWAT, options.dataNotSentLowat);
+#else
+	(void)sock;
+	(void)options;
+#endif
+}
+
+
+// Acknowledges received data at once. Linux clears this once it delays an
+//   ACK, so it is set again after every command is read.
+void quickAck(socket_type& sock) {
+#ifdef TCP_QUICKACK
+	SocketOptionsUtil::setTcpOption(sock.native_handle(), TCP_QUICKACK, 1);
+#else
+	(void)sock;
+#endif
+}
+
+
+// Corked, only full segments are sent. Uncorking sends the last partial one.
+void cork(socket_type& sock, const bool enable) {
+#ifdef TCP_CORK
+	SocketOptionsUtil::setTcpOption(sock.native_handle(), TCP_CORK, (enable ? 1 : 0));
+#else
+	(void)sock;
+	(void)enable;
+#endif
+}
+
+}	// namespace SocketTuning
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <boost/asio.hpp>
+
+
+// Options of the sockets of control (PI) and data (DTP) connections.
+// Options which the platform does not support are ignored.
+struct SocketOptions {
+	// control connections
+	bool controlNoDelay = true;		// TCP_NODELAY: replies are not held back by Nagle
+	bool controlQuickAck = true;	// TCP_QUICKACK: commands are acknowledged at once
+	std::string controlCongestion;	// TCP_CONGESTION of listener, empty for default
+	// data connections (of passive mode)
+	int dataSendBuffer = 0;		// SO_SNDBUF in bytes, 0 for default (autotuned)
+	int dataRecvBuffer = 0;		// SO_RCVBUF in bytes, 0 for default (autotuned)
+	int dataNotSentLowat = 0;	// TCP_NOTSENT_LOWAT in bytes, 0 for default
+	bool dataCork = false;		// TCP_CORK while a file or listing is sent
+	std::string dataCongestion;	// TCP_CONGESTION of listener, empty for default
+
+	void validate(void) const;
+};
+
+
+// Applies SocketOptions. Errors are ignored, since options only tune
+//   performance (and congestion control algorithms are checked by validate()).
+namespace SocketTuning {
+	typedef boost::asio::ip::tcp::acceptor acceptor_type;
+	typedef boost::asio::ip::tcp::socket socket_type;
+
+	void tuneControlListener(acceptor_type&, const SocketOptions&);
+	void tuneControl(socket_type&, const SocketOptions&);
+	void tuneDataListener(acceptor_type&, const SocketOptions&);
+	void tuneData(socket_type&, const SocketOptions&);
+	void quickAck(socket_type&);
+	void cork(socket_type&, const bool);
+}
@@ -0,0 +1,29 @@
+#include "thread_pool.h"
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+
+// throws std::invalid_argument
+ThreadPool::ThreadPool(const int numThreads)
+: ios_work{new boost::asio::io_service::work{ios}} {
+	assert(numThreads > 0);
+	if (numThreads <= 0)
+		throw std::invalid_argument{std::string{"invalid numThreads: "} + std::to_string(numThreads)};
+	threads.reserve(static_cast<std::size_t>(numThreads));
+	for (int i = 0; i < numThreads; ++i) {
+		threads.emplace_back(
+			[this]() {
+				ios.run();
+			}
+		);
+	}
+}
+
+
+// Handlers that have already been posted are run before the threads exit.
+ThreadPool::~ThreadPool() {
+	ios_work.reset(nullptr);
+	for (auto& thread : threads)
+		thread.join();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <utility>	// forward
+#include <vector>
+#include <boost/asio.hpp>
+
+
+// A fixed number of threads running handlers posted to a private io_service.
+// Used to move blocking work (filesystem, hashing) off of the server's
+//   worker threads.
+class ThreadPool {
+public:
+	ThreadPool(const int);
+	ThreadPool(const ThreadPool&) = delete;
+	~ThreadPool();
+	template<class Handler>
+	void post(Handler&&);
+	std::size_t size(void) const;
+	boost::asio::io_service& getService(void);
+	ThreadPool& operator=(const ThreadPool&) = delete;
+private:
+	boost::asio::io_service ios;
+	std::unique_ptr<boost::asio::io_service::work> ios_work;
+	std::vector<std::thread> threads;
+};
+
+
+template<class Handler>
+inline
+void ThreadPool::post(Handler&& handler) {
+	ios.post(std::forward<Handler>(handler));
+}
+
+
+inline
+std::size_t ThreadPool::size() const {
+	return threads.size();
+}
+
+
+inline
+boost::asio::io_service& ThreadPool::getService() {
+	return ios;
+}
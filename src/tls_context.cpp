@@ -0,0 +1,141 @@
+#include "tls_context.h"
+#include <csignal>	// SIGPIPE
+#include <stdexcept>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+
+namespace TlsContextConstants {
+	// sessions are cached for this server only
+	constexpr unsigned char SESSION_ID_CONTEXT[] = "ftp_server";
+}
+
+
+namespace TlsContextUtil {
+
+// description of the last OpenSSL error of this thread
+static std::string lastError() {
+	char str[256];
+	ERR_error_string_n(ERR_get_error(), str, sizeof(str));
+	ERR_clear_error();
+	return std::string{str};
+}
+
+}	// namespace TlsContextUtil
+
+
+// certFile is a PEM certificate chain, keyFile its PEM private key (or empty
+//   if in certFile).
+// throws invalid_argument, runtime_error
+TlsContext::TlsContext(const std::string& certFile, const std::string& keyFile, const bool kernel)
+: ctx{SSL_CTX_new(TLS_server_method())}, ktls{kernel}, kernelSendCount{0}, counters{} {
+	if (ctx == nullptr)
+		throw std::runtime_error{std::string{"unable to create TLS context: "} + TlsContextUtil::lastError()};
+#ifdef SIGPIPE
+	// OpenSSL writes to sockets with write(), which raises SIGPIPE once the
+	//   connection is shut down (ABOR) or reset, rather than failing like the
+	//   writes of asio.
+	std::signal(SIGPIPE, SIG_IGN);
+#endif
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	// Writes are retried with the same (not necessarily the same address of)
+	//   buffer, and may write part of it.
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_options(ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	// A connection closed without close_notify ends as it does without TLS,
+	//   which clients of uploads commonly do.
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+	if (ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+	ktls = false;
+#endif
+	SSL_CTX_set_session_id_context(ctx, TlsContextConstants::SESSION_ID_CONTEXT,
+		sizeof(TlsContextConstants::SESSION_ID_CONTEXT) - 1);
+	const std::string& key = (keyFile.empty() ? certFile : keyFile);
+	if (
+		(SSL_CTX_use_certificate_chain_file(ctx, certFile.c_str()) != 1)
+		|| (SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) != 1)
+		|| (SSL_CTX_check_private_key(ctx) != 1)
+	) {
+		const std::string err = TlsContextUtil::lastError();
+		SSL_CTX_free(ctx);
+		throw std::invalid_argument{std::string{"invalid TLS certificate or key: "} + err};
+	}
+}
+
+
+// Connections still using the context keep it (OpenSSL counts references).
+TlsContext::~TlsContext() {
+	SSL_CTX_free(ctx);
+}
+
+
+// At most cacheSize sessions are cached (0 disables the cache), each for
+//   timeout seconds, which also limits the lifetime of tickets. tickets: give
+//   sessions to clients as tickets (stateless on the server), rather than
+//   only an ID into the cache.
+// Must be called before connections are made.
+// throws invalid_argument
+void TlsContext::setSessionCache(const int cacheSize, const int timeout, const bool tickets) {
+	if (cacheSize < 0)
+		throw std::invalid_argument{std::string{"invalid tlsSessionCacheSize: "} + std::to_string(cacheSize)};
+	if (timeout <= 0)
+		throw std::invalid_argument{std::string{"invalid tlsSessionTimeout: "} + std::to_string(timeout)};
+	if (cacheSize == 0) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	}
+	else {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ctx, cacheSize);
+	}
+	SSL_CTX_set_timeout(ctx, timeout);
+	if (tickets)
+		SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+	else
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+}
+
+
+// returns nullptr on error
+SSL* TlsContext::newSsl() {
+	return SSL_new(ctx);
+}
+
+
+// Counts a handshake of channel, which took time (ok), or failed.
+void TlsContext::countHandshake(const Channel channel, const bool ok, const bool resumed,
+const Clock::duration time) {
+	Counters& c = counters[static_cast<std::size_t>(channel)];
+	if (!ok) {
+		c.failed.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	const std::uint64_t nanos = static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(time).count()
+	);
+	c.completed.fetch_add(1, std::memory_order_relaxed);
+	if (resumed)
+		c.resumed.fetch_add(1, std::memory_order_relaxed);
+	c.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+	std::uint64_t max = c.maxNanos.load(std::memory_order_relaxed);
+	while ((nanos > max) && !c.maxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+	}
+}
+
+
+// The counters are read one at a time, so they may be off by the handshakes
+//   completing meanwhile.
+TlsContext::HandshakeStats TlsContext::getStats(const Channel channel) const {
+	const Counters& c = counters[static_cast<std::size_t>(channel)];
+	HandshakeStats stats;
+	stats.completed = c.completed.load(std::memory_order_relaxed);
+	stats.resumed = c.resumed.load(std::memory_order_relaxed);
+	stats.failed = c.failed.load(std::memory_order_relaxed);
+	stats.totalNanos = c.totalNanos.load(std::memory_order_relaxed);
+	stats.maxNanos = c.maxNanos.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>	// uint64_t
+#include <string>
+#include <openssl/ossl_typ.h>	// SSL, SSL_CTX
+
+
+// Server side OpenSSL context of FTPS (RFC 4217: AUTH TLS, PBSZ, PROT), shared
+//   by the TlsStreams of all sessions.
+// With kernelTls, once a handshake (done by OpenSSL) completes, the kernel
+//   encrypts what is sent (kTLS) where it supports the negotiated cipher, so
+//   that data is sent with plain socket writes as without TLS. Otherwise
+//   records are encrypted by OpenSSL.
+// Sessions are kept in a cache, and given to clients as tickets, so that the
+//   handshake of a data connection may resume the session of the control
+//   connection (if the client offers it) instead of a full handshake. The
+//   cache and the ticket keys belong to the context, so they are shared by
+//   all threads.
+// Thread safe.
+class TlsContext {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum class Channel {CONTROL, DATA};
+
+	// handshakes of a channel since the context was created
+	struct HandshakeStats {
+		std::uint64_t completed = 0;
+		std::uint64_t resumed = 0;		// of completed, by the cache or a ticket
+		std::uint64_t failed = 0;
+		std::uint64_t totalNanos = 0;	// of completed, from start to completion
+		std::uint64_t maxNanos = 0;
+	};
+
+	TlsContext(const std::string&, const std::string&, const bool);
+	TlsContext(const TlsContext&) = delete;
+	~TlsContext();
+	TlsContext& operator=(const TlsContext&) = delete;
+	void setSessionCache(const int, const int, const bool);
+	SSL* newSsl(void);
+	bool kernelTls(void) const;
+	void countKernelSend(void);
+	std::uint64_t getKernelSendCount(void) const;
+	void countHandshake(const Channel, const bool, const bool, const Clock::duration);
+	HandshakeStats getStats(const Channel) const;
+private:
+	struct Counters {
+		std::atomic<std::uint64_t> completed{0};
+		std::atomic<std::uint64_t> resumed{0};
+		std::atomic<std::uint64_t> failed{0};
+		std::atomic<std::uint64_t> totalNanos{0};
+		std::atomic<std::uint64_t> maxNanos{0};
+	};
+
+	SSL_CTX* ctx;
+	bool ktls;
+	std::atomic<std::uint64_t> kernelSendCount;	// handshakes which enabled kTLS for sending
+	std::array<Counters, 2> counters;	// by Channel
+};
+
+
+// Is kTLS requested (and supported by the OpenSSL library)?
+inline
+bool TlsContext::kernelTls() const {
+	return ktls;
+}
+
+
+inline
+void TlsContext::countKernelSend() {
+	kernelSendCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+inline
+std::uint64_t TlsContext::getKernelSendCount() const {
+	return kernelSendCount.load(std::memory_order_relaxed);
+}
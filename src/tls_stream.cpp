@@ -0,0 +1,310 @@
+#include "tls_stream.h"
+#include <algorithm>	// min
+#include <cassert>
+#include <cerrno>
+#include <limits>
+#include <utility>		// forward, move
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+
+namespace TlsStreamUtil {
+
+// before an OpenSSL call, whose errors are then its own
+static void clearErrors() {
+	ERR_clear_error();
+	errno = 0;
+}
+
+
+static int clampSize(const std::size_t sz) {
+	return static_cast<int>(std::min(sz, static_cast<std::size_t>(std::numeric_limits<int>::max())));
+}
+
+}	// namespace TlsStreamUtil
+
+
+TlsStream::TlsStream(socket_type& socket)
+: sock(socket), ssl{nullptr}, context{nullptr}, channel{TlsContext::Channel::CONTROL}, ktlsSend{false} {
+}
+
+
+TlsStream::~TlsStream() {
+	if (ssl != nullptr)
+		SSL_free(ssl);
+}
+
+
+// Server side TLS handshake of a connection of channel (counted by ctx), once
+//   nothing is being read or written.
+// On error, the stream is not secure and should no longer be used.
+void TlsStream::handshake(TlsContext& ctx, const TlsContext::Channel chan, HandshakeHandler handler) {
+	shutdown();
+	context = &ctx;
+	channel = chan;
+	handshakeStart = TlsContext::Clock::now();
+	ssl = context->newSsl();
+	if ((ssl == nullptr) || (SSL_set_fd(ssl, static_cast<int>(sock.native_handle())) != 1)) {
+		ERR_clear_error();
+		handshakeDone(handler, make_error_code(boost::system::errc::protocol_error), false);
+		return;
+	}
+	SSL_set_accept_state(ssl);
+	doHandshake(std::move(handler), false);
+}
+
+
+void TlsStream::readSome(const boost::asio::mutable_buffer& buf, Handler handler) {
+	if (ssl == nullptr)
+		sock.async_read_some(boost::asio::buffer(buf), std::move(handler));
+	else
+		doRead(buf, std::move(handler), false);
+}
+
+
+void TlsStream::writeSome(const boost::asio::const_buffer& buf, Handler handler) {
+	if ((ssl == nullptr) || ktlsSend)
+		sock.async_write_some(boost::asio::buffer(buf), std::move(handler));
+	else
+		doWrite(buf, std::move(handler), false);
+}
+
+
+// Sends close_notify (if secure), without waiting for the peer's, before the
+//   socket is closed. The stream is no longer secure.
+// Sends at most sz bytes of the file fd from its current offset (which is
+//   advanced), like writeSome(). canSendFile() must be true.
+void TlsStream::sendFile(const int fd, const std::size_t sz, Handler handler) {
+	assert(canSendFile());
+	doSendFile(fd, sz, std::move(handler), false);
+}
+
+
+void TlsStream::shutdown() {
+	if (ssl == nullptr)
+		return;
+	std::lock_guard<std::mutex> guard{sslLock};
+	ERR_clear_error();
+	(void)SSL_shutdown(ssl);	// fails if the socket is shut down (ABOR), or would block
+	ERR_clear_error();
+	SSL_free(ssl);
+	ssl = nullptr;
+	ktlsSend = false;
+}
+
+
+// inHandler: called by a handler of the socket, so handler may be called
+//   directly
+void TlsStream::doHandshake(HandshakeHandler handler, const bool inHandler) {
+	boost::system::error_code ec;
+	Status status;
+	{
+		std::lock_guard<std::mutex> guard{sslLock};
+		TlsStreamUtil::clearErrors();
+		status = getStatus(SSL_do_handshake(ssl), ec);
+#ifdef BIO_get_ktls_send
+		if ((status == Status::DONE) && BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+			ktlsSend = true;
+			context->countKernelSend();
+		}
+#endif
+	}
+	switch (status) {
+	case Status::WANT_READ:
+	case Status::WANT_WRITE:
+		waitFor(status,
+			[this, handler](const boost::system::error_code& waitEc) mutable {
+				if (waitEc.value() != 0)
+					handshakeDone(handler, waitEc, true);
+				else
+					doHandshake(handler, true);
+			}
+		);
+		break;
+	case Status::DONE:
+	case Status::FAILED:
+		handshakeDone(handler, ec, inHandler);
+		break;
+	}
+}
+
+
+// Counts the handshake, and calls handler.
+void TlsStream::handshakeDone(HandshakeHandler& handler, const boost::system::error_code& ec,
+const bool inHandler) {
+	const bool ok = (ec.value() == 0);
+	context->countHandshake(channel, ok, (ok && (SSL_session_reused(ssl) == 1)),
+		(TlsContext::Clock::now() - handshakeStart));
+	if (inHandler) {
+		handler(ec);
+		return;
+	}
+	boost::asio::post(sock.get_executor(),
+		[handler, ec]() {
+			handler(ec);
+		}
+	);
+}
+
+
+void TlsStream::doRead(const boost::asio::mutable_buffer& buf, Handler handler, const bool inHandler) {
+	boost::system::error_code ec;
+	int ret;
+	Status status;
+	{
+		std::lock_guard<std::mutex> guard{sslLock};
+		TlsStreamUtil::clearErrors();
+		ret = SSL_read(ssl, buf.data(), TlsStreamUtil::clampSize(buf.size()));
+		status = getStatus(ret, ec);
+	}
+	switch (status) {
+	case Status::WANT_READ:
+	case Status::WANT_WRITE:
+		waitFor(status,
+			[this, buf, handler](const boost::system::error_code& waitEc) {
+				if (waitEc.value() != 0)
+					handler(waitEc, 0);
+				else
+					doRead(buf, handler, true);
+			}
+		);
+		break;
+	case Status::DONE:
+		complete(handler, ec, static_cast<std::size_t>(ret), inHandler);
+		break;
+	case Status::FAILED:
+		complete(handler, ec, 0, inHandler);
+		break;
+	}
+}
+
+
+void TlsStream::doWrite(const boost::asio::const_buffer& buf, Handler handler, const bool inHandler) {
+	if (buf.size() == 0) {
+		complete(handler, boost::system::error_code{}, 0, inHandler);
+		return;
+	}
+	boost::system::error_code ec;
+	int ret;
+	Status status;
+	{
+		std::lock_guard<std::mutex> guard{sslLock};
+		TlsStreamUtil::clearErrors();
+		ret = SSL_write(ssl, buf.data(), TlsStreamUtil::clampSize(buf.size()));
+		status = getStatus(ret, ec);
+	}
+	switch (status) {
+	case Status::WANT_READ:
+	case Status::WANT_WRITE:
+		waitFor(status,
+			[this, buf, handler](const boost::system::error_code& waitEc) {
+				if (waitEc.value() != 0)
+					handler(waitEc, 0);
+				else
+					doWrite(buf, handler, true);
+			}
+		);
+		break;
+	case Status::DONE:
+		complete(handler, ec, static_cast<std::size_t>(ret), inHandler);
+		break;
+	case Status::FAILED:
+		complete(handler, ec, 0, inHandler);
+		break;
+	}
+}
+
+
+// The socket is made non-blocking (as Asio's own operations do), so that
+//   sendfile() returns once the socket buffer is full.
+void TlsStream::doSendFile(const int fd, const std::size_t sz, Handler handler, const bool inHandler) {
+#ifdef __linux__
+	boost::system::error_code ec;
+	if (!sock.native_non_blocking())
+		sock.native_non_blocking(true, ec);
+	if (ec.value() == 0) {
+		ssize_t ret;
+		do {
+			ret = ::sendfile(static_cast<int>(sock.native_handle()), fd, nullptr, sz);
+		} while ((ret < 0) && (errno == EINTR));
+		if ((ret < 0) && (errno == EAGAIN)) {
+			waitFor(Status::WANT_WRITE,
+				[this, fd, sz, handler](const boost::system::error_code& waitEc) {
+					if (waitEc.value() != 0)
+						handler(waitEc, 0);
+					else
+						doSendFile(fd, sz, handler, true);
+				}
+			);
+			return;
+		}
+		if (ret >= 0) {
+			complete(handler, ec, static_cast<std::size_t>(ret), inHandler);
+			return;
+		}
+		ec = boost::system::error_code{errno, boost::system::system_category()};
+	}
+	complete(handler, ec, 0, inHandler);
+#else
+	(void)fd;
+	(void)sz;
+	complete(handler, make_error_code(boost::system::errc::operation_not_supported), 0, inHandler);
+#endif
+}
+
+
+// Classifies ret, returned by an OpenSSL call on ssl (with sslLock held).
+// If FAILED, sets ec: eof once the peer has closed the connection.
+TlsStream::Status TlsStream::getStatus(const int ret, boost::system::error_code& ec) {
+	if (ret > 0)
+		return Status::DONE;
+	const int savedErrno = errno;
+	switch (SSL_get_error(ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		return Status::WANT_READ;
+	case SSL_ERROR_WANT_WRITE:
+		return Status::WANT_WRITE;
+	case SSL_ERROR_ZERO_RETURN:
+		ec = boost::asio::error::eof;
+		break;
+	case SSL_ERROR_SYSCALL:
+		if (savedErrno != 0)
+			ec = boost::system::error_code{savedErrno, boost::system::system_category()};
+		else
+			ec = boost::asio::error::eof;
+		break;
+	default:
+		ec = make_error_code(boost::system::errc::protocol_error);
+		break;
+	}
+	ERR_clear_error();
+	return Status::FAILED;
+}
+
+
+// Calls retry, with the error of the wait, once the socket is ready for what
+//   status wants.
+template<class F>
+void TlsStream::waitFor(const Status status, F&& retry) {
+	sock.async_wait(
+		((status == Status::WANT_READ) ? socket_type::wait_read : socket_type::wait_write),
+		std::forward<F>(retry)
+	);
+}
+
+
+void TlsStream::complete(const Handler& handler, const boost::system::error_code& ec, const std::size_t nBytes,
+const bool inHandler) {
+	if (inHandler) {
+		handler(ec, nBytes);
+		return;
+	}
+	boost::asio::post(sock.get_executor(),
+		[handler, ec, nBytes]() {
+			handler(ec, nBytes);
+		}
+	);
+}
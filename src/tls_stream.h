@@ -0,0 +1,82 @@
+#pragma once
+
+#include "tls_context.h"
+#include <functional>
+#include <mutex>
+#include <boost/asio.hpp>
+#include <openssl/ossl_typ.h>	// SSL
+
+
+// The socket of a control or data connection, through TLS once handshake()
+//   has succeeded.
+// Reads and writes are asynchronous like the socket's: a handler is not called
+//   before readSome() or writeSome() returns. A read and a write may be
+//   pending at once, from different threads.
+// With kTLS (see TlsContext), writes go to the socket, which encrypts them.
+//   Reads always go through OpenSSL, which handles records other than data
+//   (such as close_notify) whether or not the kernel decrypts them.
+// On Linux, a file can be sent with sendfile() (without copying it to user
+//   space) unless the stream is encrypted by OpenSSL (see canSendFile()).
+class TlsStream {
+public:
+	typedef boost::asio::ip::tcp::socket socket_type;
+	typedef std::function<void(const boost::system::error_code&, std::size_t)> Handler;
+	typedef std::function<void(const boost::system::error_code&)> HandshakeHandler;
+
+	TlsStream(socket_type&);
+	TlsStream(const TlsStream&) = delete;
+	~TlsStream();
+	TlsStream& operator=(const TlsStream&) = delete;
+	void handshake(TlsContext&, const TlsContext::Channel, HandshakeHandler);
+	void readSome(const boost::asio::mutable_buffer&, Handler);
+	void writeSome(const boost::asio::const_buffer&, Handler);
+	void sendFile(const int, const std::size_t, Handler);
+	void shutdown(void);
+	bool secure(void) const;
+	bool kernelSend(void) const;
+	bool canSendFile(void) const;
+private:
+	enum class Status {DONE, WANT_READ, WANT_WRITE, FAILED};
+
+	void doHandshake(HandshakeHandler, const bool);
+	void handshakeDone(HandshakeHandler&, const boost::system::error_code&, const bool);
+	void doRead(const boost::asio::mutable_buffer&, Handler, const bool);
+	void doWrite(const boost::asio::const_buffer&, Handler, const bool);
+	void doSendFile(const int, const std::size_t, Handler, const bool);
+	Status getStatus(const int, boost::system::error_code&);
+	template<class F>
+	void waitFor(const Status, F&&);
+	void complete(const Handler&, const boost::system::error_code&, const std::size_t, const bool);
+
+	socket_type& sock;
+	SSL* ssl;	// nullptr if not secure
+	std::mutex sslLock;		// OpenSSL calls of a reader and a writer
+	// of the handshake in progress or last completed
+	TlsContext* context;
+	TlsContext::Channel channel;
+	TlsContext::Clock::time_point handshakeStart;
+	bool ktlsSend;
+};
+
+
+inline
+bool TlsStream::secure() const {
+	return (ssl != nullptr);
+}
+
+
+// Are writes encrypted by the kernel?
+inline
+bool TlsStream::kernelSend() const {
+	return ktlsSend;
+}
+
+
+inline
+bool TlsStream::canSendFile() const {
+#ifdef __linux__
+	return ((ssl == nullptr) || ktlsSend);
+#else
+	return false;
+#endif
+}
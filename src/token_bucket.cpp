@@ -0,0 +1,53 @@
+#include "token_bucket.h"
+#include <algorithm>	// max, min
+#include <limits>
+
+
+constexpr std::chrono::milliseconds TokenBucket::BURST_TIME;
+
+
+// full (once the rate is known by refill())
+TokenBucket::TokenBucket()
+: lastRefill{Clock::now()}, tokens{std::numeric_limits<double>::infinity()} {
+}
+
+
+// Adds the tokens accumulated at rate since the last refill.
+void TokenBucket::refill(const Clock::time_point now, const std::uint64_t rate) {
+	if (now < lastRefill)
+		return;		// already refilled by another thread
+	const double elapsed = std::chrono::duration<double>(now - lastRefill).count();
+	tokens = std::min(
+		static_cast<double>(getBurst(rate)), tokens + (elapsed * static_cast<double>(rate))
+	);
+	lastRefill = now;
+}
+
+
+// Returns n consumed tokens, which were not used.
+void TokenBucket::giveBack(const std::uint64_t n, const std::uint64_t rate) {
+	tokens = std::min(static_cast<double>(getBurst(rate)), tokens + static_cast<double>(n));
+}
+
+
+// time until n tokens are available at rate (which must not be 0)
+TokenBucket::Clock::duration TokenBucket::waitFor(const std::uint64_t n, const std::uint64_t rate)
+const {
+	const double missing = (static_cast<double>(n) - tokens);
+	if (missing <= 0)
+		return Clock::duration::zero();
+	return std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(missing / static_cast<double>(rate))
+	);
+}
+
+
+std::uint64_t TokenBucket::getBurst(const std::uint64_t rate) {
+	return std::max(
+		std::uint64_t{1},
+		static_cast<std::uint64_t>(
+			(rate * static_cast<std::uint64_t>(BURST_TIME.count()))
+			/ static_cast<std::uint64_t>(std::chrono::milliseconds{std::chrono::seconds{1}}.count())
+		)
+	);
+}
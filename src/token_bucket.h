@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+
+// Bytes that may be transferred at a rate (bytes per second), accumulated for
+//   at most a burst of BURST_TIME at the rate.
+// The rate is given on every refill, so it may be changed at any time.
+// Must be locked (lock()/unlock(), as a BasicLockable) while used.
+class TokenBucket {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static constexpr std::chrono::milliseconds BURST_TIME{250};
+
+	TokenBucket();
+	TokenBucket(const TokenBucket&) = delete;
+	~TokenBucket() = default;
+	void lock(void);
+	void unlock(void);
+	void refill(const Clock::time_point, const std::uint64_t);
+	std::uint64_t available(void) const;
+	void consume(const std::uint64_t);
+	void giveBack(const std::uint64_t, const std::uint64_t);
+	Clock::duration waitFor(const std::uint64_t, const std::uint64_t) const;
+	static std::uint64_t getBurst(const std::uint64_t);
+	TokenBucket& operator=(const TokenBucket&) = delete;
+private:
+	std::mutex mutex;
+	Clock::time_point lastRefill;
+	double tokens;
+};
+
+
+inline
+void TokenBucket::lock() {
+	mutex.lock();
+}
+
+
+inline
+void TokenBucket::unlock() {
+	mutex.unlock();
+}
+
+
+inline
+std::uint64_t TokenBucket::available() const {
+	return ((tokens > 0) ? static_cast<std::uint64_t>(tokens) : 0);
+}
+
+
+inline
+void TokenBucket::consume(const std::uint64_t n) {
+	tokens -= static_cast<double>(n);
+}
@@ -0,0 +1,124 @@
+#include "traffic_shaper.h"
+#include <algorithm>	// max, min
+
+
+constexpr std::size_t TrafficShaper::NUM_LEVELS;
+constexpr std::size_t TrafficShaper::MIN_GRANT;
+
+
+namespace TrafficShaperConstants {
+	// a transfer waits at least this long, so it does not spin on a nearly
+	//   empty bucket
+	constexpr std::chrono::milliseconds MIN_WAIT{1};
+}
+
+
+TrafficShaper::TrafficShaper() {
+	for (auto& level : rates) {
+		for (auto& rate : level)
+			rate.store(0);
+	}
+}
+
+
+// rate is in bytes per second, 0 if unlimited
+void TrafficShaper::setRate(const Level level, const Direction dir, const std::uint64_t rate) {
+	rates[static_cast<std::size_t>(level)][static_cast<std::size_t>(dir)].store(
+		rate, std::memory_order_relaxed
+	);
+}
+
+
+// Returns the limiter of a session logged in as userName.
+std::unique_ptr<TrafficShaper::Limiter> TrafficShaper::makeLimiter(const std::string& userName) {
+	std::shared_ptr<Buckets> user;
+	{
+		std::lock_guard<std::mutex> guard{usersLock};
+		std::weak_ptr<Buckets>& entry = users[userName];
+		user = entry.lock();
+		if (!user) {
+			user = std::make_shared<Buckets>();
+			entry = user;
+			// drop users without sessions
+			for (auto it = users.begin(); it != users.end();) {
+				if (it->second.expired())
+					it = users.erase(it);
+				else
+					++it;
+			}
+		}
+	}
+	return std::unique_ptr<Limiter>{new Limiter{*this, user}};
+}
+
+
+TrafficShaper::Limiter::Limiter(TrafficShaper& s, const std::shared_ptr<Buckets>& u)
+: shaper(s), user{u} {
+}
+
+
+// Returns the number of bytes (at most want) which may be transferred now.
+// Returns 0 if none, and sets wait to the time until some may be.
+std::size_t TrafficShaper::Limiter::take(const Direction dir, const std::size_t want,
+TokenBucket::Clock::duration& wait) {
+	TokenBucket* buckets[NUM_LEVELS];
+	std::uint64_t rates[NUM_LEVELS];
+	const std::size_t n = getBuckets(dir, buckets, rates);
+	if (n == 0)
+		return want;	// unlimited
+	// locked in the same order by every session
+	std::unique_lock<TokenBucket> locks[NUM_LEVELS];
+	const TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+	std::uint64_t grant = want;
+	std::uint64_t minGrant = std::min(want, MIN_GRANT);
+	for (std::size_t i = 0; i < n; ++i) {
+		locks[i] = std::unique_lock<TokenBucket>{*buckets[i]};
+		buckets[i]->refill(now, rates[i]);
+		grant = std::min(grant, buckets[i]->available());
+		minGrant = std::min(minGrant, TokenBucket::getBurst(rates[i]));
+	}
+	if (grant < minGrant) {
+		wait = std::chrono::duration_cast<TokenBucket::Clock::duration>(
+			TrafficShaperConstants::MIN_WAIT
+		);
+		for (std::size_t i = 0; i < n; ++i)
+			wait = std::max(wait, buckets[i]->waitFor(minGrant, rates[i]));
+		return 0;
+	}
+	for (std::size_t i = 0; i < n; ++i)
+		buckets[i]->consume(grant);
+	return static_cast<std::size_t>(grant);
+}
+
+
+// Returns bytes granted by take() which were not transferred.
+void TrafficShaper::Limiter::giveBack(const Direction dir, const std::size_t unused) {
+	if (unused == 0)
+		return;
+	TokenBucket* buckets[NUM_LEVELS];
+	std::uint64_t rates[NUM_LEVELS];
+	const std::size_t n = getBuckets(dir, buckets, rates);
+	for (std::size_t i = 0; i < n; ++i) {
+		std::lock_guard<TokenBucket> guard{*buckets[i]};
+		buckets[i]->giveBack(unused, rates[i]);
+	}
+}
+
+
+// Sets buckets and rates to those of the limited levels (from GLOBAL to
+//   SESSION), and returns their number.
+std::size_t TrafficShaper::Limiter::getBuckets(const Direction dir, TokenBucket** buckets,
+std::uint64_t* rates) {
+	const std::size_t d = static_cast<std::size_t>(dir);
+	TokenBucket* const all[NUM_LEVELS] = {&shaper.global[d], &(*user)[d], &session[d]};
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < NUM_LEVELS; ++i) {
+		const std::uint64_t rate = shaper.getRate(static_cast<Level>(i), dir);
+		if (rate > 0) {
+			buckets[n] = all[i];
+			rates[n] = rate;
+			++n;
+		}
+	}
+	return n;
+}
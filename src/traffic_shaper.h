@@ -0,0 +1,71 @@
+#pragma once
+
+#include "token_bucket.h"
+#include <array>
+#include <atomic>
+#include <cstddef>	// size_t
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+// Limits the rate of data transfers with token buckets at three levels: the
+//   whole server, each user (shared by all sessions logged in as the user), and
+//   each session. A transfer proceeds at the lowest rate of its levels.
+// Uploads and downloads are limited separately.
+// Rates may be changed at any time.
+class TrafficShaper {
+	typedef std::array<TokenBucket, 2> Buckets;	// by Direction
+public:
+	enum class Level {GLOBAL, USER, SESSION};
+	enum class Direction {UP, DOWN};	// UP: from client (STOR), DOWN: to client (RETR)
+
+	// Limits the transfers of a session.
+	// Transfers ask for the number of bytes they are about to transfer with
+	//   take(), and return what they did not transfer with giveBack().
+	class Limiter {
+	public:
+		Limiter(const Limiter&) = delete;
+		std::size_t take(const Direction, const std::size_t, TokenBucket::Clock::duration&);
+		void giveBack(const Direction, const std::size_t);
+		Limiter& operator=(const Limiter&) = delete;
+	private:
+		friend class TrafficShaper;
+
+		Limiter(TrafficShaper&, const std::shared_ptr<Buckets>&);
+		std::size_t getBuckets(const Direction, TokenBucket**, std::uint64_t*);
+
+		TrafficShaper& shaper;
+		std::shared_ptr<Buckets> user;
+		Buckets session;
+	};
+
+	static constexpr std::size_t NUM_LEVELS = 3;
+	// least bytes granted at a time (unless less is asked for, or a burst is
+	//   less), so that a limited transfer is not made in tiny pieces
+	static constexpr std::size_t MIN_GRANT = 4096;
+
+	TrafficShaper();
+	TrafficShaper(const TrafficShaper&) = delete;
+	~TrafficShaper() = default;
+	void setRate(const Level, const Direction, const std::uint64_t);
+	std::uint64_t getRate(const Level, const Direction) const;
+	std::unique_ptr<Limiter> makeLimiter(const std::string&);
+	TrafficShaper& operator=(const TrafficShaper&) = delete;
+private:
+	// bytes per second, 0 if unlimited, by Level and Direction
+	std::array<std::array<std::atomic<std::uint64_t>, 2>, NUM_LEVELS> rates;
+	Buckets global;
+	std::unordered_map<std::string, std::weak_ptr<Buckets>> users;
+	std::mutex usersLock;
+};
+
+
+inline
+std::uint64_t TrafficShaper::getRate(const Level level, const Direction dir) const {
+	return rates[static_cast<std::size_t>(level)][static_cast<std::size_t>(dir)].load(
+		std::memory_order_relaxed
+	);
+}
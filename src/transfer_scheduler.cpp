@@ -0,0 +1,65 @@
+#include "transfer_scheduler.h"
+#include <cassert>
+#include <utility>	// move
+
+
+TransferScheduler::TransferScheduler(boost::asio::io_service& service, const std::size_t maxRun)
+: ios(service), quantum{0}, running{0}, maxRunning{maxRun} {
+	assert(maxRunning > 0);
+}
+
+
+// Must be called before any transfer is submitted.
+void TransferScheduler::setQuantum(const std::size_t q) {
+	quantum = q;
+}
+
+
+// n is the number of bytes transferred by flow's last step, and step is its
+//   next. A flow has at most one step waiting.
+// weight of flow (its user's weight) is at least 1.
+void TransferScheduler::submit(Flow& flow, const unsigned weight, const std::size_t n,
+std::function<void(void)>&& step) {
+	if (quantum == 0) {
+		step();
+		return;
+	}
+	std::lock_guard<std::mutex> guard{lock};
+	assert(!flow.next && (weight > 0));
+	flow.deficit -= static_cast<std::int64_t>(n);
+	flow.weight = weight;
+	flow.next = std::move(step);
+	active.push_back(&flow);
+	dispatch();
+}
+
+
+// lock must be held
+void TransferScheduler::dispatch() {
+	while ((running < maxRunning) && !active.empty()) {
+		Flow* flow = active.front();
+		active.pop_front();
+		if (flow->deficit <= 0) {
+			// turn is over, wait for next round
+			flow->deficit += static_cast<std::int64_t>(quantum * flow->weight);
+			active.push_back(flow);
+			continue;
+		}
+		std::function<void(void)> step;
+		step.swap(flow->next);
+		++running;
+		ios.post(
+			[this, step]() {
+				step();
+				stepFinished();
+			}
+		);
+	}
+}
+
+
+void TransferScheduler::stepFinished() {
+	std::lock_guard<std::mutex> guard{lock};
+	--running;
+	dispatch();
+}
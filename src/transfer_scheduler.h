@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>	// size_t
+#include <cstdint>	// int64_t
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <boost/asio.hpp>
+
+
+// Shares the server's threads between data transfers by deficit round robin.
+// Each step of a transfer after the first (its next read or write, which may
+//   also read the file) is submitted with the number of bytes transferred by
+//   the last step. In each round, a transfer's steps run until it has
+//   transferred a quantum of bytes times its weight. At most
+//   maxRunning steps run at once, so a transfer whose steps complete back to
+//   back (e.g. a file in page cache) cannot hold every thread while other
+//   transfers wait.
+class TransferScheduler {
+public:
+	// Scheduling state of a transfer (see DataResponse).
+	struct Flow {
+		std::function<void(void)> next;	// step waiting to run
+		std::int64_t deficit = 0;	// bytes left in turn, may be negative
+		unsigned weight = 1;
+	};
+
+	TransferScheduler(boost::asio::io_service&, const std::size_t);
+	TransferScheduler(const TransferScheduler&) = delete;
+	~TransferScheduler() = default;
+	void setQuantum(const std::size_t);
+	std::size_t getQuantum(void) const;
+	void submit(Flow&, const unsigned, const std::size_t, std::function<void(void)>&&);
+	TransferScheduler& operator=(const TransferScheduler&) = delete;
+private:
+	void dispatch(void);
+	void stepFinished(void);
+
+	boost::asio::io_service& ios;
+	std::deque<Flow*> active;	// flows with a step waiting, in round robin order
+	std::mutex lock;
+	std::size_t quantum;	// bytes, 0 if disabled
+	std::size_t running;	// steps posted and not yet finished
+	const std::size_t maxRunning;
+};
+
+
+// 0 if steps are run directly, without scheduling
+inline
+std::size_t TransferScheduler::getQuantum() const {
+	return quantum;
+}
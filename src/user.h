@@ -10,4 +10,6 @@ struct User {
 	std::string name;
 	std::string salt;
 	Path home;
+	int homeFd = -1;	// see PathResolver, opened by Server
+	unsigned weight = 1;	// share of transfer scheduling (see TransferScheduler)
 };
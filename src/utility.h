@@ -11,7 +11,10 @@ namespace Constants {
 	constexpr char SP[] = " ";
 	constexpr std::size_t CMD_BUF_SZ = 2048;
 	constexpr std::size_t FILE_BUF_SZ = (64 * 1024);
-	constexpr std::array<const char*, 2> features = {"PASV", "MLSD"};
+	constexpr std::size_t LIST_BUF_SZ = (64 * 1024);
+	constexpr std::array<const char*, 5> features = {
+		"PASV", "MLST type*;size*;modify*;", "SIZE", "MDTM", "REST STREAM"
+	};
 }
 
 
@@ -27,9 +30,50 @@ namespace ResponseString {
 	constexpr char reqDataConnection[] = "Use PORT or PASV first.";
 	constexpr char incomingDirList[] = "Here comes the directory listing.";
 	constexpr char dirListSuccess[] = "Directory send OK.";
+	constexpr char cannotOpenDir[] = "Failed to open directory.";
+	constexpr char notDirectory[] = "Not a directory.";
+	constexpr char listingEnd[] = "End";
 	constexpr char cannotOpenFile[] = "Failed to open file.";
 	constexpr char transComplete[] = "Transfer complete.";
+	constexpr char writeFail[] = "Failed to write file.";
+	constexpr char readFail[] = "Failed to read file.";
+	constexpr char transAborted[] = "Connection closed; transfer aborted.";
+	constexpr char aborSuccess[] = "ABOR successful.";
+	constexpr char aborNoTransfer[] = "No transfer to abort.";
+	constexpr char cwdSuccess[] = "Directory successfully changed.";
+	constexpr char cwdFail[] = "Failed to change directory.";
+	constexpr char mkdSuccess[] = "created";
+	constexpr char mkdFail[] = "Create directory operation failed.";
+	constexpr char rmdSuccess[] = "Remove directory operation successful.";
+	constexpr char rmdFail[] = "Remove directory operation failed.";
+	constexpr char deleSuccess[] = "Delete operation successful.";
+	constexpr char deleFail[] = "Delete operation failed.";
+	constexpr char rnfrSuccess[] = "Ready for RNTO.";
+	constexpr char rnfrFail[] = "RNFR command failed.";
+	constexpr char rntoNeedRnfr[] = "RNFR required first.";
+	constexpr char rntoSuccess[] = "Rename successful.";
+	constexpr char rntoFail[] = "Rename failed.";
+	constexpr char sizeFail[] = "Could not get file size.";
+	constexpr char mdtmFail[] = "Could not get file modification time.";
+	constexpr char checksumFail[] = "Could not compute checksum.";
+	constexpr char unknownAlgorithm[] = "Unknown algorithm.";
+	constexpr char unknownOption[] = "Option not understood.";
+	constexpr char alloSuccess[] = "ALLO command successful.";
+	constexpr char restFail[] = "Restart position is beyond the end of the file.";
 	constexpr char systResponse[] = "UNIX emulated";
+	constexpr char authSuccess[] = "Proceed with negotiation.";
+	constexpr char authUnavailable[] = "TLS not available.";
+	constexpr char authUnknown[] = "Security mechanism not supported.";
+	constexpr char authDone[] = "Already using TLS.";
+	constexpr char authRequired[] = "Use AUTH TLS first.";
+	constexpr char pbszSuccess[] = "PBSZ=0";
+	constexpr char pbszNeedAuth[] = "AUTH TLS required first.";
+	constexpr char protNeedPbsz[] = "PBSZ required first.";
+	constexpr char protSuccess[] = "Protection level set.";
+	constexpr char protUnsupported[] = "Protection level not supported.";
+	constexpr char protRequired[] = "Data connections must be protected (PROT P).";
+	constexpr char statPathname[] = "STAT of a pathname not supported.";
+	constexpr char statLocalOnly[] = "Server status is only available locally.";
 }
 
 
@@ -51,18 +95,30 @@ namespace ReturnCode {
 	constexpr int fileOkayDataConn = 150;	// File status okay; about to open data connection.
 	constexpr int commandOkay = 200;
 	constexpr int systemStatus = 211;
+	constexpr int fileStatus = 213;
 	constexpr int systemType = 215;
 	constexpr int serviceReady = 220;
 	constexpr int closeDataConn = 226;	// Closing data connection. Requested file action successful.
 	constexpr int enterPassiveMode = 227;
 	constexpr int loggedIn = 230;
+	constexpr int authOkay = 234;	// Security data exchange complete (AUTH, RFC 4217)
+	constexpr int fileActionOkay = 250;	// Requested file action okay, completed.
 	constexpr int pathnameCreated = 257;	// success of MKD or PWD
 	constexpr int userOkNeedPass = 331;
+	constexpr int fileActionPending = 350;	// Requested file action pending further information.
 	constexpr int noDataConnection = 425;
+	constexpr int transferAborted = 426;	// Connection closed; transfer aborted.
+	constexpr int localError = 451;	// Requested action aborted: local error in processing.
 	constexpr int syntaxError = 500;	// or unknown command
 	constexpr int argumentSyntaxError = 501;
+	constexpr int notImplemented = 502;
 	constexpr int badSequence = 503;	// Bad sequence of commands
+	constexpr int paramNotImplemented = 504;	// Command not implemented for that parameter.
+	constexpr int dataProtectionDenied = 521;	// Data connection cannot be opened with this PROT setting.
 	constexpr int notLoggedIn = 530;
+	constexpr int policyDenied = 534;	// Request denied for policy reasons.
+	constexpr int protNotSupported = 536;	// Requested PROT level not supported by mechanism.
+	constexpr int invalidRestParam = 554;	// Requested action not taken: invalid REST parameter.
 	constexpr int fileUnavailable = 550;
 }
 
@@ -0,0 +1,283 @@
+#include "write_behind.h"
+#include "thread_pool.h"
+#include "utility.h"	// Constants
+#include <algorithm>	// max
+#include <cassert>
+#include <cerrno>
+#ifdef __linux__
+#include <fcntl.h>		// fallocate
+#include <sys/stat.h>	// fstat
+#include <unistd.h>		// pwrite, fdatasync, ftruncate, close
+#else
+#include <io.h>			// _lseeki64, _write, _commit, close
+#endif
+
+
+namespace WriteBehindUtil {
+
+// writes all of buf at off
+static bool writeAt(const int fd, const char* buf, std::size_t sz, std::uint64_t off) {
+	while (sz > 0) {
+#ifdef __linux__
+		const ssize_t n = ::pwrite(fd, buf, sz, static_cast<off_t>(off));
+#else
+		// without pwrite, writes of a file must not run concurrently (see lock)
+		if (::_lseeki64(fd, static_cast<__int64>(off), SEEK_SET) < 0)
+			return false;
+		const int n = ::_write(fd, buf, static_cast<unsigned int>(sz));
+#endif
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		sz -= static_cast<std::size_t>(n);
+		off += static_cast<std::uint64_t>(n);
+	}
+	return true;
+}
+
+}	// namespace WriteBehindUtil
+
+
+// takes ownership of f
+// Without a pool, one buffer is enough.
+WriteBehind::WriteBehind(const int f, boost::asio::io_service& service, ThreadPool* p,
+const std::size_t numBuffers, const SyncPolicy policy)
+: ios(service), pool{p}, fillBuf{nullptr}, fillSz{0},
+maxBuffers{p ? std::max(numBuffers, std::size_t{1}) : 1}, inFlight{0}, offset{0},
+unsyncedSz{0}, allocSz{0}, allocHint{0}, allocStep{0}, syncPolicy{policy}, fd{f}, waiting{false}, finishing{false}, goodFlag{f >= 0} {
+}
+
+
+WriteBehind::~WriteBehind() {
+	assert(inFlight == 0);
+	if (fd >= 0)
+		::close(fd);
+}
+
+
+// Returns the space left in the current buffer, which may be filled and then
+//   commit()'ed.
+// Returns {nullptr, 0} if all buffers are queued. The resume handler will be
+//   posted once one is free.
+std::pair<char*, std::size_t> WriteBehind::getSpace() {
+	std::lock_guard<std::mutex> guard{lock};
+	if (!fillBuf) {
+		if (!freeBuffers.empty()) {
+			fillBuf = freeBuffers.back();
+			freeBuffers.pop_back();
+		}
+		else if (buffers.size() < maxBuffers) {
+			buffers.emplace_back(new char[Constants::FILE_BUF_SZ]);
+			fillBuf = buffers.back().get();
+		}
+		else {
+			waiting = true;
+			return std::make_pair(nullptr, 0);
+		}
+		fillSz = 0;
+	}
+	return std::make_pair(fillBuf + fillSz, Constants::FILE_BUF_SZ - fillSz);
+}
+
+
+// n bytes were written to the space from getSpace()
+void WriteBehind::commit(const std::size_t n) {
+	std::lock_guard<std::mutex> guard{lock};
+	assert(fillBuf && (fillSz + n <= Constants::FILE_BUF_SZ));
+	fillSz += n;
+	if (fillSz == Constants::FILE_BUF_SZ)
+		submit();
+}
+
+
+// handler is called with false if any write failed.
+void WriteBehind::finish(const FinishHandler& handler) {
+	std::unique_lock<std::mutex> guard{lock};
+	assert(!finishing);
+	finishHandler = handler;
+	finishing = true;
+	if (fillBuf && (fillSz > 0))
+		submit();
+	if (inFlight > 0)
+		return;		// the last write finishes
+	guard.unlock();
+	if (pool) {
+		// sync may block
+		std::shared_ptr<WriteBehind> self = shared_from_this();
+		pool->post(
+			[self]() {
+				self->syncAndFinish();
+			}
+		);
+	}
+	else {
+		syncAndFinish();
+	}
+}
+
+
+bool WriteBehind::good() {
+	std::lock_guard<std::mutex> guard{lock};
+	return goodFlag;
+}
+
+
+// Queues fillBuf to be written.
+// lock must be held
+void WriteBehind::submit() {
+	char* buf = fillBuf;
+	const std::size_t sz = fillSz;
+	const std::uint64_t off = offset;
+	fillBuf = nullptr;
+	fillSz = 0;
+	offset += sz;
+	// Space to preallocate before writing, if the buffer is beyond allocSz.
+	// Without a size hint, only files larger than a step are preallocated.
+	std::uint64_t allocFrom = 0;
+	std::uint64_t allocTo = 0;
+	if (offset > allocSz) {
+		if (allocHint > allocSz)
+			allocTo = std::max(offset, allocHint);
+		else if ((allocStep > 0) && (offset >= allocStep))
+			allocTo = (offset + allocStep);
+		if (allocTo > 0) {
+			allocFrom = std::max(allocSz, off);
+			allocSz = allocTo;
+		}
+	}
+	if (!pool) {
+		if (!writeBuffer(buf, sz, off, allocFrom, allocTo))
+			goodFlag = false;
+		freeBuffers.push_back(buf);
+		return;
+	}
+	++inFlight;
+	std::shared_ptr<WriteBehind> self = shared_from_this();
+	pool->post(
+		[self, buf, sz, off, allocFrom, allocTo]() {
+			bool ok;
+			{
+#ifndef __linux__
+				std::lock_guard<std::mutex> guard{self->lock};
+#endif
+				ok = self->writeBuffer(buf, sz, off, allocFrom, allocTo);
+			}
+			self->bufferWritten(buf, sz, ok);
+		}
+	);
+}
+
+
+// Preallocates [allocFrom, allocTo) first, if not empty.
+// Returns false on write error. goodFlag is left to the caller, which may
+//   hold lock (submit() without a pool, or a pool thread without pwrite).
+bool WriteBehind::writeBuffer(char* buf, const std::size_t sz, const std::uint64_t off,
+const std::uint64_t allocFrom, const std::uint64_t allocTo) {
+#ifdef __linux__
+	// KEEP_SIZE, so readers do not see the preallocated space before it is
+	//   written. Failure (such as EOPNOTSUPP) is ignored, since the writes
+	//   allocate the space anyway.
+	if (allocTo > allocFrom) {
+		::fallocate(
+			fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(allocFrom),
+			static_cast<off_t>(allocTo - allocFrom)
+		);
+	}
+#else
+	(void)allocFrom;
+	(void)allocTo;
+#endif
+	return WriteBehindUtil::writeAt(fd, buf, sz, off);
+}
+
+
+// called by a pool thread once buf has been written, ok: without error
+void WriteBehind::bufferWritten(char* buf, const std::size_t sz, const bool ok) {
+	bool syncNow = false;
+	bool finishNow = false;
+	{
+		std::lock_guard<std::mutex> guard{lock};
+		if (!ok)
+			goodFlag = false;
+		freeBuffers.push_back(buf);
+		--inFlight;
+		if (syncPolicy == SyncPolicy::PERIODIC) {
+			unsyncedSz += sz;
+			if (unsyncedSz >= SYNC_INTERVAL) {
+				unsyncedSz = 0;
+				syncNow = true;
+			}
+		}
+		if (waiting) {
+			waiting = false;
+			ios.post(resumeHandler);
+		}
+		finishNow = (finishing && (inFlight == 0));
+	}
+	if (syncNow && !sync()) {
+		std::lock_guard<std::mutex> guard{lock};
+		goodFlag = false;
+	}
+	if (finishNow)
+		syncAndFinish();
+}
+
+
+// Called once all buffers have been written.
+// Posts the finish handler, or calls it if there is no pool.
+void WriteBehind::syncAndFinish() {
+	truncate();
+	bool ok;
+	{
+		std::lock_guard<std::mutex> guard{lock};
+		ok = goodFlag;
+	}
+	if (ok && (syncPolicy != SyncPolicy::NONE))
+		ok = sync();
+	{
+		std::lock_guard<std::mutex> guard{lock};
+		goodFlag = ok;
+	}
+	// not kept, since it may hold the owner of this
+	FinishHandler handler;
+	handler.swap(finishHandler);
+	if (pool) {
+		ios.post(
+			[handler, ok]() {
+				handler(ok);
+			}
+		);
+	}
+	else {
+		handler(ok);
+	}
+}
+
+
+bool WriteBehind::sync() {
+#ifdef __linux__
+	return (::fdatasync(fd) == 0);
+#else
+	return (::_commit(fd) == 0);
+#endif
+}
+
+
+// Frees preallocated space beyond the end of the file (all writes have
+//   finished). The size is not changed, since the space was preallocated with
+//   FALLOC_FL_KEEP_SIZE, and the file may extend beyond the data written.
+void WriteBehind::truncate() {
+#ifdef __linux__
+	if (allocSz > 0) {
+		// truncating to the same size frees the space
+		struct stat st;
+		if ((::fstat(fd, &st) != 0) || (::ftruncate(fd, st.st_size) != 0)) {
+			std::lock_guard<std::mutex> guard{lock};
+			goodFlag = false;
+		}
+	}
+#endif
+}
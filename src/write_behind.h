@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>	// size_t
+#include <cstdint>	// uint64_t
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>	// pair
+#include <vector>
+#include <boost/asio.hpp>
+
+
+class ThreadPool;
+
+
+// Writes data received for a file on a writer ThreadPool, so a slow disk does
+//   not block the thread receiving the data.
+// Data is received into a buffer from getSpace(). A full buffer is queued to
+//   be written (with pwrite, at its offset, so buffers may be written by
+//   several threads at once), and receiving continues into another buffer.
+//   At most numBuffers buffers are in use. When all are queued, getSpace()
+//   returns no space, and the resume handler is posted once a buffer has been
+//   written; the receiver should stop reading until then (backpressure).
+// Disk space may be preallocated (see setPreallocation()) ahead of the writes,
+//   so that large files are less fragmented. Preallocated space beyond the end
+//   of the file is then freed, also if the upload is aborted.
+// finish() writes the last buffer, waits for all writes, syncs the file
+//   according to the SyncPolicy, and posts the finish handler.
+// Without a pool, buffers are written as soon as they are full and handlers
+//   are called immediately.
+// Owns the file descriptor. Created with std::shared_ptr, since queued writes
+//   keep it alive.
+class WriteBehind : public std::enable_shared_from_this<WriteBehind> {
+public:
+	// NONE: the file is not synced
+	// END: fdatasync once all data is written
+	// PERIODIC: fdatasync every SYNC_INTERVAL bytes, and at the end
+	enum class SyncPolicy {NONE, END, PERIODIC};
+
+	typedef std::function<void(void)> ResumeHandler;
+	typedef std::function<void(bool)> FinishHandler;	// false on write error
+
+	static constexpr std::uint64_t SYNC_INTERVAL = (16 * 1024 * 1024);
+
+	WriteBehind(const int, boost::asio::io_service&, ThreadPool*, const std::size_t,
+		const SyncPolicy);
+	WriteBehind(const WriteBehind&) = delete;
+	~WriteBehind();
+	void setResumeHandler(const ResumeHandler&);
+	void setPreallocation(const std::uint64_t, const std::uint64_t);
+	void setOffset(const std::uint64_t);
+	std::pair<char*, std::size_t> getSpace(void);
+	void commit(const std::size_t);
+	void finish(const FinishHandler&);
+	bool good(void);
+	int getFd(void) const;
+	WriteBehind& operator=(const WriteBehind&) = delete;
+private:
+	void submit(void);
+	bool writeBuffer(char*, const std::size_t, const std::uint64_t, const std::uint64_t,
+		const std::uint64_t);
+	void bufferWritten(char*, const std::size_t, const bool);
+	void syncAndFinish(void);
+	bool sync(void);
+	void truncate(void);
+
+	std::vector<std::unique_ptr<char[]>> buffers;
+	std::vector<char*> freeBuffers;
+	ResumeHandler resumeHandler;
+	FinishHandler finishHandler;
+	std::mutex lock;	// guards members below, written by pool threads
+	boost::asio::io_service& ios;
+	ThreadPool* pool;
+	char* fillBuf;		// buffer being received into, nullptr if none
+	std::size_t fillSz;		// number of valid bytes in fillBuf
+	std::size_t maxBuffers;
+	std::size_t inFlight;	// number of queued buffers
+	std::uint64_t offset;	// of fillBuf in the file
+	std::uint64_t unsyncedSz;	// bytes written since the last sync (PERIODIC)
+	std::uint64_t allocSz;		// bytes preallocated (or being preallocated)
+	std::uint64_t allocHint;	// expected size of the file, 0 if unknown
+	std::uint64_t allocStep;	// preallocated beyond allocHint, 0 to disable
+	SyncPolicy syncPolicy;
+	int fd;
+	bool waiting;	// receiver is waiting for a buffer
+	bool finishing;
+	bool goodFlag;
+};
+
+
+inline
+void WriteBehind::setResumeHandler(const ResumeHandler& handler) {
+	resumeHandler = handler;
+}
+
+
+// sizeHint: expected size of the file, preallocated at once (0 if unknown)
+// step: preallocated at a time once the file grows past sizeHint and is at
+//   least step bytes (0 to disable)
+// Must be called before any data is committed.
+inline
+void WriteBehind::setPreallocation(const std::uint64_t sizeHint, const std::uint64_t step) {
+	allocHint = sizeHint;
+	allocStep = step;
+}
+
+
+// Data is written from offset in the file (0 by default).
+// Must be called before any data is committed.
+inline
+void WriteBehind::setOffset(const std::uint64_t off) {
+	offset = off;
+	allocSz = off;
+}
+
+
+inline
+int WriteBehind::getFd() const {
+	return fd;
+}